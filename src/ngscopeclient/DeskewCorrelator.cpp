@@ -0,0 +1,697 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* ngscopeclient                                                                                                        *
+*                                                                                                                      *
+* Copyright (c) 2012-2025 Andrew D. Zonenberg and contributors                                                         *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+/**
+	@file
+	@author Andrew D. Zonenberg
+	@brief Implementation of DeskewCorrelator
+
+	Only depends on libscopehal (not the GUI) so it can be linked into unit tests.
+ */
+#include "../../lib/scopehal/scopehal.h"
+#include "DeskewCorrelator.h"
+
+#include <cmath>
+
+#ifdef __x86_64__
+#include <immintrin.h>
+#endif
+
+using namespace std;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Helpers
+
+static int64_t FloorDiv(int64_t a, int64_t b)
+{
+	int64_t q = a / b;
+	if( (a % b != 0) && ( (a < 0) != (b < 0) ) )
+		q --;
+	return q;
+}
+
+static int64_t CeilDiv(int64_t a, int64_t b)
+{
+	return -FloorDiv(-a, b);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Argument objects
+
+UniformCrossCorrelateArgs::UniformCrossCorrelateArgs(
+	UniformAnalogWaveform* ppri, UniformAnalogWaveform* psec, int64_t delta)
+	: priTimescale(ppri->m_timescale)
+	, secTimescale(psec->m_timescale)
+	, trigPhaseDelta(ppri->m_triggerPhase - psec->m_triggerPhase)
+	, startingDelta(-delta)
+	, numDeltas(delta*2)
+	, priLen(ppri->size())
+	, secLen(psec->size())
+{
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Construction / destruction
+
+/**
+	@brief Creates a correlator
+
+	@param maxDelta		Delays in [-maxDelta, maxDelta) primary samples are considered
+ */
+DeskewCorrelator::DeskewCorrelator(int64_t maxDelta)
+	: m_maxDelta(maxDelta)
+	, m_fftSize(0)
+	, m_bestDelta(0)
+	, m_bestDeltaFraction(0)
+	, m_bestCorrelation(0)
+	, m_blocksTotal(0)
+	, m_blocksDone(0)
+	, m_cancel(false)
+{
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Resampling
+
+/**
+	@brief Resamples a uniform waveform onto another timebase
+
+	Output sample j is the input sample covering time j*outTimescale + phase, i.e. the first input sample which ends
+	at or after that time. Output samples before the start or past the end of the input are zeroed.
+
+	@param samples		Input samples
+	@param len			Number of input samples
+	@param timescale	Input timescale, in fs
+	@param outTimescale	Output timescale, in fs
+	@param phase		Time of output sample zero relative to input sample zero, in fs
+	@param first		Index of the first output sample to generate
+	@param count		Number of output samples to generate
+	@param out			Output buffer (count entries, out[0] is sample "first")
+	@param validStart	Index of the first valid output sample
+	@param validEnd		One past the index of the last valid output sample
+ */
+void DeskewCorrelator::ResampleUniform(
+	const float* samples,
+	size_t len,
+	int64_t timescale,
+	int64_t outTimescale,
+	int64_t phase,
+	int64_t first,
+	size_t count,
+	float* out,
+	int64_t& validStart,
+	int64_t& validEnd)
+{
+	//Sample j is valid if its time is non-negative and doesn't run off the end of the input
+	int64_t end = first + count;
+	validStart = max(first, CeilDiv(-phase, outTimescale));
+	validEnd = min(end, FloorDiv(static_cast<int64_t>(len) * timescale - phase, outTimescale) + 1);
+	validEnd = max(validEnd, validStart);
+
+	#pragma omp parallel for
+	for(int64_t j=first; j<end; j++)
+	{
+		if( (j < validStart) || (j >= validEnd) )
+			out[j - first] = 0;
+		else
+		{
+			int64_t target = j*outTimescale + phase;
+			int64_t i = max(CeilDiv(target, timescale) - 1, static_cast<int64_t>(0));
+			out[j - first] = samples[i];
+		}
+	}
+}
+
+/**
+	@brief Resamples a sparse waveform onto a uniform timebase
+
+	Output sample j is the input sample covering time j*outTimescale + outPhase, i.e. the first input sample which ends
+	at or after that time. Output samples at negative times or past the end of the input are zeroed.
+
+	@param samples		Input samples
+	@param offsets		Input offsets
+	@param durations	Input durations
+	@param len			Number of input samples
+	@param timescale	Input timescale, in fs
+	@param triggerPhase	Input trigger phase, in fs
+	@param outTimescale	Output timescale, in fs
+	@param outPhase		Time of output sample zero, in fs
+	@param first		Index of the first output sample to generate
+	@param count		Number of output samples to generate
+	@param out			Output buffer (count entries, out[0] is sample "first")
+	@param validStart	Index of the first valid output sample
+	@param validEnd		One past the index of the last valid output sample
+ */
+void DeskewCorrelator::ResampleSparse(
+	const float* samples,
+	const int64_t* offsets,
+	const int64_t* durations,
+	size_t len,
+	int64_t timescale,
+	int64_t triggerPhase,
+	int64_t outTimescale,
+	int64_t outPhase,
+	int64_t first,
+	size_t count,
+	float* out,
+	int64_t& validStart,
+	int64_t& validEnd)
+{
+	int64_t end = first + count;
+	validStart = max(first, CeilDiv(-outPhase, outTimescale));
+	validEnd = validStart;
+
+	size_t i = 0;
+	for(int64_t j=first; j<end; j++)
+	{
+		if( (j < validStart) || (i >= len) )
+		{
+			out[j - first] = 0;
+			continue;
+		}
+
+		int64_t target = j*outTimescale + outPhase;
+		while( (i < len) && ( (offsets[i] + durations[i]) * timescale + triggerPhase < target) )
+			i ++;
+
+		if(i >= len)
+			out[j - first] = 0;
+		else
+		{
+			out[j - first] = samples[i];
+			validEnd = j + 1;
+		}
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Correlation
+
+/**
+	@brief Cross-correlates the primary against a resampled secondary
+
+	@param pri			Primary samples
+	@param len			Number of primary samples
+	@param sec			Secondary samples covering primary indexes [-maxDelta, len + maxDelta), see ResampleUniform().
+						Samples outside [validStart, validEnd) must be zero.
+	@param validStart	Index (in primary samples) of the first valid secondary sample
+	@param validEnd		One past the index of the last valid secondary sample
+	@param priMask		If not null, nonzero for each primary sample which should be counted when normalizing.
+						Primary samples which aren't counted must be zero.
+ */
+void DeskewCorrelator::Correlate(
+	const float* pri,
+	size_t len,
+	const float* sec,
+	int64_t validStart,
+	int64_t validEnd,
+	const uint8_t* priMask)
+{
+	int64_t ndeltas = 2*m_maxDelta;
+	m_correlations.assign(ndeltas, 0.0);
+	m_bestDelta = 0;
+	m_bestDeltaFraction = 0;
+	m_bestCorrelation = 0;
+	if( (len == 0) || (ndeltas <= 0) )
+		return;
+
+	//Use blocks a few times the size of the delay window so the overlap doesn't waste too much work,
+	//but don't go any bigger than the whole waveform
+	size_t fftSize = 1024;
+	while(fftSize < static_cast<size_t>(4*ndeltas))
+		fftSize <<= 1;
+	size_t wholeSize = 1;
+	while(wholeSize < len + ndeltas)
+		wholeSize <<= 1;
+	fftSize = min(fftSize, wholeSize);
+	PrepareFFT(fftSize);
+
+	//Each block of primary samples is correlated against fftSize secondary samples starting at the same index.
+	//Block i contributes sum(pri[base + k] * sec[base + k + d + maxDelta]) for each delay d, and since
+	//blockSize + ndeltas <= fftSize, none of the terms we care about wrap around.
+	size_t blockSize = fftSize - ndeltas;
+	int64_t nblocks = (len + blockSize - 1) / blockSize;
+	size_t seclen = GetSecondaryLength(len);
+	vector<double> sums(ndeltas, 0.0);
+	m_blocksDone = 0;
+	m_blocksTotal = nblocks;
+
+	#pragma omp parallel
+	{
+		vector<complex<double> > buf(fftSize);
+		vector<double> partial(ndeltas, 0.0);
+
+		#pragma omp for
+		for(int64_t i=0; i<nblocks; i++)
+		{
+			if(m_cancel)
+				continue;
+
+			size_t base = i*blockSize;
+			size_t pend = min(len - base, blockSize);
+			size_t send = min(seclen - base, fftSize);
+
+			//Both inputs are real, so transform them together as the real and imaginary parts of one signal
+			for(size_t j=0; j<fftSize; j++)
+				buf[j] = complex<double>( (j < pend) ? pri[base + j] : 0, (j < send) ? sec[base + j] : 0);
+			FFT(&buf[0], false);
+
+			//Split the spectra apart and multiply conj(P) * S. The product is Hermitian (the correlation is real)
+			//so each pair of bins k and fftSize-k can be processed together in place.
+			for(size_t k=0; k<=fftSize/2; k++)
+			{
+				size_t m = (fftSize - k) & (fftSize - 1);
+				auto zk = buf[k];
+				auto zm = buf[m];
+
+				double pr = (zk.real() + zm.real()) * 0.5;
+				double pi = (zk.imag() - zm.imag()) * 0.5;
+				double sr = (zk.imag() + zm.imag()) * 0.5;
+				double si = (zm.real() - zk.real()) * 0.5;
+
+				double qr = pr*sr + pi*si;
+				double qi = pr*si - pi*sr;
+				buf[k] = complex<double>(qr, qi);
+				buf[m] = complex<double>(qr, -qi);
+			}
+			FFT(&buf[0], true);
+
+			for(int64_t k=0; k<ndeltas; k++)
+				partial[k] += buf[k].real();
+
+			m_blocksDone ++;
+		}
+
+		#pragma omp critical
+		{
+			for(int64_t k=0; k<ndeltas; k++)
+				sums[k] += partial[k];
+		}
+	}
+
+	if(m_cancel)
+		return;
+
+	//Running count of primary samples, so we can count how many are in any range
+	vector<int64_t> priCount;
+	if(priMask)
+	{
+		priCount.resize(len + 1);
+		priCount[0] = 0;
+		for(size_t i=0; i<len; i++)
+			priCount[i+1] = priCount[i] + (priMask[i] ? 1 : 0);
+	}
+
+	//Normalize by the number of samples overlapping the valid part of the secondary at each delay
+	int64_t slen = len;
+	double scale = 1.0 / fftSize;
+	vector<uint8_t> overlapped(ndeltas, 0);
+	for(int64_t k=0; k<ndeltas; k++)
+	{
+		int64_t d = k - m_maxDelta;
+		int64_t lo = max(static_cast<int64_t>(0), validStart - d);
+		int64_t hi = min(slen, validEnd - d);
+		int64_t count = hi - lo;
+		if( (count > 0) && priMask)
+			count = priCount[hi] - priCount[lo];
+		if(count <= 0)
+			continue;
+
+		overlapped[k] = 1;
+		m_correlations[k] = sums[k] * scale / count;
+	}
+
+	FindPeak(overlapped);
+}
+
+/**
+	@brief Cross-correlates two sparse waveforms
+
+	Delays are in ticks of the primary's timebase. Each primary sample is multiplied by the secondary sample covering
+	its start time plus the delay, and the sum is normalized by the number of primary samples that had one, the same
+	as the brute force implementation.
+
+	@param pri	Primary waveform
+	@param sec	Secondary waveform
+ */
+void DeskewCorrelator::CorrelateSparse(const DeskewSparseInput& pri, const DeskewSparseInput& sec)
+{
+	size_t plen = pri.m_samples.size();
+	if(plen == 0)
+	{
+		Correlate(nullptr, 0, nullptr, 0, 0);
+		return;
+	}
+
+	//Use the FFT if the primary fits on a reasonably small grid with at most one sample per tick
+	int64_t first = pri.m_offsets[0];
+	int64_t span = pri.m_offsets[plen-1] - first + 1;
+	bool gridOK = (span > 0) && (span <= MAX_SPARSE_GRID_RATIO * static_cast<int64_t>(plen));
+	for(size_t i=1; gridOK && (i<plen); i++)
+	{
+		if(pri.m_offsets[i] <= pri.m_offsets[i-1])
+			gridOK = false;
+	}
+	if(!gridOK)
+	{
+		CorrelateSparseDirect(pri, sec);
+		return;
+	}
+
+	vector<float> grid(span, 0);
+	vector<uint8_t> mask(span, 0);
+	for(size_t i=0; i<plen; i++)
+	{
+		grid[pri.m_offsets[i] - first] = pri.m_samples[i];
+		mask[pri.m_offsets[i] - first] = 1;
+	}
+
+	//Secondary is resampled on the same grid, so grid index j is at primary tick j + first
+	int64_t phase = first * pri.m_timescale + pri.m_triggerPhase;
+	vector<float> rsec(GetSecondaryLength(span));
+	int64_t validStart;
+	int64_t validEnd;
+	ResampleSparse(
+		sec.m_samples.data(),
+		sec.m_offsets.data(),
+		sec.m_durations.data(),
+		sec.m_samples.size(),
+		sec.m_timescale,
+		sec.m_triggerPhase,
+		pri.m_timescale,
+		phase,
+		-m_maxDelta,
+		rsec.size(),
+		rsec.data(),
+		validStart,
+		validEnd);
+
+	Correlate(grid.data(), span, rsec.data(), validStart, validEnd, mask.data());
+}
+
+/**
+	@brief Brute force sparse correlation, for primaries too spread out to put on a grid
+
+	This is O(N * D) but needs no memory beyond the inputs.
+ */
+void DeskewCorrelator::CorrelateSparseDirect(const DeskewSparseInput& pri, const DeskewSparseInput& sec)
+{
+	int64_t ndeltas = 2*m_maxDelta;
+	m_correlations.assign(max(ndeltas, static_cast<int64_t>(0)), 0.0);
+	m_bestDelta = 0;
+	m_bestDeltaFraction = 0;
+	m_bestCorrelation = 0;
+	if(ndeltas <= 0)
+		return;
+
+	size_t plen = pri.m_samples.size();
+	size_t slen = sec.m_samples.size();
+	vector<uint8_t> overlapped(ndeltas, 0);
+	m_blocksDone = 0;
+	m_blocksTotal = ndeltas;
+
+	#pragma omp parallel for
+	for(int64_t k=0; k<ndeltas; k++)
+	{
+		if(m_cancel)
+			continue;
+
+		//Convert delta from samples of the primary waveform to femtoseconds
+		int64_t deltaFs = pri.m_timescale * (k - m_maxDelta);
+
+		int64_t samplesProcessed = 0;
+		size_t isecondary = 0;
+		double correlation = 0;
+		for(size_t i=0; i<plen; i++)
+		{
+			//Target timestamp in the secondary waveform. If off the start of the waveform, skip it
+			int64_t target = pri.m_offsets[i] * pri.m_timescale + pri.m_triggerPhase + deltaFs;
+			if(target < 0)
+				continue;
+
+			//Skip secondary samples which end before the target, and stop if we run off the end
+			while( (isecondary < slen) &&
+				( (sec.m_offsets[isecondary] + sec.m_durations[isecondary]) * sec.m_timescale + sec.m_triggerPhase
+					< target) )
+			{
+				isecondary ++;
+			}
+			if(isecondary >= slen)
+				break;
+
+			correlation += pri.m_samples[i] * sec.m_samples[isecondary];
+			samplesProcessed ++;
+		}
+
+		if(samplesProcessed > 0)
+		{
+			m_correlations[k] = correlation / samplesProcessed;
+			overlapped[k] = 1;
+		}
+
+		m_blocksDone ++;
+	}
+
+	if(m_cancel)
+		return;
+
+	FindPeak(overlapped);
+}
+
+/**
+	@brief Finds the best delay in m_correlations and refines it to sub-sample resolution
+
+	@param overlapped	Nonzero for each delay which had any samples overlapping
+ */
+void DeskewCorrelator::FindPeak(const vector<uint8_t>& overlapped)
+{
+	int64_t ndeltas = m_correlations.size();
+	for(int64_t k=0; k<ndeltas; k++)
+	{
+		if(overlapped[k] && (m_correlations[k] > m_bestCorrelation))
+		{
+			m_bestCorrelation = m_correlations[k];
+			m_bestDelta = k - m_maxDelta;
+		}
+	}
+
+	//Refine the peak if we have neighbors on both sides
+	int64_t ibest = m_bestDelta + m_maxDelta;
+	if( (m_bestCorrelation > 0) && (ibest > 0) && (ibest+1 < ndeltas) && overlapped[ibest-1] && overlapped[ibest+1] )
+	{
+		m_bestDeltaFraction = InterpolatePeak(
+			m_correlations[ibest-1], m_correlations[ibest], m_correlations[ibest+1]);
+	}
+}
+
+/**
+	@brief Finds the location of a peak relative to its center sample by fitting a parabola to three samples
+
+	@return Offset of the peak from the center sample, in the range [-0.5, 0.5]
+ */
+double DeskewCorrelator::InterpolatePeak(double left, double center, double right)
+{
+	//Not a local maximum, don't try to refine it
+	double denom = left - 2*center + right;
+	if(denom >= 0)
+		return 0;
+
+	double frac = 0.5 * (left - right) / denom;
+	return max(-0.5, min(0.5, frac));
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// FFT
+
+/**
+	@brief Precomputes twiddle factors and the bit reversal permutation for a radix-2 FFT
+
+	@param npoints		FFT size (must be a power of two)
+ */
+void DeskewCorrelator::PrepareFFT(size_t npoints)
+{
+	if(m_fftSize == npoints)
+		return;
+	m_fftSize = npoints;
+
+	m_twiddles[0].resize(npoints);
+	m_twiddles[1].resize(npoints);
+	for(size_t half=1; half<npoints; half <<= 1)
+	{
+		for(size_t k=0; k<half; k++)
+		{
+			m_twiddles[0][half + k] = polar(1.0, -M_PI * k / half);
+			m_twiddles[1][half + k] = conj(m_twiddles[0][half + k]);
+		}
+	}
+
+	size_t bits = 0;
+	while( (static_cast<size_t>(1) << bits) < npoints)
+		bits ++;
+	m_bitReverse.resize(npoints);
+	for(size_t i=0; i<npoints; i++)
+	{
+		uint32_t r = 0;
+		for(size_t b=0; b<bits; b++)
+		{
+			if(i & (static_cast<size_t>(1) << b))
+				r |= 1 << (bits - 1 - b);
+		}
+		m_bitReverse[i] = r;
+	}
+}
+
+/**
+	@brief In-place iterative radix-2 complex FFT of size m_fftSize
+
+	The inverse transform is not normalized.
+ */
+void DeskewCorrelator::FFT(complex<double>* data, bool inverse)
+{
+	size_t n = m_fftSize;
+	for(size_t i=0; i<n; i++)
+	{
+		size_t j = m_bitReverse[i];
+		if(i < j)
+			swap(data[i], data[j]);
+	}
+
+	auto& twiddles = m_twiddles[inverse ? 1 : 0];
+	for(size_t half=1; half<n; half <<= 1)
+	{
+		#ifdef __x86_64__
+		if(g_hasAvx512F && (half >= 4) )
+		{
+			FFTStageAVX512F(data, n, &twiddles[half], half);
+			continue;
+		}
+		if(g_hasAvx2 && g_hasFMA && (half >= 2) )
+		{
+			FFTStageFMA(data, n, &twiddles[half], half);
+			continue;
+		}
+		#endif
+
+		FFTStage(data, n, &twiddles[half], half);
+	}
+}
+
+/**
+	@brief Runs one stage of butterflies, combining pairs of transforms of size half into transforms of size 2*half
+
+	@param data		Data being transformed
+	@param n		FFT size
+	@param twiddles	Twiddle factors for this stage (half entries)
+	@param half		Size of the transforms being combined
+ */
+void DeskewCorrelator::FFTStage(complex<double>* data, size_t n, const complex<double>* twiddles, size_t half)
+{
+	for(size_t i=0; i<n; i += 2*half)
+	{
+		for(size_t k=0; k<half; k++)
+		{
+			//Multiply out by hand, std::complex operator* has a slow path for inf/nan handling
+			double wr = twiddles[k].real();
+			double wi = twiddles[k].imag();
+
+			auto u = data[i + k];
+			auto v = data[i + k + half];
+			double vr = v.real()*wr - v.imag()*wi;
+			double vi = v.real()*wi + v.imag()*wr;
+
+			data[i + k] = complex<double>(u.real() + vr, u.imag() + vi);
+			data[i + k + half] = complex<double>(u.real() - vr, u.imag() - vi);
+		}
+	}
+}
+
+#ifdef __x86_64__
+
+/**
+	@brief AVX2/FMA version of FFTStage(), two butterflies at a time
+
+	half must be at least 2.
+ */
+__attribute__((target("avx2,fma")))
+void DeskewCorrelator::FFTStageFMA(complex<double>* data, size_t n, const complex<double>* twiddles, size_t half)
+{
+	auto p = reinterpret_cast<double*>(data);
+	auto tw = reinterpret_cast<const double*>(twiddles);
+	for(size_t i=0; i<n; i += 2*half)
+	{
+		for(size_t k=0; k<half; k += 2)
+		{
+			__m256d w = _mm256_loadu_pd(tw + 2*k);
+			__m256d u = _mm256_loadu_pd(p + 2*(i + k));
+			__m256d v = _mm256_loadu_pd(p + 2*(i + k + half));
+
+			//Complex multiply v*w: real lanes get vr*wr - vi*wi, imaginary lanes get vi*wr + vr*wi
+			__m256d wr = _mm256_movedup_pd(w);
+			__m256d wi = _mm256_permute_pd(w, 0xf);
+			__m256d vswap = _mm256_permute_pd(v, 0x5);
+			__m256d vw = _mm256_fmaddsub_pd(v, wr, _mm256_mul_pd(vswap, wi));
+
+			_mm256_storeu_pd(p + 2*(i + k), _mm256_add_pd(u, vw));
+			_mm256_storeu_pd(p + 2*(i + k + half), _mm256_sub_pd(u, vw));
+		}
+	}
+}
+
+/**
+	@brief AVX512F version of FFTStage(), four butterflies at a time
+
+	half must be at least 4.
+ */
+__attribute__((target("avx512f")))
+void DeskewCorrelator::FFTStageAVX512F(
+	complex<double>* data, size_t n, const complex<double>* twiddles, size_t half)
+{
+	auto p = reinterpret_cast<double*>(data);
+	auto tw = reinterpret_cast<const double*>(twiddles);
+	for(size_t i=0; i<n; i += 2*half)
+	{
+		for(size_t k=0; k<half; k += 4)
+		{
+			__m512d w = _mm512_loadu_pd(tw + 2*k);
+			__m512d u = _mm512_loadu_pd(p + 2*(i + k));
+			__m512d v = _mm512_loadu_pd(p + 2*(i + k + half));
+
+			//Masked forms with every lane selected, since the unmasked ones trip -Wmaybe-uninitialized in some gcc versions
+			__m512d wr = _mm512_mask_movedup_pd(w, 0xff, w);
+			__m512d wi = _mm512_mask_permute_pd(w, 0xff, w, 0xff);
+			__m512d vswap = _mm512_mask_permute_pd(v, 0xff, v, 0x55);
+			__m512d vw = _mm512_fmaddsub_pd(v, wr, _mm512_mul_pd(vswap, wi));
+
+			_mm512_storeu_pd(p + 2*(i + k), _mm512_add_pd(u, vw));
+			_mm512_storeu_pd(p + 2*(i + k + half), _mm512_sub_pd(u, vw));
+		}
+	}
+}
+
+#endif
@@ -0,0 +1,263 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* ngscopeclient                                                                                                        *
+*                                                                                                                      *
+* Copyright (c) 2012-2025 Andrew D. Zonenberg and contributors                                                         *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+/**
+	@file
+	@author Andrew D. Zonenberg
+	@brief Declaration of DeskewCorrelator
+ */
+#ifndef DeskewCorrelator_h
+#define DeskewCorrelator_h
+
+#include <atomic>
+#include <complex>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+	@brief A copy of a sparse waveform's samples and timebase, for DeskewCorrelator::CorrelateSparse()
+
+	Offsets must be in ascending order.
+ */
+class DeskewSparseInput
+{
+public:
+	DeskewSparseInput()
+	: m_timescale(1)
+	, m_triggerPhase(0)
+	{}
+
+	void clear()
+	{
+		m_samples.clear();
+		m_samples.shrink_to_fit();
+		m_offsets.clear();
+		m_offsets.shrink_to_fit();
+		m_durations.clear();
+		m_durations.shrink_to_fit();
+	}
+
+	std::vector<float> m_samples;
+	std::vector<int64_t> m_offsets;
+	std::vector<int64_t> m_durations;
+	int64_t m_timescale;
+	int64_t m_triggerPhase;
+};
+
+/**
+	@brief FFT based cross-correlation used by the deskew wizard when GPU correlation isn't available
+
+	The secondary waveform is first resampled onto the primary's timebase (using the same "secondary sample covering
+	the target time" rule as the brute force implementation), then correlated against the primary for every delay in
+	[-maxDelta, maxDelta) using overlap-save: the primary is cut into blocks, each block is correlated against the
+	matching window of the secondary with one forward and one inverse FFT, and the per-block results are summed.
+	This is O(N log D) rather than O(N * D).
+
+	Each delay's sum is normalized by the number of samples which overlapped at that delay, exactly like the brute
+	force code, and the peak is refined to sub-sample resolution by fitting a parabola through its neighbors.
+
+	Sparse primaries are placed on a grid of timebase ticks with zeros between samples and a mask marking where the
+	samples are, so sums and normalization still run over primary samples rather than ticks. If that grid would be
+	too big (see MAX_SPARSE_GRID_RATIO) the brute force per-sample correlation is used instead.
+
+	Blocks are processed in parallel, and the FFT butterflies use AVX2/FMA or AVX512F if the CPU has them.
+	Correlate() is normally run from a background thread, GetProgress() may be polled from any thread.
+
+	Everything here works on raw arrays (not waveform objects) and only depends on libscopehal, so it can be linked
+	into unit tests and benchmarks.
+ */
+class DeskewCorrelator
+{
+public:
+	DeskewCorrelator(int64_t maxDelta);
+
+	/**
+		@brief Gets the number of secondary samples needed to correlate a primary of the specified length
+
+		The secondary buffer passed to Correlate() covers primary sample indexes [-maxDelta, len + maxDelta).
+	 */
+	size_t GetSecondaryLength(size_t len)
+	{ return len + 2*m_maxDelta; }
+
+	static void ResampleUniform(
+		const float* samples,
+		size_t len,
+		int64_t timescale,
+		int64_t outTimescale,
+		int64_t phase,
+		int64_t first,
+		size_t count,
+		float* out,
+		int64_t& validStart,
+		int64_t& validEnd);
+
+	static void ResampleSparse(
+		const float* samples,
+		const int64_t* offsets,
+		const int64_t* durations,
+		size_t len,
+		int64_t timescale,
+		int64_t triggerPhase,
+		int64_t outTimescale,
+		int64_t outPhase,
+		int64_t first,
+		size_t count,
+		float* out,
+		int64_t& validStart,
+		int64_t& validEnd);
+
+	void Correlate(
+		const float* pri,
+		size_t len,
+		const float* sec,
+		int64_t validStart,
+		int64_t validEnd,
+		const uint8_t* priMask = nullptr);
+
+	void CorrelateSparse(const DeskewSparseInput& pri, const DeskewSparseInput& sec);
+
+	/**
+		@brief Maximum length of the grid CorrelateSparse() resamples onto, in timebase ticks per primary sample
+
+		Sparse captures with bigger gaps than this are correlated directly instead, so a few samples spread over a
+		long capture don't turn into a huge grid.
+	 */
+	static constexpr int64_t MAX_SPARSE_GRID_RATIO = 4;
+
+	///@brief Gets the delay (in primary samples) with the highest correlation
+	int64_t GetBestDelta()
+	{ return m_bestDelta; }
+
+	///@brief Gets the sub-sample correction to GetBestDelta(), in the range [-0.5, 0.5]
+	double GetBestDeltaFraction()
+	{ return m_bestDeltaFraction; }
+
+	///@brief Gets the normalized correlation at GetBestDelta(), or zero if nothing correlated positively
+	double GetBestCorrelation()
+	{ return m_bestCorrelation; }
+
+	///@brief Gets the normalized correlation for each delay, starting at -maxDelta
+	const std::vector<double>& GetCorrelations()
+	{ return m_correlations; }
+
+	/**
+		@brief Gets the fraction of Correlate() or CorrelateSparse() completed so far
+	 */
+	float GetProgress()
+	{
+		if(m_blocksTotal == 0)
+			return 0;
+		return m_blocksDone * 1.0f / m_blocksTotal;
+	}
+
+	/**
+		@brief Asks a Correlate() or CorrelateSparse() call running in another thread to stop as soon as possible
+
+		The results of a cancelled correlation are meaningless. A cancelled correlator can't be reused.
+	 */
+	void Cancel()
+	{ m_cancel = true; }
+
+	static double InterpolatePeak(double left, double center, double right);
+
+protected:
+	void CorrelateSparseDirect(const DeskewSparseInput& pri, const DeskewSparseInput& sec);
+	void FindPeak(const std::vector<uint8_t>& overlapped);
+
+	void PrepareFFT(size_t npoints);
+	void FFT(std::complex<double>* data, bool inverse);
+
+	static void FFTStage(std::complex<double>* data, size_t n, const std::complex<double>* twiddles, size_t half);
+#ifdef __x86_64__
+	static void FFTStageFMA(std::complex<double>* data, size_t n, const std::complex<double>* twiddles, size_t half);
+	static void FFTStageAVX512F(
+		std::complex<double>* data, size_t n, const std::complex<double>* twiddles, size_t half);
+#endif
+
+	///@brief Maximum delay to consider, in primary samples
+	int64_t m_maxDelta;
+
+	///@brief Current FFT size (always a power of two)
+	size_t m_fftSize;
+
+	/**
+		@brief Twiddle factors for the current FFT size, for forward (0) and inverse (1) transforms
+
+		Factors for the stage combining pairs of half-size transforms start at index "half", so each stage reads
+		them sequentially.
+	 */
+	std::vector<std::complex<double> > m_twiddles[2];
+
+	///@brief Bit reversal permutation for the current FFT size
+	std::vector<uint32_t> m_bitReverse;
+
+	///@brief Normalized correlation for each delay
+	std::vector<double> m_correlations;
+
+	///@brief Delay with the highest correlation
+	int64_t m_bestDelta;
+
+	///@brief Sub-sample correction to m_bestDelta
+	double m_bestDeltaFraction;
+
+	///@brief Correlation at m_bestDelta
+	double m_bestCorrelation;
+
+	///@brief Number of overlap-save blocks (or delays, for direct sparse correlation) in the current call
+	std::atomic<size_t> m_blocksTotal;
+
+	///@brief Number of blocks (or delays) finished so far
+	std::atomic<size_t> m_blocksDone;
+
+	///@brief Set by Cancel() to make the worker loops skip any remaining work
+	std::atomic<bool> m_cancel;
+};
+
+/**
+	@brief Push constants for the ScopeDeskewUniform* compute shaders
+ */
+class UniformCrossCorrelateArgs
+{
+public:
+	UniformCrossCorrelateArgs(UniformAnalogWaveform* ppri, UniformAnalogWaveform* psec, int64_t delta);
+
+	int64_t priTimescale;
+	int64_t secTimescale;
+
+	int64_t trigPhaseDelta;
+
+	int32_t startingDelta;
+	int32_t numDeltas;
+
+	int32_t priLen;
+	int32_t secLen;
+};
+
+#endif
@@ -0,0 +1,146 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* ngscopeclient                                                                                                        *
+*                                                                                                                      *
+* Copyright (c) 2012-2025 Andrew D. Zonenberg and contributors                                                         *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+/**
+	@file
+	@author Andrew D. Zonenberg
+	@brief Declaration of FenwickTree
+ */
+#ifndef FenwickTree_h
+#define FenwickTree_h
+
+#include <vector>
+
+/**
+	@brief Binary indexed tree of running sums
+
+	Supports point updates, prefix sums, appending, and searching for the first element at which the running sum
+	reaches a given value, all in O(log n). Building from a list of values is O(n).
+ */
+template<class T>
+class FenwickTree
+{
+public:
+	FenwickTree()
+	: m_tree(1, T(0))
+	{}
+
+	void clear()
+	{ m_tree.assign(1, T(0)); }
+
+	size_t size() const
+	{ return m_tree.size() - 1; }
+
+	bool empty() const
+	{ return size() == 0; }
+
+	/**
+		@brief Replaces the tree contents with the specified values
+	 */
+	void Build(const std::vector<T>& values)
+	{
+		size_t n = values.size();
+		m_tree.resize(n + 1);
+		m_tree[0] = T(0);
+		for(size_t i=1; i<=n; i++)
+			m_tree[i] = values[i-1];
+		for(size_t i=1; i<=n; i++)
+		{
+			size_t parent = i + LowBit(i);
+			if(parent <= n)
+				m_tree[parent] += m_tree[i];
+		}
+	}
+
+	/**
+		@brief Appends a new value to the end of the tree
+	 */
+	void push_back(T value)
+	{
+		size_t i = m_tree.size();
+		m_tree.push_back(value + Prefix(i-1) - Prefix(i - LowBit(i)));
+	}
+
+	/**
+		@brief Adds a delta to the value at the specified (zero based) index
+	 */
+	void Add(size_t index, T delta)
+	{
+		for(size_t i=index+1; i<m_tree.size(); i += LowBit(i))
+			m_tree[i] += delta;
+	}
+
+	/**
+		@brief Returns the sum of the first n values
+	 */
+	T Prefix(size_t n) const
+	{
+		T sum(0);
+		for(size_t i=n; i>0; i -= LowBit(i))
+			sum += m_tree[i];
+		return sum;
+	}
+
+	///@brief Returns the sum of all values
+	T Total() const
+	{ return Prefix(size()); }
+
+	/**
+		@brief Finds the first (zero based) index whose running sum, including itself, is at least the target
+
+		Values must all be non-negative. Returns size() if the total is less than the target.
+	 */
+	size_t LowerBound(T target) const
+	{
+		size_t n = size();
+		size_t step = 1;
+		while( (step << 1) <= n)
+			step <<= 1;
+
+		size_t pos = 0;
+		for(; step > 0; step >>= 1)
+		{
+			if( (pos + step <= n) && (m_tree[pos + step] < target) )
+			{
+				pos += step;
+				target -= m_tree[pos];
+			}
+		}
+		return pos;
+	}
+
+protected:
+	static size_t LowBit(size_t i)
+	{ return i & (~i + 1); }
+
+	///@brief One based tree storage (element 0 is unused)
+	std::vector<T> m_tree;
+};
+
+#endif
@@ -1590,6 +1590,28 @@ bool FilterGraphEditor::IsBackEdge(FlowGraphNode* src, FlowGraphNode* dst)
 	return false;
 }
 
+/**
+	@brief Does the same bookkeeping as HandleLinkCreationRequests() after the "add input" menu hooks up m_createInput
+ */
+void FilterGraphEditor::OnCreateInputConnected()
+{
+	//Filter inputs changed, so the session's cached graph topology is stale
+	auto f = dynamic_cast<Filter*>(m_createInput.first);
+	if(f)
+	{
+		if(f->IsUsingDefaultName())
+			f->SetDefaultName();
+		m_parent->OnFilterReconfigured(f);
+	}
+	else
+		m_session.OnFilterGraphChanged();
+
+	//Push trigger changes if needed
+	auto trig = dynamic_cast<Trigger*>(m_createInput.first);
+	if(trig)
+		trig->GetScope()->PushTrigger();
+}
+
 /**
 	@brief Runs the "add input" menu
  */
@@ -1640,10 +1662,7 @@ void FilterGraphEditor::CreateChannelMenu()
 			if(ImGui::MenuItem(s.GetName().c_str()))
 			{
 				m_createInput.first->SetInput(m_createInput.second, s);
-
-				auto trig = dynamic_cast<Trigger*>(m_createInput.first);
-				if(trig)
-					trig->GetScope()->PushTrigger();
+				OnCreateInputConnected();
 			}
 		}
 
@@ -1684,10 +1703,7 @@ void FilterGraphEditor::CreateChannelMenu()
 
 				//Once the filter exists, hook it up
 				m_createInput.first->SetInput(m_createInput.second, StreamDescriptor(f, 0));
-
-				auto trig = dynamic_cast<Trigger*>(m_createInput.first);
-				if(trig)
-					trig->GetScope()->PushTrigger();
+				OnCreateInputConnected();
 			}
 		}
 
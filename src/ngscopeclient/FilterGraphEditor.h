@@ -215,6 +215,7 @@ protected:
 	void FilterMenu(StreamDescriptor src);
 	void FilterSubmenu(StreamDescriptor src, const std::string& name, Filter::Category cat);
 	void CreateChannelMenu();
+	void OnCreateInputConnected();
 
 	///@brief Session being manipulated
 	Session& m_session;
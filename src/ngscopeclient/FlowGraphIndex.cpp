@@ -0,0 +1,234 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* ngscopeclient                                                                                                        *
+*                                                                                                                      *
+* Copyright (c) 2012-2025 Andrew D. Zonenberg and contributors                                                         *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+/**
+	@file
+	@author Andrew D. Zonenberg
+	@brief Implementation of FlowGraphIndex
+ */
+#include "ngscopeclient.h"
+#include "FlowGraphIndex.h"
+
+using namespace std;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Construction / destruction
+
+FlowGraphIndex::FlowGraphIndex()
+	: m_valid(false)
+	, m_filterCount(0)
+	, m_visitGeneration(0)
+{
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Index management
+
+/**
+	@brief Checks if the index can be used as is, or needs to be rebuilt
+ */
+bool FlowGraphIndex::IsValid()
+{
+	return m_valid && (static_cast<size_t>(Filter::GetNumInstances()) == m_filterCount);
+}
+
+/**
+	@brief Checks if a node's inputs are wired differently than when the index was last built
+
+	Only looks at the one node, so this is cheap enough to call on every dirty node before using the index.
+
+	@param node	The node to check. Must be present in the index.
+ */
+bool FlowGraphIndex::InputsChanged(FlowGraphNode* node)
+{
+	auto it = m_indexes.find(node);
+	if(it == m_indexes.end())
+		return true;
+
+	auto& inputs = m_inputs[it->second];
+	if(inputs.size() != node->GetInputCount())
+		return true;
+	for(size_t i=0; i<inputs.size(); i++)
+	{
+		if(inputs[i] != node->GetInput(i).m_channel)
+			return true;
+	}
+	return false;
+}
+
+/**
+	@brief Rebuilds the index from scratch
+
+	@param nodes	All nodes in the graph (filters plus instrument channels)
+ */
+void FlowGraphIndex::Rebuild(const set<FlowGraphNode*>& nodes)
+{
+	//Mark valid before we look at the graph, so an Invalidate() call while we're rebuilding isn't lost
+	m_valid = true;
+	m_filterCount = static_cast<size_t>(Filter::GetNumInstances());
+
+	//Assign provisional indexes in arbitrary order
+	vector<FlowGraphNode*> unsorted(nodes.begin(), nodes.end());
+	map<FlowGraphNode*, size_t> provisional;
+	for(size_t i=0; i<unsorted.size(); i++)
+		provisional[unsorted[i]] = i;
+
+	//Find edges from each input to the nodes consuming it
+	vector<vector<size_t> > edges(unsorted.size());
+	vector<size_t> indegree(unsorted.size(), 0);
+	for(size_t i=0; i<unsorted.size(); i++)
+	{
+		auto node = unsorted[i];
+		for(size_t j=0; j<node->GetInputCount(); j++)
+		{
+			FlowGraphNode* src = node->GetInput(j).m_channel;
+			if(!src)
+				continue;
+
+			auto it = provisional.find(src);
+			if(it == provisional.end())
+				continue;
+
+			edges[it->second].push_back(i);
+			indegree[i] ++;
+		}
+	}
+
+	//Topologically sort (Kahn's algorithm)
+	vector<size_t> order;
+	order.reserve(unsorted.size());
+	for(size_t i=0; i<unsorted.size(); i++)
+	{
+		if(indegree[i] == 0)
+			order.push_back(i);
+	}
+	for(size_t i=0; i<order.size(); i++)
+	{
+		for(auto dst : edges[order[i]])
+		{
+			indegree[dst] --;
+			if(indegree[dst] == 0)
+				order.push_back(dst);
+		}
+	}
+
+	//The filter graph should never have cycles, but don't lose track of nodes if it somehow does
+	if(order.size() != unsorted.size())
+	{
+		LogWarning("FlowGraphIndex: filter graph contains a cycle\n");
+		for(size_t i=0; i<unsorted.size(); i++)
+		{
+			if(indegree[i] != 0)
+				order.push_back(i);
+		}
+	}
+
+	//Renumber everything in topological order
+	vector<size_t> sortedIndex(unsorted.size());
+	for(size_t i=0; i<order.size(); i++)
+		sortedIndex[order[i]] = i;
+
+	m_nodes.resize(order.size());
+	m_indexes.clear();
+	m_inputs.clear();
+	m_inputs.resize(order.size());
+	m_downstream.clear();
+	m_downstream.resize(order.size());
+	for(size_t i=0; i<order.size(); i++)
+	{
+		auto node = unsorted[order[i]];
+		m_nodes[i] = node;
+		m_indexes[node] = i;
+
+		for(size_t j=0; j<node->GetInputCount(); j++)
+			m_inputs[i].push_back(node->GetInput(j).m_channel);
+
+		for(auto dst : edges[order[i]])
+			m_downstream[i].push_back(sortedIndex[dst]);
+	}
+
+	m_visitMarks.clear();
+	m_visitMarks.resize(m_nodes.size(), 0);
+	m_visitGeneration = 0;
+}
+
+/**
+	@brief Finds every node downstream of a set of dirty nodes
+
+	Run time is proportional to the size of the cone, not the size of the graph.
+
+	@param dirty	The nodes which have changed
+	@param cone		Set to add downstream nodes to. The dirty nodes themselves are not added unless they are
+					downstream of another dirty node.
+ */
+void FlowGraphIndex::GetDownstreamCone(const set<FlowGraphNode*>& dirty, set<FlowGraphNode*>& cone)
+{
+	//Start a new traversal. If the generation counter wraps, clear all marks so stale ones can't match
+	m_visitGeneration ++;
+	if(m_visitGeneration == 0)
+	{
+		fill(m_visitMarks.begin(), m_visitMarks.end(), 0);
+		m_visitGeneration = 1;
+	}
+
+	//Seed the worklist with everything fed by a dirty node
+	vector<size_t> worklist;
+	for(auto node : dirty)
+	{
+		auto it = m_indexes.find(node);
+		if(it == m_indexes.end())
+			continue;
+
+		for(auto dst : m_downstream[it->second])
+		{
+			if(m_visitMarks[dst] != m_visitGeneration)
+			{
+				m_visitMarks[dst] = m_visitGeneration;
+				worklist.push_back(dst);
+			}
+		}
+	}
+
+	//Then walk the rest of the cone
+	while(!worklist.empty())
+	{
+		auto i = worklist.back();
+		worklist.pop_back();
+		cone.emplace(m_nodes[i]);
+
+		for(auto dst : m_downstream[i])
+		{
+			if(m_visitMarks[dst] != m_visitGeneration)
+			{
+				m_visitMarks[dst] = m_visitGeneration;
+				worklist.push_back(dst);
+			}
+		}
+	}
+}
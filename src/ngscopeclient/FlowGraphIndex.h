@@ -0,0 +1,99 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* ngscopeclient                                                                                                        *
+*                                                                                                                      *
+* Copyright (c) 2012-2025 Andrew D. Zonenberg and contributors                                                         *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+/**
+	@file
+	@author Andrew D. Zonenberg
+	@brief Declaration of FlowGraphIndex
+ */
+#ifndef FlowGraphIndex_h
+#define FlowGraphIndex_h
+
+/**
+	@brief Cached, topologically sorted adjacency list of the filter graph
+
+	Used for finding the downstream influence cone of a set of dirty nodes without walking the entire graph.
+
+	The index has no way of knowing when the graph is changed, so anything that creates, deletes, or rewires nodes must
+	call Invalidate(). As a safety net, the index also considers itself stale if the number of filters has changed
+	since it was built, and callers can use InputsChanged() to catch nodes which rewired themselves.
+
+	Not thread safe except for Invalidate(); callers must provide their own locking.
+ */
+class FlowGraphIndex
+{
+public:
+	FlowGraphIndex();
+
+	/**
+		@brief Marks the index as out of date, so it will be rebuilt next time it's used
+	 */
+	void Invalidate()
+	{ m_valid = false; }
+
+	bool IsValid();
+	void Rebuild(const std::set<FlowGraphNode*>& nodes);
+
+	/**
+		@brief Checks if a node was present in the graph when the index was last built
+	 */
+	bool Contains(FlowGraphNode* node)
+	{ return m_indexes.find(node) != m_indexes.end(); }
+
+	bool InputsChanged(FlowGraphNode* node);
+
+	void GetDownstreamCone(const std::set<FlowGraphNode*>& dirty, std::set<FlowGraphNode*>& cone);
+
+protected:
+	///@brief True if the index is up to date
+	std::atomic<bool> m_valid;
+
+	///@brief Number of filters in existence when the index was built
+	size_t m_filterCount;
+
+	///@brief All nodes in the graph, in topological order (sources first)
+	std::vector<FlowGraphNode*> m_nodes;
+
+	///@brief Map of nodes to their position in m_nodes
+	std::map<FlowGraphNode*, size_t> m_indexes;
+
+	///@brief Nodes feeding each input of each node when the index was built
+	std::vector<std::vector<FlowGraphNode*> > m_inputs;
+
+	///@brief Indexes of the nodes directly consuming each node's outputs
+	std::vector<std::vector<size_t> > m_downstream;
+
+	///@brief Last traversal each node was visited in
+	std::vector<uint32_t> m_visitMarks;
+
+	///@brief ID of the current traversal
+	uint32_t m_visitGeneration;
+};
+
+#endif
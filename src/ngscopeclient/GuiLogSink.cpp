@@ -40,38 +40,285 @@ using namespace std;
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 // Construction / destruction
 
-GuiLogSink::GuiLogSink(Severity min_severity)
+/**
+	@brief Creates the log sink
+
+	@param min_severity	Minimum severity of messages to log
+	@param queueDepth	Number of messages which may be waiting for the GUI thread before new ones are dropped
+						(rounded up to a power of two)
+ */
+GuiLogSink::GuiLogSink(Severity min_severity, size_t queueDepth)
 	: LogSink(min_severity)
+	, m_queue(new MessageQueue(queueDepth))
+	, m_droppedMessages(0)
+	, m_maxLines(100000)
+	, m_totalLines(0)
 {
-
 }
 
 GuiLogSink::~GuiLogSink()
 {
+	delete m_queue.load();
+}
+
+/**
+	@brief Creates an empty queue with at least the requested number of slots
+ */
+GuiLogSink::MessageQueue::MessageQueue(size_t depth)
+	: m_enqueuePos(0)
+	, m_dequeuePos(0)
+	, m_producers(0)
+{
+	size_t size = 2;
+	while(size < depth)
+		size <<= 1;
+
+	m_slots = make_unique<PendingMessage[]>(size);
+	m_mask = size - 1;
+	for(size_t i=0; i<size; i++)
+		m_slots[i].m_sequence = i;
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-// Logging
+// Logging (producer side, any thread)
 
-void GuiLogSink::Clear()
+/**
+	@brief Claims the next free slot of the queue
+
+	Bounded MPMC queue after Dmitry Vyukov.
+	Each slot's sequence number tells us whether it's free for the current lap around the ring.
+
+	@param pos	Position of the claimed slot, to be passed to EndMessage()
+
+	@return The slot, or nullptr if the queue is full
+ */
+GuiLogSink::PendingMessage* GuiLogSink::MessageQueue::Claim(size_t& pos)
 {
-	m_lines.clear();
+	pos = m_enqueuePos.load(memory_order_relaxed);
+	while(true)
+	{
+		auto slot = &m_slots[pos & m_mask];
+		size_t seq = slot->m_sequence.load(memory_order_acquire);
+		auto dif = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+
+		//Slot is free, try to claim it
+		if(dif == 0)
+		{
+			if(m_enqueuePos.compare_exchange_weak(pos, pos + 1, memory_order_relaxed))
+				return slot;
+		}
+
+		//Slot hasn't been consumed yet: queue is full
+		else if(dif < 0)
+			return nullptr;
+
+		//Another producer got there first, try again
+		else
+			pos = m_enqueuePos.load(memory_order_relaxed);
+	}
+}
+
+/**
+	@brief Claims a slot for a new message
+
+	The caller fills in m_len and either m_msg or (if it's too long) m_overflow, then hands the slot to EndMessage().
+
+	@return The slot, or nullptr if the message is to be dropped
+ */
+GuiLogSink::PendingMessage* GuiLogSink::BeginMessage(Severity severity, MessageQueue*& queue, size_t& pos)
+{
+	//Pin the current queue so SetQueueDepth() doesn't free it out from under us.
+	//If it was swapped between the load and the increment, let go and try the new one.
+	while(true)
+	{
+		queue = m_queue.load();
+		queue->m_producers ++;
+		if(m_queue.load() == queue)
+			break;
+		queue->m_producers --;
+	}
+
+	auto slot = queue->Claim(pos);
+	if(!slot)
+	{
+		m_droppedMessages ++;
+		queue->m_producers --;
+		return nullptr;
+	}
+
+	slot->m_sev = severity;
+	return slot;
+}
+
+/**
+	@brief Finishes a message started by BeginMessage() and hands it to the consumer
+ */
+void GuiLogSink::EndMessage(MessageQueue* queue, PendingMessage* slot, size_t pos)
+{
+	//Indentation is per thread, so has to be captured now
+	auto indent = GetIndentString();
+	size_t len = min(indent.length(), MAX_INDENT_LENGTH);
+	memcpy(slot->m_indent, indent.c_str(), len);
+	slot->m_indent[len] = '\0';
+
+	if(!slot->m_overflow)
+		slot->m_msg[slot->m_len] = '\0';
+
+	slot->m_timestamp = GetTime();
+	slot->m_sequence.store(pos + 1, memory_order_release);
+	queue->m_producers --;
 }
 
+/**
+	@brief Queues a message for processing by the GUI thread
+
+	If the queue is full, the message is dropped (and counted) rather than blocking the caller.
+ */
 void GuiLogSink::Log(Severity severity, const string &msg)
 {
 	if(severity > m_min_severity)
 		return;
 
+	MessageQueue* queue;
+	size_t pos;
+	auto slot = BeginMessage(severity, queue, pos);
+	if(!slot)
+		return;
+
+	slot->m_len = msg.length();
+	if(slot->m_len > MAX_MESSAGE_LENGTH)
+	{
+		slot->m_overflow = make_unique<char[]>(slot->m_len + 1);
+		memcpy(slot->m_overflow.get(), msg.c_str(), slot->m_len + 1);
+	}
+	else
+		memcpy(slot->m_msg, msg.c_str(), slot->m_len);
+	EndMessage(queue, slot, pos);
+}
+
+void GuiLogSink::Log(Severity severity, const char *format, va_list va)
+{
+	if(severity > m_min_severity)
+		return;
+
+	MessageQueue* queue;
+	size_t pos;
+	auto slot = BeginMessage(severity, queue, pos);
+	if(!slot)
+		return;
+
+	//Format straight into the slot, and if it didn't fit, again into a buffer big enough for it
+	va_list va2;
+	va_copy(va2, va);
+	int len = vsnprintf(slot->m_msg, sizeof(slot->m_msg), format, va);
+	slot->m_len = (len < 0) ? 0 : len;
+	if(slot->m_len > MAX_MESSAGE_LENGTH)
+	{
+		slot->m_overflow = make_unique<char[]>(slot->m_len + 1);
+		vsnprintf(slot->m_overflow.get(), slot->m_len + 1, format, va2);
+	}
+	va_end(va2);
+	EndMessage(queue, slot, pos);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Log processing (consumer side, GUI thread only)
+
+/**
+	@brief Processes all messages logged since the last call
+ */
+void GuiLogSink::Poll()
+{
+	Drain(m_queue.load());
+
+	size_t dropped = m_droppedMessages.exchange(0);
+	if(dropped)
+		AddLine(Severity::WARNING, to_string(dropped) + " log messages dropped (log queue full)", GetTime());
+}
+
+/**
+	@brief Processes all messages waiting in a queue
+ */
+void GuiLogSink::Drain(MessageQueue* queue)
+{
+	while(true)
+	{
+		auto& slot = queue->m_slots[queue->m_dequeuePos & queue->m_mask];
+		size_t seq = slot.m_sequence.load(memory_order_acquire);
+		if(static_cast<intptr_t>(seq) - static_cast<intptr_t>(queue->m_dequeuePos + 1) < 0)
+			break;
+
+		const char* msg = slot.m_overflow ? slot.m_overflow.get() : slot.m_msg;
+		ProcessMessage(slot.m_sev, string(msg, slot.m_len), slot.m_indent, slot.m_timestamp);
+		slot.m_overflow.reset();
+
+		//Hand the slot back to the producers for their next lap
+		slot.m_sequence.store(queue->m_dequeuePos + queue->m_mask + 1, memory_order_release);
+		queue->m_dequeuePos ++;
+	}
+}
+
+/**
+	@brief Changes the number of messages which may be waiting for the GUI thread before new ones are dropped
+
+	Safe to call while other threads are logging. Does nothing if the (rounded up) depth is unchanged.
+ */
+void GuiLogSink::SetQueueDepth(size_t depth)
+{
+	auto oldQueue = m_queue.load();
+	size_t size = 2;
+	while(size < depth)
+		size <<= 1;
+	if(size == oldQueue->m_mask + 1)
+		return;
+
+	//New messages go to the new queue from here on.
+	//Wait for anyone still writing to the old one, then process what they left behind before freeing it.
+	m_queue.store(new MessageQueue(size));
+	while(oldQueue->m_producers.load() != 0)
+		this_thread::yield();
+	Drain(oldQueue);
+	delete oldQueue;
+}
+
+/**
+	@brief Sets the maximum number of lines kept for display
+ */
+void GuiLogSink::SetMaxLines(size_t lines)
+{
+	m_maxLines = max(lines, (size_t)1);
+	while(m_lines.size() > m_maxLines)
+		m_lines.pop_front();
+}
+
+void GuiLogSink::Clear()
+{
+	m_lines.clear();
+}
+
+/**
+	@brief Appends a single line to the log, discarding the oldest line if we're full
+ */
+void GuiLogSink::AddLine(Severity severity, const string& msg, double timestamp)
+{
+	if(m_lines.size() >= m_maxLines)
+		m_lines.pop_front();
+	m_lines.push_back(LogLine(severity, msg, timestamp));
+	m_totalLines ++;
+}
+
+/**
+	@brief Splits a logged message into lines
+ */
+void GuiLogSink::ProcessMessage(Severity severity, const string& msg, const string& indent, double timestamp)
+{
 	//Blank lines get special handling
 	if(msg == "\n")
 	{
-		m_lines.push_back(LogLine(severity, ""));
+		AddLine(severity, "", timestamp);
 		return;
 	}
 
-	auto indent = GetIndentString();
-
 	//No newline? Append to existing buffer
 	if(msg.find('\n') == string::npos)
 	{
@@ -101,20 +348,12 @@ void GuiLogSink::Log(Severity severity, const string &msg)
 		//If unbuffered line is present, append to it
 		if(!m_unbufferedLine.empty())
 		{
-			m_lines.push_back(LogLine(severity, m_unbufferedLine + line));
+			AddLine(severity, m_unbufferedLine + line, timestamp);
 			m_unbufferedLine = "";
 		}
 
 		//Otherwise append it
 		else
-			m_lines.push_back(LogLine(severity, indent + line));
+			AddLine(severity, indent + line, timestamp);
 	}
 }
-
-void GuiLogSink::Log(Severity severity, const char *format, va_list va)
-{
-	if(severity > m_min_severity)
-		return;
-
-	Log(severity, vstrprintf(format, va));
-}
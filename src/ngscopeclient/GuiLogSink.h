@@ -36,6 +36,7 @@
 #define GuiLogSink_h
 
 #include "Marker.h"
+#include <deque>
 
 /**
 	@brief A single line of the log
@@ -43,10 +44,10 @@
 class LogLine
 {
 public:
-	LogLine(Severity sev, const std::string& str)
+	LogLine(Severity sev, const std::string& str, double timestamp = GetTime())
 		: m_sev(sev)
 		, m_msg(str)
-		, m_timestamp(GetTime())
+		, m_timestamp(timestamp)
 	{
 	}
 
@@ -57,11 +58,17 @@ public:
 
 /**
 	@brief Log sink for displaying logs in the GUI
+
+	Log() may be called from any thread and never blocks: messages are formatted straight into a slot of a fixed size
+	lock-free queue (dropping them if it's full) and all of the parsing and line splitting is done later, on the GUI
+	thread, by Poll(). Only messages too long to fit in a slot allocate memory.
+
+	Everything other than Log() must only be called from the GUI thread.
  */
 class GuiLogSink : public LogSink
 {
 public:
-	GuiLogSink(Severity min_severity = Severity::DEBUG);
+	GuiLogSink(Severity min_severity = Severity::DEBUG, size_t queueDepth = 4096);
 	virtual ~GuiLogSink() override;
 
 	void Clear();
@@ -69,11 +76,105 @@ public:
 	void Log(Severity severity, const std::string &msg) override;
 	void Log(Severity severity, const char *format, va_list va) override;
 
-	const std::vector<LogLine>& GetLines()
-	{ return m_lines; }
+	void Poll();
+
+	void SetMaxLines(size_t lines);
+	void SetQueueDepth(size_t depth);
+
+	const std::deque<LogLine>& GetLines()
+	{
+		Poll();
+		return m_lines;
+	}
+
+	/**
+		@brief Returns the total number of lines ever logged, including any which have since been discarded
+
+		The first line in GetLines() is line number GetTotalLineCount() - GetLines().size().
+	 */
+	size_t GetTotalLineCount()
+	{ return m_totalLines; }
+
+	///@brief Longest message (in bytes) which can be queued without a heap allocation
+	static constexpr size_t MAX_MESSAGE_LENGTH = 511;
+
+	///@brief Longest indentation string (in bytes) which can be queued without truncation
+	static constexpr size_t MAX_INDENT_LENGTH = 63;
 
 protected:
-	std::vector<LogLine> m_lines;
+	void ProcessMessage(Severity severity, const std::string& msg, const std::string& indent, double timestamp);
+	void AddLine(Severity severity, const std::string& msg, double timestamp);
+
+	/**
+		@brief A message waiting to be processed
+	 */
+	class PendingMessage
+	{
+	public:
+		///@brief Sequence number used to arbitrate between producers and the consumer
+		std::atomic<size_t> m_sequence;
+
+		Severity m_sev;
+		double m_timestamp;
+
+		///@brief Length of the message, not including the null terminator
+		size_t m_len;
+
+		///@brief The message, if it's no longer than MAX_MESSAGE_LENGTH
+		char m_msg[MAX_MESSAGE_LENGTH + 1];
+
+		///@brief The message, if it's too long for m_msg (rare, so allocated on demand)
+		std::unique_ptr<char[]> m_overflow;
+
+		char m_indent[MAX_INDENT_LENGTH + 1];
+	};
+
+	/**
+		@brief Ring buffer of messages waiting to be processed
+
+		Kept separate from the sink so SetQueueDepth() can swap in a new one while other threads are logging.
+	 */
+	class MessageQueue
+	{
+	public:
+		MessageQueue(size_t depth);
+
+		PendingMessage* Claim(size_t& pos);
+
+		///@brief Slots of the ring
+		std::unique_ptr<PendingMessage[]> m_slots;
+
+		///@brief Number of slots minus one (size is always a power of two)
+		size_t m_mask;
+
+		///@brief Position of the next slot to be written by a producer
+		std::atomic<size_t> m_enqueuePos;
+
+		///@brief Position of the next slot to be read by the consumer
+		size_t m_dequeuePos;
+
+		///@brief Number of producers currently holding a reference to this queue
+		std::atomic<size_t> m_producers;
+	};
+
+	PendingMessage* BeginMessage(Severity severity, MessageQueue*& queue, size_t& pos);
+	void EndMessage(MessageQueue* queue, PendingMessage* slot, size_t pos);
+	void Drain(MessageQueue* queue);
+
+	///@brief The queue producers are currently writing to
+	std::atomic<MessageQueue*> m_queue;
+
+	///@brief Number of messages dropped due to a full queue since the last Poll()
+	std::atomic<size_t> m_droppedMessages;
+
+	///@brief Processed log lines
+	std::deque<LogLine> m_lines;
+
+	///@brief Maximum size of m_lines (oldest lines are discarded beyond this)
+	size_t m_maxLines;
+
+	///@brief Total number of lines ever added to m_lines
+	size_t m_totalLines;
 
 	std::string m_unbufferedLine;
 };
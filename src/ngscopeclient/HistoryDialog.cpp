@@ -140,7 +140,9 @@ bool HistoryDialog::DoRender()
 	ImGui::InputInt("History Depth", &m_mgr.m_maxDepth, 1, 10);
 	HelpMarker(
 		"Adjust the cap on total history depth, in waveforms.\n"
-		"Large history depths can use significant amounts of RAM with deep memory.");
+		"Large history depths can use significant amounts of RAM with deep memory.\n\n"
+		"Memory used by history is also limited by the budgets under Preferences > Performance > History.\n"
+		"Older waveforms are moved out of GPU memory, then to disk, before being deleted.");
 
 	if(ImGui::BeginTable("history", 3, flags))
 	{
@@ -251,6 +253,18 @@ bool HistoryDialog::DoRender()
 					strDetails += "  * " + jt.first->m_nickname + " (" + to_string(numNonNull) + " channels with data)\n";
 				}
 
+				static const char* tierNames[HistoryPoint::TIER_COUNT] =
+				{
+					"GPU memory",
+					"pinned host memory",
+					"pageable host memory",
+					"disk",
+					"session file (not loaded)"
+				};
+				Unit bytes(Unit::UNIT_BYTES);
+				strDetails += string("\nStored in ") + tierNames[point->m_tier] +
+					" (" + bytes.PrettyPrint(point->m_sizeBytes) + ")\n";
+
 				ImGui::BeginTooltip();
 				ImGui::PushTextWrapPos(ImGui::GetFontSize() * 50);
 				ImGui::TextUnformatted(strDetails.c_str());
@@ -312,7 +326,7 @@ bool HistoryDialog::DoRender()
 					//Nickname box
 					ImGui::TableSetColumnIndex(2);
 					if(ImGui::InputText("###nick", &m.m_name))
-						m_parent.GetSession().OnMarkerChanged();
+						m_parent.GetSession().OnMarkerChanged(point->m_time);
 
 					ImGui::PopID();
 				}
@@ -321,7 +335,7 @@ bool HistoryDialog::DoRender()
 				if(deletingMarker)
 				{
 					markers.erase(markers.begin() + markerToDelete);
-					m_parent.GetSession().OnMarkerChanged();
+					m_parent.GetSession().OnMarkerChanged(point->m_time);
 				}
 
 				ImGui::TreePop();
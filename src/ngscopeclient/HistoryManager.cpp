@@ -35,14 +35,316 @@
 #include "ngscopeclient.h"
 #include "HistoryManager.h"
 #include "Session.h"
+#include "WaveformLoadJob.h"
+#include "../../scopehal/DensityFunctionWaveform.h"
+
+#include <filesystem>
+
+#ifdef _WIN32
+#include <process.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
 
 using namespace std;
 
+/**
+	@brief Calls a function on each sample buffer of a waveform
+
+	@return False if we don't know the buffer layout of this waveform type
+ */
+template<class T>
+static bool ForEachSampleBuffer(WaveformBase* wfm, T func)
+{
+	auto uacap = dynamic_cast<UniformAnalogWaveform*>(wfm);
+	if(uacap)
+	{
+		func(uacap->m_samples);
+		return true;
+	}
+
+	auto udcap = dynamic_cast<UniformDigitalWaveform*>(wfm);
+	if(udcap)
+	{
+		func(udcap->m_samples);
+		return true;
+	}
+
+	auto sacap = dynamic_cast<SparseAnalogWaveform*>(wfm);
+	if(sacap)
+	{
+		func(sacap->m_offsets);
+		func(sacap->m_durations);
+		func(sacap->m_samples);
+		return true;
+	}
+
+	auto sdcap = dynamic_cast<SparseDigitalWaveform*>(wfm);
+	if(sdcap)
+	{
+		func(sdcap->m_offsets);
+		func(sdcap->m_durations);
+		func(sdcap->m_samples);
+		return true;
+	}
+
+	return false;
+}
+
+/**
+	@brief Gets the size of the sample data in a waveform, in bytes
+ */
+static size_t GetWaveformSize(WaveformBase* wfm)
+{
+	if(!wfm)
+		return 0;
+
+	size_t bytes = 0;
+	bool known = ForEachSampleBuffer(wfm, [&](auto& buf)
+		{ bytes += buf.size() * sizeof(buf[0]); });
+
+	//Don't know what's inside it, assume it's about the size of an analog waveform
+	if(!known)
+		bytes += wfm->size() * sizeof(float);
+	return bytes;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// FilterOutputCache
+
+FilterOutputCache::FilterOutputCache(HistoryManager& mgr, uint64_t generation)
+	: m_mgr(mgr)
+	, m_generation(generation)
+{
+	lock_guard<recursive_mutex> lock(m_mgr.m_filterCacheMutex);
+	m_mgr.m_filterCaches.emplace(this);
+}
+
+FilterOutputCache::~FilterOutputCache()
+{
+	lock_guard<recursive_mutex> lock(m_mgr.m_filterCacheMutex);
+	clear();
+	m_mgr.m_filterCaches.erase(this);
+}
+
+/**
+	@brief Checks if a filter's output can be cached at all
+
+	Only filters whose output is a pure function of their current inputs are eligible.
+ */
+bool FilterOutputCache::IsCacheable(Filter* f)
+{
+	//Persisted waveforms are already snapshots of something that can't be regenerated
+	if(f->ShouldPersistWaveform())
+		return false;
+
+	//Protocol decoders keep their packets in the filter rather than the waveform, so always have to re-run
+	if(dynamic_cast<PacketDecoder*>(f) != nullptr)
+		return false;
+
+	//Analysis and measurement filters frequently accumulate results (eye patterns, trends, statistics, etc) across
+	//acquisitions, and export / generation / memory filters aren't a function of their inputs at all
+	switch(f->GetCategory())
+	{
+		case Filter::CAT_BUS:
+		case Filter::CAT_CLOCK:
+		case Filter::CAT_MATH:
+		case Filter::CAT_OPTICAL:
+		case Filter::CAT_POWER:
+		case Filter::CAT_RF:
+		case Filter::CAT_SERIAL:
+			break;
+
+		default:
+			return false;
+	}
+
+	//Density plots are integrated in place across acquisitions, so handing the buffer to the cache would lose data
+	for(size_t i=0; i<f->GetStreamCount(); i++)
+	{
+		if(dynamic_cast<DensityFunctionWaveform*>(f->GetData(i)) != nullptr)
+			return false;
+	}
+
+	return true;
+}
+
+/**
+	@brief Saves the current output of a filter, replacing anything previously cached for it
+ */
+void FilterOutputCache::Update(Filter* f)
+{
+	lock_guard<recursive_mutex> lock(m_mgr.m_filterCacheMutex);
+
+	for(size_t i=0; i<f->GetStreamCount(); i++)
+	{
+		StreamDescriptor stream(f, i);
+		auto data = stream.GetData();
+
+		//Already have this exact waveform? Nothing to do
+		auto it = m_outputs.find(stream);
+		if( (it != m_outputs.end()) && (it->second == data) )
+			continue;
+
+		//Discard the stale output
+		if(it != m_outputs.end())
+		{
+			ReleaseEntry(it->first, it->second);
+			m_outputs.erase(it);
+		}
+
+		//Don't save null data, or anything that some other cache already owns
+		if( (data == nullptr) || m_mgr.IsCachedFilterOutput(stream, data) )
+			continue;
+
+		f->AddRef();
+		m_mgr.m_filterCacheRefs[f] ++;
+		m_outputs[stream] = data;
+	}
+}
+
+/**
+	@brief Discards all cached outputs of a single filter
+ */
+void FilterOutputCache::RemoveFilter(Filter* f)
+{
+	lock_guard<recursive_mutex> lock(m_mgr.m_filterCacheMutex);
+
+	for(auto it = m_outputs.begin(); it != m_outputs.end(); )
+	{
+		if(it->first.m_channel == f)
+		{
+			ReleaseEntry(it->first, it->second);
+			it = m_outputs.erase(it);
+		}
+		else
+			it++;
+	}
+}
+
+/**
+	@brief Discards all cached outputs
+ */
+void FilterOutputCache::clear()
+{
+	lock_guard<recursive_mutex> lock(m_mgr.m_filterCacheMutex);
+
+	for(auto it : m_outputs)
+		ReleaseEntry(it.first, it.second);
+	m_outputs.clear();
+}
+
+/**
+	@brief Frees a cached waveform (unless its filter is still using it) and drops our reference to the filter
+ */
+void FilterOutputCache::ReleaseEntry(StreamDescriptor stream, WaveformBase* wfm)
+{
+	if(stream.GetData() != wfm)
+		delete wfm;
+
+	auto f = dynamic_cast<Filter*>(stream.m_channel);
+	auto it = m_mgr.m_filterCacheRefs.find(f);
+	if(it != m_mgr.m_filterCacheRefs.end())
+	{
+		it->second --;
+		if(it->second == 0)
+			m_mgr.m_filterCacheRefs.erase(it);
+	}
+
+	//Must be last, since this may free the filter
+	f->Release();
+}
+
+/**
+	@brief Discards the cache contents if they were captured before the last call to
+	HistoryManager::InvalidateFilterCaches()
+ */
+void FilterOutputCache::Revalidate(uint64_t generation)
+{
+	lock_guard<recursive_mutex> lock(m_mgr.m_filterCacheMutex);
+
+	if(generation == m_generation)
+		return;
+
+	clear();
+	m_generation = generation;
+}
+
+/**
+	@brief Attaches all cached waveforms to their filters
+
+	Must be called with the waveform data mutex held.
+
+	@param restoredFilters	Filters whose outputs were restored are added to this set
+ */
+void FilterOutputCache::Restore(set<FlowGraphNode*>& restoredFilters)
+{
+	lock_guard<recursive_mutex> lock(m_mgr.m_filterCacheMutex);
+
+	for(auto it : m_outputs)
+	{
+		auto stream = it.first;
+		auto current = stream.GetData();
+		if(current != it.second)
+		{
+			//If the filter's current output belongs to another cache, give it back to that cache.
+			//Otherwise it's not needed any more and SetData() will free it.
+			if(m_mgr.IsCachedFilterOutput(stream, current))
+				stream.m_channel->Detach(stream.m_stream);
+			stream.m_channel->SetData(it.second, stream.m_stream);
+		}
+
+		restoredFilters.emplace(stream.m_channel);
+	}
+}
+
+/**
+	@brief Takes back ownership of any cached waveforms attached to the specified nodes
+ */
+void FilterOutputCache::Detach(const set<FlowGraphNode*>& nodes)
+{
+	for(auto it : m_outputs)
+	{
+		auto stream = it.first;
+		if( (nodes.find(stream.m_channel) != nodes.end()) && (stream.GetData() == it.second) )
+			stream.m_channel->Detach(stream.m_stream);
+	}
+}
+
+/**
+	@brief Checks if a specific waveform is cached for a stream
+ */
+bool FilterOutputCache::Contains(StreamDescriptor stream, WaveformBase* wfm)
+{
+	auto it = m_outputs.find(stream);
+	if(it == m_outputs.end())
+		return false;
+	return it->second == wfm;
+}
+
+/**
+	@brief Gets the total size of the sample data in all cached waveforms, in bytes
+ */
+size_t FilterOutputCache::GetSizeBytes()
+{
+	lock_guard<recursive_mutex> lock(m_mgr.m_filterCacheMutex);
+
+	size_t bytes = 0;
+	for(auto it : m_outputs)
+		bytes += GetWaveformSize(it.second);
+	return bytes;
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 // HistoryPoint
 
 HistoryPoint::HistoryPoint()
-	: m_time(0, 0)
+	: m_tier(TIER_GPU)
+	, m_sizeBytes(0)
+	, m_spillPending(false)
+	, m_time(0, 0)
 	, m_pinned(false)
 	, m_nickname("")
 {
@@ -58,11 +360,13 @@ HistoryPoint::~HistoryPoint()
 		{
 			auto wfm = jt.second;
 
+			//Waveforms which were demoted out of GPU memory have the wrong memory types to be reused by the scope
+			if(m_tier != TIER_GPU)
+				delete wfm;
+
 			//Add known waveform types to pool for reuse
 			//Delete anything else
-			//TODO: this assumes the waveforms are currently configured for GPU-local or mirrored memory.
-			//This will have to change when we start paging old waveforms out to disk.
-			if(dynamic_cast<UniformAnalogWaveform*>(wfm) != nullptr)
+			else if(dynamic_cast<UniformAnalogWaveform*>(wfm) != nullptr)
 				scope->AddWaveformToAnalogPool(wfm);
 			else if(dynamic_cast<SparseDigitalWaveform*>(wfm) != nullptr)
 				scope->AddWaveformToDigitalPool(wfm);
@@ -70,6 +374,40 @@ HistoryPoint::~HistoryPoint()
 				delete wfm;
 		}
 	}
+
+	if(!m_spillPath.empty())
+	{
+		error_code ec;
+		filesystem::remove(m_spillPath, ec);
+	}
+}
+
+/**
+	@brief Calculates the total size of the sample data in this point
+ */
+size_t HistoryPoint::CalculateSize()
+{
+	size_t bytes = 0;
+	for(auto& it : m_history)
+	{
+		for(auto& jt : it.second)
+			bytes += GetWaveformSize(jt.second);
+	}
+	return bytes;
+}
+
+/**
+	@brief Gets the size of this point as counted against the history budgets
+
+	This is the sample data (m_sizeBytes) plus any cached filter outputs, which live in memory alongside it until the
+	point is spilled or unloaded. Cached outputs change as filters re-run, so are measured fresh every time.
+ */
+size_t HistoryPoint::GetBudgetedSize()
+{
+	size_t bytes = m_sizeBytes;
+	if(m_filterCache)
+		bytes += m_filterCache->GetSizeBytes();
+	return bytes;
 }
 
 /**
@@ -104,6 +442,13 @@ void HistoryPoint::LoadHistoryToSession(Session& session)
 	//We don't want to keep capturing if we're trying to look at a historical waveform. That would be a bit silly.
 	session.StopTrigger();
 
+	//Bring the data back from wherever it was demoted to
+	auto& mgr = session.GetHistory();
+	{
+		lock_guard<shared_mutex> lock(session.GetWaveformDataMutex());
+		mgr.MakeResident(this);
+	}
+
 	//Go over each scope in the session and load the relevant history
 	//We do this rather than just looping over the scopes in the history so that we can handle missing data.
 	auto scopes = session.GetScopes();
@@ -149,6 +494,15 @@ void HistoryPoint::LoadHistoryToSession(Session& session)
 			}
 		}
 	}
+
+	//Swap in whatever filter outputs we saved the last time this point was processed
+	if(!m_filterCache)
+		m_filterCache = mgr.CreateFilterCache();
+	session.LoadFilterCache(m_filterCache);
+
+	//Now that we're using GPU memory again, other points may have to move out of the way
+	lock_guard<shared_mutex> lock(session.GetWaveformDataMutex());
+	mgr.EnforceBudgets();
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -157,16 +511,52 @@ void HistoryPoint::LoadHistoryToSession(Session& session)
 HistoryManager::HistoryManager(Session& session)
 	: m_maxDepth(10)
 	, m_session(session)
+	, m_nextSpillFile(0)
+	, m_tierLocks(0)
+	, m_finishedSpills(0)
+	, m_activeSpill(nullptr)
+	, m_spillTerminating(false)
+	, m_filterCacheGeneration(0)
 {
 }
 
 HistoryManager::~HistoryManager()
 {
+	FlushSpills();
+	if(m_spillThread)
+	{
+		{
+			lock_guard<mutex> lock(m_spillMutex);
+			m_spillTerminating = true;
+		}
+		m_spillCondition.notify_all();
+		m_spillThread->join();
+	}
+
+	//Filter caches unregister themselves from us, so make sure they go first
+	m_history.clear();
+
+	if(!m_spillDirectory.empty())
+	{
+		error_code ec;
+		filesystem::remove_all(m_spillDirectory, ec);
+	}
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 // History processing
 
+/**
+	@brief Deletes all history
+
+	Anything still being spilled to disk is abandoned first, so no point outlives the call.
+ */
+void HistoryManager::clear()
+{
+	FlushSpills();
+	m_history.clear();
+}
+
 /**
 	@brief Returns true if we have no historical waveform data whatsoever (markers are allowed)
  */
@@ -212,6 +602,38 @@ void HistoryManager::LoadEmptyHistoryToSession(Session& session)
 			}
 		}
 	}
+
+	session.LoadFilterCache(nullptr);
+}
+
+/**
+	@brief Captures the waveforms currently attached to each channel of a set of scopes
+
+	The returned pointers are not owned by the snapshot. They remain owned by the channels until detached, at which
+	point ownership passes to whoever is holding the snapshot (normally the history).
+
+	@param scopes		The instruments to capture
+ */
+map<shared_ptr<Oscilloscope>, WaveformHistory> HistoryManager::SnapshotWaveforms(
+	const vector<shared_ptr<Oscilloscope>>& scopes)
+{
+	map<shared_ptr<Oscilloscope>, WaveformHistory> data;
+	for(auto scope : scopes)
+	{
+		WaveformHistory hist;
+
+		for(size_t i=0; i<scope->GetChannelCount(); i++)
+		{
+			auto chan = scope->GetOscilloscopeChannel(i);
+			if(!chan)
+				continue;
+			for(size_t j=0; j<chan->GetStreamCount(); j++)
+				hist[StreamDescriptor(chan, j)] = chan->GetData(j);
+		}
+
+		data[scope] = hist;
+	}
+	return data;
 }
 
 /**
@@ -229,30 +651,50 @@ void HistoryManager::AddHistory(
 	bool pin,
 	string nick,
 	TimePoint refTimeIfNoWaveforms)
+{
+	AddHistory(SnapshotWaveforms(scopes), deleteOld, pin, nick, refTimeIfNoWaveforms);
+}
+
+/**
+	@brief Adds previously captured waveform data to the history
+
+	This is used by the waveform processing pipeline, since by the time the GUI thread gets around to committing an
+	acquisition to history the scope channels may already be holding the next one.
+
+	@param data			Waveforms to add, indexed by instrument
+	@param deleteOld	True to delete old data that rolled off the end of the history buffer
+						Set false when loading waveforms from a session
+	@param pin			True to pin into history
+	@param nick			Nickname
+
+	@return The new history point, or null if we already had one for this timestamp
+ */
+shared_ptr<HistoryPoint> HistoryManager::AddHistory(
+	const map<shared_ptr<Oscilloscope>, WaveformHistory>& data,
+	bool deleteOld,
+	bool pin,
+	string nick,
+	TimePoint refTimeIfNoWaveforms)
 {
 	bool foundTimestamp = false;
 	TimePoint tp(0,0);
 
 	//First pass: find first waveform with a timestamp
-	for(auto scope : scopes)
+	for(auto& it : data)
 	{
-		for(size_t i=0; i<scope->GetChannelCount(); i++)
+		for(auto& jt : it.second)
 		{
-			auto chan = scope->GetOscilloscopeChannel(i);
-			if(!chan)
-				continue;
-			for(size_t j=0; j<chan->GetStreamCount(); j++)
+			auto wfm = jt.second;
+			if(wfm)
 			{
-				auto wfm = chan->GetData(j);
-				if(wfm)
-				{
-					tp.SetSec(wfm->m_startTimestamp);
-					tp.SetFs(wfm->m_startFemtoseconds);
-					foundTimestamp = true;
-					break;
-				}
+				tp.SetSec(wfm->m_startTimestamp);
+				tp.SetFs(wfm->m_startFemtoseconds);
+				foundTimestamp = true;
+				break;
 			}
 		}
+		if(foundTimestamp)
+			break;
 	}
 
 	//If we get here, there were no waveforms anywhere!
@@ -263,7 +705,7 @@ void HistoryManager::AddHistory(
 	//If we already have a history point for the same exact timestamp, do nothing
 	//Either a bug or we're in append mode
 	if(HasHistory(tp))
-		return;
+		return nullptr;
 
 	LogTrace("Adding history for %s\n", tp.PrettyPrint().c_str());
 
@@ -273,63 +715,785 @@ void HistoryManager::AddHistory(
 	pt->m_time = tp;
 	pt->m_pinned = pin;
 	pt->m_nickname = nick;
+	pt->m_history = data;
+	pt->m_sizeBytes = pt->CalculateSize();
 
-	//Add waveforms
-	for(auto scope : scopes)
+	//Delete old waveforms if needed.
+	//Memory budgets are enforced separately by EnforceBudgets(), since that needs the waveform data mutex held
+	//exclusively and we're normally called with it only held shared.
+	if(deleteOld)
 	{
-		WaveformHistory hist;
-
-		for(size_t i=0; i<scope->GetChannelCount(); i++)
+		while(m_history.size() > (size_t) m_maxDepth)
 		{
-			auto chan = scope->GetOscilloscopeChannel(i);
-			if(!chan)
-				continue;
-			for(size_t j=0; j<chan->GetStreamCount(); j++)
-				hist[StreamDescriptor(chan, j)] = chan->GetData(j);
+			//If nothing deleted, all remaining items are pinned. Stop.
+			if(!DeleteOldestPoint())
+				break;
 		}
-
-		pt->m_history[scope] = hist;
 	}
 
-	//TODO: check history size in MB/GB etc
-	//TODO: convert older stuff to disk, free GPU memory, etc?
-	if(deleteOld)
-	{
-		while(m_history.size() > (size_t) m_maxDepth)
-		{
-			bool deletedSomething = false;
+	return pt;
+}
 
-			//Delete first un-pinned entry
-			for(auto it = m_history.begin(); it != m_history.end(); it++)
-			{
-				auto& point = (*it);
-				if(point->m_pinned)
-					continue;
-				if(!m_session.GetMarkers(point->m_time).empty())
-					continue;
+/**
+	@brief Deletes the oldest point in history which isn't pinned, marked, or in use
 
-				//With multiple trigger groups at different rates, we might have the most recent trigger for a scope
-				//roll to the start of the history queue. Don't delete that!!
-				if(point->IsInUse())
-				{
-					LogTrace("Not removing %s because it's in use\n", point->m_time.PrettyPrint().c_str());
-					continue;
-				}
+	@return True if a point was deleted
+ */
+bool HistoryManager::DeleteOldestPoint()
+{
+	for(auto it = m_history.begin(); it != m_history.end(); it++)
+	{
+		auto& point = (*it);
+		if(point->m_pinned)
+			continue;
+		if(!m_session.GetMarkers(point->m_time).empty())
+			continue;
 
-				LogTrace("Removing un-pinned waveform at t=%s (now have %zu points of %d allowed)\n",
-					point->m_time.PrettyPrint().c_str(), m_history.size(), m_maxDepth);
-				m_session.RemoveMarkers(point->m_time);
-				m_session.RemovePackets(point->m_time);
-				m_history.erase(it);
-				deletedSomething = true;
-				break;
+		//With multiple trigger groups at different rates, we might have the most recent trigger for a scope
+		//roll to the start of the history queue. Don't delete that!!
+		if(point->IsInUse())
+		{
+			LogTrace("Not removing %s because it's in use\n", point->m_time.PrettyPrint().c_str());
+			continue;
+		}
+
+		LogTrace("Removing un-pinned waveform at t=%s (now have %zu points of %d allowed)\n",
+			point->m_time.PrettyPrint().c_str(), m_history.size(), m_maxDepth);
+		m_session.RemoveMarkers(point->m_time);
+		m_session.RemovePackets(point->m_time);
+		m_history.erase(it);
+		return true;
+	}
+
+	return false;
+}
+
+/**
+	@brief Moves history between storage tiers (and optionally deletes old history) to stay within our limits
+
+	Walking from newest to oldest, each point goes in the fastest tier which still has room for it. Points are only
+	ever demoted here; they get promoted again when loaded (see MakeResident()).
+
+	Budgets come from the Performance.History preferences. A disk budget of zero disables spilling, leaving anything
+	that doesn't fit in pageable memory there. Points loaded from a session file are dropped back to it rather than
+	being spilled, and don't count against any budget while dropped. Cached filter outputs count against the budget
+	of the point they belong to (see HistoryPoint::GetBudgetedSize()).
+
+	Points demoted to disk are written by a background thread, and stay in memory (but count against the disk budget)
+	until CommitSpills() frees them.
+
+	Must be called from the GUI thread with the waveform data mutex held exclusively, since demoting a point frees or
+	reallocates its sample buffers.
+
+	@param deleteOld	True to delete the oldest points if we're over the depth limit or the total of all budgets
+ */
+void HistoryManager::EnforceBudgets(bool deleteOld)
+{
+	CommitSpills();
+
+	auto& prefs = m_session.GetPreferences();
+	int64_t budgets[HistoryPoint::TIER_COUNT] =
+	{
+		prefs.GetInt("Performance.History.gpu_budget"),
+		prefs.GetInt("Performance.History.pinned_budget"),
+		prefs.GetInt("Performance.History.pageable_budget"),
+		prefs.GetInt("Performance.History.disk_budget")
+	};
+
+	if(deleteOld)
+	{
+		int64_t totalBudget = 0;
+		for(auto b : budgets)
+			totalBudget += b;
+
+		while(true)
+		{
+			int64_t total = 0;
+			for(auto& pt : m_history)
+			{
+				if(pt->m_tier != HistoryPoint::TIER_SESSION)
+					total += pt->GetBudgetedSize();
 			}
 
+			if( (m_history.size() <= (size_t) m_maxDepth) && (total <= totalBudget) )
+				break;
+
 			//If nothing deleted, all remaining items are pinned. Stop.
-			if(!deletedSomething)
+			if(!DeleteOldestPoint())
 				break;
 		}
 	}
+
+	int64_t used[HistoryPoint::TIER_COUNT] = {0};
+	for(auto it = m_history.rbegin(); it != m_history.rend(); it++)
+	{
+		auto pt = it->get();
+		int64_t size = pt->GetBudgetedSize();
+
+		//Already dropped back to the session file, takes up no space
+		if(pt->m_tier == HistoryPoint::TIER_SESSION)
+			continue;
+
+		//On its way to disk
+		if(pt->m_spillPending)
+		{
+			used[HistoryPoint::TIER_DISK] += size;
+			continue;
+		}
+
+		//Anything currently being displayed stays where it is
+		if(pt->IsInUse() || (size == 0) )
+		{
+			used[pt->m_tier] += size;
+			continue;
+		}
+
+		int tier = pt->m_tier;
+		while( (tier < HistoryPoint::TIER_DISK) && (used[tier] + size > budgets[tier]) )
+			tier ++;
+		if( (tier == HistoryPoint::TIER_DISK) && !pt->m_sessionRecords.empty() )
+			tier = HistoryPoint::TIER_SESSION;
+		else if( (tier == HistoryPoint::TIER_DISK) && (used[tier] + size > budgets[tier]) )
+			tier = max(static_cast<int>(HistoryPoint::TIER_PAGEABLE), static_cast<int>(pt->m_tier));
+
+		used[tier] += size;
+		SetTier(pt, static_cast<HistoryPoint::Tier>(tier));
+	}
+}
+
+/**
+	@brief Moves a point in history to a different storage tier
+
+	Moving a point to TIER_DISK only queues it for the spill thread; it stays in its current tier until the spill
+	is committed.
+
+	Must be called from the GUI thread with the waveform data mutex held exclusively.
+ */
+void HistoryManager::SetTier(HistoryPoint* pt, HistoryPoint::Tier tier)
+{
+	//Changing the memory type of the buffers would pull them out from under the spill thread.
+	//Wait for it to finish with this point (the result will be discarded, since we want it somewhere else now).
+	if(pt->m_spillPending)
+		WaitForSpill(pt);
+
+	if(pt->m_tier == tier)
+		return;
+
+	//If someone is reading the sample data, only promotion to GPU memory (which just changes hints) is safe
+	if( (m_tierLocks > 0) && ( (tier != HistoryPoint::TIER_GPU) || (pt->m_tier >= HistoryPoint::TIER_DISK) ) )
+		return;
+
+	LogTrace("Moving history at %s from tier %d to %d\n", pt->m_time.PrettyPrint().c_str(), pt->m_tier, tier);
+
+	//Reload from disk first if needed (this leaves it in pageable memory)
+	if(pt->m_tier == HistoryPoint::TIER_DISK)
+	{
+		if(!LoadFromDisk(pt))
+			return;
+		if(tier == HistoryPoint::TIER_PAGEABLE)
+			return;
+	}
+	else if(pt->m_tier == HistoryPoint::TIER_SESSION)
+	{
+		if(!LoadFromSession(pt))
+			return;
+		if(tier == HistoryPoint::TIER_PAGEABLE)
+			return;
+	}
+
+	if(tier == HistoryPoint::TIER_DISK)
+	{
+		QueueSpill(pt);
+		return;
+	}
+	if(tier == HistoryPoint::TIER_SESSION)
+	{
+		UnloadToSession(pt);
+		return;
+	}
+
+	//Change the memory types of the sample buffers
+	for(auto& it : pt->m_history)
+	{
+		for(auto& jt : it.second)
+		{
+			auto wfm = jt.second;
+			if(!wfm)
+				continue;
+
+			if(tier != HistoryPoint::TIER_GPU)
+				wfm->PrepareForCpuAccess();
+
+			ForEachSampleBuffer(wfm, [&](auto& buf)
+			{
+				using Buffer = remove_reference_t<decltype(buf)>;
+				switch(tier)
+				{
+					case HistoryPoint::TIER_GPU:
+						buf.SetGpuAccessHint(Buffer::HINT_LIKELY);
+						break;
+
+					//Still might go back to the GPU, so keep it pinned
+					case HistoryPoint::TIER_PINNED:
+						buf.SetGpuAccessHint(Buffer::HINT_UNLIKELY, true);
+						break;
+
+					default:
+						buf.SetGpuAccessHint(Buffer::HINT_NEVER, true);
+						break;
+				}
+			});
+
+			if(tier != HistoryPoint::TIER_GPU)
+				wfm->FreeGpuMemory();
+		}
+	}
+
+	pt->m_tier = tier;
+}
+
+/**
+	@brief Moves a point in history back into GPU memory, in preparation for displaying it
+ */
+void HistoryManager::MakeResident(HistoryPoint* pt)
+{
+	SetTier(pt, HistoryPoint::TIER_GPU);
+}
+
+/**
+	@brief Gets the number of points, and total bytes, in each storage tier
+
+	@param points	Array of HistoryPoint::TIER_COUNT point counts
+	@param bytes	Array of HistoryPoint::TIER_COUNT sizes
+ */
+void HistoryManager::GetTierUsage(size_t* points, size_t* bytes)
+{
+	for(int i=0; i<HistoryPoint::TIER_COUNT; i++)
+	{
+		points[i] = 0;
+		bytes[i] = 0;
+	}
+
+	for(auto& pt : m_history)
+	{
+		points[pt->m_tier] ++;
+		if(pt->m_tier == HistoryPoint::TIER_SESSION)
+			bytes[pt->m_tier] += pt->m_sizeBytes;
+		else
+			bytes[pt->m_tier] += pt->GetBudgetedSize();
+	}
+}
+
+/**
+	@brief Gets the directory to spill history to, creating it if needed
+
+	@return The directory, or an empty string if it couldn't be created
+ */
+string HistoryManager::GetSpillDirectory()
+{
+	if(!m_spillDirectory.empty())
+		return m_spillDirectory;
+
+	#ifdef _WIN32
+		auto pid = _getpid();
+	#else
+		auto pid = getpid();
+	#endif
+
+	error_code ec;
+	auto dir = filesystem::temp_directory_path(ec) / ("ngscopeclient-history-" + to_string(pid));
+	if(!ec)
+		filesystem::create_directories(dir, ec);
+	if(ec)
+	{
+		LogError("Couldn't create history spill directory: %s\n", ec.message().c_str());
+		return "";
+	}
+
+	m_spillDirectory = dir.string();
+	return m_spillDirectory;
+}
+
+/**
+	@brief Gets a path for a new spill file
+
+	@return The path, or an empty string if the spill directory couldn't be created
+ */
+string HistoryManager::GetNextSpillPath()
+{
+	auto dir = GetSpillDirectory();
+	if(dir.empty())
+		return "";
+	return dir + "/point_" + to_string(m_nextSpillFile++) + ".bin";
+}
+
+/**
+	@brief Makes sure the CPU side copy of every waveform in a point is current, so it can be written out
+ */
+void HistoryManager::PrepareForSpill(HistoryPoint* pt)
+{
+	for(auto& it : pt->m_history)
+	{
+		for(auto& jt : it.second)
+		{
+			if(jt.second)
+				jt.second->PrepareForCpuAccess();
+		}
+	}
+}
+
+/**
+	@brief Writes all of the sample data in a point to disk, then frees it from memory
+
+	This blocks until the data is written, so is only used when we're out of memory and can't wait for the spill
+	thread. Everything else goes through QueueSpill().
+
+	Waveform types whose layout we don't know are left in memory.
+
+	@return True on success
+ */
+bool HistoryManager::SpillToDisk(HistoryPoint* pt)
+{
+	auto path = GetNextSpillPath();
+	if(path.empty())
+		return false;
+
+	PrepareForSpill(pt);
+	vector<HistoryPoint::SpillRecord> records;
+	if(!WriteSpillFile(pt, path, records))
+		return false;
+
+	CommitSpill(pt, path, records);
+	return true;
+}
+
+/**
+	@brief Hands a point to the spill thread to be written to disk
+
+	The point stays in memory, and must not have its buffers changed, until CommitSpills() picks up the result.
+	SetTier() takes care of this by calling WaitForSpill() first.
+ */
+void HistoryManager::QueueSpill(HistoryPoint* pt)
+{
+	auto path = GetNextSpillPath();
+	if(path.empty())
+		return;
+
+	//The spill thread only reads CPU side buffers, so any copying back from the GPU has to happen now
+	PrepareForSpill(pt);
+	pt->m_spillPending = true;
+
+	{
+		lock_guard<mutex> lock(m_spillMutex);
+		m_spillQueue.push_back(SpillRequest(pt->shared_from_this(), path));
+	}
+	if(!m_spillThread)
+		m_spillThread = make_unique<thread>(SpillThread, this);
+	m_spillCondition.notify_all();
+}
+
+/**
+	@brief Writes queued points to disk
+ */
+void HistoryManager::SpillThread(HistoryManager* mgr)
+{
+	pthread_setname_np_compat("HistorySpill");
+
+	unique_lock<mutex> lock(mgr->m_spillMutex);
+	while(true)
+	{
+		mgr->m_spillCondition.wait(lock, [&]{ return mgr->m_spillTerminating || !mgr->m_spillQueue.empty(); });
+		if(mgr->m_spillTerminating)
+			break;
+
+		auto req = std::move(mgr->m_spillQueue.front());
+		mgr->m_spillQueue.pop_front();
+		mgr->m_activeSpill = req.m_point.get();
+		lock.unlock();
+
+		req.m_ok = WriteSpillFile(req.m_point.get(), req.m_path, req.m_records);
+
+		lock.lock();
+		mgr->m_activeSpill = nullptr;
+		mgr->m_spillDone.push_back(std::move(req));
+		mgr->m_finishedSpills = mgr->m_spillDone.size();
+		mgr->m_spillCondition.notify_all();
+	}
+}
+
+/**
+	@brief Stops any spill of a point which is in progress
+
+	If the spill thread hasn't started on the point yet, it's just removed from the queue. Otherwise, we block until
+	the file has been written and then discard it.
+ */
+void HistoryManager::WaitForSpill(HistoryPoint* pt)
+{
+	{
+		unique_lock<mutex> lock(m_spillMutex);
+		for(auto it = m_spillQueue.begin(); it != m_spillQueue.end(); it++)
+		{
+			if(it->m_point.get() == pt)
+			{
+				m_spillQueue.erase(it);
+				pt->m_spillPending = false;
+				return;
+			}
+		}
+
+		m_spillCondition.wait(lock, [&]{ return m_activeSpill != pt; });
+	}
+
+	//Now in m_spillDone, make sure it's thrown away rather than committed
+	pt->m_spillPending = false;
+	CommitSpills();
+}
+
+/**
+	@brief Abandons all queued spills and waits for the one in progress (if any) to finish
+ */
+void HistoryManager::FlushSpills()
+{
+	{
+		unique_lock<mutex> lock(m_spillMutex);
+		for(auto& req : m_spillQueue)
+			req.m_point->m_spillPending = false;
+		m_spillQueue.clear();
+
+		m_spillCondition.wait(lock, [&]{ return m_activeSpill == nullptr; });
+	}
+
+	CommitSpills();
+}
+
+/**
+	@brief Frees the memory of all points which the spill thread has finished writing
+
+	Spills are discarded instead if they failed, or the point has since been deleted, loaded, or locked by a save.
+
+	Must be called from the GUI thread with the waveform data mutex held exclusively.
+ */
+void HistoryManager::CommitSpills()
+{
+	deque<SpillRequest> done;
+	{
+		lock_guard<mutex> lock(m_spillMutex);
+		done.swap(m_spillDone);
+		m_finishedSpills = 0;
+	}
+
+	for(auto& req : done)
+	{
+		auto pt = req.m_point.get();
+
+		//If we're holding the only reference, the point was deleted while we were writing it
+		bool wanted = pt->m_spillPending && (req.m_point.use_count() > 1) && !pt->IsInUse() && (m_tierLocks == 0);
+		pt->m_spillPending = false;
+
+		if(req.m_ok && wanted)
+			CommitSpill(pt, req.m_path, req.m_records);
+		else
+		{
+			error_code ec;
+			filesystem::remove(req.m_path, ec);
+		}
+	}
+
+	//Any points we were keeping alive are freed here, on the GUI thread, as they would have been without us
+	done.clear();
+}
+
+/**
+	@brief Writes the raw sample buffers of a point back to back into a spill file
+
+	Only reads the CPU side buffers, so is safe to call from the spill thread. Call PrepareForSpill() first.
+
+	@param pt		The point to write
+	@param path		Path to the spill file
+	@param records	Waveforms written to the file, in order
+
+	@return True on success. The file is deleted on failure.
+ */
+bool HistoryManager::WriteSpillFile(HistoryPoint* pt, const string& path, vector<HistoryPoint::SpillRecord>& records)
+{
+	FILE* fp = fopen(path.c_str(), "wb");
+	if(!fp)
+	{
+		LogError("Couldn't create history spill file %s\n", path.c_str());
+		return false;
+	}
+
+	bool ok = true;
+	for(auto& it : pt->m_history)
+	{
+		for(auto& jt : it.second)
+		{
+			auto wfm = jt.second;
+			if(!wfm)
+				continue;
+
+			size_t len = wfm->size();
+			bool known = ForEachSampleBuffer(wfm, [&](auto& buf)
+			{
+				if(ok && (len != 0) && (fwrite(buf.GetCpuPointer(), sizeof(buf[0]), len, fp) != len) )
+					ok = false;
+			});
+			if(known)
+				records.push_back(HistoryPoint::SpillRecord(wfm, len));
+		}
+	}
+	if(fclose(fp) != 0)
+		ok = false;
+
+	if(!ok)
+	{
+		LogError("Failed to write history spill file %s\n", path.c_str());
+		error_code ec;
+		filesystem::remove(path, ec);
+		return false;
+	}
+	return true;
+}
+
+/**
+	@brief Frees the memory of a point whose sample data has been written to a spill file
+ */
+void HistoryManager::CommitSpill(
+	HistoryPoint* pt,
+	const string& path,
+	const vector<HistoryPoint::SpillRecord>& records)
+{
+	for(auto& r : records)
+	{
+		r.m_waveform->FreeGpuMemory();
+		ForEachSampleBuffer(r.m_waveform, [](auto& buf)
+		{
+			buf.clear();
+			buf.shrink_to_fit();
+		});
+	}
+
+	//Cached filter outputs would just be holding on to the memory we're trying to free
+	if(pt->m_filterCache)
+		pt->m_filterCache->clear();
+
+	pt->m_spillPath = path;
+	pt->m_spillRecords = records;
+	pt->m_tier = HistoryPoint::TIER_DISK;
+}
+
+/**
+	@brief Reads spilled sample data back into pageable memory, and deletes the spill file
+
+	If the file is shorter than expected, whatever waveforms it still holds in full are restored and the rest are left
+	empty. The point is still moved to pageable memory, since there's nothing more to read back.
+
+	@return True on success, false if the file couldn't be read or was truncated
+ */
+bool HistoryManager::LoadFromDisk(HistoryPoint* pt)
+{
+	LogTrace("Loading history at %s from %s\n", pt->m_time.PrettyPrint().c_str(), pt->m_spillPath.c_str());
+
+	//Windows: use generic file reads for now
+	#ifdef _WIN32
+		FILE* fp = fopen(pt->m_spillPath.c_str(), "rb");
+		if(!fp)
+		{
+			LogError("couldn't open %s\n", pt->m_spillPath.c_str());
+			return false;
+		}
+		fseek(fp, 0, SEEK_END);
+		size_t len = ftell(fp);
+		fseek(fp, 0, SEEK_SET);
+		vector<uint8_t> data(len);
+		if(len != fread(data.data(), 1, len, fp))
+		{
+			LogError("couldn't read %s\n", pt->m_spillPath.c_str());
+			fclose(fp);
+			return false;
+		}
+		fclose(fp);
+		const uint8_t* buf = data.data();
+
+	//On POSIX, just memory map the file
+	#else
+		int fd = open(pt->m_spillPath.c_str(), O_RDONLY);
+		if(fd < 0)
+		{
+			LogError("couldn't open %s\n", pt->m_spillPath.c_str());
+			return false;
+		}
+		size_t len = lseek(fd, 0, SEEK_END);
+		const uint8_t* buf = nullptr;
+		if(len)
+		{
+			auto map = mmap(nullptr, len, PROT_READ, MAP_PRIVATE, fd, 0);
+			if(map == MAP_FAILED)
+			{
+				LogError("couldn't map %s\n", pt->m_spillPath.c_str());
+				::close(fd);
+				return false;
+			}
+			buf = reinterpret_cast<const uint8_t*>(map);
+		}
+	#endif
+
+	size_t offset = 0;
+	size_t lost = 0;
+	for(auto& r : pt->m_spillRecords)
+	{
+		//Allocate straight into pageable memory, there's no point pinning it until we know where it's going
+		ForEachSampleBuffer(r.m_waveform, [](auto& b)
+		{
+			using Buffer = remove_reference_t<decltype(b)>;
+			b.SetGpuAccessHint(Buffer::HINT_NEVER);
+		});
+
+		//Make sure the whole waveform is there before touching it
+		size_t nbytes = 0;
+		ForEachSampleBuffer(r.m_waveform, [&](auto& b)
+			{ nbytes += r.m_length * sizeof(b[0]); });
+		if(offset + nbytes > len)
+		{
+			r.m_waveform->Resize(0);
+			offset += nbytes;
+			lost ++;
+			continue;
+		}
+
+		r.m_waveform->Resize(r.m_length);
+		ForEachSampleBuffer(r.m_waveform, [&](auto& b)
+		{
+			size_t n = r.m_length * sizeof(b[0]);
+			memcpy(b.GetCpuPointer(), buf + offset, n);
+			offset += n;
+		});
+		r.m_waveform->MarkModifiedFromCpu();
+	}
+
+	if(lost)
+	{
+		LogError("History spill file %s is truncated (%zu of %zu bytes), %zu of %zu waveforms at %s were lost\n",
+			pt->m_spillPath.c_str(),
+			len,
+			offset,
+			lost,
+			pt->m_spillRecords.size(),
+			pt->m_time.PrettyPrint().c_str());
+	}
+
+	#ifndef _WIN32
+		if(len)
+			munmap(const_cast<uint8_t*>(buf), len);
+		::close(fd);
+	#endif
+
+	error_code ec;
+	filesystem::remove(pt->m_spillPath, ec);
+	pt->m_spillPath = "";
+	pt->m_spillRecords.clear();
+	pt->m_tier = HistoryPoint::TIER_PAGEABLE;
+	if(lost)
+	{
+		pt->m_sizeBytes = pt->CalculateSize();
+		return false;
+	}
+	return true;
+}
+
+/**
+	@brief Frees the sample data of a point which was loaded from a session file
+
+	Waveform types whose layout we don't know are left in memory.
+ */
+void HistoryManager::UnloadToSession(HistoryPoint* pt)
+{
+	LogTrace("Unloading history at %s\n", pt->m_time.PrettyPrint().c_str());
+
+	for(auto& r : pt->m_sessionRecords)
+	{
+		auto& wfm = pt->m_history[r.m_scope][r.m_stream];
+		if(!wfm)
+			continue;
+		wfm->FreeGpuMemory();
+
+		//Sparse waveforms which turned out to be dense packed were converted to uniform when loaded.
+		//Put back an empty sparse waveform so the loader gets the type it expects next time.
+		auto target = WaveformCodec::MakeReloadTarget(wfm, r.m_dense);
+		if(target != wfm)
+		{
+			delete wfm;
+			wfm = target;
+			continue;
+		}
+
+		ForEachSampleBuffer(wfm, [](auto& buf)
+		{
+			buf.clear();
+			buf.shrink_to_fit();
+		});
+	}
+
+	//Cached filter outputs would just be holding on to the memory we're trying to free
+	if(pt->m_filterCache)
+		pt->m_filterCache->clear();
+
+	pt->m_tier = HistoryPoint::TIER_SESSION;
+}
+
+/**
+	@brief Reads the sample data for a point back from the session file it was loaded from, into pageable memory
+
+	All streams in the point are decoded in parallel. If any of them fail, the rest are still loaded (and the point
+	moved to pageable memory) with the failed streams left empty.
+
+	@return True on success, false if any stream failed to load
+ */
+bool HistoryManager::LoadFromSession(HistoryPoint* pt)
+{
+	LogTrace("Loading history at %s from session\n", pt->m_time.PrettyPrint().c_str());
+	LogIndenter li;
+
+	WaveformLoadJob job;
+	vector<size_t> requests;
+	for(auto& r : pt->m_sessionRecords)
+	{
+		auto wfm = pt->m_history[r.m_scope][r.m_stream];
+		if(!wfm)
+		{
+			requests.push_back(SIZE_MAX);
+			continue;
+		}
+
+		//Allocate straight into pageable memory, there's no point pinning it until we know where it's going
+		ForEachSampleBuffer(wfm, [](auto& b)
+		{
+			using Buffer = remove_reference_t<decltype(b)>;
+			b.SetGpuAccessHint(Buffer::HINT_NEVER);
+		});
+		requests.push_back(job.Add(wfm, r.m_format, r.m_path, r.m_fileSize));
+	}
+	job.Start(m_session.GetPreferences().GetInt("Performance.Loading.max_inflight_bytes"));
+	job.Wait();
+
+	//The loader may have swapped in a different waveform type
+	for(size_t i=0; i<requests.size(); i++)
+	{
+		if(requests[i] == SIZE_MAX)
+			continue;
+		auto& r = pt->m_sessionRecords[i];
+		pt->m_history[r.m_scope][r.m_stream] = job.GetWaveform(requests[i]);
+	}
+
+	pt->m_sizeBytes = pt->CalculateSize();
+	pt->m_tier = HistoryPoint::TIER_PAGEABLE;
+
+	if(job.HasFailed())
+	{
+		LogError("Some waveforms at %s could not be read back from the session\n", pt->m_time.PrettyPrint().c_str());
+		return false;
+	}
+	return true;
 }
 
 /**
@@ -382,10 +1546,6 @@ bool HistoryManager::OnMemoryPressure(
 	LogDebug("HistoryManager::OnMemoryPressure\n");
 	LogIndenter li;
 
-	//For now, only free GPU memory in case of pressure here
-	if(type != MemoryPressureType::Device)
-		return false;
-
 	//Try to lock the waveform data mutex for up to 250ms
 	auto& mutex = m_session.GetWaveformDataMutex();
 	double end = GetTime() + 0.25;
@@ -403,12 +1563,57 @@ bool HistoryManager::OnMemoryPressure(
 		LogDebug("Failed to lock waveform data mutex\n");
 		return false;
 	}
+	bool memFreed = false;
+
+	//Cached filter outputs can always be regenerated, so they're the first thing to go
+	{
+		lock_guard<recursive_mutex> lock(m_filterCacheMutex);
+		for(auto c : m_filterCaches)
+		{
+			if(!c->m_outputs.empty())
+			{
+				memFreed = true;
+				c->clear();
+			}
+		}
+	}
+	if(memFreed)
+		LogDebug("Freed cached filter outputs\n");
+
+	//Out of host memory? Push everything we can out to disk.
+	//We can't wait for the spill thread here, so anything it's already finished with is freed now and the rest is
+	//written synchronously.
+	if(type != MemoryPressureType::Device)
+	{
+		CommitSpills();
+		for(auto& pt : m_history)
+		{
+			if(m_tierLocks > 0)
+				break;
+			if( (pt->m_tier >= HistoryPoint::TIER_DISK) || (pt->m_sizeBytes == 0) || pt->IsInUse() )
+				continue;
+			if(pt->m_spillPending)
+				continue;
+
+			//If it came from a session file, we can just drop it and read it back later
+			if(!pt->m_sessionRecords.empty())
+			{
+				UnloadToSession(pt.get());
+				memFreed = true;
+			}
+			else if(SpillToDisk(pt.get()))
+				memFreed = true;
+		}
+
+		mutex.unlock();
+		return memFreed;
+	}
+
 	LogDebug("Got waveform data mutex, freeing GPU memory of all old points\n");
 
 	auto mostRecent = GetMostRecentPoint();
 
 	//Go through historical waveforms and free memory
-	bool memFreed = false;
 	for(auto& pt : m_history)
 	{
 		if(pt->m_time == mostRecent)
@@ -432,3 +1637,92 @@ bool HistoryManager::OnMemoryPressure(
 	mutex.unlock();
 	return memFreed;
 }
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Filter output caching
+
+/**
+	@brief Creates a new, empty, filter output cache
+ */
+shared_ptr<FilterOutputCache> HistoryManager::CreateFilterCache()
+{
+	return make_shared<FilterOutputCache>(*this, m_filterCacheGeneration);
+}
+
+/**
+	@brief Hands any cached waveforms currently attached to the specified nodes back to their caches
+
+	This must be called (with the waveform data mutex held) before re-running filters, to prevent them from
+	overwriting cached data in place.
+ */
+void HistoryManager::DetachCachedFilterOutputs(const set<FlowGraphNode*>& nodes)
+{
+	lock_guard<recursive_mutex> lock(m_filterCacheMutex);
+	for(auto c : m_filterCaches)
+		c->Detach(nodes);
+}
+
+/**
+	@brief Checks if a waveform belongs to any filter cache
+ */
+bool HistoryManager::IsCachedFilterOutput(StreamDescriptor stream, WaveformBase* wfm)
+{
+	if(wfm == nullptr)
+		return false;
+
+	lock_guard<recursive_mutex> lock(m_filterCacheMutex);
+	for(auto c : m_filterCaches)
+	{
+		if(c->Contains(stream, wfm))
+			return true;
+	}
+	return false;
+}
+
+/**
+	@brief Checks if any filter is being kept alive only by references from filter caches
+ */
+bool HistoryManager::HasOrphanedFilterCaches()
+{
+	lock_guard<recursive_mutex> lock(m_filterCacheMutex);
+	for(auto it : m_filterCacheRefs)
+	{
+		if(it.first->GetRefCount() <= it.second)
+			return true;
+	}
+	return false;
+}
+
+/**
+	@brief Removes cached outputs of filters which have been deleted by the user
+
+	Must be called with the waveform data mutex held, since this will free the filters.
+ */
+void HistoryManager::PurgeOrphanedFilterCaches()
+{
+	lock_guard<recursive_mutex> lock(m_filterCacheMutex);
+
+	set<Filter*> orphans;
+	for(auto it : m_filterCacheRefs)
+	{
+		if(it.first->GetRefCount() <= it.second)
+			orphans.emplace(it.first);
+	}
+
+	for(auto f : orphans)
+	{
+		LogTrace("Purging cached outputs of deleted filter %s\n", f->GetDisplayName().c_str());
+		for(auto c : m_filterCaches)
+			c->RemoveFilter(f);
+	}
+}
+
+/**
+	@brief Discards the contents of all filter caches
+ */
+void HistoryManager::ClearFilterCaches()
+{
+	lock_guard<recursive_mutex> lock(m_filterCacheMutex);
+	for(auto c : m_filterCaches)
+		c->clear();
+}
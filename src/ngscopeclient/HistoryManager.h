@@ -36,14 +36,73 @@
 #define HistoryManager_h
 
 #include "Marker.h"
+#include "WaveformCodec.h"
+#include <condition_variable>
+#include <deque>
+#include <thread>
 
 //Waveform history for a single instrument
 typedef std::map<StreamDescriptor, WaveformBase*> WaveformHistory;
 
+class HistoryManager;
+
+/**
+	@brief Saved outputs of expensive filters, computed from the data in a single point of history
+
+	Revisiting a point in history restores these outputs rather than re-running the filters that produced them.
+
+	A cached waveform is owned by the cache, except while it's attached to its filter (i.e. the filter is currently
+	displaying it) in which case it's shared between the two. The filter must not overwrite it in place, so before a
+	filter runs again HistoryManager::DetachCachedFilterOutputs() must be called to hand the waveform back to the cache.
+	The filter then allocates a new output buffer. If the cache goes away while a waveform is still attached, the
+	filter keeps it.
+
+	Each cached stream holds a reference to its filter, so the stream descriptors can't dangle. Filters which are only
+	being kept alive by caches are removed by HistoryManager::PurgeOrphanedFilterCaches().
+
+	All member functions are protected by HistoryManager::m_filterCacheMutex.
+ */
+class FilterOutputCache
+{
+public:
+	FilterOutputCache(HistoryManager& mgr, uint64_t generation);
+	~FilterOutputCache();
+
+	FilterOutputCache(const FilterOutputCache&) =delete;
+	FilterOutputCache& operator=(const FilterOutputCache&) =delete;
+
+	void Update(Filter* f);
+	void RemoveFilter(Filter* f);
+	void clear();
+
+	void Revalidate(uint64_t generation);
+	void Restore(std::set<FlowGraphNode*>& restoredFilters);
+
+	static bool IsCacheable(Filter* f);
+
+	size_t GetSizeBytes();
+
+protected:
+	void Detach(const std::set<FlowGraphNode*>& nodes);
+	bool Contains(StreamDescriptor stream, WaveformBase* wfm);
+	void ReleaseEntry(StreamDescriptor stream, WaveformBase* wfm);
+
+	friend class HistoryManager;
+
+	///@brief The history manager we're registered with
+	HistoryManager& m_mgr;
+
+	///@brief HistoryManager::GetFilterCacheGeneration() at the time our contents were captured
+	uint64_t m_generation;
+
+	///@brief The cached waveforms
+	WaveformHistory m_outputs;
+};
+
 /**
 	@brief A single point of waveform history
  */
-class HistoryPoint
+class HistoryPoint : public std::enable_shared_from_this<HistoryPoint>
 {
 public:
 	HistoryPoint();
@@ -51,6 +110,41 @@ public:
 
 	bool IsInUse();
 
+	/**
+		@brief Storage tiers for historical waveform data, fastest first
+	 */
+	enum Tier
+	{
+		///@brief Data is in GPU memory (with a pinned CPU-side mirror) and ready to render
+		TIER_GPU,
+
+		///@brief GPU memory freed, data kept in pinned host memory for fast upload
+		TIER_PINNED,
+
+		///@brief Data kept in ordinary pageable host memory
+		TIER_PAGEABLE,
+
+		///@brief Data spilled to a file on disk, and sample buffers freed
+		TIER_DISK,
+
+		///@brief Sample buffers freed, data will be read back from the session file it was loaded from
+		TIER_SESSION,
+
+		TIER_COUNT
+	};
+
+	///@brief Storage tier the point is currently in
+	Tier m_tier;
+
+	///@brief Size of the sample data in this point, in bytes (calculated when the point is added to history)
+	size_t m_sizeBytes;
+
+	size_t CalculateSize();
+	size_t GetBudgetedSize();
+
+	///@brief True while the point is queued for, or being written by, the spill thread (waveform data mutex held)
+	bool m_spillPending;
+
 	///@brief Timestamp of the point
 	TimePoint m_time;
 
@@ -63,6 +157,68 @@ public:
 	///@brief Waveform data
 	std::map<std::shared_ptr<Oscilloscope>, WaveformHistory> m_history;
 
+	///@brief Cached filter outputs (may be null)
+	std::shared_ptr<FilterOutputCache> m_filterCache;
+
+	/**
+		@brief Location of one waveform's samples within the spill file
+	 */
+	class SpillRecord
+	{
+	public:
+		SpillRecord(WaveformBase* wfm, size_t len)
+		: m_waveform(wfm)
+		, m_length(len)
+		{}
+
+		WaveformBase* m_waveform;
+		size_t m_length;
+	};
+
+	///@brief Path to the spill file, if m_tier is TIER_DISK
+	std::string m_spillPath;
+
+	///@brief Waveforms in the spill file, in the order they were written
+	std::vector<SpillRecord> m_spillRecords;
+
+	/**
+		@brief Location of one waveform's samples within a saved session
+	 */
+	class SessionRecord
+	{
+	public:
+		SessionRecord(
+			std::shared_ptr<Oscilloscope> scope,
+			StreamDescriptor stream,
+			const std::string& format,
+			const std::string& path,
+			size_t fileSize)
+		: m_scope(scope)
+		, m_stream(stream)
+		, m_format(format)
+		, m_path(path)
+		, m_fileSize(fileSize)
+		, m_dense(WaveformCodec::IsDenseFormat(format))
+		{}
+
+		std::shared_ptr<Oscilloscope> m_scope;
+		StreamDescriptor m_stream;
+		std::string m_format;
+		std::string m_path;
+		size_t m_fileSize;
+
+		///@brief True if m_format is densev1 or densev2, so the stream reloads into a uniform waveform
+		bool m_dense;
+	};
+
+	/**
+		@brief Files in the session this point was loaded from, if any
+
+		Points with session records are dropped back to TIER_SESSION rather than being spilled to disk, since their
+		data can be read back from the session at any time.
+	 */
+	std::vector<SessionRecord> m_sessionRecords;
+
 	void LoadHistoryToSession(Session& session);
 };
 
@@ -84,6 +240,16 @@ public:
 		std::string nick = "",
 		TimePoint refTimeIfNoWaveforms = TimePoint(0, 0));
 
+	std::shared_ptr<HistoryPoint> AddHistory(
+		const std::map<std::shared_ptr<Oscilloscope>, WaveformHistory>& data,
+		bool deleteOld = true,
+		bool pin = false,
+		std::string nick = "",
+		TimePoint refTimeIfNoWaveforms = TimePoint(0, 0));
+
+	static std::map<std::shared_ptr<Oscilloscope>, WaveformHistory> SnapshotWaveforms(
+		const std::vector<std::shared_ptr<Oscilloscope>>& scopes);
+
 	void LoadEmptyHistoryToSession(Session& session);
 
 	bool empty();
@@ -97,8 +263,50 @@ public:
 
 	TimePoint GetMostRecentPoint();
 
-	void clear()
-	{ m_history.clear(); }
+	void clear();
+
+	void EnforceBudgets(bool deleteOld = false);
+	void SetTier(HistoryPoint* pt, HistoryPoint::Tier tier);
+	void MakeResident(HistoryPoint* pt);
+	void GetTierUsage(size_t* points, size_t* bytes);
+
+	///@brief Returns true if the spill thread has finished writing points which CommitSpills() hasn't freed yet
+	bool HasFinishedSpills()
+	{ return m_finishedSpills > 0; }
+
+	void CommitSpills();
+
+	/**
+		@brief Prevents sample buffers from being moved or freed while another thread is reading them
+
+		While locked, points may still be promoted to GPU memory (which doesn't touch the CPU side copy) but will not
+		be demoted or spilled to disk.
+	 */
+	void LockTiers()
+	{ m_tierLocks ++; }
+
+	///@brief Releases a lock taken by LockTiers()
+	void UnlockTiers()
+	{ m_tierLocks --; }
+
+	std::shared_ptr<FilterOutputCache> CreateFilterCache();
+	void DetachCachedFilterOutputs(const std::set<FlowGraphNode*>& nodes);
+	bool IsCachedFilterOutput(StreamDescriptor stream, WaveformBase* wfm);
+	bool HasOrphanedFilterCaches();
+	void PurgeOrphanedFilterCaches();
+	void ClearFilterCaches();
+
+	/**
+		@brief Marks all cached filter outputs as stale
+
+		Call this whenever something changes that might make filters produce different results from the same input.
+	 */
+	void InvalidateFilterCaches()
+	{ m_filterCacheGeneration ++; }
+
+	///@brief Gets the current filter cache generation (see InvalidateFilterCaches())
+	uint64_t GetFilterCacheGeneration()
+	{ return m_filterCacheGeneration; }
 
 	std::list<std::shared_ptr<HistoryPoint>> m_history;
 
@@ -106,7 +314,97 @@ public:
 	int m_maxDepth;
 
 protected:
+	friend class FilterOutputCache;
+
+	bool DeleteOldestPoint();
+	bool SpillToDisk(HistoryPoint* pt);
+	void QueueSpill(HistoryPoint* pt);
+	void WaitForSpill(HistoryPoint* pt);
+	void FlushSpills();
+	void CommitSpill(HistoryPoint* pt, const std::string& path, const std::vector<HistoryPoint::SpillRecord>& records);
+	std::string GetNextSpillPath();
+	static void PrepareForSpill(HistoryPoint* pt);
+	static bool WriteSpillFile(
+		HistoryPoint* pt,
+		const std::string& path,
+		std::vector<HistoryPoint::SpillRecord>& records);
+	static void SpillThread(HistoryManager* mgr);
+	bool LoadFromDisk(HistoryPoint* pt);
+	void UnloadToSession(HistoryPoint* pt);
+	bool LoadFromSession(HistoryPoint* pt);
+	std::string GetSpillDirectory();
+
 	Session& m_session;
+
+	///@brief Directory spilled history is written to (created on first use)
+	std::string m_spillDirectory;
+
+	///@brief Number used to name the next spill file
+	size_t m_nextSpillFile;
+
+	///@brief Number of outstanding LockTiers() calls
+	std::atomic<int> m_tierLocks;
+
+	/**
+		@brief A point to be written to disk by the spill thread
+	 */
+	class SpillRequest
+	{
+	public:
+		SpillRequest(std::shared_ptr<HistoryPoint> point, const std::string& path)
+		: m_point(point)
+		, m_path(path)
+		, m_ok(false)
+		{}
+
+		///@brief The point to write, kept alive until the GUI thread commits or discards the spill
+		std::shared_ptr<HistoryPoint> m_point;
+
+		///@brief Path to the spill file
+		std::string m_path;
+
+		///@brief Waveforms written to the file
+		std::vector<HistoryPoint::SpillRecord> m_records;
+
+		///@brief True if the file was written successfully
+		bool m_ok;
+	};
+
+	///@brief Thread writing spilled points to disk (started on first use)
+	std::unique_ptr<std::thread> m_spillThread;
+
+	///@brief Mutex controlling access to m_spillQueue, m_spillDone, m_activeSpill, and m_spillTerminating
+	std::mutex m_spillMutex;
+
+	///@brief Signaled when a spill request is queued or finished, or the spill thread is asked to exit
+	std::condition_variable m_spillCondition;
+
+	///@brief Points waiting to be written
+	std::deque<SpillRequest> m_spillQueue;
+
+	///@brief Points which have been written, waiting for the GUI thread to free their memory
+	std::deque<SpillRequest> m_spillDone;
+
+	///@brief Size of m_spillDone
+	std::atomic<size_t> m_finishedSpills;
+
+	///@brief Point the spill thread is currently writing, if any
+	HistoryPoint* m_activeSpill;
+
+	///@brief Set to make the spill thread exit
+	bool m_spillTerminating;
+
+	///@brief Mutex controlling access to m_filterCaches, m_filterCacheRefs, and the contents of the caches
+	std::recursive_mutex m_filterCacheMutex;
+
+	///@brief All filter caches currently in existence
+	std::set<FilterOutputCache*> m_filterCaches;
+
+	///@brief Number of references held on each filter by caches
+	std::map<Filter*, size_t> m_filterCacheRefs;
+
+	///@brief Incremented whenever all cached filter outputs become stale
+	std::atomic<uint64_t> m_filterCacheGeneration;
 };
 
 #endif
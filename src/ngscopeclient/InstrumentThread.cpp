@@ -73,17 +73,43 @@ void InstrumentThread(InstrumentThreadArgs args)
 	auto psustate = args.psustate;
 	auto awgstate = args.awgstate;
 
+	//Figure out which poll budget applies to us.
+	//Combination instruments (e.g. scope with built in AWG) use the first of their types in the order checked below,
+	//so a scope's budget wins over a BERT's, which wins over a load's, and so on down to AWGs.
+	auto pollClass = PollScheduler::CLASS_MISC;
+	if(scope)
+		pollClass = PollScheduler::CLASS_SCOPE;
+	else if(bert)
+		pollClass = PollScheduler::CLASS_BERT;
+	else if(load)
+		pollClass = PollScheduler::CLASS_LOAD;
+	else if(psu)
+		pollClass = PollScheduler::CLASS_PSU;
+	else if(meter)
+		pollClass = PollScheduler::CLASS_METER;
+	else if(awg)
+		pollClass = PollScheduler::CLASS_AWG;
+	PollScheduler sched;
+
 	bool triggerUpToDate = false;
+	double tlastPoll = GetTime();
 
 	while(!*args.shuttingDown)
 	{
+		//Pick up any changes to the poll budget
+		sched.SetLimits(session->GetPollBudget(pollClass), session->GetMaxIdlePollInterval());
+
+		//Set if this iteration found something to do, so we should come back quickly
+		bool active = false;
+
 		//Flush any pending commands
 		inst->GetTransport()->FlushCommandQueue();
 
 		//Scope processing
 		if(scope)
 		{
-			//If the queue is too big, stop grabbing data
+			//If the queue is too big, stop grabbing data and back off until the WaveformThread catches up.
+			//Don't count this as activity, or we'd spin checking the queue at the scope's poll budget.
 			size_t npending = scope->GetPendingWaveformCount();
 			if(npending > 5)
 			{
@@ -91,11 +117,9 @@ void InstrumentThread(InstrumentThreadArgs args)
 				this_thread::sleep_for(chrono::milliseconds(5));
 			}
 
-			//If trigger isn't armed, don't even bother polling for a while.
+			//If trigger isn't armed, don't even bother polling very often
 			else if(!scope->IsTriggerArmed())
 			{
-				//LogTrace("Scope isn't armed, sleeping\n");
-				this_thread::sleep_for(chrono::milliseconds(5));
 				if(!triggerUpToDate)
 				{	// Check for trigger state change
 					auto stat = scope->PollTrigger();
@@ -105,12 +129,19 @@ void InstrumentThread(InstrumentThreadArgs args)
 						triggerUpToDate = true;
 					}
 				}
+
+				//Can't trigger while we're not armed, so latency measurements start from here
+				tlastPoll = GetTime();
 			}
 
 			//Grab data if it's ready
 			//TODO: how is this going to play with reading realtime BER from BERT+scope deviecs?
 			else
 			{
+				//We're expecting a trigger, so keep polling at full rate whether or not it's arrived yet
+				active = true;
+
+				double tpoll = GetTime();
 				auto stat = scope->PollTrigger();
 				session->GetInstrumentConnectionState(inst)->m_lastTriggerState = stat;
 				if(stat == Oscilloscope::TRIGGER_MODE_TRIGGERED)
@@ -120,14 +151,22 @@ void InstrumentThread(InstrumentThreadArgs args)
 					shared_lock<shared_mutex> vlock(g_vulkanActivityMutex);
 
 					scope->AcquireData();
+
+					//Worst case, the trigger happened right after the previous poll
+					*args.acquisitionLatency = (GetTime() - tlastPoll) * FS_PER_SECOND;
 				}
+				tlastPoll = tpoll;
 				triggerUpToDate = false;
 			}
 		}
 
-		//Always acquire data from non-scope instruments
+		//Always acquire data from non-scope instruments.
+		//Latency is from when this poll was due (which includes any oversleep) to having the data.
 		else
+		{
 			inst->AcquireData();
+			*args.acquisitionLatency = (GetTime() - sched.GetDeadline()) * FS_PER_SECOND;
+		}
 
 		//Populate scalar channel and do other instrument-specific processing
 		if(psu && psustate)
@@ -140,8 +179,13 @@ void InstrumentThread(InstrumentThreadArgs args)
 				if(!pchan)
 					continue;
 
-				psustate->m_channelVoltage[i] = pchan->GetVoltageMeasured();
-				psustate->m_channelCurrent[i] = pchan->GetCurrentMeasured();
+				float v = pchan->GetVoltageMeasured();
+				float c = pchan->GetCurrentMeasured();
+				if( (v != psustate->m_channelVoltage[i]) || (c != psustate->m_channelCurrent[i]) )
+					active = true;
+
+				psustate->m_channelVoltage[i] = v;
+				psustate->m_channelCurrent[i] = c;
 				psustate->m_channelConstantCurrent[i] = psu->IsPowerConstantCurrent(i);
 				psustate->m_channelFuseTripped[i] = psu->GetPowerOvercurrentShutdownTripped(i);
 				psustate->m_channelOn[i] = psu->GetPowerChannelActive(i);
@@ -160,8 +204,13 @@ void InstrumentThread(InstrumentThreadArgs args)
 			{
 				auto lchan = dynamic_cast<LoadChannel*>(load->GetChannel(i));
 
-				loadstate->m_channelVoltage[i] = lchan->GetScalarValue(LoadChannel::STREAM_VOLTAGE_MEASURED);
-				loadstate->m_channelCurrent[i] = lchan->GetScalarValue(LoadChannel::STREAM_CURRENT_MEASURED);
+				float v = lchan->GetScalarValue(LoadChannel::STREAM_VOLTAGE_MEASURED);
+				float c = lchan->GetScalarValue(LoadChannel::STREAM_CURRENT_MEASURED);
+				if( (v != loadstate->m_channelVoltage[i]) || (c != loadstate->m_channelCurrent[i]) )
+					active = true;
+
+				loadstate->m_channelVoltage[i] = v;
+				loadstate->m_channelCurrent[i] = c;
 
 				session->MarkChannelDirty(lchan);
 			}
@@ -172,8 +221,13 @@ void InstrumentThread(InstrumentThreadArgs args)
 			auto chan = dynamic_cast<MultimeterChannel*>(meter->GetChannel(meter->GetCurrentMeterChannel()));
 			if(chan)
 			{
-				meterstate->m_primaryMeasurement = chan->GetPrimaryValue();
-				meterstate->m_secondaryMeasurement = chan->GetSecondaryValue();
+				float primary = chan->GetPrimaryValue();
+				float secondary = chan->GetSecondaryValue();
+				if( (primary != meterstate->m_primaryMeasurement) || (secondary != meterstate->m_secondaryMeasurement) )
+					active = true;
+
+				meterstate->m_primaryMeasurement = primary;
+				meterstate->m_secondaryMeasurement = secondary;
 				meterstate->m_firstUpdateDone = true;
 
 				session->MarkChannelDirty(chan);
@@ -181,6 +235,9 @@ void InstrumentThread(InstrumentThreadArgs args)
 		}
 		if(misc || rfgen || bert)
 		{
+			//No way to tell if anything changed, so always poll these at full rate
+			active = true;
+
 			for(size_t i=0; i<inst->GetChannelCount(); i++)
 			{
 				auto chan = inst->GetChannel(i);
@@ -245,6 +302,7 @@ void InstrumentThread(InstrumentThreadArgs args)
 					session->MarkChannelDirty(awgchan);
 
 					awgstate->m_needsUpdate[i] = false;
+					active = true;
 				}
 
 			}
@@ -253,9 +311,14 @@ void InstrumentThread(InstrumentThreadArgs args)
 		//TODO: does this make sense to do in the instrument thread?
 		session->RefreshDirtyFiltersNonblocking();
 
-		//Rate limit to 100 Hz to avoid saturating CPU with polls
+		//Rate limit polls to the budget for this instrument type, backing off if nothing is happening
 		//(this also provides a yield point for the gui thread to get mutex ownership etc)
-		this_thread::sleep_for(chrono::milliseconds(10));
+		if(active)
+			sched.OnActivity();
+		else
+			sched.OnIdle();
+		*args.pollInterval = sched.GetInterval();
+		sched.Wait();
 	}
 
 	LogTrace("Shutting down instrument thread\n");
@@ -167,6 +167,7 @@ bool LogViewerDialog::DoRender()
 	auto font = m_parent->GetFontPref("Appearance.General.console_font");
 	ImGui::PushFont(font.first, font.second);
 	auto& lines = g_guiLog->GetLines();
+	size_t firstLine = g_guiLog->GetTotalLineCount() - lines.size();
 
 	float width = ImGui::GetFontSize();
 	static ImGuiTableFlags flags =
@@ -251,9 +252,11 @@ bool LogViewerDialog::DoRender()
 			ImGui::TextUnformatted(line.m_msg.c_str());
 
 			//Autoscroll when new messages arrive
-			if(m_lastLine < i)
+			//(use absolute line numbers since old lines get discarded from the start of the buffer)
+			size_t lineNum = firstLine + i;
+			if(m_lastLine < lineNum)
 			{
-				m_lastLine = i;
+				m_lastLine = lineNum;
 				ImGui::SetScrollHereY(1.0f);
 			}
 		}
@@ -92,6 +92,7 @@ using namespace std;
 
 extern Event g_rerenderRequestedEvent;
 extern unique_ptr<MainWindow> g_mainWindow;
+extern GuiLogSink* g_guiLog;
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 // Construction / destruction
@@ -141,6 +142,12 @@ MainWindow::MainWindow(shared_ptr<QueueHandle> queue)
 	m_cmdBuffer = make_unique<vk::raii::CommandBuffer>(
 		std::move(vk::raii::CommandBuffers(*g_vkComputeDevice, bufinfo).front()));
 
+	//Start signaled so the first tone mapping pass doesn't wait for a nonexistent previous one
+	m_toneMapFence = make_unique<vk::raii::Fence>(
+		*g_vkComputeDevice,
+		vk::FenceCreateInfo(vk::FenceCreateFlagBits::eSignaled));
+	m_toneMapSemaphore = make_unique<vk::raii::Semaphore>(*g_vkComputeDevice, vk::SemaphoreCreateInfo());
+
 	if(g_hasDebugUtils)
 	{
 		g_vkComputeDevice->setDebugUtilsObjectNameEXT(
@@ -154,6 +161,18 @@ MainWindow::MainWindow(shared_ptr<QueueHandle> queue)
 				vk::ObjectType::eCommandBuffer,
 				reinterpret_cast<int64_t>(static_cast<VkCommandBuffer>(**m_cmdBuffer)),
 				"MainWindow.m_cmdBuffer"));
+
+		g_vkComputeDevice->setDebugUtilsObjectNameEXT(
+			vk::DebugUtilsObjectNameInfoEXT(
+				vk::ObjectType::eFence,
+				reinterpret_cast<uint64_t>(static_cast<VkFence>(**m_toneMapFence)),
+				"MainWindow.m_toneMapFence"));
+
+		g_vkComputeDevice->setDebugUtilsObjectNameEXT(
+			vk::DebugUtilsObjectNameInfoEXT(
+				vk::ObjectType::eSemaphore,
+				reinterpret_cast<uint64_t>(static_cast<VkSemaphore>(**m_toneMapSemaphore)),
+				"MainWindow.m_toneMapSemaphore"));
 	}
 
 	UpdateFonts();
@@ -189,6 +208,9 @@ MainWindow::~MainWindow()
 	g_vkComputeDevice->waitIdle();
 	m_texmgr.clear();
 
+	m_toneMapChannels.clear();
+	m_toneMapFence = nullptr;
+	m_toneMapSemaphore = nullptr;
 	m_cmdBuffer = nullptr;
 	m_cmdPool = nullptr;
 
@@ -533,6 +555,10 @@ void MainWindow::Render()
 	//Load all of our fonts
 	UpdateFonts();
 
+	SetMaxFramesInFlight(max(
+		static_cast<int64_t>(1),
+		m_session.GetPreferences().GetInt("Performance.Rendering.max_frames_in_flight")));
+
 	VulkanWindow::Render();
 }
 
@@ -544,7 +570,12 @@ void MainWindow::DoRender(vk::raii::CommandBuffer& /*cmdBuf*/)
 /**
 	@brief Run the tone-mapping shader on all of our waveforms
 
-	Called by Session::CheckForWaveforms() at the start of each frame if new data is ready to render
+	Called by Session::CheckForWaveforms() at the start of each frame if new data is ready to render.
+
+	The tone mapping pass is submitted without waiting for it to finish: it signals m_toneMapSemaphore, which the
+	next frame waits on before its fragment shaders sample the waveform textures. We only block here if one of the
+	waveforms was tone mapped directly from waveform data (e.g. a spectrogram), since the caller releases its lock on
+	the waveform data as soon as we return.
  */
 void MainWindow::ToneMapAllWaveforms(vk::raii::CommandBuffer& cmdbuf)
 {
@@ -552,7 +583,22 @@ void MainWindow::ToneMapAllWaveforms(vk::raii::CommandBuffer& cmdbuf)
 
 	lock_guard<mutex> lock(m_session.GetRasterizedWaveformMutex());
 
-	m_cmdBuffer->begin(vk::CommandBufferBeginInfo(vk::CommandBufferUsageFlagBits::eOneTimeSubmit));
+	//Make sure the previous pass is done with the command buffer before we reuse it
+	(void)g_vkComputeDevice->waitForFences({**m_toneMapFence}, VK_TRUE, UINT64_MAX);
+	m_toneMapChannels.clear();
+	g_vkComputeDevice->resetFences({**m_toneMapFence});
+
+	cmdbuf.begin(vk::CommandBufferBeginInfo(vk::CommandBufferUsageFlagBits::eOneTimeSubmit));
+	FlushPendingLayoutTransitions(cmdbuf);
+
+	//Earlier frames may still be in flight, so don't overwrite textures until they're done sampling them
+	cmdbuf.pipelineBarrier(
+		vk::PipelineStageFlagBits::eFragmentShader,
+		vk::PipelineStageFlagBits::eComputeShader,
+		{},
+		{},
+		{},
+		{});
 
 	//Tone map the waveforms, holding the group mutex for as short a time as possible
 	vector<shared_ptr<WaveformGroup>> groups;
@@ -560,16 +606,49 @@ void MainWindow::ToneMapAllWaveforms(vk::raii::CommandBuffer& cmdbuf)
 		lock_guard<recursive_mutex> lock2(m_waveformGroupsMutex);
 		groups = m_waveformGroups;
 	}
+	bool readsWaveformData = false;
 	for(auto group : groups)
-		group->ToneMapAllWaveforms(cmdbuf);
+		readsWaveformData |= group->ToneMapAllWaveforms(cmdbuf, m_toneMapChannels);
 
-	m_cmdBuffer->end();
-	m_renderQueue->SubmitAndBlock(*m_cmdBuffer);
+	cmdbuf.end();
+
+	//If no frame has consumed the previous pass's signal yet (e.g. the window was minimized),
+	//wait on it here and signal it again, so there's never more than one signal outstanding
+	bool chained = HasFrameWaitSemaphore(**m_toneMapSemaphore);
+	vector<vk::Semaphore> waitSemaphores;
+	vector<vk::PipelineStageFlags> waitStages;
+	if(chained)
+	{
+		waitSemaphores.push_back(**m_toneMapSemaphore);
+		waitStages.push_back(vk::PipelineStageFlagBits::eComputeShader);
+	}
+	vk::Semaphore signalSemaphore = **m_toneMapSemaphore;
+	vk::SubmitInfo info(waitSemaphores, waitStages, *cmdbuf, signalSemaphore);
+	{
+		QueueLock qlock(m_renderQueue);
+		(*qlock).submit(info, **m_toneMapFence);
+	}
+	if(!chained)
+		AddFrameWaitSemaphore(**m_toneMapSemaphore, vk::PipelineStageFlagBits::eFragmentShader);
+
+	//Secondary viewports are drawn without waiting on the semaphore, so fall back to blocking if we have any
+	if(readsWaveformData || (ImGui::GetPlatformIO().Viewports.Size > 1) )
+		(void)g_vkComputeDevice->waitForFences({**m_toneMapFence}, VK_TRUE, UINT64_MAX);
 
 	double dt = GetTime() - start;
 	m_toneMapTime = dt * FS_PER_SECOND;
 }
 
+/**
+	@brief Blocks until the most recently submitted tone mapping pass has completed
+
+	The caller must hold the rasterized waveform mutex.
+ */
+void MainWindow::WaitForToneMap()
+{
+	(void)g_vkComputeDevice->waitForFences({**m_toneMapFence}, VK_TRUE, UINT64_MAX);
+}
+
 void MainWindow::RenderWaveformTextures(
 	vk::raii::CommandBuffer& cmdbuf,
 	vector<shared_ptr<DisplayedChannel> >& channels)
@@ -625,6 +704,35 @@ void MainWindow::RenderUI()
 
 	m_needRender = false;
 
+	//Process any log messages from other threads
+	g_guiLog->SetMaxLines(m_session.GetPreferences().GetInt("Performance.Logging.history_depth"));
+	g_guiLog->SetQueueDepth(m_session.GetPreferences().GetInt("Performance.Logging.queue_depth"));
+	g_guiLog->Poll();
+
+	//Report completion of background saves
+	auto saveJob = m_session.GetSaveJob();
+	if(saveJob && saveJob->IsDone())
+	{
+		Unit bytes(Unit::UNIT_BYTES);
+		if(saveJob->HasFailed())
+		{
+			ShowErrorPopup(
+				"Write failed",
+				"Failed to save some waveform data, see log for details");
+		}
+		else
+		{
+			LogNotice("Saved %s of waveform data at %s/s\n",
+				bytes.PrettyPrint(saveJob->GetBytesWritten()).c_str(),
+				bytes.PrettyPrint(saveJob->GetThroughput()).c_str());
+		}
+		m_session.FinishSaveJob();
+
+		//History may have gone over budget while the save had it locked
+		lock_guard<shared_mutex> lock(m_session.GetWaveformDataMutex());
+		m_session.GetHistory().EnforceBudgets();
+	}
+
 	//Keep references to all of our waveform textures until next frame
 	//Any groups we're closing will be destroyed at the start of that frame, once rendering has finished
 	{
@@ -633,6 +741,9 @@ void MainWindow::RenderUI()
 			g->ReferenceWaveformTextures();
 	}
 
+	//Free pooled textures nobody has wanted for a while
+	m_texmgr.TrimTexturePool();
+
 	//Destroy all waveform groups we were asked to close
 	//Block until all background processing completes to ensure no command buffers are still pending
 	if(!m_groupsToClose.empty())
@@ -1385,6 +1496,18 @@ void MainWindow::StatusBar(float height)
 		ImGui::SameLine();
 	}
 
+	//Show progress of background saves
+	auto saveJob = m_session.GetSaveJob();
+	if(saveJob)
+	{
+		Unit bytes(Unit::UNIT_BYTES);
+		ImGui::TextUnformatted("Saving waveforms");
+		ImGui::SameLine();
+		string str = bytes.PrettyPrint(saveJob->GetThroughput()) + "/s";
+		ImGui::ProgressBar(saveJob->GetProgress(), ImVec2(10 * ImGui::GetFontSize(), iconHeight), str.c_str());
+		ImGui::SameLine();
+	}
+
 	//Delete status bar contents so we can draw new stuff next frame
 	m_statusHelp.clear();
 }
@@ -1973,6 +2096,7 @@ Filter* MainWindow::CreateFilter(
 
 	//Give it an initial name, may change later
 	f->SetDefaultName();
+	m_session.OnFilterGraphChanged();
 
 	//Find a home for each of its streams
 	if(addToArea)
@@ -2201,6 +2325,9 @@ void MainWindow::OnFilterReconfigured(Filter* f)
 		f->ClearSweeps();
 	}
 
+	//Inputs may have been rewired, so the cached topology is no longer trustworthy
+	m_session.OnFilterGraphChanged();
+
 	//Re-run the filter
 	m_session.RefreshAllFiltersNonblocking();
 
@@ -2907,6 +3034,9 @@ void MainWindow::DoSaveFile(string sessionPath)
 	//Stop the trigger so we don't have data races if a waveform comes in mid-save
 	m_session.StopTrigger();
 
+	//If we're still writing waveform data from the last save, let it finish
+	m_session.FinishSaveJob();
+
 	//Saving the file conflicts with all other waveform data operations
 	lock_guard<shared_mutex> lock(m_session.GetWaveformDataMutex());
 
@@ -160,6 +160,7 @@ public:
 	}
 
 	void ToneMapAllWaveforms(vk::raii::CommandBuffer& cmdbuf);
+	void WaitForToneMap();
 
 	void RenderWaveformTextures(
 		vk::raii::CommandBuffer& cmdbuf,
@@ -542,6 +543,15 @@ protected:
 	///@brief Command buffer used during rendering operations
 	std::unique_ptr<vk::raii::CommandBuffer> m_cmdBuffer;
 
+	///@brief Signaled when the most recent tone mapping pass (in m_cmdBuffer) completes
+	std::unique_ptr<vk::raii::Fence> m_toneMapFence;
+
+	///@brief Signaled by tone mapping, and waited on by the next frame before it draws the waveform textures
+	std::unique_ptr<vk::raii::Semaphore> m_toneMapSemaphore;
+
+	///@brief Channels used by the most recent tone mapping pass, kept alive until it completes
+	std::vector<std::shared_ptr<DisplayedChannel> > m_toneMapChannels;
+
 	bool DropdownButton(const char* id, float height);
 
 public:
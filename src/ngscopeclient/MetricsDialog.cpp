@@ -45,9 +45,16 @@ using namespace std;
 MetricsDialog::MetricsDialog(Session* session)
 	: Dialog("Performance Metrics", "Metrics", ImVec2(300, 400))
 	, m_session(session)
+	, m_lastPipelineSampleTime(GetTime())
 {
 	m_displayRefreshRate = 0;
 
+	for(int i=0; i<Session::PIPELINE_STAGE_COUNT; i++)
+	{
+		m_lastPipelineBusyTime[i] = m_session->GetPipelineBusyTime(static_cast<Session::PipelineStage>(i));
+		m_pipelineUtilization[i] = 0;
+	}
+
 	auto mon = glfwGetPrimaryMonitor();
 	if(mon)
 	{
@@ -102,6 +109,28 @@ bool MetricsDialog::DoRender()
 		HelpMarker(
 			"Refresh rate for your monitor. Framerate should ideally be very close to this.");
 
+		ImGui::BeginDisabled();
+			str = fs.PrettyPrint(m_session->GetFrameCpuTime());
+			ImGui::SetNextItemWidth(width);
+			ImGui::InputText("Frame CPU time", &str);
+		ImGui::EndDisabled();
+
+		HelpMarker(
+			"Time the GUI thread spent preparing the most recent frame, not counting time spent waiting for the GPU "
+			"or for vsync.\n\n"
+			"If this is close to the frame period, the GUI thread is the bottleneck.");
+
+		ImGui::BeginDisabled();
+			str = fs.PrettyPrint(m_session->GetFrameGpuTime());
+			ImGui::SetNextItemWidth(width);
+			ImGui::InputText("Frame GPU time", &str);
+		ImGui::EndDisabled();
+
+		HelpMarker(
+			"Time the GPU spent drawing the most recently completed frame, measured with timestamp queries.\n\n"
+			"Includes any time the frame spent waiting for tone mapping to finish. "
+			"Shows zero if the GPU does not support timestamps on the render queue.");
+
 		ImGui::BeginDisabled();
 			str = fs.PrettyPrint(m_session->GetLastWaveformRenderTime());
 			ImGui::SetNextItemWidth(width);
@@ -121,9 +150,12 @@ bool MetricsDialog::DoRender()
 		ImGui::EndDisabled();
 
 		HelpMarker(
-			"Most recent execution time for the tone mapping compute shader (total across all waveforms).\n\n"
+			"Most recent time spent recording and submitting the tone mapping compute shader (total across all "
+			"waveforms).\n\n"
 			"This shader runs every time a waveform is re-rasterized or display color ramp settings are changed, and "
-			"does not necessarily execute every frame. When needed, it runs synchronously during frame rendering."
+			"does not necessarily execute every frame. It runs asynchronously and the frame waits for it on the GPU, "
+			"so this only includes GPU execution time if a density plot (spectrogram, eye pattern, etc) or a "
+			"second top level window is displayed."
 			);
 
 
@@ -177,11 +209,69 @@ bool MetricsDialog::DoRender()
 
 		HelpMarker(
 			"Rate at which waveforms are being retrieved from the queue and processed.\n\n"
-			"This is currently capped at the display framerate.\n"
+			"This is capped at the display framerate multiplied by the pipeline depth.\n"
 			"If it drops below the framerate, your instrument, filter graph execution, or waveform rendering "
 			"are likely the bottleneck."
 			);
 
+		if(ImGui::TreeNode("Pipeline"))
+		{
+			static const char* stageNames[Session::PIPELINE_STAGE_COUNT] =
+			{
+				"Download",
+				"Filter",
+				"Render",
+				"Display"
+			};
+
+			static const char* stageHelp[Session::PIPELINE_STAGE_COUNT] =
+			{
+				"Fraction of time the waveform thread spends pulling waveforms out of the instrument queues and "
+				"attaching them to channels.",
+				"Fraction of time the waveform thread spends running the filter graph.",
+				"Fraction of time the waveform thread spends rasterizing waveforms.\n\n"
+				"Download, filter, and render run one after another on a single thread, so their sum is the waveform "
+				"thread's total utilization. If it's close to 100%, the waveform thread is the bottleneck.",
+				"Number of fully processed waveforms waiting for the GUI thread to tone map them and add them to "
+				"history.\n\n"
+				"If this is consistently at the pipeline depth, the GUI thread is the bottleneck."
+			};
+
+			auto depth = m_session->GetPipelineDepth();
+
+			//Update utilization a couple of times a second so it's readable
+			double now = GetTime();
+			double dt = now - m_lastPipelineSampleTime;
+			if(dt > 0.5)
+			{
+				for(int i=0; i<Session::PIPELINE_STAGE_COUNT; i++)
+				{
+					double busy = m_session->GetPipelineBusyTime(static_cast<Session::PipelineStage>(i));
+					m_pipelineUtilization[i] = (busy - m_lastPipelineBusyTime[i]) / dt;
+					m_lastPipelineBusyTime[i] = busy;
+				}
+				m_lastPipelineSampleTime = now;
+			}
+
+			for(int i=0; i<Session::PIPELINE_STAGE_COUNT; i++)
+			{
+				auto stage = static_cast<Session::PipelineStage>(i);
+
+				ImGui::BeginDisabled();
+					if(stage == Session::PIPELINE_STAGE_DISPLAY)
+						str = to_string(m_session->GetPipelineOccupancy(stage)) + " / " + to_string(depth);
+					else
+						str = to_string(static_cast<int>(round(m_pipelineUtilization[i] * 100))) + "%";
+					ImGui::SetNextItemWidth(width);
+					ImGui::InputText(stageNames[i], &str);
+				ImGui::EndDisabled();
+
+				HelpMarker(stageHelp[i]);
+			}
+
+			ImGui::TreePop();
+		}
+
 		//Category for each scope
 		auto scopes = m_session->GetScopes();
 		for(auto s : scopes)
@@ -206,6 +296,125 @@ bool MetricsDialog::DoRender()
 		}
 	}
 
+	if(ImGui::CollapsingHeader("Instruments"))
+	{
+		auto insts = m_session->GetInstruments();
+		for(auto inst : insts)
+		{
+			auto state = m_session->GetInstrumentConnectionState(inst);
+			if(!state)
+				continue;
+
+			if(ImGui::TreeNode(inst->m_nickname.c_str()))
+			{
+				ImGui::BeginDisabled();
+					str = fs.PrettyPrint(state->m_pollInterval.load());
+					ImGui::SetNextItemWidth(width);
+					ImGui::InputText("Poll interval", &str);
+				ImGui::EndDisabled();
+
+				HelpMarker(
+					"Current interval between polls of the instrument.\n\n"
+					"This is the poll budget for the instrument type (see Preferences > Performance > Polling) while\n"
+					"the instrument is busy, and backs off towards the maximum idle interval while it is idle."
+					);
+
+				ImGui::BeginDisabled();
+					str = fs.PrettyPrint(state->m_acquisitionLatency.load());
+					ImGui::SetNextItemWidth(width);
+					ImGui::InputText("Acquisition latency", &str);
+				ImGui::EndDisabled();
+
+				HelpMarker(
+					"Most recent acquisition latency.\n\n"
+					"For oscilloscopes, this is the worst case time from the trigger event to having the waveform "
+					"downloaded.\n"
+					"For other instruments, it is the time from when the poll was due to having the readings."
+					);
+
+				ImGui::TreePop();
+			}
+		}
+	}
+
+	if(ImGui::CollapsingHeader("Protocol analyzers"))
+	{
+		Unit bytes(Unit::UNIT_BYTES);
+
+		auto mgrs = m_session->GetPacketManagers();
+		for(auto it : mgrs)
+		{
+			size_t npackets;
+			size_t decodedBytes;
+			size_t storedBytes;
+			it.second->GetMemoryUsage(npackets, decodedBytes, storedBytes);
+
+			if(ImGui::TreeNode(it.first->GetDisplayName().c_str()))
+			{
+				ImGui::BeginDisabled();
+					str = counts.PrettyPrint(npackets);
+					ImGui::SetNextItemWidth(width);
+					ImGui::InputText("Packets", &str);
+				ImGui::EndDisabled();
+
+				HelpMarker("Number of packets (including merged child packets) in history.");
+
+				ImGui::BeginDisabled();
+					str = bytes.PrettyPrint(storedBytes, 4);
+					ImGui::SetNextItemWidth(width);
+					ImGui::InputText("Memory", &str);
+				ImGui::EndDisabled();
+
+				HelpMarker("Estimated memory used by packets in history, including display and filter state.");
+
+				ImGui::BeginDisabled();
+					str = npackets ? bytes.PrettyPrint(decodedBytes * 1.0 / npackets, 4) : "";
+					ImGui::SetNextItemWidth(width);
+					ImGui::InputText("Bytes per packet (decoded)", &str);
+				ImGui::EndDisabled();
+
+				HelpMarker("Estimated average size of a packet as it came out of the protocol decoder.");
+
+				ImGui::BeginDisabled();
+					str = npackets ? bytes.PrettyPrint(storedBytes * 1.0 / npackets, 4) : "";
+					ImGui::SetNextItemWidth(width);
+					ImGui::InputText("Bytes per packet (stored)", &str);
+				ImGui::EndDisabled();
+
+				HelpMarker(
+					"Estimated average size of a packet once stored in history.\n\n"
+					"This includes trimming of excess capacity in packet data, plus per-packet filter and display state.");
+
+				ImGui::TreePop();
+			}
+		}
+	}
+
+	if(ImGui::CollapsingHeader("History"))
+	{
+		Unit bytes(Unit::UNIT_BYTES);
+
+		size_t points[HistoryPoint::TIER_COUNT];
+		size_t sizes[HistoryPoint::TIER_COUNT];
+		m_session->GetHistory().GetTierUsage(points, sizes);
+
+		static const char* tierNames[HistoryPoint::TIER_COUNT] = { "GPU", "Pinned", "Pageable", "Disk", "Session" };
+		for(int i=0; i<HistoryPoint::TIER_COUNT; i++)
+		{
+			ImGui::BeginDisabled();
+				str = counts.PrettyPrint(points[i]) + " / " + bytes.PrettyPrint(sizes[i], 4);
+				ImGui::SetNextItemWidth(width);
+				ImGui::InputText(tierNames[i], &str);
+			ImGui::EndDisabled();
+		}
+
+		HelpMarker(
+			"Number of history points, and size of their sample data, in each storage tier.\n\n"
+			"Limits for each tier are set under Preferences > Performance > History.\n\n"
+			"Points in the Session tier haven't been loaded from the session file yet (or were dropped to save memory),\n"
+			"and are read back when selected.");
+	}
+
 	//Only show this tab if available
 	if(g_hasMemoryBudget)
 	{
@@ -36,6 +36,7 @@
 #define MetricsDialog_h
 
 #include "Dialog.h"
+#include "Session.h"
 
 class MetricsDialog : public Dialog
 {
@@ -49,6 +50,15 @@ protected:
 	Session* m_session;
 
 	int m_displayRefreshRate;
+
+	///@brief Time we last sampled the pipeline busy times
+	double m_lastPipelineSampleTime;
+
+	///@brief Pipeline busy times as of m_lastPipelineSampleTime
+	double m_lastPipelineBusyTime[Session::PIPELINE_STAGE_COUNT];
+
+	///@brief Fraction of time each pipeline stage was busy over the last sample interval
+	float m_pipelineUtilization[Session::PIPELINE_STAGE_COUNT];
 };
 
 #endif
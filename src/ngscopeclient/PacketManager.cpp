@@ -35,6 +35,7 @@
 #include "ngscopeclient.h"
 #include "PacketManager.h"
 #include "Session.h"
+#include <typeinfo>
 
 using namespace std;
 
@@ -51,16 +52,7 @@ PacketManager::PacketManager(PacketDecoder* pd, Session& session)
 
 PacketManager::~PacketManager()
 {
-	for(auto& it : m_packets)
-	{
-		for(auto p : it.second)
-		{
-			RemoveChildHistoryFrom(p);
-			delete p;
-		}
-	}
 	m_packets.clear();
-	m_childPackets.clear();
 
 	m_filter->Release();
 }
@@ -68,6 +60,9 @@ PacketManager::~PacketManager()
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 // Waveform data processing
 
+/**
+	@brief Rebuilds all rows
+ */
 void PacketManager::RefreshRows()
 {
 	LogTrace("Refreshing rows for %s\n", m_filter->GetDisplayName().c_str());
@@ -76,108 +71,151 @@ void PacketManager::RefreshRows()
 
 	//Clear all existing row state
 	m_refreshPending = false;
+	m_pendingRowRefreshes.clear();
 	m_rows.clear();
 
-	//Make a list of waveform timestamps and make sure we display them in order
-	vector<TimePoint> times;
-	for(auto& it : m_filteredPackets)
-		times.push_back(it.first);
-	std::sort(times.begin(), times.end());
-	LogTrace("%zu times\n", times.size());
+	//Process packets from each waveform
+	for(auto& it : m_packets)
+		RefreshRows(it.first);
+
+	LogTrace("%zu rows\n", m_rows.size());
+}
+
+/**
+	@brief Rebuilds the rows for a single waveform, leaving the others untouched
+
+	@param wavetime		Timestamp of the waveform
+ */
+void PacketManager::RefreshRows(TimePoint wavetime)
+{
+	lock_guard<recursive_mutex> lock(m_mutex);
+
+	//If nothing passed the filter (or the waveform is gone), remove it
+	auto it = m_packets.find(wavetime);
+	if( (it == m_packets.end()) || ( (it->second->GetFilteredCount() == 0) && (m_filterExpression != nullptr) ) )
+	{
+		m_rows.RemoveSegment(wavetime);
+		return;
+	}
+	auto& block = *it->second;
 
-	double totalHeight = 0;
 	double lineheight = ImGui::CalcTextSize("dummy text").y;
 	double padding = ImGui::GetStyle().CellPadding.y;
+	double height = padding*2 + lineheight;
 
-	//Process packets from each waveform
-	for(auto wavetime : times)
+	//Get markers for this waveform, if any
+	auto& markers = m_session.GetMarkers(wavetime);
+	size_t imarker = 0;
+	int64_t lastoff = 0;
+
+	LogTrace("Refreshing (markers: %zu at %s)\n", markers.size(), wavetime.PrettyPrint().c_str());
+
+	vector<RowData> rows;
+	rows.reserve(block.GetFilteredCount());
+	for(size_t i=0; i<block.GetFilteredCount(); i++)
 	{
-		auto& wpackets = m_filteredPackets[wavetime];
+		size_t index = block.GetFilteredIndex(i);
+		auto pack = block.GetPacket(index);
+		size_t childStart = block.GetFilteredChildStart(i);
+		size_t childEnd = block.GetFilteredChildEnd(i);
+
+		//Add marker before this packet if needed
+		//(loop because we might have two or more markers between packets)
+		while( (imarker < markers.size()) &&
+			(markers[imarker].m_offset >= lastoff) &&
+			(markers[imarker].m_offset < pack->m_offset) )
+		{
+			RowData row(wavetime, markers[imarker]);
+			row.m_height = height;
+			rows.push_back(row);
 
-		//Get markers for this waveform, if any
-		auto& markers = m_session.GetMarkers(wavetime);
-		size_t imarker = 0;
-		int64_t lastoff = 0;
+			imarker ++;
+		}
 
-		LogTrace("Refreshing (markers: %zu at %s)\n", markers.size(), wavetime.PrettyPrint().c_str());
+		//Add an entry for the top level
+		RowData dat(wavetime, pack, index, childEnd > childStart);
+		dat.m_height = height;
+		rows.push_back(dat);
+		lastoff = pack->m_offset;
 
-		for(auto pack : wpackets)
+		//Add child packets, if expanded
+		if(block.IsChildOpen(index))
 		{
-			//Add marker before this packet if needed
-			//(loop because we might have two or more markers between packets)
-			while( (imarker < markers.size()) &&
-				(markers[imarker].m_offset >= lastoff) &&
-				(markers[imarker].m_offset < pack->m_offset) )
+			for(size_t j=childStart; j<childEnd; j++)
 			{
-				RowData row(wavetime, markers[imarker]);
-				row.m_height = padding*2 + lineheight;
-				totalHeight += row.m_height;
-				row.m_totalHeight = totalHeight;
-				m_rows.push_back(row);
-
-				imarker ++;
+				RowData cdat(wavetime, block.GetFilteredChild(j), index);
+				cdat.m_height = height;
+				rows.push_back(cdat);
 			}
+		}
+	}
 
-			//See if we have child packets
-			auto children = m_filteredChildPackets[pack];
-
-			//Add an entry for the top level
-			RowData dat(wavetime, pack);
-			lastoff = pack->m_offset;
-
-			//Calculate row height
-			double height = padding*2 + lineheight;
-
-			//Integrate heights
-			dat.m_height = height;
-			totalHeight += height;
-			dat.m_totalHeight = totalHeight;
-
-			//Save this row
-			m_rows.push_back(dat);
+	//If we have a marker after the start of the last packet, add it now
+	//(loop because we might have two or more markers)
+	while( (imarker < markers.size()) && (markers[imarker].m_offset >= lastoff) )
+	{
+		RowData row(wavetime, markers[imarker]);
+		row.m_height = height;
+		rows.push_back(row);
 
-			if(IsChildOpen(pack))
-			{
-				for(auto child : children)
-				{
-					//Add an entry for the top level
-					RowData cdat(wavetime, child);
+		imarker ++;
+	}
 
-					//Calculate row height
-					height = padding*2 + lineheight;
+	m_rows.SetSegment(wavetime, std::move(rows));
+}
 
-					//Integrate heights
-					cdat.m_height = height;
-					totalHeight += height;
-					cdat.m_totalHeight = totalHeight;
+/**
+	@brief Rebuilds rows for any waveforms that have changed since the last refresh
+ */
+void PacketManager::RefreshIfPending()
+{
+	lock_guard<recursive_mutex> lock(m_mutex);
+	if(m_refreshPending)
+	{
+		LogTrace("Refreshing rows for %s due to pending changes\n", m_filter->GetDisplayName().c_str());
+		RefreshRows();
+	}
+	else if(!m_pendingRowRefreshes.empty())
+	{
+		for(auto t : m_pendingRowRefreshes)
+			RefreshRows(t);
+		m_pendingRowRefreshes.clear();
+	}
+}
 
-					//Save this row
-					m_rows.push_back(cdat);
-				}
-			}
-		}
+/**
+	@brief Expands or collapses the child packets under a packet
 
-		//If we have a marker after the start of the last packet, add it now
-		//(loop because we might have two or more markers)
-		while( (imarker < markers.size()) && (markers[imarker].m_offset >= lastoff) )
-		{
-			RowData row(wavetime, markers[imarker]);
-			row.m_height = padding*2 + lineheight;
-			totalHeight += row.m_height;
-			row.m_totalHeight = totalHeight;
-			m_rows.push_back(row);
+	@param stamp	Timestamp of the waveform containing the packet
+	@param index	Index of the packet within the waveform
+	@param open		True to expand, false to collapse
+ */
+void PacketManager::SetChildOpen(TimePoint stamp, size_t index, bool open)
+{
+	lock_guard<recursive_mutex> lock(m_mutex);
 
-			imarker ++;
-		}
-	}
+	auto it = m_packets.find(stamp);
+	if(it == m_packets.end())
+		return;
 
-	LogTrace("%zu rows\n", m_rows.size());
+	auto& block = *it->second;
+	if(block.IsChildOpen(index) == open)
+		return;
+	block.SetChildOpen(index, open);
+	m_pendingRowRefreshes.emplace(stamp);
 }
 
-void PacketManager::OnMarkerChanged()
+/**
+	@brief Handles a marker being added, removed, or modified
+
+	@param t	Timestamp of the waveform containing the marker
+ */
+void PacketManager::OnMarkerChanged(TimePoint t)
 {
 	lock_guard<recursive_mutex> lock(m_mutex);
-	RefreshRows();
+
+	//Only that waveform's rows need rebuilding (but not until we next render)
+	m_pendingRowRefreshes.emplace(t);
 }
 
 /**
@@ -209,8 +247,7 @@ void PacketManager::Update()
 	{
 		lock_guard<recursive_mutex> lock(m_mutex);
 
-		auto& outpackets = m_packets[time];
-		outpackets.clear();
+		auto block = make_unique<PacketBlock>();
 
 		auto& packets = m_filter->GetPackets();
 		auto npackets = packets.size();
@@ -237,7 +274,7 @@ void PacketManager::Update()
 				//Create the summary packet
 				firstChildPacketOfGroup = p;
 				parentOfGroup = m_filter->CreateMergedHeader(p, i);
-				outpackets.push_back(parentOfGroup);
+				block->AddPacket(parentOfGroup);
 			}
 
 			//End a merge group
@@ -249,75 +286,97 @@ void PacketManager::Update()
 
 			//If we're a child of an group, add under the parent node
 			if(parentOfGroup)
-				m_childPackets[parentOfGroup].push_back(p);
+				block->AddChild(p);
 
 			//Otherwise add at the top level
 			else
-				outpackets.push_back(p);
+				block->AddPacket(p);
 
 			lastPacket = p;
 		}
+
+		block->Compact();
+		m_packets[time] = std::move(block);
 	}
 	m_filter->DetachPackets();
 
-	//Run filters
-	FilterPackets();
+	//Run filters (only on the new packets, everything else is unchanged)
+	FilterPackets(time);
 }
 
 /**
-	@brief Run the filter expression against the packets
+	@brief Run the filter expression against all packets in history
+
+	This is only needed when the filter expression changes. New waveforms are filtered as they arrive.
  */
 void PacketManager::FilterPackets()
 {
-	//If we do NOT have a filter, early out: just copy stuff
-	if(m_filterExpression == nullptr)
-	{
-		m_filteredPackets = m_packets;
-		m_filteredChildPackets = m_childPackets;
+	lock_guard<recursive_mutex> lock(m_mutex);
+
+	for(auto& it : m_packets)
+		FilterPackets(it.first);
+
+	m_refreshPending = true;
+}
+
+/**
+	@brief Run the filter expression against the packets from a single waveform
+
+	@param timestamp	Timestamp of the waveform to filter
+ */
+void PacketManager::FilterPackets(TimePoint timestamp)
+{
+	lock_guard<recursive_mutex> lock(m_mutex);
 
-		//but still refresh the set of rows being displayed
-		m_refreshPending = true;
+	m_pendingRowRefreshes.emplace(timestamp);
+
+	auto it = m_packets.find(timestamp);
+	if(it == m_packets.end())
 		return;
-	}
+	auto& block = *it->second;
 
-	//We have a filter! Start out by clearing output, then we can re-add the ones that match
-	m_filteredPackets.clear();
-	m_filteredChildPackets.clear();
+	//Clear any previous results for this waveform
+	block.ClearFilterResults();
 
-	//Check all top level packets against the filter
-	for(auto it : m_packets)
+	for(size_t i=0; i<block.size(); i++)
 	{
-		auto timestamp = it.first;
-		auto& packets = it.second;
-		for(auto p : packets)
+		auto p = block.GetPacket(i);
+		size_t childStart = block.GetChildStart(i);
+		size_t childEnd = block.GetChildEnd(i);
+
+		//If we do NOT have a filter, just copy stuff
+		if(m_filterExpression == nullptr)
 		{
-			//If no children, just check the top level packet for a match
-			if(m_childPackets[p].empty())
-			{
-				if(m_filterExpression->Match(p))
-					m_filteredPackets[timestamp].push_back(p);
-			}
+			block.AddFilterResult(i);
+			for(size_t j=childStart; j<childEnd; j++)
+				block.AddFilteredChild(block.GetChild(j));
+		}
 
-			//We have children.
-			//Check them for matches, and add the parent if any child matches
-			else
+		//If no children, just check the top level packet for a match
+		else if(childStart == childEnd)
+		{
+			if(m_filterExpression->Match(p))
+				block.AddFilterResult(i);
+		}
+
+		//We have children.
+		//Check them for matches, and add the parent if any child matches
+		else
+		{
+			bool anyChildMatched = false;
+			for(size_t j=childStart; j<childEnd; j++)
 			{
-				bool anyChildMatched = false;
-				for(auto c : m_childPackets[p])
+				auto c = block.GetChild(j);
+				if(m_filterExpression->Match(c))
 				{
-					if(m_filterExpression->Match(c))
-					{
-						m_filteredChildPackets[p].push_back(c);
-						anyChildMatched = true;
-					}
+					if(!anyChildMatched)
+						block.AddFilterResult(i);
+					block.AddFilteredChild(c);
+					anyChildMatched = true;
 				}
-				if(anyChildMatched)
-					m_filteredPackets[timestamp].push_back(p);
 			}
 		}
 	}
-
-	m_refreshPending = true;
 }
 
 /**
@@ -331,420 +390,403 @@ void PacketManager::RemoveHistoryFrom(TimePoint timestamp)
 
 	LogTrace("Removing history from %s\n", timestamp.PrettyPrint().c_str());
 
-	auto& packets = m_packets[timestamp];
-	for(auto p : packets)
-	{
-		RemoveChildHistoryFrom(p);
-		delete p;
-	}
+	//Frees all of the packets and their state
 	m_packets.erase(timestamp);
 
-	m_filteredPackets.erase(timestamp);
-
 	//update the list of displayed rows so we don't have anything left pointing to stale packets
-	m_refreshPending = true;
+	m_pendingRowRefreshes.emplace(timestamp);
 }
 
-void PacketManager::RemoveChildHistoryFrom(Packet* pack)
+/**
+	@brief Returns the number of top level packets in history
+ */
+size_t PacketManager::GetPacketCount()
 {
-	//For now, we can only have one level of hierarchy
-	//so no need to check for children of children
-	auto& children = m_childPackets[pack];
-	for(auto p : children)
-		delete p;
-	m_childPackets.erase(pack);
-	m_filteredChildPackets.erase(pack);
-	m_lastChildOpen.erase(pack);
-}
+	lock_guard<recursive_mutex> lock(m_mutex);
 
-////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-// ProtocolDisplayFilter
+	size_t total = 0;
+	for(auto& it : m_packets)
+		total += it.second->size();
+	return total;
+}
 
-ProtocolDisplayFilter::ProtocolDisplayFilter(string str, size_t& i)
+/**
+	@brief Returns the number of top level packets in history which passed the current filter
+ */
+size_t PacketManager::GetFilteredPacketCount()
 {
-	//One or more clauses separated by operators
-	while(i < str.length())
-	{
-		//Read the clause
-		m_clauses.push_back(new ProtocolDisplayFilterClause(str, i));
-
-		//Remove spaces before the operator
-		EatSpaces(str, i);
-		if( (i >= str.length()) || (str[i] == ')') || (str[i] == ']') )
-			break;
-
-		//Read the operator, if any
-		string tmp;
-		while(i < str.length())
-		{
-			if(isspace(str[i]) || (str[i] == '\"') || (str[i] == '(') || (str[i] == ')') )
-				break;
-
-			//An alphanumeric character after an operator other than text terminates it
-			if( (tmp != "") && !isalnum(tmp[0]) && isalnum(str[i]) )
-				break;
+	lock_guard<recursive_mutex> lock(m_mutex);
 
-			tmp += str[i];
-			i++;
-		}
-		m_operators.push_back(tmp);
-	}
+	size_t total = 0;
+	for(auto& it : m_packets)
+		total += it.second->GetFilteredCount();
+	return total;
 }
 
-ProtocolDisplayFilter::~ProtocolDisplayFilter()
-{
-	for(auto c : m_clauses)
-		delete c;
-}
+/**
+	@brief Finds the packet (which passed the filter) at a given offset within a waveform
 
-bool ProtocolDisplayFilter::Validate(vector<string> headers, bool nakedLiteralOK)
+	@param stamp	Timestamp of the waveform
+	@param offset	Offset within the waveform
+
+	@return The matching packet, or null if none
+ */
+Packet* PacketManager::FindFilteredPacket(TimePoint stamp, int64_t offset)
 {
-	//No clauses? valid all-pass filter
-	if(m_clauses.empty())
-		return true;
+	lock_guard<recursive_mutex> lock(m_mutex);
 
-	//We should always have one more clause than operator
-	if( (m_operators.size() + 1) != m_clauses.size())
-		return false;
+	auto it = m_packets.find(stamp);
+	if(it == m_packets.end())
+		return nullptr;
+	auto& block = *it->second;
 
-	//Operators must make sense. For now only equal/unequal and boolean and/or allowed
-	for(auto op : m_operators)
+	//TODO: binary search vs linear
+	for(size_t i=0; i<block.GetFilteredCount(); i++)
 	{
-		if( (op != "==") &&
-			(op != "!=") &&
-			(op != "||") &&
-			(op != "&&") &&
-			(op != "startswith") &&
-			(op != "contains")
-		)
+		//Check child packets first
+		for(size_t j=block.GetFilteredChildStart(i); j<block.GetFilteredChildEnd(i); j++)
 		{
-			return false;
+			auto c = block.GetFilteredChild(j);
+			if(offset > (c->m_offset + c->m_len) )
+				continue;
+			if(c->m_offset > offset)
+				return nullptr;
+
+			return c;
 		}
-	}
 
-	//If any clause is invalid, we're invalid
-	for(auto c : m_clauses)
-	{
-		if(!c->Validate(headers))
-			return false;
-	}
+		//If we get here no child hit, try to match parent
+		auto p = block.GetPacket(block.GetFilteredIndex(i));
+		if(offset > (p->m_offset + p->m_len) )
+			continue;
+		if(p->m_offset > offset)
+			return nullptr;
 
-	//A single literal is not a legal filter, it has to be compared to something
-	//(But for sub-expressions used as indexes etc, it's OK)
-	if(!nakedLiteralOK)
-	{
-		if(m_clauses.size() == 1)
-		{
-			if(m_clauses[0]->m_type != ProtocolDisplayFilterClause::TYPE_EXPRESSION)
-				return false;
-		}
+		return p;
 	}
 
-	return true;
-}
-
-void ProtocolDisplayFilter::EatSpaces(string str, size_t& i)
-{
-	while( (i < str.length()) && isspace(str[i]) )
-		i++;
+	return nullptr;
 }
 
-bool ProtocolDisplayFilter::Match(const Packet* pack)
-{
-	if(m_clauses.empty())
-		return true;
-	else
-		return Evaluate(pack) != "0";
-}
+/**
+	@brief Gets statistics on memory used by packets in history
 
-string ProtocolDisplayFilter::Evaluate(const Packet* pack)
+	@param npackets		Number of packets (including child packets)
+	@param decodedBytes	Estimated size of the packets as they came out of the decoder
+	@param storedBytes	Estimated size of the packets after compaction, plus our own bookkeeping
+ */
+void PacketManager::GetMemoryUsage(size_t& npackets, size_t& decodedBytes, size_t& storedBytes)
 {
-	//Calling code checks for validity so no need to verify here
+	lock_guard<recursive_mutex> lock(m_mutex);
 
-	//For now, all operators have equal precedence and are evaluated left to right.
-	string current = m_clauses[0]->Evaluate(pack);
-	for(size_t i=1; i<m_clauses.size(); i++)
+	npackets = 0;
+	decodedBytes = 0;
+	storedBytes = 0;
+	for(auto& it : m_packets)
 	{
-		string rhs = m_clauses[i]->Evaluate(pack);
-		string op = m_operators[i-1];
-
-		bool a = (current != "0");
-		bool b = (rhs != "0");
-
-		//== and != do exact string equality checks
-		bool temp = false;
-		if(op == "==")
-			temp = (current == rhs);
-		else if(op == "!=")
-			temp = (current != rhs);
-
-		//&& and || do boolean operations
-		else if(op == "&&")
-			temp = (a && b);
-		else if(op == "||")
-			temp = (a || b);
-
-		//String prefix
-		else if(op == "startswith")
-			temp = (current.find(rhs) == 0);
-		else if(op == "contains")
-			temp = (current.find(rhs) != string::npos);
-
-		//done, convert back to string
-		current = temp ? "1" : "0";
+		npackets += it.second->GetTotalPacketCount();
+		decodedBytes += it.second->GetDecodedBytes();
+		storedBytes += it.second->GetStoredBytes();
 	}
-	return current;
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-// ProtocolDisplayFilterClause
+// PacketBlock
 
-ProtocolDisplayFilterClause::ProtocolDisplayFilterClause(string str, size_t& i)
+PacketBlock::PacketBlock()
+	: m_decodedBytes(0)
+	, m_packetBytes(0)
 {
-	ProtocolDisplayFilter::EatSpaces(str, i);
-
-	m_real = 0;
-	m_long = 0;
-	m_expression = 0;
-	m_invert = false;
+}
 
-	//Parenthetical expression
-	if( (str[i] == '(') || (str[i] == '!') )
-	{
-		//Inversion
-		if(str[i] == '!')
-		{
-			m_invert = true;
-			i++;
+PacketBlock::~PacketBlock()
+{
+	//Anything in m_storage is freed in one go when it's destroyed
+	for(auto p : m_heapPackets)
+		delete p;
+}
 
-			if(str[i] != '(')
-			{
-				m_type = TYPE_ERROR;
-				i++;
-				return;
-			}
-		}
+/**
+	@brief Adds a new top level packet
+ */
+void PacketBlock::AddPacket(Packet* pack)
+{
+	m_packets.push_back(pack);
+	m_childStart.push_back(m_children.size());
+}
 
-		i++;
-		m_type = TYPE_EXPRESSION;
-		m_expression = new ProtocolDisplayFilter(str, i);
+/**
+	@brief Adds a child packet under the most recently added top level packet
+ */
+void PacketBlock::AddChild(Packet* pack)
+{
+	m_children.push_back(pack);
+}
 
-		//eat trailing spaces
-		ProtocolDisplayFilter::EatSpaces(str, i);
+/**
+	@brief Moves the packets into block storage once all of them have been added, and calculates memory usage
 
-		//expect closing parentheses
-		if(str[i] != ')')
-			m_type = TYPE_ERROR;
-		i++;
-	}
+	Decoders allocate each packet separately on the heap. Here they're copied into a single array and the originals
+	freed, so the whole block is one allocation (plus the packets' own header and payload storage) which is released in
+	one go when the history point is deleted. Copying also drops the slack decoders leave in payloads by building
+	them one byte at a time.
 
-	//Quoted string
-	else if(str[i] == '\"')
+	Header tables and payloads are members of Packet, so they can't be interned or pooled without changing the
+	Packet class in libscopehal.
+ */
+void PacketBlock::Compact()
+{
+	//Only plain Packets go in m_storage. Copying a subclass in would slice it, so those stay on the heap.
+	size_t nstorage = 0;
+	for(auto list : {&m_packets, &m_children})
 	{
-		m_type = TYPE_STRING;
-		i++;
-
-		while( (i < str.length()) && (str[i] != '\"') )
+		for(auto p : *list)
 		{
-			m_string += str[i];
-			i++;
+			if(typeid(*p) == typeid(Packet))
+				nstorage ++;
 		}
-
-		if(str[i] != '\"')
-			m_type = TYPE_ERROR;
-
-		i++;
 	}
 
-	//Number
-	else if(isdigit(str[i]) || (str[i] == '-') || (str[i] == '.') )
-	{
-		string tmp;
-		while( (i < str.length()) && (isdigit(str[i]) || (str[i] == '-')  || (str[i] == '.') || (str[i] == 'x')) )
-		{
-			tmp += str[i];
-			i++;
-		}
-
-		//Hex string
-		if(tmp.find("0x") == 0)
-		{
-			sscanf(tmp.c_str(), "%lx", (unsigned long*)&m_long);
-			m_type = TYPE_INT;
-		}
-
-		//Number with decimal point
-		else if(tmp.find('.') != string::npos)
-		{
-			m_real = atof(tmp.c_str());
-			m_type = TYPE_REAL;
-		}
-
-		//Number without decimal point
-		else
-		{
-			m_real = atol(tmp.c_str());
-			m_type = TYPE_INT;
-		}
-	}
+	//Pointers into m_storage are handed out below, so it must never reallocate after this
+	m_storage.reserve(nstorage);
 
-	//Identifier (or data)
-	else
+	m_decodedBytes = 0;
+	m_packetBytes = 0;
+	for(auto list : {&m_packets, &m_children})
 	{
-		m_type = TYPE_IDENTIFIER;
-
-		while( (i < str.length()) && isalnum(str[i]) )
+		for(auto& p : *list)
 		{
-			m_identifier += str[i];
-			i++;
-		}
+			m_decodedBytes += EstimatePacketSize(p) + HEAP_ALLOCATION_OVERHEAD;
 
-		//Opening square bracket
-		if(str[i] == '[')
-		{
-			if(m_identifier == "data")
+			if(typeid(*p) == typeid(Packet))
 			{
-				m_type = TYPE_DATA;
-				i++;
-
-				//Read the index expression
-				m_expression = new ProtocolDisplayFilter(str, i);
-
-				//eat trailing spaces
-				ProtocolDisplayFilter::EatSpaces(str, i);
-
-				//expect closing square bracket
-				if(str[i] != ']')
-					m_type = TYPE_ERROR;
-				i++;
+				m_storage.push_back(*p);
+				delete p;
+				p = &m_storage.back();
+				m_packetBytes += EstimatePacketSize(p);
 			}
-
 			else
 			{
-				m_type = TYPE_ERROR;
-				i++;
+				p->m_data.shrink_to_fit();
+				m_heapPackets.push_back(p);
+				m_packetBytes += EstimatePacketSize(p) + HEAP_ALLOCATION_OVERHEAD;
 			}
 		}
-
-		if(m_identifier == "")
-		{
-			i++;
-			m_type = TYPE_ERROR;
-		}
 	}
+
+	m_packets.shrink_to_fit();
+	m_childStart.shrink_to_fit();
+	m_children.shrink_to_fit();
+	m_childOpen.assign(m_packets.size(), false);
 }
 
 /**
-	@brief Returns a copy of the input string with spaces removed
+	@brief Estimated memory usage of the packets and all of our state, after compaction
  */
-string ProtocolDisplayFilterClause::EatSpaces(string str)
+size_t PacketBlock::GetStoredBytes() const
 {
-	string ret;
-	for(auto c : str)
-	{
-		if(!isspace(c))
-			ret += c;
-	}
-	return ret;
+	return m_packetBytes +
+		sizeof(*this) +
+		(m_packets.capacity() + m_children.capacity() + m_filteredChildren.capacity() + m_heapPackets.capacity()) *
+			sizeof(Packet*) +
+		(m_childStart.capacity() + m_filtered.capacity() + m_filteredChildStart.capacity()) * sizeof(uint32_t) +
+		m_childOpen.capacity() / 8;
 }
 
-string ProtocolDisplayFilterClause::Evaluate(const Packet* pack)
+/**
+	@brief Returns the heap memory used by a string, if it doesn't fit in the small string buffer
+ */
+static size_t GetStringHeapSize(const string& str)
 {
-	char tmp[32];
+	//15 characters is typical for the small string buffer
+	if(str.capacity() <= 15)
+		return 0;
+	return str.capacity() + 1;
+}
 
-	switch(m_type)
+/**
+	@brief Estimates the memory used by a single packet
+ */
+size_t PacketBlock::EstimatePacketSize(const Packet* pack)
+{
+	size_t size = sizeof(Packet) + pack->m_data.capacity();
+	for(auto& it : pack->m_headers)
 	{
-		case TYPE_DATA:
-			{
-				string sindex = m_expression->Evaluate(pack);
-				int index = atoi(sindex.c_str());
+		//Tree node overhead (color plus three pointers), then the key and value
+		size += 4*sizeof(void*) + 2*sizeof(string);
+		size += GetStringHeapSize(it.first) + GetStringHeapSize(it.second);
+	}
+	return size;
+}
 
-				//Bounds check
-				if(pack->m_data.size() <= (size_t)index)
-					return "NaN";
+void PacketBlock::ClearFilterResults()
+{
+	m_filtered.clear();
+	m_filteredChildStart.clear();
+	m_filteredChildren.clear();
+}
 
-				return to_string(pack->m_data[index]);
-			}
-			break;
+/**
+	@brief Marks a top level packet as having passed the filter
 
-		case TYPE_IDENTIFIER:
-			{
-				auto it = pack->m_headers.find(m_identifier);
-				if(it != pack->m_headers.end())
-					return it->second;
-				else
-					return "NaN";
-			}
+	Any filtered child packets must be added immediately afterward.
+ */
+void PacketBlock::AddFilterResult(size_t i)
+{
+	m_filtered.push_back(i);
+	m_filteredChildStart.push_back(m_filteredChildren.size());
+}
 
-		case TYPE_STRING:
-			return m_string;
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// PacketRowIndex
 
-		case TYPE_REAL:
-			snprintf(tmp, sizeof(tmp), "%f", m_real);
-			return tmp;
+void PacketRowIndex::clear()
+{
+	m_segments.clear();
+	m_segmentHeights.clear();
+	m_segmentRowCounts.clear();
+}
 
-		case TYPE_INT:
-			snprintf(tmp, sizeof(tmp), "%ld", m_long);
-			return tmp;
+/**
+	@brief Replaces the rows for a single waveform
 
-		case TYPE_EXPRESSION:
-			if(m_invert)
-			{
-				if(m_expression->Evaluate(pack) == "1")
-					return "0";
-				else
-					return "1";
-			}
-			else
-				return m_expression->Evaluate(pack);
+	@param stamp	Timestamp of the waveform
+	@param rows		The new rows (if empty, the waveform is removed from the index)
+ */
+void PacketRowIndex::SetSegment(TimePoint stamp, vector<RowData>&& rows)
+{
+	auto it = lower_bound(
+		m_segments.begin(),
+		m_segments.end(),
+		stamp,
+		[](const Segment& seg, TimePoint t) { return seg.m_stamp < t; });
+	bool found = (it != m_segments.end()) && (it->m_stamp == stamp);
+
+	if(rows.empty())
+	{
+		if(!found)
+			return;
+		m_segments.erase(it);
+	}
+	else
+	{
+		if(!found)
+			it = m_segments.insert(it, Segment(stamp));
+
+		vector<double> heights;
+		heights.reserve(rows.size());
+		for(auto& r : rows)
+			heights.push_back(r.m_height);
+		it->m_heights.Build(heights);
+		it->m_rows = std::move(rows);
+	}
+
+	RebuildSegmentIndex();
+}
 
-		case TYPE_ERROR:
-		default:
-			return "NaN";
+/**
+	@brief Recalculates the running sums across segments
+ */
+void PacketRowIndex::RebuildSegmentIndex()
+{
+	vector<double> heights;
+	vector<size_t> counts;
+	heights.reserve(m_segments.size());
+	counts.reserve(m_segments.size());
+	for(auto& seg : m_segments)
+	{
+		heights.push_back(seg.m_heights.Total());
+		counts.push_back(seg.m_rows.size());
 	}
+	m_segmentHeights.Build(heights);
+	m_segmentRowCounts.Build(counts);
+}
 
-	//never happens because of the 'default" clause, but prevents -Wreturn-type warning with some gcc versions
-	return "NaN";
+/**
+	@brief Finds the segment containing a row, and the row's position within it
+ */
+void PacketRowIndex::Locate(size_t i, size_t& segment, size_t& local)
+{
+	segment = m_segmentRowCounts.LowerBound(i+1);
+	local = i - m_segmentRowCounts.Prefix(segment);
 }
 
-ProtocolDisplayFilterClause::~ProtocolDisplayFilterClause()
+RowData& PacketRowIndex::GetRow(size_t i)
 {
-	if(m_expression)
-		delete m_expression;
+	size_t segment;
+	size_t local;
+	Locate(i, segment, local);
+	return m_segments[segment].m_rows[local];
 }
 
-bool ProtocolDisplayFilterClause::Validate(vector<string> headers)
+/**
+	@brief Returns the Y coordinate of the top of a row
+ */
+double PacketRowIndex::GetRowTop(size_t i)
 {
-	switch(m_type)
-	{
-		case TYPE_ERROR:
-			return false;
+	size_t segment;
+	size_t local;
+	Locate(i, segment, local);
+	return m_segmentHeights.Prefix(segment) + m_segments[segment].m_heights.Prefix(local);
+}
 
-		case TYPE_DATA:
-			return m_expression->Validate(headers, true);
+/**
+	@brief Returns the index of the first row whose bottom edge is at or below the specified Y coordinate
 
-		//If we're an identifier, we must be a valid header field
-		//TODO: support comparisons on data
-		case TYPE_IDENTIFIER:
-			for(auto h : headers)
-			{
-				//Match, removing spaces from header names if needed
-				//Note that m_identifier is now the real, un-spaced version of the identifier name
-				//so we can look it up in the packet
-				if(EatSpaces(h) == m_identifier)
-				{
-					m_identifier = h;
-					return true;
-				}
-			}
+	Returns size() if there is no such row.
+ */
+size_t PacketRowIndex::FindRowAtHeight(double y)
+{
+	size_t segment = m_segmentHeights.LowerBound(y);
+	if(segment >= m_segments.size())
+		return size();
+
+	auto& seg = m_segments[segment];
+	size_t local = seg.m_heights.LowerBound(y - m_segmentHeights.Prefix(segment));
 
-			return false;
+	//Clamp in case of rounding error in the running sums
+	if(local >= seg.m_rows.size())
+		local = seg.m_rows.size() - 1;
+
+	return m_segmentRowCounts.Prefix(segment) + local;
+}
 
-		//If we're an expression, it must be valid
-		case TYPE_EXPRESSION:
-			return m_expression->Validate(headers);
+/**
+	@brief Returns the index of the first row at or after the specified offset within its waveform
 
-		default:
-			return true;
+	Rows are only sorted by offset within a single waveform, so this is approximate if more than one is present.
+	Returns size() if there is no such row.
+ */
+size_t PacketRowIndex::FindRowAtOffset(int64_t offset)
+{
+	size_t lo = 0;
+	size_t hi = size();
+	while(lo < hi)
+	{
+		size_t mid = lo + (hi - lo) / 2;
+		auto& row = GetRow(mid);
+		int64_t rowoff = row.m_packet ? row.m_packet->m_offset : row.m_marker.m_offset;
+		if(rowoff < offset)
+			lo = mid + 1;
+		else
+			hi = mid;
 	}
+	return lo;
+}
+
+/**
+	@brief Changes the height of a single row
+ */
+void PacketRowIndex::SetRowHeight(size_t i, double height)
+{
+	size_t segment;
+	size_t local;
+	Locate(i, segment, local);
+
+	auto& row = m_segments[segment].m_rows[local];
+	double delta = height - row.m_height;
+	row.m_height = height;
+
+	m_segments[segment].m_heights.Add(local, delta);
+	m_segmentHeights.Add(segment, delta);
 }
@@ -36,7 +36,9 @@
 #define PacketManager_h
 
 #include "../../lib/scopehal/PacketDecoder.h"
+#include "FenwickTree.h"
 #include "Marker.h"
+#include "ProtocolDisplayFilter.h"
 #include "TextureManager.h"
 
 class Session;
@@ -49,40 +51,46 @@ class RowData
 public:
 	RowData()
 	: m_height(0)
-	, m_totalHeight(0)
 	, m_stamp(0, 0)
 	, m_packet(nullptr)
+	, m_index(0)
+	, m_hasChildren(false)
 	, m_marker(TimePoint(0,0), 0, "")
 	{}
 
-	RowData(TimePoint t, Packet* p)
+	RowData(TimePoint t, Packet* p, size_t index, bool hasChildren = false)
 	: m_height(0)
-	, m_totalHeight(0)
 	, m_stamp(t)
 	, m_packet(p)
+	, m_index(index)
+	, m_hasChildren(hasChildren)
 	, m_marker(t, 0, "")
 	{}
 
 	RowData(TimePoint t, Marker m)
 	: m_height(0)
-	, m_totalHeight(0)
 	, m_stamp(t)
 	, m_packet(nullptr)
+	, m_index(0)
+	, m_hasChildren(false)
 	, m_marker(m)
 	{}
 
 	///@brief Height of this row
 	double m_height;
 
-	///@brief Total height of the entire list up to this point
-	double m_totalHeight;
-
 	///@brief Timestamp of the waveform this packet came from
 	TimePoint m_stamp;
 
 	///@brief The packet in this row (null if m_marker is valid)
 	Packet* m_packet;
 
+	///@brief Index of the top level packet within its PacketBlock (for child packets, index of the parent)
+	size_t m_index;
+
+	///@brief True if this is a top level packet with child packets that passed the filter
+	bool m_hasChildren;
+
 	///@brief The marker in this row (ignored if m_packet is valid)
 	Marker m_marker;
 
@@ -90,60 +98,196 @@ public:
 	std::shared_ptr<Texture> m_texture;
 };
 
-class ProtocolDisplayFilter;
+/**
+	@brief All of the packets decoded from a single waveform, plus filter results and display state
 
-class ProtocolDisplayFilterClause
+	Everything is stored in flat per-waveform arrays indexed by packet position rather than in per-packet map
+	entries, so deleting a waveform from history frees its packets and all associated state in one go.
+	Children of each top level packet are contiguous, since merged packets always immediately follow their parent.
+ */
+class PacketBlock
 {
 public:
-	ProtocolDisplayFilterClause(std::string str, size_t& i);
-	ProtocolDisplayFilterClause(const ProtocolDisplayFilterClause&) =delete;
-	ProtocolDisplayFilterClause& operator=(const ProtocolDisplayFilterClause&) =delete;
+	PacketBlock();
+	~PacketBlock();
 
-	virtual ~ProtocolDisplayFilterClause();
+	PacketBlock(const PacketBlock&) =delete;
+	PacketBlock& operator=(const PacketBlock&) =delete;
 
-	bool Validate(std::vector<std::string> headers);
+	void AddPacket(Packet* pack);
+	void AddChild(Packet* pack);
+	void Compact();
 
-	std::string Evaluate(const Packet* pack);
+	///@brief Returns the number of top level packets
+	size_t size() const
+	{ return m_packets.size(); }
 
-	static std::string EatSpaces(std::string str);
+	///@brief Returns the total number of packets, including children
+	size_t GetTotalPacketCount() const
+	{ return m_packets.size() + m_children.size(); }
 
-	enum
-	{
-		TYPE_DATA,
-		TYPE_IDENTIFIER,
-		TYPE_STRING,
-		TYPE_REAL,
-		TYPE_INT,
-		TYPE_EXPRESSION,
-		TYPE_ERROR
-	} m_type;
-
-	std::string m_identifier;
-	std::string m_string;
-	float m_real;
-	long m_long;
-	ProtocolDisplayFilter* m_expression;
-	bool m_invert;
+	Packet* GetPacket(size_t i)
+	{ return m_packets[i]; }
+
+	///@brief Returns the index of the first child of the specified top level packet in m_children
+	size_t GetChildStart(size_t i) const
+	{ return m_childStart[i]; }
+
+	///@brief Returns one past the index of the last child of the specified top level packet in m_children
+	size_t GetChildEnd(size_t i) const
+	{ return (i+1 < m_childStart.size()) ? m_childStart[i+1] : m_children.size(); }
+
+	Packet* GetChild(size_t i)
+	{ return m_children[i]; }
+
+	void ClearFilterResults();
+	void AddFilterResult(size_t i);
+
+	///@brief Adds a child packet which passed the filter, under the most recently added filter result
+	void AddFilteredChild(Packet* pack)
+	{ m_filteredChildren.push_back(pack); }
+
+	///@brief Returns the number of top level packets which passed the filter
+	size_t GetFilteredCount() const
+	{ return m_filtered.size(); }
+
+	///@brief Returns the index (in m_packets) of a packet which passed the filter
+	size_t GetFilteredIndex(size_t i) const
+	{ return m_filtered[i]; }
+
+	///@brief Returns the index of the first filtered child of a filter result in m_filteredChildren
+	size_t GetFilteredChildStart(size_t i) const
+	{ return m_filteredChildStart[i]; }
+
+	///@brief Returns one past the index of the last filtered child of a filter result in m_filteredChildren
+	size_t GetFilteredChildEnd(size_t i) const
+	{ return (i+1 < m_filteredChildStart.size()) ? m_filteredChildStart[i+1] : m_filteredChildren.size(); }
+
+	Packet* GetFilteredChild(size_t i)
+	{ return m_filteredChildren[i]; }
+
+	bool IsChildOpen(size_t i) const
+	{ return m_childOpen[i]; }
+
+	void SetChildOpen(size_t i, bool open)
+	{ m_childOpen[i] = open; }
+
+	///@brief Estimated memory usage of the packets as they came out of the decoder
+	size_t GetDecodedBytes() const
+	{ return m_decodedBytes; }
+
+	size_t GetStoredBytes() const;
+
+	static size_t EstimatePacketSize(const Packet* pack);
+
+protected:
+	///@brief Approximate allocator bookkeeping overhead for each separately allocated packet
+	static const size_t HEAP_ALLOCATION_OVERHEAD = 2*sizeof(void*);
+
+	///@brief Block storage for the packets (everything in m_packets and m_children points into this or m_heapPackets)
+	std::vector<Packet> m_storage;
+
+	///@brief Packets of derived types, which can't be moved into m_storage and are still individually allocated
+	std::vector<Packet*> m_heapPackets;
+
+	///@brief Top level packets, in order
+	std::vector<Packet*> m_packets;
+
+	///@brief Index of the first child of each top level packet in m_children
+	std::vector<uint32_t> m_childStart;
+
+	///@brief Child packets, grouped by parent
+	std::vector<Packet*> m_children;
+
+	///@brief Tree expansion state of each top level packet
+	std::vector<bool> m_childOpen;
+
+	///@brief Indexes of top level packets which passed the current filter expression
+	std::vector<uint32_t> m_filtered;
+
+	///@brief Index of the first filtered child of each filter result in m_filteredChildren
+	std::vector<uint32_t> m_filteredChildStart;
+
+	///@brief Child packets which passed the current filter expression, grouped by parent
+	std::vector<Packet*> m_filteredChildren;
+
+	///@brief See GetDecodedBytes()
+	size_t m_decodedBytes;
+
+	///@brief Estimated memory usage of the packets after compaction (not including our own state)
+	size_t m_packetBytes;
 };
 
-class ProtocolDisplayFilter
+/**
+	@brief Index of all rows displayed in a protocol analyzer
+
+	Rows are stored in one segment per waveform, sorted by timestamp, so a single waveform can be added, removed, or
+	rebuilt without touching the others. Running sums of row heights are kept in Fenwick trees (one per segment, plus
+	one across segments) so finding the row at a given scroll position, or resizing a row, is O(log n).
+ */
+class PacketRowIndex
 {
 public:
-	ProtocolDisplayFilter(std::string str, size_t& i);
-	ProtocolDisplayFilter(const ProtocolDisplayFilterClause&) =delete;
-	ProtocolDisplayFilter& operator=(const ProtocolDisplayFilter&) =delete;
-	virtual ~ProtocolDisplayFilter();
+	void clear();
+
+	void SetSegment(TimePoint stamp, std::vector<RowData>&& rows);
+
+	///@brief Removes the segment for a given waveform, if present
+	void RemoveSegment(TimePoint stamp)
+	{ SetSegment(stamp, std::vector<RowData>()); }
 
-	static void EatSpaces(std::string str, size_t& i);
+	///@brief Returns the number of rows
+	size_t size() const
+	{ return m_segmentRowCounts.Total(); }
 
-	bool Validate(std::vector<std::string> headers, bool nakedLiteralOK = false);
+	bool empty() const
+	{ return m_segments.empty(); }
 
-	bool Match(const Packet* pack);
-	std::string Evaluate(const Packet* pack);
+	RowData& GetRow(size_t i);
+	double GetRowTop(size_t i);
+
+	///@brief Returns the Y coordinate of the bottom of a row
+	double GetRowBottom(size_t i)
+	{ return GetRowTop(i) + GetRow(i).m_height; }
+
+	///@brief Returns the total height of all rows
+	double GetTotalHeight() const
+	{ return m_segmentHeights.Total(); }
+
+	size_t FindRowAtHeight(double y);
+	size_t FindRowAtOffset(int64_t offset);
+	void SetRowHeight(size_t i, double height);
 
 protected:
-	std::vector<ProtocolDisplayFilterClause*> m_clauses;
-	std::vector<std::string> m_operators;
+	void Locate(size_t i, size_t& segment, size_t& local);
+	void RebuildSegmentIndex();
+
+	///@brief Rows from a single waveform
+	class Segment
+	{
+	public:
+		Segment(TimePoint stamp)
+		: m_stamp(stamp)
+		{}
+
+		///@brief Timestamp of the waveform
+		TimePoint m_stamp;
+
+		///@brief The rows
+		std::vector<RowData> m_rows;
+
+		///@brief Running sum of row heights
+		FenwickTree<double> m_heights;
+	};
+
+	///@brief Segments sorted by timestamp (empty segments are not stored)
+	std::vector<Segment> m_segments;
+
+	///@brief Running sum of total segment heights
+	FenwickTree<double> m_segmentHeights;
+
+	///@brief Running sum of segment row counts
+	FenwickTree<size_t> m_segmentRowCounts;
 };
 
 /**
@@ -161,17 +305,10 @@ public:
 	std::recursive_mutex& GetMutex()
 	{ return m_mutex; }
 
-	const std::map<TimePoint, std::vector<Packet*> >& GetPackets()
-	{ return m_packets; }
-
-	const std::vector<Packet*>& GetChildPackets(Packet* pack)
-	{ return m_childPackets[pack]; }
-
-	const std::map<TimePoint, std::vector<Packet*> >& GetFilteredPackets()
-	{ return m_filteredPackets; }
-
-	const std::vector<Packet*>& GetFilteredChildPackets(Packet* pack)
-	{ return m_filteredChildPackets[pack]; }
+	size_t GetPacketCount();
+	size_t GetFilteredPacketCount();
+	Packet* FindFilteredPacket(TimePoint stamp, int64_t offset);
+	void GetMemoryUsage(size_t& npackets, size_t& decodedBytes, size_t& storedBytes);
 
 	/**
 		@brief Sets the current filter expression
@@ -183,37 +320,21 @@ public:
 	}
 
 	void FilterPackets();
+	void FilterPackets(TimePoint timestamp);
 
-	bool IsChildOpen(Packet* pack)
-	{ return m_lastChildOpen[pack]; }
+	void SetChildOpen(TimePoint stamp, size_t index, bool open);
 
-	void SetChildOpen(Packet* pack, bool open)
-	{ m_lastChildOpen[pack] = open; }
-
-	std::vector<RowData>& GetRows()
+	PacketRowIndex& GetRows()
 	{
 		RefreshIfPending();
 		return m_rows;
 	}
 
-	void OnMarkerChanged();
+	void OnMarkerChanged(TimePoint t);
 
-	/**
-		@brief Refresh the list of pending packets
-	 */
-	void RefreshIfPending()
-	{
-		std::lock_guard<std::recursive_mutex> lock(m_mutex);
-		if(m_refreshPending)
-		{
-			LogTrace("Refreshing rows for %s due to pending changes\n", m_filter->GetDisplayName().c_str());
-			RefreshRows();
-		}
-	}
+	void RefreshIfPending();
 
 protected:
-	void RemoveChildHistoryFrom(Packet* pack);
-
 	///@brief Parent session object
 	Session& m_session;
 
@@ -223,17 +344,8 @@ protected:
 	///@brief The filter we're managing
 	PacketDecoder* m_filter;
 
-	///@brief Our saved packet data
-	std::map<TimePoint, std::vector<Packet*> > m_packets;
-
-	///@brief Merged child packets
-	std::map<Packet*, std::vector<Packet*> > m_childPackets;
-
-	///@brief Subset of m_packets that passed the current filter expression
-	std::map<TimePoint, std::vector<Packet*> > m_filteredPackets;
-
-	///@brief Subset of m_filteredChildPackets that passed the current filter expression
-	std::map<Packet*, std::vector<Packet*> > m_filteredChildPackets;
+	///@brief Our saved packet data, and filter results
+	std::map<TimePoint, std::unique_ptr<PacketBlock> > m_packets;
 
 	///@brief Cache key for the current waveform
 	WaveformCacheKey m_cachekey;
@@ -241,16 +353,16 @@ protected:
 	///@brief Current filter expression
 	std::shared_ptr<ProtocolDisplayFilter> m_filterExpression;
 
-	///@brief Update the list of rows being displayed
 	void RefreshRows();
+	void RefreshRows(TimePoint wavetime);
 
 	///@brief The set of rows that are to be displayed, based on current tree expansion and filter state
-	std::vector<RowData> m_rows;
+	PacketRowIndex m_rows;
 
-	///@brief Map of packets to child-open flags from last frame
-	std::map<Packet*, bool> m_lastChildOpen;
+	///@brief Waveforms whose rows need to be rebuilt before we can render
+	std::set<TimePoint> m_pendingRowRefreshes;
 
-	///@brief True if we have a refresh pending before we can render (i.e. pending deletion or similar)
+	///@brief True if we have a refresh of all rows pending before we can render (i.e. filter changed or similar)
 	bool m_refreshPending;
 };
 
@@ -0,0 +1,98 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* ngscopeclient                                                                                                        *
+*                                                                                                                      *
+* Copyright (c) 2012-2025 Andrew D. Zonenberg and contributors                                                         *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+/**
+	@file
+	@author Andrew D. Zonenberg
+	@brief Implementation of PollScheduler
+ */
+#include "ngscopeclient.h"
+#include "PollScheduler.h"
+
+using namespace std;
+
+///@brief Smallest nonzero interval to back off to when idle, so a zero poll budget still backs off
+static const int64_t g_minBackoffInterval = FS_PER_SECOND / 10000;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Construction / destruction
+
+PollScheduler::PollScheduler()
+	: m_minInterval(0)
+	, m_maxInterval(0)
+	, m_interval(0)
+	, m_deadline(GetTime())
+{
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Scheduling
+
+/**
+	@brief Updates the minimum and maximum poll intervals
+
+	@param minInterval	Interval to use when the instrument is busy (zero to spin)
+	@param maxInterval	Ceiling for backoff when the instrument is idle
+ */
+void PollScheduler::SetLimits(int64_t minInterval, int64_t maxInterval)
+{
+	m_minInterval = max(minInterval, static_cast<int64_t>(0));
+	m_maxInterval = max(maxInterval, m_minInterval);
+	m_interval = min(max(m_interval, m_minInterval), m_maxInterval);
+}
+
+/**
+	@brief Notifies the scheduler that the last poll found work to do, so we should poll again as soon as allowed
+ */
+void PollScheduler::OnActivity()
+{
+	m_interval = m_minInterval;
+}
+
+/**
+	@brief Notifies the scheduler that the last poll found nothing to do, so we can back off
+ */
+void PollScheduler::OnIdle()
+{
+	m_interval = min(max(m_interval * 2, g_minBackoffInterval), m_maxInterval);
+}
+
+/**
+	@brief Blocks until it's time for the next poll
+
+	A zero interval just yields, so the GUI and other threads still get a chance at any mutexes we hold between polls.
+ */
+void PollScheduler::Wait()
+{
+	m_deadline = GetTime() + static_cast<double>(m_interval) / FS_PER_SECOND;
+	if(m_interval <= 0)
+		this_thread::yield();
+	else
+		this_thread::sleep_for(chrono::nanoseconds(static_cast<int64_t>(m_interval * 1e9 / FS_PER_SECOND)));
+}
@@ -0,0 +1,92 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* ngscopeclient                                                                                                        *
+*                                                                                                                      *
+* Copyright (c) 2012-2025 Andrew D. Zonenberg and contributors                                                         *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+/**
+	@file
+	@author Andrew D. Zonenberg
+	@brief Declaration of PollScheduler
+ */
+#ifndef PollScheduler_h
+#define PollScheduler_h
+
+/**
+	@brief Adaptive polling interval for an InstrumentThread
+
+	The interval starts out at the minimum (the per-instrument-type poll budget) and doubles every time a poll finds
+	nothing to do, up to a configurable ceiling. Any activity snaps it back down to the minimum.
+
+	All intervals are in femtoseconds.
+ */
+class PollScheduler
+{
+public:
+	///@brief Instrument types with separately configurable poll budgets
+	enum InstrumentClass
+	{
+		CLASS_SCOPE,
+		CLASS_PSU,
+		CLASS_METER,
+		CLASS_LOAD,
+		CLASS_BERT,
+		CLASS_AWG,
+		CLASS_MISC,
+
+		CLASS_COUNT
+	};
+
+	PollScheduler();
+
+	void SetLimits(int64_t minInterval, int64_t maxInterval);
+	void OnActivity();
+	void OnIdle();
+	void Wait();
+
+	///@brief Gets the interval that the next call to Wait() will sleep for
+	int64_t GetInterval()
+	{ return m_interval; }
+
+	///@brief Gets the time (as returned by GetTime()) at which the last call to Wait() was due to return
+	double GetDeadline()
+	{ return m_deadline; }
+
+protected:
+	///@brief Interval used when the instrument is busy
+	int64_t m_minInterval;
+
+	///@brief Upper bound for backoff when the instrument is idle
+	int64_t m_maxInterval;
+
+	///@brief Current interval
+	int64_t m_interval;
+
+	///@brief Time at which the last call to Wait() was due to return
+	double m_deadline;
+};
+
+#endif
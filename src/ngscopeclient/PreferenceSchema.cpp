@@ -509,6 +509,20 @@ void PreferenceManager::InitializeDefaults()
 			.Label("Max recent files")
 			.Description("Maximum number of recent .scopesession file paths to save in history")
 			.Unit(Unit::UNIT_COUNTS));
+		files.AddPreference(
+			Preference::Bool("compress_waveforms", false)
+			.Label("Compress waveform data")
+			.Description(
+				"Save uniformly sampled waveforms in a compressed format.\n\n"
+				"Digital channels are stored as one bit per sample, and analog channels as 8 or 16 bit ADC codes\n"
+				"where possible. Compression is lossless, but sessions saved this way can't be opened by older\n"
+				"versions of ngscopeclient."));
+		files.AddPreference(
+			Preference::Bool("columnar_sparse_waveforms", false)
+			.Label("Columnar sparse waveforms")
+			.Description(
+				"Save sparsely sampled waveforms (including most filter outputs) in the columnar \"sparsev2\" format.\n\n"
+				"Sessions saved this way load much faster, but can't be opened by older versions of ngscopeclient."));
 
 	auto& misc = this->m_treeRoot.AddCategory("Miscellaneous");
 		auto& menus = misc.AddCategory("Menus");
@@ -517,6 +531,209 @@ void PreferenceManager::InitializeDefaults()
 				.Label("Recent instrument count")
 				.Description("Number of recently used instruments to display"));
 
+	auto& perf = this->m_treeRoot.AddCategory("Performance");
+		auto& pipeline = perf.AddCategory("Pipeline");
+			pipeline.AddPreference(
+				Preference::Int("depth", 2)
+				.Label("Pipeline depth")
+				.Description(
+					"Maximum number of processed waveforms which may be waiting to be displayed.\n\n"
+					"With a depth of 1, each waveform is downloaded, filtered, rendered, and displayed before the\n"
+					"next one is downloaded. Larger values allow the next waveform to be processed while the\n"
+					"previous one is still being displayed, improving update rate at high trigger rates at\n"
+					"the cost of slightly higher display latency.")
+				.Unit(Unit::UNIT_COUNTS));
+
+		auto& polling = perf.AddCategory("Polling");
+			polling.AddPreference(
+				Preference::Real("scope_interval", FS_PER_SECOND / 10000)
+				.Label("Oscilloscope poll interval")
+				.Unit(Unit::UNIT_FS)
+				.Description(
+					"Minimum interval between trigger status polls of an oscilloscope while its trigger is armed.\n\n"
+					"Shorter intervals reduce the latency between a trigger event and the waveform being downloaded.\n"
+					"Set to zero to poll continuously (only yielding between polls), which gives the lowest latency\n"
+					"at the cost of keeping one CPU core busy per instrument.\n\n"
+					"Idle instruments are polled less often, backing off up to the maximum idle interval.")
+				);
+			polling.AddPreference(
+				Preference::Real("psu_interval", FS_PER_SECOND / 100)
+				.Label("Power supply poll interval")
+				.Unit(Unit::UNIT_FS)
+				.Description(
+					"Minimum interval between status polls of a power supply.\n\n"
+					"Idle instruments are polled less often, backing off up to the maximum idle interval.")
+				);
+			polling.AddPreference(
+				Preference::Real("meter_interval", FS_PER_SECOND / 100)
+				.Label("Multimeter poll interval")
+				.Unit(Unit::UNIT_FS)
+				.Description(
+					"Minimum interval between readings from a multimeter.\n\n"
+					"Idle instruments are polled less often, backing off up to the maximum idle interval.")
+				);
+			polling.AddPreference(
+				Preference::Real("load_interval", FS_PER_SECOND / 100)
+				.Label("Load poll interval")
+				.Unit(Unit::UNIT_FS)
+				.Description(
+					"Minimum interval between status polls of an electronic load.\n\n"
+					"Idle instruments are polled less often, backing off up to the maximum idle interval.")
+				);
+			polling.AddPreference(
+				Preference::Real("bert_interval", FS_PER_SECOND / 100)
+				.Label("BERT poll interval")
+				.Unit(Unit::UNIT_FS)
+				.Description(
+					"Minimum interval between status polls of a bit error rate tester.\n\n"
+					"Idle instruments are polled less often, backing off up to the maximum idle interval.")
+				);
+			polling.AddPreference(
+				Preference::Real("awg_interval", FS_PER_SECOND / 100)
+				.Label("Function generator poll interval")
+				.Unit(Unit::UNIT_FS)
+				.Description(
+					"Minimum interval between status polls of a function generator.\n\n"
+					"Idle instruments are polled less often, backing off up to the maximum idle interval.")
+				);
+			polling.AddPreference(
+				Preference::Real("misc_interval", FS_PER_SECOND / 100)
+				.Label("Other poll interval")
+				.Unit(Unit::UNIT_FS)
+				.Description(
+					"Minimum interval between polls of any other type of instrument.\n\n"
+					"Idle instruments are polled less often, backing off up to the maximum idle interval.")
+				);
+			polling.AddPreference(
+				Preference::Real("max_idle_interval", FS_PER_SECOND / 20)
+				.Label("Maximum idle interval")
+				.Unit(Unit::UNIT_FS)
+				.Description(
+					"Upper limit on the poll interval for instruments with nothing to do (for example an\n"
+					"oscilloscope which is not armed, or a power supply whose readings are not changing).\n\n"
+					"Polling backs off exponentially up to this value while idle and returns to the per-type\n"
+					"interval as soon as there is activity.")
+				);
+
+		auto& logging = perf.AddCategory("Logging");
+			logging.AddPreference(
+				Preference::Int("history_depth", 100000)
+				.Label("Log history depth")
+				.Description(
+					"Maximum number of lines kept in the log viewer.\n\n"
+					"Once this is reached, the oldest lines are discarded as new ones arrive.")
+				.Unit(Unit::UNIT_COUNTS));
+			logging.AddPreference(
+				Preference::Int("queue_depth", 4096)
+				.Label("Log queue depth")
+				.Description(
+					"Maximum number of log messages waiting to be shown in the log viewer.\n\n"
+					"Messages logged faster than the GUI can process them are dropped once this is reached.\n"
+					"Rounded up to a power of two.")
+				.Unit(Unit::UNIT_COUNTS));
+
+		auto& history = perf.AddCategory("History");
+			history.AddPreference(
+				Preference::Bool("filter_cache", true)
+				.Label("Cache filter outputs")
+				.Description(
+					"Save the outputs of expensive filters alongside each waveform in history.\n\n"
+					"When revisiting a point in history, cached outputs are restored instead of re-running the\n"
+					"filters that produced them. This uses more memory per history point; cached outputs are\n"
+					"discarded first if memory runs low."));
+			history.AddPreference(
+				Preference::Real("filter_cache_min_runtime", FS_PER_SECOND / 1000)
+				.Label("Minimum runtime to cache")
+				.Unit(Unit::UNIT_FS)
+				.Description(
+					"Only cache outputs of filters which took at least this long to run.\n\n"
+					"Re-running fast filters is cheaper than keeping a copy of their output for every point in history.")
+				);
+			history.AddPreference(
+				Preference::Int("gpu_budget", 1024LL * 1024 * 1024)
+				.Label("GPU memory budget")
+				.Unit(Unit::UNIT_BYTES)
+				.Description(
+					"Maximum amount of GPU memory used by waveforms in history.\n\n"
+					"Older waveforms beyond this are moved to pinned host memory."));
+			history.AddPreference(
+				Preference::Int("pinned_budget", 1024LL * 1024 * 1024)
+				.Label("Pinned memory budget")
+				.Unit(Unit::UNIT_BYTES)
+				.Description(
+					"Maximum amount of pinned host memory used by waveforms in history.\n\n"
+					"Pinned memory can be copied back to the GPU quickly, but is a limited resource.\n"
+					"Older waveforms beyond this are moved to pageable host memory."));
+			history.AddPreference(
+				Preference::Int("pageable_budget", 4096LL * 1024 * 1024)
+				.Label("Pageable memory budget")
+				.Unit(Unit::UNIT_BYTES)
+				.Description(
+					"Maximum amount of ordinary host memory used by waveforms in history.\n\n"
+					"Older waveforms beyond this are written to a temporary file on disk."));
+			history.AddPreference(
+				Preference::Int("disk_budget", 16384LL * 1024 * 1024)
+				.Label("Disk budget")
+				.Unit(Unit::UNIT_BYTES)
+				.Description(
+					"Maximum amount of temporary disk space used by waveforms in history.\n\n"
+					"Once all budgets are full, the oldest un-pinned waveforms are deleted.\n"
+					"Set to zero to never write history to disk."));
+
+		auto& loading = perf.AddCategory("Loading");
+			loading.AddPreference(
+				Preference::Bool("lazy_load", false)
+				.Label("Lazy history loading")
+				.Description(
+					"Only load the most recent waveform when opening a session.\n\n"
+					"Older history is read from the session file when it's selected, which makes opening large\n"
+					"sessions much faster. Protocol decodes for older history are not available until the\n"
+					"corresponding point has been selected."));
+			loading.AddPreference(
+				Preference::Int("max_inflight_bytes", 2048LL * 1024 * 1024)
+				.Label("Max in-flight data")
+				.Unit(Unit::UNIT_BYTES)
+				.Description(
+					"Maximum total size of waveform files being decoded at once when opening a session.\n\n"
+					"Files are loaded in parallel; larger values use more threads on sessions with big waveforms,\n"
+					"smaller values reduce peak memory and disk cache usage while loading."));
+
+		auto& rendering = perf.AddCategory("Rendering");
+			rendering.AddPreference(
+				Preference::Enum("texture_format", TEXTURE_FORMAT_RGBA32F)
+					.Label("Waveform texture format")
+					.Description(
+						"Pixel format of the tone mapped textures for analog and digital waveforms.\n\n"
+						"The display is normally 8 bits per channel, so RGBA8 looks the same as the others while using\n"
+						"a quarter of the memory and bandwidth of RGBA32F. RGBA32F is the default for now, while the\n"
+						"reduced precision tone mapping shaders get more testing.")
+					.EnumValue("RGBA8", TEXTURE_FORMAT_RGBA8)
+					.EnumValue("RGBA16F", TEXTURE_FORMAT_RGBA16F)
+					.EnumValue("RGBA32F", TEXTURE_FORMAT_RGBA32F)
+				);
+			rendering.AddPreference(
+				Preference::Enum("rasterize_format", RASTERIZE_FP32)
+					.Label("Rasterization precision")
+					.Description(
+						"Precision of the intensity buffer analog and digital waveforms are drawn into before tone mapping.\n\n"
+						"Half precision halves the buffer size and is plenty for intensity grading, but is off by default\n"
+						"for now while the half precision rendering shaders get more testing. Waveforms with persistence\n"
+						"enabled always use single precision, since the slowly decaying history would lose too much\n"
+						"detail at half precision.")
+					.EnumValue("Half (fp16)", RASTERIZE_FP16)
+					.EnumValue("Single (fp32)", RASTERIZE_FP32)
+				);
+			rendering.AddPreference(
+				Preference::Int("max_frames_in_flight", 2)
+					.Label("Max frames in flight")
+					.Description(
+						"Maximum number of frames the GPU may still be drawing while the next one is prepared.\n\n"
+						"With 1, each frame is finished on the GPU before work on the next one starts, which minimizes\n"
+						"latency but leaves the CPU and GPU waiting on each other. Larger values overlap them, improving\n"
+						"framerate on slower GPUs. Limited to the number of swapchain images (normally 2).")
+					.Unit(Unit::UNIT_COUNTS)
+				);
+
 	auto& pwr = this->m_treeRoot.AddCategory("Power");
 		auto& events = pwr.AddCategory("Events");
 			events.AddPreference(
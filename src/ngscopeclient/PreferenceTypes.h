@@ -68,4 +68,17 @@ enum HeadlessStartupMode
 	HEADLESS_STARTUP_C1_ONLY
 };
 
+enum WaveformTextureFormat
+{
+	TEXTURE_FORMAT_RGBA32F,
+	TEXTURE_FORMAT_RGBA16F,
+	TEXTURE_FORMAT_RGBA8
+};
+
+enum RasterizeFormat
+{
+	RASTERIZE_FP32,
+	RASTERIZE_FP16
+};
+
 #endif
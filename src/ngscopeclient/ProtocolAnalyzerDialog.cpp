@@ -144,19 +144,8 @@ bool ProtocolAnalyzerDialog::DoRender()
 	//Display tooltip for filter state
 	if(ImGui::IsItemHovered(ImGuiHoveredFlags_DelayNormal))
 	{
-		size_t itotal = 0;
-		size_t idisplayed = 0;
-		{
-			lock_guard<recursive_mutex> lock(m_mgr->GetMutex());
-
-			auto& packets = m_mgr->GetPackets();
-			for(auto it : packets)
-				itotal += it.second.size();
-
-			auto& filt = m_mgr->GetFilteredPackets();
-			for(auto it : filt)
-				idisplayed += it.second.size();
-		}
+		size_t itotal = m_mgr->GetPacketCount();
+		size_t idisplayed = m_mgr->GetFilteredPacketCount();
 		char stmp[128];
 		snprintf(stmp, sizeof(stmp), "%zu / %zu packets displayed (%.2f %%)\n",
 			idisplayed, itotal, idisplayed * 100.0 / itotal);
@@ -198,7 +187,7 @@ bool ProtocolAnalyzerDialog::DoRender()
 		ImGui::TableHeadersRow();
 
 		ImGuiListClipper clipper;
-		clipper.Begin((int)rows.back().m_totalHeight, 1.0f);
+		clipper.Begin((int)rows.GetTotalHeight(), 1.0f);
 
 		//see https://github.com/ocornut/imgui/issues/6042
 		// hacky way to disable clipper.Step() submitting a range for an offscreen row that has focus
@@ -216,16 +205,12 @@ bool ProtocolAnalyzerDialog::DoRender()
 			double minY = (double)clipper.DisplayStart;
 			double maxY = (double)clipper.DisplayEnd;
 
-			const auto sit = std::lower_bound(
-				rows.begin(),
-				rows.end(),
-				minY,
-				[](const RowData& data, double f) { return f > data.m_totalHeight; });
-			size_t istart = sit - rows.begin();
+			size_t istart = rows.FindRowAtHeight(minY);
+			double rowStart = (istart < rows.size()) ? rows.GetRowTop(istart) : 0;
 
-			for (size_t i = istart; i < rows.size() && (!i || maxY > rows[i - 1].m_totalHeight); i++)
+			for (size_t i = istart; i < rows.size() && (maxY > rowStart); i++)
 			{
-				auto& row = rows[i];
+				auto& row = rows.GetRow(i);
 
 				ImGui::PushID(row.m_stamp.first);
 				ImGui::PushID(row.m_stamp.second);
@@ -262,14 +247,8 @@ bool ProtocolAnalyzerDialog::DoRender()
 				}
 
 				//See if we have child packets
-				bool hasChildren = false;
-				if(pack)
-				{
-					auto children = m_mgr->GetFilteredChildPackets(pack);
-					hasChildren = !children.empty();
-				}
+				bool hasChildren = row.m_hasChildren;
 
-				float rowStart = rows[i].m_totalHeight - rows[i].m_height;
 				bool firstRow = (i == istart);
 
 				//Timestamp (and row selection logic)
@@ -281,12 +260,8 @@ bool ProtocolAnalyzerDialog::DoRender()
 				{
 					open = ImGui::TreeNodeEx("##tree", ImGuiTreeNodeFlags_OpenOnArrow);
 
-					if(m_mgr->IsChildOpen(pack) != open)
-					{
-						m_mgr->SetChildOpen(pack, open);
-						LogTrace("tree node opened or closed, forcing refresh\n");
-						forceRefresh = true;
-					}
+					//Rows for this waveform will be rebuilt next frame
+					m_mgr->SetChildOpen(row.m_stamp, row.m_index, open);
 
 					if(open)
 						ImGui::TreePop();
@@ -407,6 +382,9 @@ bool ProtocolAnalyzerDialog::DoRender()
 				ImGui::PopID();
 				ImGui::PopID();
 				ImGui::PopID();
+
+				//Height may have changed while rendering, so don't look at it until now
+				rowStart += row.m_height;
 			}
 		}
 
@@ -415,14 +393,9 @@ bool ProtocolAnalyzerDialog::DoRender()
 		{
 			//Go through our visible rows to find the closest packet
 			//(may not be the selected one we're just trying to scroll to that general area)
-			const auto sit = std::lower_bound(
-				rows.begin(),
-				rows.end(),
-				m_selectedPacket->m_offset,
-				[](const RowData& data, double f)
-					{ return f > (data.m_packet? data.m_packet->m_offset : data.m_marker.m_offset); });
-			auto& row = *sit;
-			ImGui::SetScrollFromPosY(ImGui::GetCursorStartPos().y + row.m_totalHeight);
+			size_t irow = rows.FindRowAtOffset(m_selectedPacket->m_offset);
+			if(irow < rows.size())
+				ImGui::SetScrollFromPosY(ImGui::GetCursorStartPos().y + rows.GetRowBottom(irow));
 
 			m_needToScrollToSelectedPacket = false;
 		}
@@ -458,7 +431,7 @@ bool ProtocolAnalyzerDialog::DoRender()
 /**
 	@brief Handles the "image" column for packets
  */
-void ProtocolAnalyzerDialog::DoImageColumn(Packet* pack, vector<RowData>& rows, size_t nrow)
+void ProtocolAnalyzerDialog::DoImageColumn(Packet* pack, PacketRowIndex& rows, size_t nrow)
 {
 	//TODO: get the actual texture
 	auto pos = ImGui::GetCursorScreenPos();
@@ -467,7 +440,7 @@ void ProtocolAnalyzerDialog::DoImageColumn(Packet* pack, vector<RowData>& rows,
 
 	//auto tex = m_parent.GetTextureManager()->GetTexture("visible-spectrum-380nm-750nm");
 
-	if(!rows[nrow].m_texture)
+	if(!rows.GetRow(nrow).m_texture)
 	{
 		size_t width = pack->m_data.size() / 3;
 
@@ -541,7 +514,7 @@ void ProtocolAnalyzerDialog::DoImageColumn(Packet* pack, vector<RowData>& rows,
 			);
 
 		//Make the Vulkan texture for it
-		rows[nrow].m_texture = make_shared<Texture>(
+		rows.GetRow(nrow).m_texture = make_shared<Texture>(
 			*g_vkComputeDevice,
 			imageInfo,
 			stagingBuf,
@@ -553,7 +526,7 @@ void ProtocolAnalyzerDialog::DoImageColumn(Packet* pack, vector<RowData>& rows,
 	}
 
 	//Actually draw it
-	auto tex = rows[nrow].m_texture;
+	auto tex = rows.GetRow(nrow).m_texture;
 	m_parent.AddTextureUsedThisFrame(tex);
 	list->AddImage(
 		tex->GetTexture(),
@@ -564,7 +537,7 @@ void ProtocolAnalyzerDialog::DoImageColumn(Packet* pack, vector<RowData>& rows,
 /**
 	@brief Handles the "data" column for packets
  */
-void ProtocolAnalyzerDialog::DoDataColumn(Packet* pack, FontWithSize dataFont, vector<RowData>& rows, size_t nrow)
+void ProtocolAnalyzerDialog::DoDataColumn(Packet* pack, FontWithSize dataFont, PacketRowIndex& rows, size_t nrow)
 {
 	ImGui::PushFont(dataFont.first, dataFont.second);
 
@@ -741,17 +714,10 @@ void ProtocolAnalyzerDialog::DoDataColumn(Packet* pack, FontWithSize dataFont, v
 	double height = padding*2 + ImGui::CalcTextSize(firstLine.c_str()).y;
 	if(open)
 		height += ImGui::CalcTextSize(data.c_str()).y;
-	double oldheight = rows[nrow].m_height;
+	double oldheight = rows.GetRow(nrow).m_height;
 	double delta = height - oldheight;
 	if(abs(delta) > 0.001)
-	{
-		//Apply the changed height
-		rows[nrow].m_height = height;
-
-		//Move every impacted row up or down as appropriate
-		for(size_t i=nrow; i<rows.size(); i++)
-			rows[i].m_totalHeight += delta;
-	}
+		rows.SetRowHeight(nrow, height);
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -771,37 +737,10 @@ void ProtocolAnalyzerDialog::OnCursorMoved(int64_t offset)
 		m_lastSelectedWaveform = TimePoint(data->m_startTimestamp, data->m_startFemtoseconds);
 	}
 
-	auto& allpackets = m_mgr->GetFilteredPackets();
-	auto it = allpackets.find(m_lastSelectedWaveform);
-	if(it == allpackets.end())
-		return;
-	auto packets = it->second;
-
-	//TODO: binary search vs linear
-	for(auto p : packets)
+	auto pack = m_mgr->FindFilteredPacket(m_lastSelectedWaveform, offset);
+	if(pack)
 	{
-		//Check child packets first
-		auto& children = m_mgr->GetFilteredChildPackets(p);
-		for(auto c : children)
-		{
-			if(offset > (c->m_offset + c->m_len) )
-				continue;
-			if(c->m_offset > offset)
-				return;
-
-			m_selectedPacket = c;
-			m_needToScrollToSelectedPacket = true;
-			return;
-		}
-
-		//If we get here no child hit, try to match parent
-		if(offset > (p->m_offset + p->m_len) )
-			continue;
-		if(p->m_offset > offset)
-			return;
-
-		m_selectedPacket = p;
+		m_selectedPacket = pack;
 		m_needToScrollToSelectedPacket = true;
-		return;
 	}
 }
@@ -110,8 +110,8 @@ protected:
 	///@brief True if the selected packet should be scrolled to
 	bool m_needToScrollToSelectedPacket;
 
-	void DoDataColumn(Packet* pack, FontWithSize dataFont, std::vector<RowData>& rows, size_t nrow);
-	void DoImageColumn(Packet* pack, std::vector<RowData>& rows, size_t nrow);
+	void DoDataColumn(Packet* pack, FontWithSize dataFont, PacketRowIndex& rows, size_t nrow);
+	void DoImageColumn(Packet* pack, PacketRowIndex& rows, size_t nrow);
 
 	///@brief True the first time DoDataColumn() is called in a given frame
 	bool m_firstDataBlockOfFrame;
@@ -0,0 +1,783 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* ngscopeclient                                                                                                        *
+*                                                                                                                      *
+* Copyright (c) 2012-2025 Andrew D. Zonenberg and contributors                                                         *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+/**
+	@file
+	@author Andrew D. Zonenberg
+	@brief Implementation of ProtocolDisplayFilter and related classes
+
+	Only depends on libscopehal (not the GUI) so it can be linked into unit tests.
+ */
+#include "../../lib/scopehal/scopehal.h"
+#include "../../lib/scopehal/PacketDecoder.h"
+#include "ProtocolDisplayFilter.h"
+
+using namespace std;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// ProtocolDisplayFilter
+
+ProtocolDisplayFilter::ProtocolDisplayFilter(string str, size_t& i)
+	: m_compiled(false)
+{
+	//One or more clauses separated by operators
+	while(i < str.length())
+	{
+		//Read the clause
+		m_clauses.push_back(new ProtocolDisplayFilterClause(str, i));
+
+		//Remove spaces before the operator
+		EatSpaces(str, i);
+		if( (i >= str.length()) || (str[i] == ')') || (str[i] == ']') )
+			break;
+
+		//Read the operator, if any
+		string tmp;
+		while(i < str.length())
+		{
+			if(isspace(str[i]) || (str[i] == '\"') || (str[i] == '(') || (str[i] == ')') )
+				break;
+
+			//An alphanumeric character after an operator other than text terminates it
+			if( (tmp != "") && !isalnum(tmp[0]) && isalnum(str[i]) )
+				break;
+
+			tmp += str[i];
+			i++;
+		}
+		m_operators.push_back(tmp);
+	}
+}
+
+ProtocolDisplayFilter::~ProtocolDisplayFilter()
+{
+	for(auto c : m_clauses)
+		delete c;
+}
+
+bool ProtocolDisplayFilter::Validate(vector<string> headers, bool nakedLiteralOK)
+{
+	//Validation rewrites identifiers to the real header names, so any previously compiled code is stale
+	m_compiled = false;
+
+	//No clauses? valid all-pass filter
+	if(m_clauses.empty())
+		return true;
+
+	//We should always have one more clause than operator
+	if( (m_operators.size() + 1) != m_clauses.size())
+		return false;
+
+	//Operators must make sense. For now only equal/unequal and boolean and/or allowed
+	for(auto op : m_operators)
+	{
+		if( (op != "==") &&
+			(op != "!=") &&
+			(op != "||") &&
+			(op != "&&") &&
+			(op != "startswith") &&
+			(op != "contains")
+		)
+		{
+			return false;
+		}
+	}
+
+	//If any clause is invalid, we're invalid
+	for(auto c : m_clauses)
+	{
+		if(!c->Validate(headers))
+			return false;
+	}
+
+	//A single literal is not a legal filter, it has to be compared to something
+	//(But for sub-expressions used as indexes etc, it's OK)
+	if(!nakedLiteralOK)
+	{
+		if(m_clauses.size() == 1)
+		{
+			if(m_clauses[0]->m_type != ProtocolDisplayFilterClause::TYPE_EXPRESSION)
+				return false;
+		}
+	}
+
+	return true;
+}
+
+void ProtocolDisplayFilter::EatSpaces(string str, size_t& i)
+{
+	while( (i < str.length()) && isspace(str[i]) )
+		i++;
+}
+
+/**
+	@brief Checks if a packet matches the filter
+
+	The first call compiles the expression, so this should only be called after Validate().
+ */
+bool ProtocolDisplayFilter::Match(const Packet* pack)
+{
+	if(m_clauses.empty())
+		return true;
+
+	if(!m_compiled)
+		Compile();
+	return m_program.Match(pack);
+}
+
+/**
+	@brief Evaluates the expression by walking the parse tree
+
+	This is the original string based evaluator. It's far too slow to run over every packet, but is kept as the
+	reference that the compiled form is tested against.
+ */
+string ProtocolDisplayFilter::Evaluate(const Packet* pack)
+{
+	//Calling code checks for validity so no need to verify here
+
+	//For now, all operators have equal precedence and are evaluated left to right.
+	string current = m_clauses[0]->Evaluate(pack);
+	for(size_t i=1; i<m_clauses.size(); i++)
+	{
+		string rhs = m_clauses[i]->Evaluate(pack);
+		string op = m_operators[i-1];
+
+		bool a = (current != "0");
+		bool b = (rhs != "0");
+
+		//== and != do exact string equality checks
+		bool temp = false;
+		if(op == "==")
+			temp = (current == rhs);
+		else if(op == "!=")
+			temp = (current != rhs);
+
+		//&& and || do boolean operations
+		else if(op == "&&")
+			temp = (a && b);
+		else if(op == "||")
+			temp = (a || b);
+
+		//String prefix
+		else if(op == "startswith")
+			temp = (current.find(rhs) == 0);
+		else if(op == "contains")
+			temp = (current.find(rhs) != string::npos);
+
+		//done, convert back to string
+		current = temp ? "1" : "0";
+	}
+	return current;
+}
+
+/**
+	@brief Compiles the expression to bytecode
+ */
+void ProtocolDisplayFilter::Compile()
+{
+	m_program.Clear();
+	EmitCode(m_program);
+	m_program.Finalize();
+	m_compiled = true;
+}
+
+/**
+	@brief Appends bytecode for this expression to a program
+ */
+void ProtocolDisplayFilter::EmitCode(ProtocolDisplayFilterProgram& program)
+{
+	//Empty sub-expression (e.g. "data[]")
+	if(m_clauses.empty())
+	{
+		program.EmitConstant(ProtocolDisplayFilterValue::TYPE_NAN, "NaN");
+		return;
+	}
+
+	//All operators have equal precedence and are evaluated left to right, so this is a simple fold
+	m_clauses[0]->EmitCode(program);
+	for(size_t i=1; i<m_clauses.size(); i++)
+	{
+		string op;
+		if(i <= m_operators.size())
+			op = m_operators[i-1];
+
+		//Boolean operators short circuit.
+		//Evaluation has no side effects so this gives the same result as evaluating both sides.
+		size_t jump = 0;
+		bool shortCircuit = false;
+		if(op == "&&")
+		{
+			jump = program.GetCurrentAddress();
+			program.Emit(ProtocolDisplayFilterProgram::OP_JUMP_IF_FALSE);
+			shortCircuit = true;
+		}
+		else if(op == "||")
+		{
+			jump = program.GetCurrentAddress();
+			program.Emit(ProtocolDisplayFilterProgram::OP_JUMP_IF_TRUE);
+			shortCircuit = true;
+		}
+
+		m_clauses[i]->EmitCode(program);
+
+		if(op == "==")
+			program.Emit(ProtocolDisplayFilterProgram::OP_EQUAL);
+		else if(op == "!=")
+			program.Emit(ProtocolDisplayFilterProgram::OP_NOT_EQUAL);
+		else if(op == "&&")
+			program.Emit(ProtocolDisplayFilterProgram::OP_AND);
+		else if(op == "||")
+			program.Emit(ProtocolDisplayFilterProgram::OP_OR);
+		else if(op == "startswith")
+			program.Emit(ProtocolDisplayFilterProgram::OP_STARTS_WITH);
+		else if(op == "contains")
+			program.Emit(ProtocolDisplayFilterProgram::OP_CONTAINS);
+		else
+			program.Emit(ProtocolDisplayFilterProgram::OP_INVALID);
+
+		if(shortCircuit)
+			program.PatchJumpTarget(jump, program.GetCurrentAddress());
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// ProtocolDisplayFilterClause
+
+ProtocolDisplayFilterClause::ProtocolDisplayFilterClause(string str, size_t& i)
+{
+	ProtocolDisplayFilter::EatSpaces(str, i);
+
+	m_real = 0;
+	m_long = 0;
+	m_expression = 0;
+	m_invert = false;
+
+	//Parenthetical expression
+	if( (str[i] == '(') || (str[i] == '!') )
+	{
+		//Inversion
+		if(str[i] == '!')
+		{
+			m_invert = true;
+			i++;
+
+			if(str[i] != '(')
+			{
+				m_type = TYPE_ERROR;
+				i++;
+				return;
+			}
+		}
+
+		i++;
+		m_type = TYPE_EXPRESSION;
+		m_expression = new ProtocolDisplayFilter(str, i);
+
+		//eat trailing spaces
+		ProtocolDisplayFilter::EatSpaces(str, i);
+
+		//expect closing parentheses
+		if(str[i] != ')')
+			m_type = TYPE_ERROR;
+		i++;
+	}
+
+	//Quoted string
+	else if(str[i] == '\"')
+	{
+		m_type = TYPE_STRING;
+		i++;
+
+		while( (i < str.length()) && (str[i] != '\"') )
+		{
+			m_string += str[i];
+			i++;
+		}
+
+		if(str[i] != '\"')
+			m_type = TYPE_ERROR;
+
+		i++;
+	}
+
+	//Number
+	else if(isdigit(str[i]) || (str[i] == '-') || (str[i] == '.') )
+	{
+		string tmp;
+		while( (i < str.length()) && (isdigit(str[i]) || (str[i] == '-')  || (str[i] == '.') || (str[i] == 'x')) )
+		{
+			tmp += str[i];
+			i++;
+		}
+
+		//Hex string
+		if(tmp.find("0x") == 0)
+		{
+			sscanf(tmp.c_str(), "%lx", (unsigned long*)&m_long);
+			m_type = TYPE_INT;
+		}
+
+		//Number with decimal point
+		else if(tmp.find('.') != string::npos)
+		{
+			m_real = atof(tmp.c_str());
+			m_type = TYPE_REAL;
+		}
+
+		//Number without decimal point
+		else
+		{
+			m_long = atol(tmp.c_str());
+			m_type = TYPE_INT;
+		}
+	}
+
+	//Identifier (or data)
+	else
+	{
+		m_type = TYPE_IDENTIFIER;
+
+		while( (i < str.length()) && isalnum(str[i]) )
+		{
+			m_identifier += str[i];
+			i++;
+		}
+
+		//Opening square bracket
+		if(str[i] == '[')
+		{
+			if(m_identifier == "data")
+			{
+				m_type = TYPE_DATA;
+				i++;
+
+				//Read the index expression
+				m_expression = new ProtocolDisplayFilter(str, i);
+
+				//eat trailing spaces
+				ProtocolDisplayFilter::EatSpaces(str, i);
+
+				//expect closing square bracket
+				if(str[i] != ']')
+					m_type = TYPE_ERROR;
+				i++;
+			}
+
+			else
+			{
+				m_type = TYPE_ERROR;
+				i++;
+			}
+		}
+
+		if(m_identifier == "")
+		{
+			i++;
+			m_type = TYPE_ERROR;
+		}
+	}
+}
+
+/**
+	@brief Returns a copy of the input string with spaces removed
+ */
+string ProtocolDisplayFilterClause::EatSpaces(string str)
+{
+	string ret;
+	for(auto c : str)
+	{
+		if(!isspace(c))
+			ret += c;
+	}
+	return ret;
+}
+
+string ProtocolDisplayFilterClause::Evaluate(const Packet* pack)
+{
+	char tmp[32];
+
+	switch(m_type)
+	{
+		case TYPE_DATA:
+			{
+				string sindex = m_expression->Evaluate(pack);
+				int index = atoi(sindex.c_str());
+
+				//Bounds check
+				if(pack->m_data.size() <= (size_t)index)
+					return "NaN";
+
+				return to_string(pack->m_data[index]);
+			}
+			break;
+
+		case TYPE_IDENTIFIER:
+			{
+				auto it = pack->m_headers.find(m_identifier);
+				if(it != pack->m_headers.end())
+					return it->second;
+				else
+					return "NaN";
+			}
+
+		case TYPE_STRING:
+			return m_string;
+
+		case TYPE_REAL:
+			snprintf(tmp, sizeof(tmp), "%f", m_real);
+			return tmp;
+
+		case TYPE_INT:
+			snprintf(tmp, sizeof(tmp), "%ld", m_long);
+			return tmp;
+
+		case TYPE_EXPRESSION:
+			if(m_invert)
+			{
+				if(m_expression->Evaluate(pack) == "1")
+					return "0";
+				else
+					return "1";
+			}
+			else
+				return m_expression->Evaluate(pack);
+
+		case TYPE_ERROR:
+		default:
+			return "NaN";
+	}
+
+	//never happens because of the 'default" clause, but prevents -Wreturn-type warning with some gcc versions
+	return "NaN";
+}
+
+/**
+	@brief Appends bytecode for this clause to a program
+
+	Literals are converted to text here exactly as Evaluate() would, so comparisons behave identically.
+ */
+void ProtocolDisplayFilterClause::EmitCode(ProtocolDisplayFilterProgram& program)
+{
+	char tmp[32];
+
+	switch(m_type)
+	{
+		case TYPE_DATA:
+			m_expression->EmitCode(program);
+			program.Emit(ProtocolDisplayFilterProgram::OP_PUSH_DATA);
+			break;
+
+		case TYPE_IDENTIFIER:
+			program.EmitHeader(m_identifier);
+			break;
+
+		case TYPE_STRING:
+			program.EmitConstant(ProtocolDisplayFilterValue::TYPE_STRING, m_string);
+			break;
+
+		case TYPE_REAL:
+			snprintf(tmp, sizeof(tmp), "%f", m_real);
+			program.EmitConstant(ProtocolDisplayFilterValue::TYPE_STRING, tmp);
+			break;
+
+		case TYPE_INT:
+			snprintf(tmp, sizeof(tmp), "%ld", m_long);
+			program.EmitConstant(ProtocolDisplayFilterValue::TYPE_INT, tmp, m_long);
+			break;
+
+		case TYPE_EXPRESSION:
+			m_expression->EmitCode(program);
+			if(m_invert)
+				program.Emit(ProtocolDisplayFilterProgram::OP_INVERT);
+			break;
+
+		case TYPE_ERROR:
+		default:
+			program.EmitConstant(ProtocolDisplayFilterValue::TYPE_NAN, "NaN");
+			break;
+	}
+}
+
+ProtocolDisplayFilterClause::~ProtocolDisplayFilterClause()
+{
+	if(m_expression)
+		delete m_expression;
+}
+
+bool ProtocolDisplayFilterClause::Validate(vector<string> headers)
+{
+	switch(m_type)
+	{
+		case TYPE_ERROR:
+			return false;
+
+		case TYPE_DATA:
+			return m_expression->Validate(headers, true);
+
+		//If we're an identifier, we must be a valid header field
+		//TODO: support comparisons on data
+		case TYPE_IDENTIFIER:
+			for(auto h : headers)
+			{
+				//Match, removing spaces from header names if needed
+				//Note that m_identifier is now the real, un-spaced version of the identifier name
+				//so we can look it up in the packet
+				if(EatSpaces(h) == m_identifier)
+				{
+					m_identifier = h;
+					return true;
+				}
+			}
+
+			return false;
+
+		//If we're an expression, it must be valid
+		case TYPE_EXPRESSION:
+			return m_expression->Validate(headers);
+
+		default:
+			return true;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// ProtocolDisplayFilterValue
+
+/**
+	@brief Converts the value to an index into packet data, the same way the string evaluator does
+ */
+int ProtocolDisplayFilterValue::AsIndex() const
+{
+	if(m_type == TYPE_INT)
+		return m_int;
+
+	//m_text is always null terminated, see class comment
+	return atoi(m_text.data());
+}
+
+ProtocolDisplayFilterValue ProtocolDisplayFilterValue::NaN()
+{
+	ProtocolDisplayFilterValue ret;
+	ret.m_type = TYPE_NAN;
+	ret.m_int = 0;
+	ret.m_text = "NaN";
+	return ret;
+}
+
+/**
+	@brief Creates an integer value (data bytes and boolean results are always in 0...255)
+ */
+ProtocolDisplayFilterValue ProtocolDisplayFilterValue::FromInt(uint8_t i)
+{
+	static const vector<string> names = []
+	{
+		vector<string> ret;
+		for(int j=0; j<256; j++)
+			ret.push_back(to_string(j));
+		return ret;
+	}();
+
+	ProtocolDisplayFilterValue ret;
+	ret.m_type = TYPE_INT;
+	ret.m_int = i;
+	ret.m_text = names[i];
+	return ret;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// ProtocolDisplayFilterProgram
+
+void ProtocolDisplayFilterProgram::Clear()
+{
+	m_code.clear();
+	m_constants.clear();
+	m_constantText.clear();
+	m_headerNames.clear();
+	m_stack.clear();
+}
+
+/**
+	@brief Adds a literal to the constant pool and emits an instruction to push it
+ */
+void ProtocolDisplayFilterProgram::EmitConstant(ProtocolDisplayFilterValue::Type type, const string& text, int64_t value)
+{
+	//m_text is filled in by Finalize() since m_constantText may still reallocate
+	ProtocolDisplayFilterValue v;
+	v.m_type = type;
+	v.m_int = value;
+
+	Emit(OP_PUSH_CONST, m_constants.size());
+	m_constants.push_back(v);
+	m_constantText.push_back(text);
+}
+
+/**
+	@brief Interns a header name and emits an instruction to push its value
+ */
+void ProtocolDisplayFilterProgram::EmitHeader(const string& name)
+{
+	size_t index = 0;
+	for(; index < m_headerNames.size(); index++)
+	{
+		if(m_headerNames[index] == name)
+			break;
+	}
+	if(index == m_headerNames.size())
+		m_headerNames.push_back(name);
+
+	Emit(OP_PUSH_HEADER, index);
+}
+
+/**
+	@brief Resolves constant text and allocates the evaluation stack, after all code has been emitted
+ */
+void ProtocolDisplayFilterProgram::Finalize()
+{
+	for(size_t i=0; i<m_constants.size(); i++)
+		m_constants[i].m_text = m_constantText[i];
+
+	//Every instruction pushes at most one value, so this is a (loose) upper bound on stack depth
+	m_stack.resize(m_code.size() + 1);
+}
+
+bool ProtocolDisplayFilterProgram::Match(const Packet* pack)
+{
+	return Execute(pack).IsTrue();
+}
+
+/**
+	@brief Runs the program against a single packet and returns the result
+ */
+ProtocolDisplayFilterValue ProtocolDisplayFilterProgram::Execute(const Packet* pack)
+{
+	auto stack = m_stack.data();
+	size_t sp = 0;
+
+	size_t pc = 0;
+	size_t len = m_code.size();
+	while(pc < len)
+	{
+		auto& insn = m_code[pc++];
+		switch(insn.m_op)
+		{
+			case OP_PUSH_CONST:
+				stack[sp++] = m_constants[insn.m_arg];
+				break;
+
+			case OP_PUSH_HEADER:
+				{
+					auto it = pack->m_headers.find(m_headerNames[insn.m_arg]);
+					if(it == pack->m_headers.end())
+						stack[sp++] = ProtocolDisplayFilterValue::NaN();
+					else
+					{
+						auto& v = stack[sp++];
+						v.m_type = ProtocolDisplayFilterValue::TYPE_STRING;
+						v.m_int = 0;
+						v.m_text = it->second;
+					}
+				}
+				break;
+
+			case OP_PUSH_DATA:
+				{
+					auto& v = stack[sp-1];
+					int index = v.AsIndex();
+					if(pack->m_data.size() <= (size_t)index)
+						v = ProtocolDisplayFilterValue::NaN();
+					else
+						v = ProtocolDisplayFilterValue::FromInt(pack->m_data[index]);
+				}
+				break;
+
+			case OP_INVERT:
+				stack[sp-1] = ProtocolDisplayFilterValue::FromBool(!stack[sp-1].IsOne());
+				break;
+
+			case OP_JUMP_IF_FALSE:
+				if(!stack[sp-1].IsTrue())
+				{
+					stack[sp-1] = ProtocolDisplayFilterValue::FromBool(false);
+					pc = insn.m_arg;
+				}
+				break;
+
+			case OP_JUMP_IF_TRUE:
+				if(stack[sp-1].IsTrue())
+				{
+					stack[sp-1] = ProtocolDisplayFilterValue::FromBool(true);
+					pc = insn.m_arg;
+				}
+				break;
+
+			//Binary operators
+			default:
+				{
+					sp--;
+					auto& lhs = stack[sp-1];
+					auto& rhs = stack[sp];
+
+					bool temp = false;
+					switch(insn.m_op)
+					{
+						case OP_EQUAL:
+							temp = (lhs == rhs);
+							break;
+
+						case OP_NOT_EQUAL:
+							temp = !(lhs == rhs);
+							break;
+
+						case OP_AND:
+							temp = lhs.IsTrue() && rhs.IsTrue();
+							break;
+
+						case OP_OR:
+							temp = lhs.IsTrue() || rhs.IsTrue();
+							break;
+
+						case OP_STARTS_WITH:
+							temp = (lhs.m_text.substr(0, rhs.m_text.size()) == rhs.m_text);
+							break;
+
+						case OP_CONTAINS:
+							temp = (lhs.m_text.find(rhs.m_text) != string_view::npos);
+							break;
+
+						default:
+							break;
+					}
+					lhs = ProtocolDisplayFilterValue::FromBool(temp);
+				}
+				break;
+		}
+	}
+
+	return stack[0];
+}
@@ -0,0 +1,258 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* ngscopeclient                                                                                                        *
+*                                                                                                                      *
+* Copyright (c) 2012-2025 Andrew D. Zonenberg and contributors                                                         *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+/**
+	@file
+	@author Andrew D. Zonenberg
+	@brief Declaration of ProtocolDisplayFilter and related classes
+ */
+#ifndef ProtocolDisplayFilter_h
+#define ProtocolDisplayFilter_h
+
+#include <string_view>
+
+class ProtocolDisplayFilter;
+class ProtocolDisplayFilterProgram;
+
+class ProtocolDisplayFilterClause
+{
+public:
+	ProtocolDisplayFilterClause(std::string str, size_t& i);
+	ProtocolDisplayFilterClause(const ProtocolDisplayFilterClause&) =delete;
+	ProtocolDisplayFilterClause& operator=(const ProtocolDisplayFilterClause&) =delete;
+
+	virtual ~ProtocolDisplayFilterClause();
+
+	bool Validate(std::vector<std::string> headers);
+
+	std::string Evaluate(const Packet* pack);
+	void EmitCode(ProtocolDisplayFilterProgram& program);
+
+	static std::string EatSpaces(std::string str);
+
+	enum
+	{
+		TYPE_DATA,
+		TYPE_IDENTIFIER,
+		TYPE_STRING,
+		TYPE_REAL,
+		TYPE_INT,
+		TYPE_EXPRESSION,
+		TYPE_ERROR
+	} m_type;
+
+	std::string m_identifier;
+	std::string m_string;
+	float m_real;
+	long m_long;
+	ProtocolDisplayFilter* m_expression;
+	bool m_invert;
+};
+
+/**
+	@brief A single typed value on the ProtocolDisplayFilterProgram evaluation stack
+
+	The legacy evaluator passes everything around as strings, so to keep identical semantics every value carries its
+	textual form in m_text. Numeric values additionally carry m_int so the common cases (integer comparisons and
+	boolean logic) never have to look at the text.
+
+	m_text always points to a null terminated string owned by the program, the packet, or a static table.
+ */
+class ProtocolDisplayFilterValue
+{
+public:
+	enum Type
+	{
+		///@brief Missing header, out of range data index, etc
+		TYPE_NAN,
+
+		///@brief Integer (m_int is valid, m_text is its canonical decimal form)
+		TYPE_INT,
+
+		///@brief Anything else (only m_text is valid)
+		TYPE_STRING
+	} m_type;
+
+	///@brief Integer value, if m_type is TYPE_INT
+	int64_t m_int;
+
+	///@brief Textual form of the value
+	std::string_view m_text;
+
+	bool IsTrue() const
+	{
+		if(m_type == TYPE_INT)
+			return m_int != 0;
+		return m_text != "0";
+	}
+
+	bool IsOne() const
+	{
+		if(m_type == TYPE_INT)
+			return m_int == 1;
+		return m_text == "1";
+	}
+
+	bool operator==(const ProtocolDisplayFilterValue& rhs) const
+	{
+		if( (m_type == TYPE_INT) && (rhs.m_type == TYPE_INT) )
+			return m_int == rhs.m_int;
+		return m_text == rhs.m_text;
+	}
+
+	int AsIndex() const;
+
+	static ProtocolDisplayFilterValue NaN();
+	static ProtocolDisplayFilterValue FromInt(uint8_t i);
+	static ProtocolDisplayFilterValue FromBool(bool b)
+	{ return FromInt(b ? 1 : 0); }
+};
+
+/**
+	@brief Compiled form of a ProtocolDisplayFilter
+
+	The parse tree is flattened into postfix bytecode for a small stack machine. Header names and literals are resolved
+	once at compile time, so evaluating a packet does no string formatting or allocation.
+ */
+class ProtocolDisplayFilterProgram
+{
+public:
+	enum Opcode
+	{
+		///@brief Push m_constants[arg]
+		OP_PUSH_CONST,
+
+		///@brief Push the value of header m_headerNames[arg], or NaN if not present
+		OP_PUSH_HEADER,
+
+		///@brief Pop an index, push the data byte at that index or NaN if out of range
+		OP_PUSH_DATA,
+
+		///@brief Pop a value, push 0 if it's 1 and 1 otherwise
+		OP_INVERT,
+
+		///@brief If top of stack is false, replace it with 0 and jump to arg. Otherwise leave it in place
+		OP_JUMP_IF_FALSE,
+
+		///@brief If top of stack is true, replace it with 1 and jump to arg. Otherwise leave it in place
+		OP_JUMP_IF_TRUE,
+
+		//Binary operators: pop rhs, pop lhs, push result
+		OP_EQUAL,
+		OP_NOT_EQUAL,
+		OP_AND,
+		OP_OR,
+		OP_STARTS_WITH,
+		OP_CONTAINS,
+
+		///@brief Unrecognized operator, always false
+		OP_INVALID
+	};
+
+	class Instruction
+	{
+	public:
+		Instruction(Opcode op, uint32_t arg = 0)
+		: m_op(op)
+		, m_arg(arg)
+		{}
+
+		Opcode m_op;
+		uint32_t m_arg;
+	};
+
+	void Clear();
+
+	size_t GetCurrentAddress()
+	{ return m_code.size(); }
+
+	void Emit(Opcode op, uint32_t arg = 0)
+	{ m_code.push_back(Instruction(op, arg)); }
+
+	void PatchJumpTarget(size_t addr, size_t target)
+	{ m_code[addr].m_arg = target; }
+
+	void EmitConstant(ProtocolDisplayFilterValue::Type type, const std::string& text, int64_t value = 0);
+	void EmitHeader(const std::string& name);
+	void Finalize();
+
+	bool Match(const Packet* pack);
+
+	bool empty()
+	{ return m_code.empty(); }
+
+protected:
+	ProtocolDisplayFilterValue Execute(const Packet* pack);
+
+	///@brief The bytecode
+	std::vector<Instruction> m_code;
+
+	///@brief Literal values referenced by the bytecode
+	std::vector<ProtocolDisplayFilterValue> m_constants;
+
+	///@brief Backing storage for text of m_constants
+	std::vector<std::string> m_constantText;
+
+	///@brief Interned header names
+	std::vector<std::string> m_headerNames;
+
+	///@brief Evaluation stack (preallocated to avoid allocating per packet)
+	std::vector<ProtocolDisplayFilterValue> m_stack;
+};
+
+class ProtocolDisplayFilter
+{
+public:
+	ProtocolDisplayFilter(std::string str, size_t& i);
+	ProtocolDisplayFilter(const ProtocolDisplayFilterClause&) =delete;
+	ProtocolDisplayFilter& operator=(const ProtocolDisplayFilter&) =delete;
+	virtual ~ProtocolDisplayFilter();
+
+	static void EatSpaces(std::string str, size_t& i);
+
+	bool Validate(std::vector<std::string> headers, bool nakedLiteralOK = false);
+
+	bool Match(const Packet* pack);
+	std::string Evaluate(const Packet* pack);
+
+	void Compile();
+	void EmitCode(ProtocolDisplayFilterProgram& program);
+
+protected:
+	std::vector<ProtocolDisplayFilterClause*> m_clauses;
+	std::vector<std::string> m_operators;
+
+	///@brief True if m_program is up to date
+	bool m_compiled;
+
+	///@brief Compiled form of the expression, used by Match()
+	ProtocolDisplayFilterProgram m_program;
+};
+
+#endif
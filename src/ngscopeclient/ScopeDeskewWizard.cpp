@@ -36,26 +36,12 @@
 #include "ngscopeclient.h"
 #include "ScopeDeskewWizard.h"
 #include "MainWindow.h"
+#include "pthread_compat.h"
 
 #include <cinttypes>
 
 using namespace std;
 
-////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-// Argument objects
-
-UniformCrossCorrelateArgs::UniformCrossCorrelateArgs(
-	UniformAnalogWaveform* ppri, UniformAnalogWaveform* psec, int64_t delta)
-	: priTimescale(ppri->m_timescale)
-	, secTimescale(psec->m_timescale)
-	, trigPhaseDelta(ppri->m_triggerPhase - psec->m_triggerPhase)
-	, startingDelta(-delta)
-	, numDeltas(delta*2)
-	, priLen(ppri->size())
-	, secLen(psec->size())
-{
-}
-
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 // Construction / destruction
 
@@ -80,8 +66,14 @@ ScopeDeskewWizard::ScopeDeskewWizard(
 	, m_lastTriggerFs(0)
 	, m_bestCorrelation(0)
 	, m_bestCorrelationOffset(0)
+	, m_bestCorrelationFraction(0)
 	, m_maxSkewSamples(30000)
 	, m_medianSkew(0)
+	, m_correlationTimescale(0)
+	, m_correlationDone(false)
+	, m_cpuValidStart(0)
+	, m_cpuValidEnd(0)
+	, m_cpuSparse(false)
 	, m_queue(g_vkQueueManager->GetComputeQueue("ScopeDeskewWizard.queue"))
 	, m_pool(*g_vkComputeDevice,
 		vk::CommandPoolCreateInfo(
@@ -127,6 +119,12 @@ ScopeDeskewWizard::ScopeDeskewWizard(
 
 ScopeDeskewWizard::~ScopeDeskewWizard()
 {
+	//Don't wait for a long CPU correlation to finish if the dialog is closed partway through
+	if(m_correlationThread)
+	{
+		m_correlator->Cancel();
+		m_correlationThread->join();
+	}
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -420,7 +418,9 @@ void ScopeDeskewWizard::DoMainProcessingFlow()
 				ImGui::TextUnformatted("Done");
 
 			ImGui::TableSetColumnIndex(1);
-			if(m_state == STATE_CORRELATE)
+			if( (m_state == STATE_CORRELATE) && m_correlator)
+				ImGui::ProgressBar(m_correlator->GetProgress(), ImVec2(-1, 0));
+			else if(m_state == STATE_CORRELATE)
 				ImGui::TextUnformatted("Calculating");
 			else
 				ImGui::TextUnformatted("Pending");
@@ -489,7 +489,29 @@ void ScopeDeskewWizard::DoMainProcessingFlow()
 
 		case STATE_CORRELATE:
 			{
-				//TODO: check if the correlation is done
+				//Wait for the CPU correlation to finish, if we have one running
+				if(m_correlationThread)
+				{
+					if(!m_correlationDone)
+						return;
+
+					m_correlationThread->join();
+					m_correlationThread = nullptr;
+
+					m_bestCorrelation = m_correlator->GetBestCorrelation();
+					m_bestCorrelationOffset = m_correlator->GetBestDelta();
+					m_bestCorrelationFraction = m_correlator->GetBestDeltaFraction();
+
+					m_correlator = nullptr;
+					m_cpuPrimary.clear();
+					m_cpuPrimary.shrink_to_fit();
+					m_cpuSecondary.clear();
+					m_cpuSecondary.shrink_to_fit();
+					m_sparsePrimary.clear();
+					m_sparseSecondary.clear();
+
+					CollectCorrelation();
+				}
 
 				m_measureCycle ++;
 
@@ -541,6 +563,8 @@ void ScopeDeskewWizard::StartCorrelation()
 	auto spri = dynamic_cast<SparseAnalogWaveform*>(pri);
 	auto ssec = dynamic_cast<SparseAnalogWaveform*>(sec);
 
+	m_correlationTimescale = pri->m_timescale;
+
 	//Optimized path (if both waveforms are dense packed)
 	if(upri && usec)
 	{
@@ -578,8 +602,17 @@ void ScopeDeskewWizard::StartCorrelation()
 		return;
 	}
 
-	//Collect the skew from this round
-	int64_t skew = m_bestCorrelationOffset * pri->m_timescale;
+	//CPU paths finish in the background, GPU paths are already done
+	if(!m_correlationThread)
+		CollectCorrelation();
+}
+
+/**
+	@brief Records the skew from the current waveform once the correlation is complete
+ */
+void ScopeDeskewWizard::CollectCorrelation()
+{
+	int64_t skew = llround( (m_bestCorrelationOffset + m_bestCorrelationFraction) * m_correlationTimescale);
 	Unit fs(Unit::UNIT_FS);
 	LogTrace("Bxest correlation = %f (delta = %" PRId64 " / %s)\n",
 		m_bestCorrelation, m_bestCorrelationOffset, fs.PrettyPrint(skew).c_str());
@@ -598,67 +631,22 @@ void ScopeDeskewWizard::DoProcessWaveformSparse(SparseAnalogWaveform* ppri, Spar
 {
 	shared_lock<shared_mutex> lock(m_session.GetWaveformDataMutex());
 
-	//Calculate cross-correlation between the primary and secondary waveforms at up to +/- half the waveform length
-	int64_t len = ppri->size();
-	size_t slen = psec->size();
-
-	std::mutex cmutex;
-
-	#pragma omp parallel for
-	for(int64_t d = -m_maxSkewSamples; d < m_maxSkewSamples; d ++)
+	//Copy both waveforms so the correlation can run in the background without holding the lock
+	for(auto p : {make_pair(ppri, &m_sparsePrimary), make_pair(psec, &m_sparseSecondary)})
 	{
-		//Convert delta from samples of the primary waveform to femtoseconds
-		int64_t deltaFs = ppri->m_timescale * d;
-
-		//Loop over samples in the primary waveform
-		//TODO: Can we AVX this?
-		ssize_t samplesProcessed = 0;
-		size_t isecondary = 0;
-		double correlation = 0;
-		for(size_t i=0; i<(size_t)len; i++)
-		{
-			//Timestamp of this sample, in fs
-			int64_t start = ppri->m_offsets[i] * ppri->m_timescale + ppri->m_triggerPhase;
-
-			//Target timestamp in the secondary waveform
-			int64_t target = start + deltaFs;
-
-			//If off the start of the waveform, skip it
-			if(target < 0)
-				continue;
-
-			//Skip secondary samples if the current secondary sample ends before the primary sample starts
-			bool done = false;
-			while( (((psec->m_offsets[isecondary] + psec->m_durations[isecondary]) *
-						psec->m_timescale) + psec->m_triggerPhase) < target)
-			{
-				isecondary ++;
-
-				//If off the end of the waveform, stop
-				if(isecondary >= slen)
-				{
-					done = true;
-					break;
-				}
-			}
-			if(done)
-				break;
-
-			//Do the actual cross-correlation
-			correlation += ppri->m_samples[i] * psec->m_samples[isecondary];
-			samplesProcessed ++;
-		}
-
-		double normalizedCorrelation = correlation / samplesProcessed;
-
-		//Update correlation
-		lock_guard<mutex> lock2(cmutex);
-		if(normalizedCorrelation > m_bestCorrelation)
-		{
-			m_bestCorrelation = normalizedCorrelation;
-			m_bestCorrelationOffset = d;
-		}
+		auto wfm = p.first;
+		auto& in = *p.second;
+		size_t len = wfm->size();
+		in.m_samples.assign(wfm->m_samples.GetCpuPointer(), wfm->m_samples.GetCpuPointer() + len);
+		in.m_offsets.assign(wfm->m_offsets.GetCpuPointer(), wfm->m_offsets.GetCpuPointer() + len);
+		in.m_durations.assign(wfm->m_durations.GetCpuPointer(), wfm->m_durations.GetCpuPointer() + len);
+		in.m_timescale = wfm->m_timescale;
+		in.m_triggerPhase = wfm->m_triggerPhase;
 	}
+
+	m_correlator = make_unique<DeskewCorrelator>(m_maxSkewSamples);
+	m_cpuSparse = true;
+	StartCpuCorrelation();
 }
 
 /*
@@ -770,71 +758,59 @@ void ScopeDeskewWizard::DoProcessWaveformUniformUnequalRate(UniformAnalogWavefor
 {
 	shared_lock<shared_mutex> lock(m_session.GetWaveformDataMutex());
 
-	double start = GetTime();
-
-	int64_t len = ppri->size();
-	size_t slen = psec->size();
-
-	std::mutex cmutex;
-
-	#pragma omp parallel for
-	for(int64_t d = -m_maxSkewSamples; d < m_maxSkewSamples; d ++)
-	{
-		//Convert delta from samples of the primary waveform to femtoseconds
-		int64_t deltaFs = ppri->m_timescale * d;
-
-		//Shift by relative trigger phase
-		deltaFs += (ppri->m_triggerPhase - psec->m_triggerPhase);
-
-		//Loop over samples in the primary waveform
-		ssize_t samplesProcessed = 0;
-		size_t isecondary = 0;
-		double correlation = 0;
-		for(size_t i=0; i<(size_t)len; i++)
-		{
-			//Target timestamp in the secondary waveform
-			int64_t target = i * ppri->m_timescale + deltaFs;
-
-			//If off the start of the waveform, skip it
-			if(target < 0)
-				continue;
-
-			uint64_t utarget = target;
-
-			//Skip secondary samples if the current secondary sample ends before the primary sample starts
-			bool done = false;
-			while( static_cast<uint64_t>((isecondary + 1) *	psec->m_timescale) < utarget)
-			{
-				isecondary ++;
+	//Copy the primary and resample the secondary onto its timebase, shifted by the relative trigger phase,
+	//so the correlation doesn't need the waveforms to stick around
+	size_t len = ppri->size();
+	m_correlator = make_unique<DeskewCorrelator>(m_maxSkewSamples);
+	m_cpuSparse = false;
+	m_cpuPrimary.assign(ppri->m_samples.GetCpuPointer(), ppri->m_samples.GetCpuPointer() + len);
+	m_cpuSecondary.resize(m_correlator->GetSecondaryLength(len));
+	DeskewCorrelator::ResampleUniform(
+		psec->m_samples.GetCpuPointer(),
+		psec->size(),
+		psec->m_timescale,
+		ppri->m_timescale,
+		ppri->m_triggerPhase - psec->m_triggerPhase,
+		-m_maxSkewSamples,
+		m_cpuSecondary.size(),
+		&m_cpuSecondary[0],
+		m_cpuValidStart,
+		m_cpuValidEnd);
+
+	StartCpuCorrelation();
+}
 
-				//If off the end of the waveform, stop
-				if(isecondary >= slen)
-				{
-					done = true;
-					break;
-				}
-			}
-			if(done)
-				break;
+/**
+	@brief Runs m_correlator on m_cpuPrimary and m_cpuSecondary in the background
+ */
+void ScopeDeskewWizard::StartCpuCorrelation()
+{
+	m_correlationDone = false;
+	m_correlationThread = make_unique<thread>(CorrelationThread, this);
+}
 
-			//Do the actual cross-correlation
-			correlation += ppri->m_samples[i] * psec->m_samples[isecondary];
-			samplesProcessed ++;
-		}
+void ScopeDeskewWizard::CorrelationThread(ScopeDeskewWizard* wizard)
+{
+	pthread_setname_np_compat("DeskewCorrelate");
 
-		double normalizedCorrelation = correlation / samplesProcessed;
+	double start = GetTime();
 
-		//Update correlation
-		lock_guard<mutex> lock2(cmutex);
-		if(normalizedCorrelation > m_bestCorrelation)
-		{
-			m_bestCorrelation = normalizedCorrelation;
-			m_bestCorrelationOffset = d;
-		}
+	if(wizard->m_cpuSparse)
+		wizard->m_correlator->CorrelateSparse(wizard->m_sparsePrimary, wizard->m_sparseSecondary);
+	else
+	{
+		wizard->m_correlator->Correlate(
+			&wizard->m_cpuPrimary[0],
+			wizard->m_cpuPrimary.size(),
+			&wizard->m_cpuSecondary[0],
+			wizard->m_cpuValidStart,
+			wizard->m_cpuValidEnd);
 	}
 
 	double dt = GetTime() - start;
 	LogTrace("Correlation evaluated in %.3f sec\n", dt);
+
+	wizard->m_correlationDone = true;
 }
 
 void ScopeDeskewWizard::DoProcessWaveformUniform4xRateVulkan(
@@ -956,4 +932,5 @@ void ScopeDeskewWizard::PostprocessVulkanCorrelation()
 
 	m_bestCorrelation = bestCorr;
 	m_bestCorrelationOffset = bestOffset;
+	m_bestCorrelationFraction = 0;
 }
@@ -36,24 +36,10 @@
 #define ScopeDeskewWizard_h
 
 #include "Dialog.h"
+#include "DeskewCorrelator.h"
 #include "Session.h"
 
-class UniformCrossCorrelateArgs
-{
-public:
-	UniformCrossCorrelateArgs(UniformAnalogWaveform* ppri, UniformAnalogWaveform* psec, int64_t delta);
-
-	int64_t priTimescale;
-	int64_t secTimescale;
-
-	int64_t trigPhaseDelta;
-
-	int32_t startingDelta;
-	int32_t numDeltas;
-
-	int32_t priLen;
-	int32_t secLen;
-};
+#include <thread>
 
 class ScopeDeskewWizard : public Dialog
 {
@@ -76,6 +62,9 @@ protected:
 	void DoProcessWaveformUniformEqualRateVulkan(UniformAnalogWaveform* ppri, UniformAnalogWaveform* psec);
 	void PostprocessVulkanCorrelation();
 	void DoProcessWaveformSparse(SparseAnalogWaveform* ppri, SparseAnalogWaveform* psec);
+	void StartCpuCorrelation();
+	void CollectCorrelation();
+	static void CorrelationThread(ScopeDeskewWizard* wizard);
 	void ChannelSelector(const char* name, std::shared_ptr<Oscilloscope> scope, StreamDescriptor& stream);
 
 	enum state_t
@@ -116,6 +105,9 @@ protected:
 	float m_bestCorrelation;
 	int64_t m_bestCorrelationOffset;
 
+	///@brief Sub-sample correction to m_bestCorrelationOffset (only calculated by the CPU paths)
+	double m_bestCorrelationFraction;
+
 	bool m_gpuCorrelationAvailable;
 
 	//Maximum number of samples offset to consider
@@ -124,6 +116,39 @@ protected:
 	///@brief Calculated total skew
 	int64_t m_medianSkew;
 
+	///@brief Timescale of the primary waveform being correlated
+	int64_t m_correlationTimescale;
+
+	///@brief CPU correlator for the current waveform (null if it's being correlated on the GPU)
+	std::unique_ptr<DeskewCorrelator> m_correlator;
+
+	///@brief Background thread running m_correlator
+	std::unique_ptr<std::thread> m_correlationThread;
+
+	///@brief Set by the background thread once m_correlator is done
+	std::atomic<bool> m_correlationDone;
+
+	///@brief Primary samples being correlated on the CPU
+	std::vector<float> m_cpuPrimary;
+
+	///@brief Secondary samples being correlated on the CPU, resampled to the primary timebase
+	std::vector<float> m_cpuSecondary;
+
+	///@brief First valid sample in m_cpuSecondary (as a primary sample index)
+	int64_t m_cpuValidStart;
+
+	///@brief One past the last valid sample in m_cpuSecondary (as a primary sample index)
+	int64_t m_cpuValidEnd;
+
+	///@brief True if the CPU correlation is of m_sparsePrimary and m_sparseSecondary rather than m_cpuPrimary
+	bool m_cpuSparse;
+
+	///@brief Primary waveform being correlated on the CPU, if sparse
+	DeskewSparseInput m_sparsePrimary;
+
+	///@brief Secondary waveform being correlated on the CPU, if sparse
+	DeskewSparseInput m_sparseSecondary;
+
 	//Vulkan processing queues etc
 	std::shared_ptr<QueueHandle> m_queue;
 	vk::raii::CommandPool m_pool;
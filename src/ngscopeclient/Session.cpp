@@ -44,6 +44,8 @@
 #include "PowerSupplyDialog.h"
 #include "RFGeneratorDialog.h"
 #include "PreferenceTypes.h"
+#include "WaveformCodec.h"
+#include "WaveformLoadJob.h"
 
 #include "../scopehal/LeCroyOscilloscope.h"
 #include "../scopehal/SiglentSCPIOscilloscope.h"
@@ -53,6 +55,7 @@
 
 #include <fstream>
 #include <cinttypes>
+#include <filesystem>
 
 #ifdef _WIN32
 #include <windows.h>
@@ -65,7 +68,6 @@
 #endif
 
 extern Event g_waveformReadyEvent;
-extern Event g_waveformProcessedEvent;
 extern Event g_rerenderDoneEvent;
 extern Event g_refilterRequestedEvent;
 extern Event g_partialRefilterRequestedEvent;
@@ -83,6 +85,11 @@ Session::Session(MainWindow* wnd)
 	, m_mainWindow(wnd)
 	, m_shuttingDown(false)
 	, m_modifiedSinceLastSave(false)
+	, m_pipelineDepth(1)
+	, m_activePipelineStage(PIPELINE_STAGE_COUNT)
+	, m_pipelineStageStart(0)
+	, m_maxIdlePollInterval(0)
+	, m_rasterizeFp16(false)
 	, m_tArm(0)
 	, m_tPrimaryTrigger(0)
 	, m_triggerArmed(false)
@@ -90,9 +97,16 @@ Session::Session(MainWindow* wnd)
 	, m_graphExecutor(4)
 	, m_lastFilterGraphExecTime(0)
 	, m_history(*this)
+	, m_restoredFilterGeneration(0)
+	, m_filterCacheEnabled(true)
+	, m_filterCacheMinRuntime(0)
 	, m_multiScope(false)
 	, m_nextMarkerNum(1)
 {
+	for(int i=0; i<PIPELINE_STAGE_COUNT; i++)
+		m_pipelineBusyTime[i] = 0;
+
+	CachePerformancePreferences();
 	CreateReferenceFilters();
 
 	SCPIOscilloscope::EnumDrivers(m_driverNamesByType["oscilloscope"]);
@@ -130,6 +144,9 @@ void Session::ClearBackgroundThreads()
 	//Stop the trigger so there's no pending waveforms
 	StopTrigger(true);
 
+	//Finish writing any saved waveforms before we start tearing down history
+	FinishSaveJob();
+
 	//Shut down instrument threads.
 	//This has to happen before we terminate the WaveformThread, to avoid waveforms getting stuck
 	//which have been acquired but not processed
@@ -140,10 +157,8 @@ void Session::ClearBackgroundThreads()
 	}
 
 	//Clear our trigger state
-	//Important to signal the WaveformThread so it doesn't block waiting on response that's not going to come
 	g_waveformReadyEvent.Clear();
 	g_rerenderDoneEvent.Clear();
-	g_waveformProcessedEvent.Signal();
 
 	//Signal our other worker threads to exit, then wait until they do so
 	m_shuttingDown = true;
@@ -154,8 +169,8 @@ void Session::ClearBackgroundThreads()
 	//Clear shutdown flag in case we're reusing the session object
 	m_shuttingDown = false;
 
-	//Clear the WaveformThread signal if it's not already cleared
-	g_waveformProcessedEvent.Clear();
+	//Clear the WaveformThread signal in case it published something on the way out
+	g_waveformReadyEvent.Clear();
 }
 
 void Session::FlushConfigCache()
@@ -182,8 +197,11 @@ void Session::Clear()
 
 	lock_guard<shared_mutex> lock(m_waveformDataMutex);
 
-	//Clear packet managers before removing filters (since they can hold references to them)
+	//Clear packet managers and cached filter outputs before removing filters (since they can hold references to them)
 	m_packetmgrs.clear();
+	m_currentFilterCache = nullptr;
+	m_restoredFilters.clear();
+	m_history.ClearFilterCaches();
 
 	/**
 		HACK: for now, export filters keep an open reference to themselves to avoid memory leaks
@@ -219,7 +237,13 @@ void Session::Clear()
 
 	//Delete scopes once we've terminated the threads
 	//Detach waveforms before we destroy the scope, since history owns them
-	//(but make sure they're actually *in* history first!)
+	//(but make sure they're actually *in* history first, including anything still stuck in the pipeline!)
+	{
+		lock_guard<mutex> lock3(m_pendingAcquisitionMutex);
+		for(auto& acq : m_pendingAcquisitions)
+			m_history.AddHistory(acq.m_waveforms);
+		m_pendingAcquisitions.clear();
+	}
 	m_history.AddHistory(m_oscilloscopes);
 	for(auto scope : m_oscilloscopes)
 	{
@@ -241,6 +265,7 @@ void Session::Clear()
 	m_oscilloscopes.clear();
 	m_psus.clear();
 	m_loads.clear();
+	m_graphIndex.Invalidate();
 	m_meters.clear();
 	m_berts.clear();
 	m_scopeDeskewCal.clear();
@@ -249,8 +274,7 @@ void Session::Clear()
 
 	//Remove all trigger groups
 	m_triggerGroups.clear();
-	m_recentlyTriggeredScopes.clear();
-	m_recentlyTriggeredGroups.clear();
+	m_stagedAcquisition = PendingAcquisition();
 
 	//Remove any existing IDs
 	m_idtable.clear();
@@ -286,25 +310,24 @@ void Session::AddMarker(Marker m)
 
 	//Add the marker
 	m_markers[m.m_timestamp].push_back(m);
-	OnMarkerChanged();
+	OnMarkerChanged(m.m_timestamp);
 }
 
 /**
 	@brief Called when a marker is added, removed, or modified
 
-	TODO: hint as to what marker and what was changed?
+	@param t	Timestamp of the waveform containing the marker
  */
-void Session::OnMarkerChanged()
+void Session::OnMarkerChanged(TimePoint t)
 {
-	//Sort our markers by timestamp
-	auto times = GetMarkerTimes();
-	for(auto t : times)
-		sort(m_markers[t].begin(), m_markers[t].end());
+	//Keep the markers for this waveform sorted
+	auto& markers = m_markers[t];
+	sort(markers.begin(), markers.end());
 
 	//Update the protocol analyzer views that might be displaying it
 	lock_guard lock(m_packetMgrMutex);
 	for(auto it : m_packetmgrs)
-		it.second->OnMarkerChanged();
+		it.second->OnMarkerChanged(t);
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -383,8 +406,6 @@ bool Session::LoadFromYaml(const YAML::Node& node, const string& dataDir, bool o
 		}
 	}
 
-	OnMarkerChanged();
-
 	//If we have no waveform data (filter-only session) create a WaveformThread to do rendering,
 	//then refresh the filter graph
 	if(m_history.empty())
@@ -440,6 +461,12 @@ bool Session::LoadWaveformData(int version, const string& dataDir)
 
 	m_history.SetMaxToCurrentDepth();
 
+	//Nothing was moved between tiers while loading, so get back within budget now
+	{
+		lock_guard<shared_mutex> lock(m_waveformDataMutex);
+		m_history.EnforceBudgets();
+	}
+
 	return true;
 }
 
@@ -482,7 +509,7 @@ bool Session::LoadWaveformDataForFilters(
 				continue;
 
 			auto fmt = stag["format"].as<string>();
-			bool dense = (fmt == "densev1");
+			bool dense = WaveformCodec::IsDenseFormat(fmt);
 
 			//TODO: we need to encode a digital path in the YAML once MemoryFilter has digital channel support
 			//TODO: support non-analog/digital captures (eyes, spectrograms, etc)
@@ -529,6 +556,11 @@ bool Session::LoadWaveformDataForFilters(
 
 /**
 	@brief Loads waveform data for a single scope
+
+	All metadata is parsed first, then the sample data for every stream is decoded in parallel by a WaveformLoadJob.
+	This blocks until everything is decoded. With Performance.Loading.lazy_load set, only the newest point is decoded
+	here and the rest of history is read back from the session on demand, so the newest waveform can be shown without
+	waiting for older history.
  */
 bool Session::LoadWaveformDataForScope(
 	int version,
@@ -563,7 +595,10 @@ bool Session::LoadWaveformDataForScope(
 			chan->SetData(nullptr, j);
 	}
 
-	//Load the data for each waveform
+	//Parse all of the metadata and create empty waveforms first, so we can load the payloads in parallel
+	vector<PendingHistoryPoint> points;
+	set<TimePoint> times;
+	WaveformLoadJob job;
 	for(auto it : wavenode)
 	{
 		//Top level metadata
@@ -593,20 +628,25 @@ bool Session::LoadWaveformDataForScope(
 		if(wfm["label"])
 			label = wfm["label"].as<string>();
 
-		LogTrace("Loading waveform data at time %s\n", time.PrettyPrint().c_str());
+		LogTrace("Loading waveform metadata at time %s\n", time.PrettyPrint().c_str());
 
 		//If we already have historical data from this timestamp, warn and drop the duplicate data
 		auto hist = m_history.GetHistory(time);
-		if(hist && (hist->m_history.find(scope) != hist->m_history.end()))
+		if( (hist && (hist->m_history.find(scope) != hist->m_history.end())) || (times.find(time) != times.end()) )
 		{
 			LogWarning("Session contains duplicate data for time %" PRId64 ".%" PRId64 ", discarding\n", static_cast<int64_t>(time.first), time.second);
 			continue;
 		}
+		times.emplace(time);
+
+		PendingHistoryPoint point;
+		point.m_time = time;
+		point.m_pinned = pinned;
+		point.m_label = label;
 
-		//Set up channel metadata first (serialized)
+		//Set up channel metadata
 		auto chans = wfm["channels"];
-		vector<pair<int, int>> channels;	//pair<channel, stream>
-		vector<string> formats;
+		char tmp[512];
 		for(auto jt : chans)
 		{
 			auto ch = jt.second;
@@ -615,55 +655,51 @@ bool Session::LoadWaveformDataForScope(
 			if(ch["stream"])
 				stream = ch["stream"].as<int>();
 			auto chan = scope->GetOscilloscopeChannel(channel_index);
-			channels.push_back(pair<int, int>(channel_index, stream));
 
 			//Waveform format defaults to sparsev1 as that's what was used before
 			//the metadata file contained a format ID at all
 			string format = "sparsev1";
 			if(ch["format"])
 				format = ch["format"].as<string>();
-			formats.push_back(format);
 
-			bool dense = (format == "densev1");
+			bool dense = WaveformCodec::IsDenseFormat(format);
 
 			//TODO: support non-analog/digital captures (eyes, spectrograms, etc)
 			WaveformBase* cap = nullptr;
-			SparseAnalogWaveform* sacap = nullptr;
-			UniformAnalogWaveform* uacap = nullptr;
-			SparseDigitalWaveform* sdcap = nullptr;
-			UniformDigitalWaveform* udcap = nullptr;
-			CANWaveform* sccap = nullptr;
 
 			//if datatype is specified, use that
-			if( (format == "sparsev1") && ch["datatype"] )
+			if( ( (format == "sparsev1") || (format == "sparsev2") ) && ch["datatype"] )
 			{
 				auto dtype = ch["datatype"].as<string>();
 				if(dtype == "analog")
-					cap = sacap = new SparseAnalogWaveform;
+					cap = new SparseAnalogWaveform;
 				else if(dtype == "digital")
-					cap = sdcap = new SparseDigitalWaveform;
+					cap = new SparseDigitalWaveform;
 				else if(dtype == "can")
-					cap = sccap = new CANWaveform;
+					cap = new CANWaveform;
 				else
-					LogError("Unrecognized sparsev1 datatype %s\n", dtype.c_str());
+					LogError("Unrecognized %s datatype %s\n", format.c_str(), dtype.c_str());
 			}
 
 			//if not guess based on stream type
 			else if(chan->GetType(0) == Stream::STREAM_TYPE_ANALOG)
 			{
 				if(dense)
-					cap = uacap = new UniformAnalogWaveform;
+					cap = new UniformAnalogWaveform;
 				else
-					cap = sacap = new SparseAnalogWaveform;
+					cap = new SparseAnalogWaveform;
 			}
 			else
 			{
 				if(dense)
-					cap = udcap = new UniformDigitalWaveform;
+					cap = new UniformDigitalWaveform;
 				else
-					cap = sdcap = new SparseDigitalWaveform;
+					cap = new SparseDigitalWaveform;
 			}
 
+			if(!cap)
+				continue;
+
 			//Channel waveform metadata
 			cap->m_timescale = ch["timescale"].as<long>();
 			cap->m_startTimestamp = time.first;
@@ -676,25 +712,13 @@ bool Session::LoadWaveformDataForScope(
 			else
 				cap->m_triggerPhase = ch["trigphase"].as<long long>();
 
-			chan->Detach(stream);
-			chan->SetData(cap, stream);
-		}
-
-		//Actually load the data for each channel
-		size_t nchans = channels.size();
-		char tmp[512];
-		for(size_t i=0; i<nchans; i++)
-		{
-			auto nchan = channels[i].first;
-			auto nstream = channels[i].second;
-
-			if(nstream == 0)
+			if(stream == 0)
 			{
 				snprintf(tmp, sizeof(tmp), "%s/scope_%d_waveforms/waveform_%d/channel_%d.bin",
 					dataDir.c_str(),
 					scope_id,
 					waveform_id,
-					nchan);
+					channel_index);
 			}
 			else
 			{
@@ -702,28 +726,120 @@ bool Session::LoadWaveformDataForScope(
 					dataDir.c_str(),
 					scope_id,
 					waveform_id,
-					nchan,
-					nstream);
+					channel_index,
+					stream);
+			}
+
+			PendingStream ps;
+			ps.m_channel = chan;
+			ps.m_stream = stream;
+			ps.m_waveform = cap;
+			ps.m_format = format;
+			ps.m_path = tmp;
+			ps.m_fileSize = 0;
+			ps.m_request = 0;
+			error_code ec;
+			auto fsize = filesystem::file_size(ps.m_path, ec);
+			if(!ec)
+				ps.m_fileSize = fsize;
+			point.m_streams.push_back(ps);
+		}
+
+		points.push_back(point);
+	}
+
+	//In lazy mode only the newest point is loaded now, everything else is read from the session on demand
+	bool lazy = m_preferences.GetBool("Performance.Loading.lazy_load");
+	size_t firstEager = 0;
+	if(lazy && !points.empty())
+		firstEager = points.size() - 1;
+
+	//Queue the payloads newest first, so the waveform that ends up on screen is ready soonest
+	for(size_t i=points.size(); i > firstEager; i--)
+	{
+		for(auto& ps : points[i-1].m_streams)
+			ps.m_request = job.Add(ps.m_waveform, ps.m_format, ps.m_path, ps.m_fileSize);
+	}
+	double tstart = GetTime();
+	job.Start(m_preferences.GetInt("Performance.Loading.max_inflight_bytes"));
+	job.Wait();
+	LogTrace("Loaded %zu history points in %.3f sec\n", points.size() - firstEager, GetTime() - tstart);
+
+	//Commit to history in file order
+	for(size_t i=0; i<points.size(); i++)
+	{
+		auto& point = points[i];
+		shared_ptr<HistoryPoint> hpoint;
+
+		//Not loaded yet, add the empty waveforms straight to history
+		if(i < firstEager)
+		{
+			map<shared_ptr<Oscilloscope>, WaveformHistory> data;
+			auto& hist = data[scope];
+			for(size_t j=0; j<scope->GetChannelCount(); j++)
+			{
+				auto chan = scope->GetOscilloscopeChannel(j);
+				if(!chan)
+					continue;
+				for(size_t k=0; k<chan->GetStreamCount(); k++)
+					hist[StreamDescriptor(chan, k)] = nullptr;
 			}
+			for(auto& ps : point.m_streams)
+				hist[StreamDescriptor(ps.m_channel, ps.m_stream)] = ps.m_waveform;
 
-			DoLoadWaveformDataForStream(
-				scope->GetOscilloscopeChannel(nchan),
-				nstream,
-				formats[i],
-				tmp);
+			hpoint = m_history.AddHistory(data, false, point.m_pinned, point.m_label);
+			if(!hpoint)
+			{
+				for(auto& ps : point.m_streams)
+					delete ps.m_waveform;
+				continue;
+			}
+
+			//Size of the files is a reasonable guess until we actually load it
+			hpoint->m_tier = HistoryPoint::TIER_SESSION;
+			hpoint->m_sizeBytes = 0;
+			for(auto& ps : point.m_streams)
+				hpoint->m_sizeBytes += ps.m_fileSize;
 		}
 
-		vector<shared_ptr<Oscilloscope>> temp;
-		temp.push_back(scope);
-		m_history.AddHistory(temp, false, pinned, label);
+		else
+		{
+			for(auto& ps : point.m_streams)
+			{
+				auto cap = job.GetWaveform(ps.m_request);
+				cap->PrepareForGpuAccess();
+
+				ps.m_channel->Detach(ps.m_stream);
+				ps.m_channel->SetData(cap, ps.m_stream);
+			}
+
+			vector<shared_ptr<Oscilloscope>> temp;
+			temp.push_back(scope);
+			m_history.AddHistory(temp, false, point.m_pinned, point.m_label);
+
+			//TODO: this is not good for multiscope
+			//TODO: handle eye patterns (need to know window size for it to work right)
+			RefreshAllFilters();
 
-		//TODO: this is not good for multiscope
-		//TODO: handle eye patterns (need to know window size for it to work right)
-		RefreshAllFilters();
+			//Make sure we actually got our own point and not one for another scope at the same time
+			hpoint = m_history.GetHistory(point.m_time);
+			if(!hpoint || (hpoint->m_history.find(scope) == hpoint->m_history.end()) )
+				continue;
+		}
+
+		//Remember where the data came from, so it can be dropped and read back again instead of spilling
+		for(auto& ps : point.m_streams)
+		{
+			hpoint->m_sessionRecords.push_back(HistoryPoint::SessionRecord(
+				scope, StreamDescriptor(ps.m_channel, ps.m_stream), ps.m_format, ps.m_path, ps.m_fileSize));
+		}
 	}
 	return true;
 }
 
+/**
+	@brief Loads sample data for a single stream and attaches it to the channel
+ */
 void Session::DoLoadWaveformDataForStream(
 	OscilloscopeChannel* chan,
 	int stream,
@@ -732,6 +848,36 @@ void Session::DoLoadWaveformDataForStream(
 	)
 {
 	auto cap = chan->GetData(stream);
+	auto loaded = DoLoadWaveformData(cap, format, fname);
+
+	//We might have replaced the waveform with a uniform one
+	if(loaded != cap)
+	{
+		chan->Detach(stream);
+		chan->SetData(loaded, stream);
+	}
+	loaded->PrepareForGpuAccess();
+}
+
+/**
+	@brief Loads sample data from a file into a waveform
+
+	Only touches the CPU side of the waveform, so it's safe to call from a background thread as long as nothing else
+	is using the waveform.
+
+	@param cap		The waveform to load into
+	@param format	Format of the file
+	@param fname	Path to the file
+	@param ok		Set to false if the file couldn't be read or was invalid, true otherwise (may be null)
+
+	@return The loaded waveform. This is normally cap, but if a sparse waveform turns out to be dense packed it's
+			converted to a uniform waveform and cap is deleted.
+ */
+WaveformBase* Session::DoLoadWaveformData(WaveformBase* cap, const string& format, const string& fname, bool* ok)
+{
+	if(ok)
+		*ok = false;
+
 	auto sacap = dynamic_cast<SparseAnalogWaveform*>(cap);
 	auto uacap = dynamic_cast<UniformAnalogWaveform*>(cap);
 	auto sdcap = dynamic_cast<SparseDigitalWaveform*>(cap);
@@ -749,7 +895,7 @@ void Session::DoLoadWaveformDataForStream(
 		if(!fp)
 		{
 			LogError("couldn't open %s\n", fname.c_str());
-			return;
+			return cap;
 		}
 
 		//Read the whole file into a buffer a megabyte at a time
@@ -779,12 +925,23 @@ void Session::DoLoadWaveformDataForStream(
 		if(fd < 0)
 		{
 			LogError("couldn't open %s\n", fname.c_str());
-			return;
+			return cap;
 		}
 		size_t len = lseek(fd, 0, SEEK_END);
-		buf = (unsigned char*)mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+		if(len)
+		{
+			buf = (unsigned char*)mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+			if(buf == MAP_FAILED)
+			{
+				LogError("couldn't map %s\n", fname.c_str());
+				::close(fd);
+				return cap;
+			}
+		}
 	#endif
 
+	bool success = true;
+
 	//Sparse interleaved
 	if(format == "sparsev1")
 	{
@@ -799,58 +956,101 @@ void Session::DoLoadWaveformDataForStream(
 		size_t nsamples = len / samplesize;
 		cap->Resize(nsamples);
 
-		//TODO: AVX this?
-		for(size_t j=0; j<nsamples; j++)
+		//Type dispatch is hoisted out of the per-sample loop, the unpacking itself is vectorized and multithreaded
+		if(sacap)
 		{
-			size_t offset = j*samplesize;
-
-			//Read start time and duration
-			int64_t* stime = reinterpret_cast<int64_t*>(buf+offset);
-			offset += 2*sizeof(int64_t);
+			WaveformCodec::UnpackSparseV1Analog(
+				buf,
+				nsamples,
+				sacap->m_offsets.GetCpuPointer(),
+				sacap->m_durations.GetCpuPointer(),
+				sacap->m_samples.GetCpuPointer());
+		}
+		else if(sdcap)
+		{
+			WaveformCodec::UnpackSparseV1Digital(
+				buf,
+				nsamples,
+				sdcap->m_offsets.GetCpuPointer(),
+				sdcap->m_durations.GetCpuPointer(),
+				sdcap->m_samples.GetCpuPointer());
+		}
 
-			//Read sample data
-			if(sacap)
+		//CAN capture
+		else if(ccap)
+		{
+			WaveformCodec::UnpackSparseV1Timestamps(
+				buf,
+				nsamples,
+				samplesize,
+				ccap->m_offsets.GetCpuPointer(),
+				ccap->m_durations.GetCpuPointer());
+
+			auto samples = ccap->m_samples.GetCpuPointer();
+			#pragma omp parallel for
+			for(int64_t j=0; j<(int64_t)nsamples; j++)
 			{
-				//The file format assumes "float" is IEEE754 32-bit float.
-				//If your platform doesn't do that, good luck.
-				//cppcheck-suppress invalidPointerCast
-				sacap->m_samples[j] = *reinterpret_cast<float*>(buf+offset);
-
-				sacap->m_offsets[j] = stime[0];
-				sacap->m_durations[j] = stime[1];
+				uint32_t p[2];
+				memcpy(p, buf + j*samplesize + 2*sizeof(int64_t), sizeof(p));
+				samples[j] = CANSymbol((CANSymbol::stype)p[1], p[0]);
 			}
+		}
 
-			else if(sdcap)
-			{
-				sdcap->m_samples[j] = *reinterpret_cast<bool*>(buf+offset);
-				sdcap->m_offsets[j] = stime[0];
-				sdcap->m_durations[j] = stime[1];
-			}
+		cap = ConvertToUniformIfDense(cap);
+	}
 
-			//CAN capture
-			else if(ccap)
-			{
-				uint32_t* p = reinterpret_cast<uint32_t*>(buf+offset);
+	//Sparse columnar
+	else if(format == "sparsev2")
+	{
+		size_t sampleSize = 0;
+		if(sacap)
+			sampleSize = sizeof(float);
+		else if(sdcap)
+			sampleSize = sizeof(bool);
+		else if(ccap)
+			sampleSize = 2*sizeof(uint32_t);
 
-				ccap->m_samples[j] = CANSymbol((CANSymbol::stype)p[1], p[0]);
-				ccap->m_offsets[j] = stime[0];
-				ccap->m_durations[j] = stime[1];
-			}
+		WaveformCodec::SparseV2Header hdr;
+		auto scap = dynamic_cast<SparseWaveformBase*>(cap);
+		if(!scap || !WaveformCodec::ParseSparseV2Header(buf, len, sampleSize, hdr))
+		{
+			LogError("Invalid or truncated sparsev2 waveform file %s\n", fname.c_str());
+			success = false;
 		}
 
-		//Quickly check if the waveform is dense packed, even if it was stored as sparse.
-		//Since we know samples must be monotonic and non-overlapping, we don't have to check every single one!
-		int64_t nlast = nsamples - 1;
-		if(sacap)
+		else
 		{
-			if( (sacap->m_offsets[0] == 0) &&
-				(sacap->m_offsets[nlast] == nlast) &&
-				(sacap->m_durations[nlast] == 1) )
+			size_t nsamples = hdr.m_nsamples;
+			cap->Resize(nsamples);
+
+			//Columns are stored exactly as they are in memory, so this is one copy per column
+			if(!WaveformCodec::UnpackSparseV2Timestamps(
+				buf, hdr, scap->m_offsets.GetCpuPointer(), scap->m_durations.GetCpuPointer()))
 			{
-				//Waveform was actually uniform, so convert it
-				cap = new UniformAnalogWaveform(*sacap);
-				chan->SetData(cap, stream);
+				LogError("Corrupted offsets in sparsev2 waveform file %s\n", fname.c_str());
+				cap->Resize(0);
+				nsamples = 0;
+				success = false;
 			}
+
+			auto psamples = buf + hdr.m_columnStart[WaveformCodec::COLUMN_SAMPLES];
+			if(sacap)
+				memcpy(sacap->m_samples.GetCpuPointer(), psamples, nsamples*sampleSize);
+			else if(sdcap)
+				memcpy(sdcap->m_samples.GetCpuPointer(), psamples, nsamples*sampleSize);
+			else if(ccap)
+			{
+				auto samples = ccap->m_samples.GetCpuPointer();
+				#pragma omp parallel for
+				for(int64_t j=0; j<(int64_t)nsamples; j++)
+				{
+					uint32_t p[2];
+					memcpy(p, psamples + j*sampleSize, sizeof(p));
+					samples[j] = CANSymbol((CANSymbol::stype)p[1], p[0]);
+				}
+			}
+
+			cap = ConvertToUniformIfDense(cap);
 		}
 	}
 
@@ -872,22 +1072,83 @@ void Session::DoLoadWaveformDataForStream(
 			memcpy(udcap->m_samples.GetCpuPointer(), buf, nsamples*sizeof(bool));
 	}
 
+	//Dense compressed
+	else if(format == "densev2")
+	{
+		WaveformCodec::DenseV2Header hdr;
+		auto type = uacap ? WaveformCodec::DENSEV2_ANALOG : WaveformCodec::DENSEV2_DIGITAL;
+		if( (!uacap && !udcap) || !WaveformCodec::ParseDenseV2Header(buf, len, type, hdr) )
+		{
+			LogError("Invalid or corrupted densev2 file %s\n", fname.c_str());
+			success = false;
+		}
+		else
+		{
+			cap->Resize(hdr.m_nsamples);
+
+			bool decoded;
+			if(uacap)
+				decoded = WaveformCodec::DecodeDenseV2Analog(buf, hdr, uacap->m_samples.GetCpuPointer());
+			else
+				decoded = WaveformCodec::DecodeDenseV2Digital(buf, hdr, udcap->m_samples.GetCpuPointer());
+
+			if(!decoded)
+			{
+				LogError("Invalid or corrupted densev2 file %s\n", fname.c_str());
+				cap->Resize(0);
+				success = false;
+			}
+		}
+	}
+
 	else
 	{
 		LogError(
 			"Unknown waveform format \"%s\", perhaps this file was created by a newer version of ngscopeclient?\n",
 			format.c_str());
+		success = false;
 	}
 
 	cap->MarkModifiedFromCpu();
-	cap->PrepareForGpuAccess();
 
 	#ifdef _WIN32
 		delete[] buf;
 	#else
-		munmap(buf, len);
+		if(len)
+			munmap(buf, len);
 		::close(fd);
 	#endif
+
+	if(ok)
+		*ok = success;
+	return cap;
+}
+
+/**
+	@brief Replaces a freshly loaded sparse analog waveform with a uniform one, if it's actually dense packed
+
+	@return The waveform to use (if it was converted, the original waveform is deleted)
+ */
+WaveformBase* Session::ConvertToUniformIfDense(WaveformBase* cap)
+{
+	auto sacap = dynamic_cast<SparseAnalogWaveform*>(cap);
+	if(!sacap || (sacap->size() == 0) )
+		return cap;
+
+	//Quickly check if the waveform is dense packed, even if it was stored as sparse.
+	//Since we know samples must be monotonic and non-overlapping, we don't have to check every single one!
+	int64_t nlast = sacap->size() - 1;
+	if( (sacap->m_offsets[0] == 0) &&
+		(sacap->m_offsets[nlast] == nlast) &&
+		(sacap->m_durations[nlast] == 1) )
+	{
+		//Waveform was actually uniform, so convert it
+		auto uacap = new UniformAnalogWaveform(*sacap);
+		delete sacap;
+		return uacap;
+	}
+
+	return cap;
 }
 
 /**
@@ -2042,6 +2303,7 @@ bool Session::LoadFilters(int /*version*/, const YAML::Node& node)
 			filter->LoadInputs(dnode, m_idtable);
 	}
 
+	OnFilterGraphChanged();
 	return true;
 }
 
@@ -2074,6 +2336,7 @@ bool Session::LoadInstrumentInputs(int /*version*/, const YAML::Node& node)
 		}
 	}
 
+	OnFilterGraphChanged();
 	return true;
 }
 
@@ -2219,17 +2482,92 @@ YAML::Node Session::SerializeMarkers()
 	return node;
 }
 
+/**
+	@brief Checks if a file is somewhere inside a directory
+
+	Errs on the side of saying yes if either path can't be resolved.
+ */
+static bool IsInDirectory(const string& path, const string& dir)
+{
+	error_code ec;
+	auto cdir = filesystem::weakly_canonical(dir, ec);
+	if(ec)
+		return true;
+	auto cpath = filesystem::weakly_canonical(path, ec);
+	if(ec)
+		return true;
+
+	auto rel = cpath.lexically_relative(cdir);
+	return !rel.empty() && (*rel.begin() != "..");
+}
+
+/**
+	@brief Saves waveform data for all history and persistent filters
+
+	Metadata is written immediately, but sample data for history in memory is written by a background WaveformSaveJob.
+	Call FinishSaveJob() to wait for it. History which has been spilled or unloaded is written synchronously, one point
+	at a time, then dropped back to the newly written files.
+
+	@param dataDir	Path to the _data directory
+ */
 bool Session::SerializeWaveforms(const string& dataDir)
 {
+	//Don't start a new save until the previous one is done
+	FinishSaveJob();
+
 	//Metadata nodes for each scope
 	std::map<std::shared_ptr<Oscilloscope>, YAML::Node> metadataNodes;
 
+	//Spilled and unloaded history is brought back into memory one point at a time below, and written out before
+	//moving on to the next, so we never need room for all of it at once.
+	//The exception is anything loaded from files we're about to overwrite, which has to be read back up front.
+	//This stays in memory until the save completes, since the job locks history in its current tier.
+	{
+		lock_guard<shared_mutex> lock(m_waveformDataMutex);
+		for(auto& hpoint : m_history.m_history)
+		{
+			if(hpoint->m_tier != HistoryPoint::TIER_SESSION)
+				continue;
+
+			for(auto& r : hpoint->m_sessionRecords)
+			{
+				if(IsInDirectory(r.m_path, dataDir))
+				{
+					m_history.SetTier(hpoint.get(), HistoryPoint::TIER_PAGEABLE);
+					break;
+				}
+			}
+		}
+	}
+
+	//Sample data for resident history is written in the background
+	bool compress = m_preferences.GetBool("Files.compress_waveforms");
+	bool columnar = m_preferences.GetBool("Files.columnar_sparse_waveforms");
+	m_saveJob = make_unique<WaveformSaveJob>(m_history, compress, columnar);
+
 	//Serialize data from each history point
 	size_t numwfm = 0;
 	for(auto& hpoint : m_history.m_history)
 	{
 		auto timestamp = hpoint->m_time;
 
+		//If the point isn't in memory, load it just long enough to write it out synchronously.
+		//Otherwise we might be about to overwrite the session it was loaded from, so forget where it came from.
+		bool streamed = (hpoint->m_tier >= HistoryPoint::TIER_DISK);
+		if(streamed)
+		{
+			lock_guard<shared_mutex> lock(m_waveformDataMutex);
+			m_history.SetTier(hpoint.get(), HistoryPoint::TIER_PAGEABLE);
+		}
+		else
+			hpoint->m_sessionRecords.clear();
+		if(hpoint->m_tier >= HistoryPoint::TIER_DISK)
+		{
+			LogError("Couldn't load history at %s to save it\n", timestamp.PrettyPrint().c_str());
+			return false;
+		}
+		vector<HistoryPoint::SessionRecord> newRecords;
+
 		//Save each scope
 		//TODO: Do we want to change the directory hierarchy in a future file format schema?
 		//For now, we stick with scope / waveform.
@@ -2292,11 +2630,38 @@ bool Session::SerializeWaveforms(const string& dataDir)
 					else
 						datapath += string("/channel_") + to_string(i) + "_stream" + to_string(j) + ".bin";
 					auto sparse = dynamic_cast<SparseWaveformBase*>(data);
-					auto uniform = dynamic_cast<UniformWaveformBase*>(data);
+					string format;
+					if(sparse)
+						format = columnar ? "sparsev2" : "sparsev1";
+					else
+						format = compress ? "densev2" : "densev1";
+					data->PrepareForCpuAccess();
+					if(streamed)
+					{
+						bool ok;
+						if(sparse)
+							ok = SerializeSparseWaveform(sparse, datapath, columnar);
+						else
+						{
+							ok = SerializeUniformWaveform(
+								dynamic_cast<UniformWaveformBase*>(data), datapath, compress);
+						}
+						if(!ok)
+						{
+							LogError("Failed to save waveform data to %s\n", datapath.c_str());
+							return false;
+						}
+
+						error_code ec;
+						auto fsize = filesystem::file_size(datapath, ec);
+						newRecords.push_back(HistoryPoint::SessionRecord(
+							scope, stream, format, datapath, ec ? 0 : fsize));
+					}
+					else
+						m_saveJob->Add(hpoint, data, datapath);
+					chnode["format"] = format;
 					if(sparse)
 					{
-						chnode["format"] = "sparsev1";
-						SerializeSparseWaveform(sparse, datapath);
 
 						//Save type if it's a protocol waveform
 						//so if we do an offline load, we know what type of waveform to make
@@ -2307,11 +2672,6 @@ bool Session::SerializeWaveforms(const string& dataDir)
 						else if(dynamic_cast<CANWaveform*>(sparse) != nullptr)
 							chnode["datatype"] = "can";
 					}
-					else
-					{
-						chnode["format"] = "densev1";
-						SerializeUniformWaveform(uniform, datapath);
-					}
 
 					mnode["channels"][string("ch") + to_string(i) + "s" + to_string(j)] = chnode;
 				}
@@ -2320,9 +2680,19 @@ bool Session::SerializeWaveforms(const string& dataDir)
 			metadataNodes[scope]["waveforms"][string("wfm") + to_string(numwfm)] = mnode;
 		}
 
+		//Drop streamed points back out of memory. They can now be read back from the files we just wrote.
+		if(streamed)
+		{
+			hpoint->m_sessionRecords = newRecords;
+			lock_guard<shared_mutex> lock(m_waveformDataMutex);
+			m_history.SetTier(hpoint.get(), HistoryPoint::TIER_SESSION);
+		}
+
 		numwfm ++;
 	}
 
+	m_saveJob->Start();
+
 	//Write metadata files (by this point, data directories should have been created)
 	for(size_t i=0; i<m_oscilloscopes.size(); i++)
 	{
@@ -2399,13 +2769,13 @@ bool Session::SerializeWaveforms(const string& dataDir)
 			auto uniform = dynamic_cast<UniformWaveformBase*>(data);
 			if(sparse)
 			{
-				chnode["format"] = "sparsev1";
-				SerializeSparseWaveform(sparse, datapath);
+				chnode["format"] = columnar ? "sparsev2" : "sparsev1";
+				SerializeSparseWaveform(sparse, datapath, columnar);
 			}
 			else
 			{
-				chnode["format"] = "densev1";
-				SerializeUniformWaveform(uniform, datapath);
+				chnode["format"] = compress ? "densev2" : "densev1";
+				SerializeUniformWaveform(uniform, datapath, compress);
 			}
 
 			mnode["streams"][string("s") + to_string(j)] = chnode;
@@ -2425,30 +2795,159 @@ bool Session::SerializeWaveforms(const string& dataDir)
 }
 
 /**
-	@brief Saves waveform sample data in the "sparsev1" file format.
+	@brief Blocks until the background save job (if any) completes, then frees it
+ */
+void Session::FinishSaveJob()
+{
+	if(!m_saveJob)
+		return;
+
+	m_saveJob->Wait();
+	m_saveJob = nullptr;
+}
+
+/**
+	@brief Opens a waveform data file for writing
+
+	We only ever write in large blocks, so stdio buffering would just be an extra copy.
+ */
+static FILE* OpenWaveformFile(const string& path)
+{
+	FILE* fp = fopen(path.c_str(), "wb");
+	if(fp)
+		setvbuf(fp, nullptr, _IONBF, 0);
+	return fp;
+}
+
+///@brief Size of the blocks waveform data is written in
+static const size_t g_waveformWriteBlockSize = 4 * 1024 * 1024;
+
+/**
+	@brief Writes contiguous sample data to a file in large blocks
+
+	@param fp		File to write to
+	@param data		Sample data
+	@param len		Number of samples
+	@param job		Background job to report progress to (may be null)
+ */
+template<class T>
+static bool WriteRawBlocks(FILE* fp, const T* data, size_t len, WaveformSaveJob* job)
+{
+	const size_t samples_per_block = g_waveformWriteBlockSize / sizeof(T);
+	for(size_t i=0; i<len; i += samples_per_block)
+	{
+		size_t blocklen = min(len-i, samples_per_block);
+		if(blocklen != fwrite(data + i, sizeof(T), blocklen, fp))
+		{
+			LogError("file write error\n");
+			return false;
+		}
+		if(job)
+			job->OnBlockWritten(blocklen, blocklen * sizeof(T));
+	}
+	return true;
+}
+
+/**
+	@brief Packs samples into a reusable block buffer and writes each block to a file
+
+	This avoids making an interleaved copy of the entire waveform before writing it.
+
+	@param fp		File to write to
+	@param len		Number of samples
+	@param job		Background job to report progress to (may be null)
+	@param pack		Function returning the packed form of sample i
+ */
+template<class T, class F>
+static bool WriteInterleavedBlocks(FILE* fp, size_t len, WaveformSaveJob* job, F pack)
+{
+	const size_t samples_per_block = g_waveformWriteBlockSize / sizeof(T);
+	vector<T, AlignedAllocator<T, 4096> > block(min(len, samples_per_block));
+
+	for(size_t i=0; i<len; i += samples_per_block)
+	{
+		size_t blocklen = min(len-i, samples_per_block);
+		for(size_t j=0; j<blocklen; j++)
+			block[j] = pack(i + j);
+
+		if(blocklen != fwrite(block.data(), sizeof(T), blocklen, fp))
+		{
+			LogError("file write error\n");
+			return false;
+		}
+		if(job)
+			job->OnBlockWritten(blocklen, blocklen * sizeof(T));
+	}
+	return true;
+}
+
+/**
+	@brief Writes zeros to pad a file out to the specified position
 
-	Interleaved (slow):
+	@param fp		File to write to
+	@param pos		Current position in the file, updated on return
+	@param target	Position to pad to
+ */
+static bool WritePadding(FILE* fp, size_t& pos, size_t target)
+{
+	static const uint8_t zeros[WaveformCodec::SPARSEV2_ALIGN] = {0};
+	while(pos < target)
+	{
+		size_t blocklen = min(target - pos, sizeof(zeros));
+		if(blocklen != fwrite(zeros, 1, blocklen, fp))
+			return false;
+		pos += blocklen;
+	}
+	return true;
+}
+
+/**
+	@brief Writes the offset column of a sparsev2 file as delta varints
+
+	Encoded a block at a time so we never need a copy of the whole column.
+ */
+static bool WriteVarintDeltaBlocks(FILE* fp, const int64_t* offsets, size_t len, WaveformSaveJob* job)
+{
+	const size_t samples_per_block = g_waveformWriteBlockSize / WaveformCodec::MAX_VARINT_SIZE;
+	vector<uint8_t, AlignedAllocator<uint8_t, 4096> > block(min(len, samples_per_block) * WaveformCodec::MAX_VARINT_SIZE);
+
+	for(size_t i=0; i<len; i += samples_per_block)
+	{
+		size_t blocklen = min(len-i, samples_per_block);
+		size_t nbytes = WaveformCodec::EncodeVarintDeltas(offsets, i, i + blocklen, block.data());
+		if(nbytes != fwrite(block.data(), 1, nbytes, fp))
+		{
+			LogError("file write error\n");
+			return false;
+		}
+		if(job)
+			job->OnBlockWritten(0, nbytes);
+	}
+	return true;
+}
+
+/**
+	@brief Writes sample data in the "sparsev1" format
+
+	Interleaved:
 		int64 offset
 		int64 len
 		for analog
 			float voltage
 		for digital
 			bool voltage
+		for CAN
+			uint32 data
+			uint32 type
  */
-bool Session::SerializeSparseWaveform(SparseWaveformBase* wfm, const string& path)
+static bool WriteSparseV1(
+	FILE* fp,
+	SparseAnalogWaveform* achan,
+	SparseDigitalWaveform* dchan,
+	CANWaveform* cchan,
+	size_t len,
+	WaveformSaveJob* job)
 {
-	FILE* fp = fopen(path.c_str(), "wb");
-	if(!fp)
-		return false;
-
-	wfm->PrepareForCpuAccess();
-	auto achan = dynamic_cast<SparseAnalogWaveform*>(wfm);
-	auto dchan = dynamic_cast<SparseDigitalWaveform*>(wfm);
-	auto cchan = dynamic_cast<CANWaveform*>(wfm);
-	size_t len = wfm->size();
-
-	//Analog channels
-	const size_t samples_per_block = 10000;
 	if(achan)
 	{
 		#pragma pack(push, 1)
@@ -2465,23 +2964,8 @@ bool Session::SerializeSparseWaveform(SparseWaveformBase* wfm, const string& pat
 		};
 		#pragma pack(pop)
 
-		//Copy sample data
-		vector<asample_t,	AlignedAllocator<asample_t, 64 > > samples;
-		samples.reserve(len);
-		for(size_t i=0; i<len; i++)
-			samples.push_back(asample_t(achan->m_offsets[i], achan->m_durations[i], achan->m_samples[i]));
-
-		//Write it
-		for(size_t i=0; i<len; i+= samples_per_block)
-		{
-			size_t blocklen = min(len-i, samples_per_block);
-			if(blocklen != fwrite(&samples[i], sizeof(asample_t), blocklen, fp))
-			{
-				LogError("file write error\n");
-				fclose(fp);
-				return false;
-			}
-		}
+		return WriteInterleavedBlocks<asample_t>(fp, len, job, [&](size_t i)
+			{ return asample_t(achan->m_offsets[i], achan->m_durations[i], achan->m_samples[i]); });
 	}
 	else if(dchan)
 	{
@@ -2499,24 +2983,10 @@ bool Session::SerializeSparseWaveform(SparseWaveformBase* wfm, const string& pat
 		};
 		#pragma pack(pop)
 
-		//Copy sample data
-		vector<dsample_t,	AlignedAllocator<dsample_t, 64 > > samples;
-		samples.reserve(len);
-		for(size_t i=0; i<len; i++)
-			samples.push_back(dsample_t(dchan->m_offsets[i], dchan->m_durations[i], dchan->m_samples[i]));
-
-		//Write it
-		for(size_t i=0; i<len; i+= samples_per_block)
-		{
-			size_t blocklen = min(len-i, samples_per_block);
-			if(blocklen != fwrite(&samples[i], sizeof(dsample_t), blocklen, fp))
-			{
-				LogError("file write error\n");
-				fclose(fp);
-			}
-		}
+		return WriteInterleavedBlocks<dsample_t>(fp, len, job, [&](size_t i)
+			{ return dsample_t(dchan->m_offsets[i], dchan->m_durations[i], dchan->m_samples[i]); });
 	}
-	else if(cchan)
+	else
 	{
 		#pragma pack(push, 1)
 		class csample_t
@@ -2533,96 +3003,259 @@ bool Session::SerializeSparseWaveform(SparseWaveformBase* wfm, const string& pat
 		};
 		#pragma pack(pop)
 
-		//Copy sample data
-		vector<csample_t,	AlignedAllocator<csample_t, 64 > > samples;
-		samples.reserve(len);
-		for(size_t i=0; i<len; i++)
-			samples.push_back(csample_t(cchan->m_offsets[i], cchan->m_durations[i], cchan->m_samples[i]));
+		return WriteInterleavedBlocks<csample_t>(fp, len, job, [&](size_t i)
+			{ return csample_t(cchan->m_offsets[i], cchan->m_durations[i], cchan->m_samples[i]); });
+	}
+}
+
+/**
+	@brief Saves waveform sample data in the "sparsev1" or "sparsev2" file format.
+
+	sparsev1 interleaves the offset, duration, and sample of each point (see WriteSparseV1()).
+
+	sparsev2 is a WaveformCodec::SparseV2Header, followed by one page aligned column each for:
+		offsets (int64, or delta varints if that's smaller)
+		durations (int64)
+		samples
+			for analog: float voltage
+			for digital: bool voltage
+			for CAN: uint32 data, uint32 type
+
+	Since the columns are stored exactly as they are in memory, each one can be written straight out of the waveform
+	and loaded with a single copy. Older versions of ngscopeclient can only read sparsev1, though.
+
+	@param wfm		The waveform to save
+	@param path		Path to the output file
+	@param columnar	True to write sparsev2, false for sparsev1
+	@param job		Background job to report progress to (may be null)
+ */
+bool Session::SerializeSparseWaveform(SparseWaveformBase* wfm, const string& path, bool columnar, WaveformSaveJob* job)
+{
+	auto achan = dynamic_cast<SparseAnalogWaveform*>(wfm);
+	auto dchan = dynamic_cast<SparseDigitalWaveform*>(wfm);
+	auto cchan = dynamic_cast<CANWaveform*>(wfm);
+
+	size_t sampleSize;
+	if(achan)
+		sampleSize = sizeof(float);
+	else if(dchan)
+		sampleSize = sizeof(bool);
+	else if(cchan)
+		sampleSize = 2*sizeof(uint32_t);
+	else
+	{
+		//TODO: support other waveform types (buses, eyes, etc)
+		LogError("unrecognized sample type\n");
+		return false;
+	}
+
+	FILE* fp = OpenWaveformFile(path);
+	if(!fp)
+		return false;
+
+	if(!job)
+		wfm->PrepareForCpuAccess();
+	size_t len = wfm->size();
+
+	if(!columnar)
+	{
+		bool ok = WriteSparseV1(fp, achan, dchan, cchan, len, job);
+		fclose(fp);
+		return ok;
+	}
+
+	auto offsets = wfm->m_offsets.GetCpuPointer();
+	auto durations = wfm->m_durations.GetCpuPointer();
+
+	//Delta encode offsets if that's smaller, which it will be for anything reasonably close to uniform
+	size_t rawSize = len * sizeof(int64_t);
+	size_t varintSize = WaveformCodec::GetVarintDeltaSize(offsets, len);
+	auto encoding = (varintSize < rawSize) ? WaveformCodec::OFFSETS_DELTA_VARINT : WaveformCodec::OFFSETS_RAW;
+	auto hdr = WaveformCodec::MakeSparseV2Header(
+		len,
+		sampleSize,
+		encoding,
+		(encoding == WaveformCodec::OFFSETS_RAW) ? rawSize : varintSize);
+
+	bool ok = (1 == fwrite(&hdr, sizeof(hdr), 1, fp));
+	size_t pos = sizeof(hdr);
+
+	//Offsets
+	ok = ok && WritePadding(fp, pos, hdr.m_columnStart[WaveformCodec::COLUMN_OFFSETS]);
+	if(encoding == WaveformCodec::OFFSETS_RAW)
+		ok = ok && WriteRawBlocks(fp, offsets, len, nullptr);
+	else
+		ok = ok && WriteVarintDeltaBlocks(fp, offsets, len, nullptr);
+	pos += hdr.m_columnSize[WaveformCodec::COLUMN_OFFSETS];
+
+	//Durations
+	ok = ok && WritePadding(fp, pos, hdr.m_columnStart[WaveformCodec::COLUMN_DURATIONS]);
+	ok = ok && WriteRawBlocks(fp, durations, len, nullptr);
+	pos += hdr.m_columnSize[WaveformCodec::COLUMN_DURATIONS];
+
+	//Only report bytes for the timestamps, so progress counts each sample once
+	if(job)
+		job->OnBlockWritten(0, pos);
+
+	//Samples
+	ok = ok && WritePadding(fp, pos, hdr.m_columnStart[WaveformCodec::COLUMN_SAMPLES]);
+	if(achan)
+		ok = ok && WriteRawBlocks(fp, achan->m_samples.GetCpuPointer(), len, job);
+	else if(dchan)
+		ok = ok && WriteRawBlocks(fp, dchan->m_samples.GetCpuPointer(), len, job);
+	else
+	{
+		#pragma pack(push, 1)
+		class csample_t
+		{
+		public:
+			uint32_t data;
+			uint32_t type;
+
+			csample_t(CANSymbol s = CANSymbol())
+			: data(s.m_data), type(s.m_stype)
+			{}
+		};
+		#pragma pack(pop)
+
+		ok = ok && WriteInterleavedBlocks<csample_t>(fp, len, job, [&](size_t i)
+			{ return csample_t(cchan->m_samples[i]); });
+	}
+
+	fclose(fp);
+	return ok;
+}
+
+/**
+	@brief Writes sample data in the densev2 format
+
+	Blocks are encoded in parallel a batch at a time, then written in order. The block table is filled in at the end.
+
+	@param fp		File to write to
+	@param type		Type of samples
+	@param samples	Sample data
+	@param len		Number of samples
+	@param job		Background job to report progress to (may be null)
+	@param encode	Function to encode one block
+ */
+template<class T, class F>
+static bool WriteDenseV2Blocks(
+	FILE* fp,
+	WaveformCodec::DenseV2SampleType type,
+	const T* samples,
+	size_t len,
+	WaveformSaveJob* job,
+	F encode)
+{
+	auto hdr = WaveformCodec::MakeDenseV2Header(type, len);
+	vector<uint64_t> index(hdr.m_nblocks + 1, 0);
+	if( (1 != fwrite(&hdr, sizeof(hdr), 1, fp)) ||
+		(index.size() != fwrite(index.data(), sizeof(uint64_t), index.size(), fp)) )
+	{
+		LogError("file write error\n");
+		return false;
+	}
+
+	//Enough blocks per batch to keep all cores busy
+	const size_t batchSize = 16;
+	vector<vector<uint8_t> > blocks(batchSize);
+	uint64_t pos = hdr.m_headerSize + WaveformCodec::DenseV2IndexSize(hdr.m_nblocks);
+	for(size_t first=0; first<hdr.m_nblocks; first += batchSize)
+	{
+		int64_t nblocks = min(batchSize, static_cast<size_t>(hdr.m_nblocks - first));
+
+		#pragma omp parallel for
+		for(int64_t i=0; i<nblocks; i++)
+		{
+			size_t start = (first + i) * hdr.m_blockSize;
+			encode(samples + start, min(static_cast<size_t>(hdr.m_blockSize), len - start), blocks[i]);
+		}
 
-		//Write it
-		for(size_t i=0; i<len; i+= samples_per_block)
+		for(int64_t i=0; i<nblocks; i++)
 		{
-			size_t blocklen = min(len-i, samples_per_block);
-			if(blocklen != fwrite(&samples[i], sizeof(csample_t), blocklen, fp))
+			auto& block = blocks[i];
+			if(block.size() != fwrite(block.data(), 1, block.size(), fp))
 			{
 				LogError("file write error\n");
-				fclose(fp);
 				return false;
 			}
+			index[first + i] = pos;
+			pos += block.size();
+
+			if(job)
+			{
+				size_t start = (first + i) * hdr.m_blockSize;
+				job->OnBlockWritten(min(static_cast<size_t>(hdr.m_blockSize), len - start), block.size());
+			}
 		}
 	}
-	else
+	index[hdr.m_nblocks] = pos;
+
+	//Go back and fill in the block table
+	if( (0 != fseek(fp, hdr.m_headerSize, SEEK_SET)) ||
+		(index.size() != fwrite(index.data(), sizeof(uint64_t), index.size(), fp)) )
 	{
-		//TODO: support other waveform types (buses, eyes, etc)
-		LogError("unrecognized sample type\n");
-		fclose(fp);
+		LogError("file write error\n");
 		return false;
 	}
-
-	fclose(fp);
 	return true;
 }
 
 /**
-	@brief Saves waveform sample data in the "densev1" file format.
+	@brief Saves waveform sample data in the "densev1" or "densev2" file format.
 
+	densev1 is the raw samples:
 	for analog
 		float[] voltage
 	for digital
 		bool[] voltage
 
+	densev2 is a compressed format (see WaveformCodec::DenseV2Header) with bit packed digital samples, and analog
+	samples stored as 8 or 16 bit codes when they came from an ADC with that resolution. It's lossless either way.
+
 	Durations are implied {1....1} and offsets are implied {0...n-1}.
+
+	@param wfm		The waveform to save
+	@param path		Path to the output file
+	@param compress	True to write densev2, false for densev1
+	@param job		Background job to report progress to (may be null)
  */
-bool Session::SerializeUniformWaveform(UniformWaveformBase* wfm, const string& path)
+bool Session::SerializeUniformWaveform(UniformWaveformBase* wfm, const string& path, bool compress, WaveformSaveJob* job)
 {
-	FILE* fp = fopen(path.c_str(), "wb");
+	FILE* fp = OpenWaveformFile(path);
 	if(!fp)
 		return false;
 
-	wfm->PrepareForCpuAccess();
+	if(!job)
+		wfm->PrepareForCpuAccess();
 	auto achan = dynamic_cast<UniformAnalogWaveform*>(wfm);
 	auto dchan = dynamic_cast<UniformDigitalWaveform*>(wfm);
-	size_t len = wfm->size();
 
-	//Analog channels
-	const size_t samples_per_block = 10000;
-	if(achan)
+	//Sample data is already contiguous, write it straight out of the waveform
+	bool ok;
+	if(compress && achan)
 	{
-		//Write it
-		for(size_t i=0; i<len; i+= samples_per_block)
-		{
-			size_t blocklen = min(len-i, samples_per_block);
-
-			if(blocklen != fwrite(achan->m_samples.GetCpuPointer() + i, sizeof(float), blocklen, fp))
-			{
-				LogError("file write error\n");
-				return false;
-			}
-		}
+		ok = WriteDenseV2Blocks(fp, WaveformCodec::DENSEV2_ANALOG, achan->m_samples.GetCpuPointer(), wfm->size(), job,
+			WaveformCodec::EncodeDenseV2AnalogBlock);
 	}
-	else if(dchan)
+	else if(compress && dchan)
 	{
-		//Write it
-		for(size_t i=0; i<len; i+= samples_per_block)
-		{
-			size_t blocklen = min(len-i, samples_per_block);
-
-			if(blocklen != fwrite(dchan->m_samples.GetCpuPointer() + i, sizeof(bool), blocklen, fp))
-			{
-				LogError("file write error\n");
-				return false;
-			}
-		}
+		ok = WriteDenseV2Blocks(fp, WaveformCodec::DENSEV2_DIGITAL, dchan->m_samples.GetCpuPointer(), wfm->size(), job,
+			WaveformCodec::EncodeDenseV2DigitalBlock);
 	}
+	else if(achan)
+		ok = WriteRawBlocks(fp, achan->m_samples.GetCpuPointer(), wfm->size(), job);
+	else if(dchan)
+		ok = WriteRawBlocks(fp, dchan->m_samples.GetCpuPointer(), wfm->size(), job);
 	else
 	{
 		//TODO: support other waveform types (buses, eyes, etc)
 		LogError("unrecognized sample type\n");
-		return false;
+		ok = false;
 	}
 
 	fclose(fp);
-	return true;
+	return ok;
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -2986,6 +3619,9 @@ void Session::RemoveInstrument(shared_ptr<Instrument> inst)
 
 	//Clear worker threads etc
 	m_instrumentStates.erase(inst);
+
+	//Channels of this instrument may still be in the cached filter graph
+	OnFilterGraphChanged();
 }
 
 /**
@@ -3177,6 +3813,28 @@ bool Session::CheckForPendingWaveforms()
 	return false;
 }
 
+/**
+	@brief Copies preferences used by background threads into atomics they can safely read
+
+	Preferences are only safe to touch from the GUI thread, so this is called once per frame.
+ */
+void Session::CachePerformancePreferences()
+{
+	m_pipelineDepth = max(static_cast<int64_t>(1), m_preferences.GetInt("Performance.Pipeline.depth"));
+
+	m_pollBudget[PollScheduler::CLASS_SCOPE] = m_preferences.GetReal("Performance.Polling.scope_interval");
+	m_pollBudget[PollScheduler::CLASS_PSU] = m_preferences.GetReal("Performance.Polling.psu_interval");
+	m_pollBudget[PollScheduler::CLASS_METER] = m_preferences.GetReal("Performance.Polling.meter_interval");
+	m_pollBudget[PollScheduler::CLASS_LOAD] = m_preferences.GetReal("Performance.Polling.load_interval");
+	m_pollBudget[PollScheduler::CLASS_BERT] = m_preferences.GetReal("Performance.Polling.bert_interval");
+	m_pollBudget[PollScheduler::CLASS_AWG] = m_preferences.GetReal("Performance.Polling.awg_interval");
+	m_pollBudget[PollScheduler::CLASS_MISC] = m_preferences.GetReal("Performance.Polling.misc_interval");
+	m_maxIdlePollInterval = m_preferences.GetReal("Performance.Polling.max_idle_interval");
+	m_filterCacheEnabled = m_preferences.GetBool("Performance.History.filter_cache");
+	m_filterCacheMinRuntime = m_preferences.GetReal("Performance.History.filter_cache_min_runtime");
+	m_rasterizeFp16 = (m_preferences.GetEnumRaw("Performance.Rendering.rasterize_format") == RASTERIZE_FP16);
+}
+
 /**
 	@brief Pull the waveform data out of the queue and make it current
  */
@@ -3192,6 +3850,7 @@ void Session::DownloadWaveforms()
 	lock_guard<recursive_mutex> lock3(m_triggerGroupMutex);
 
 	//Get the data from each  trigger group
+	vector<shared_ptr<Oscilloscope>> scopes;
 	for(auto group : m_triggerGroups)
 	{
 		if(!group->CheckForPendingWaveforms())
@@ -3200,20 +3859,107 @@ void Session::DownloadWaveforms()
 		group->DownloadWaveforms();
 
 		//This scope has recently triggered and should be added to history
-		{
-			lock_guard<mutex> lock4(m_recentlyTriggeredScopeMutex);
-			m_recentlyTriggeredScopes.emplace(group->m_primary);
-			m_recentlyTriggeredGroups.emplace(group);
-			for(auto scope : group->m_secondaries)
-				m_recentlyTriggeredScopes.emplace(scope);
-		}
+		m_stagedAcquisition.m_groups.emplace(group);
+		scopes.push_back(group->m_primary);
+		for(auto scope : group->m_secondaries)
+			scopes.push_back(scope);
 	}
 
+	//Capture the waveforms now, since the channels will be holding the next acquisition by the time the GUI thread
+	//gets around to adding this one to history.
+	//Once the next download detaches them, the pending acquisition (and then the history) owns them.
+	auto snapshot = HistoryManager::SnapshotWaveforms(scopes);
+	m_stagedAcquisition.m_waveforms.insert(snapshot.begin(), snapshot.end());
+
+	//Filter outputs computed from this data get cached alongside it.
+	//Nothing from any previous point in history is valid any more.
+	if(!m_stagedAcquisition.m_filterCache)
+		m_stagedAcquisition.m_filterCache = m_history.CreateFilterCache();
+	m_currentFilterCache = m_stagedAcquisition.m_filterCache;
+	m_restoredFilters.clear();
+
 	//If we're in offline one-shot mode, disarm the trigger
 	if( m_triggerGroups.empty() && m_triggerOneShot)
 		m_triggerArmed = false;
 }
 
+/**
+	@brief Hands the acquisition the WaveformThread just finished processing off to the GUI thread
+
+	The caller must have checked HasPipelineSlotAvailable() before downloading the acquisition.
+ */
+void Session::PublishAcquisition()
+{
+	{
+		lock_guard<mutex> lock(m_pendingAcquisitionMutex);
+		m_pendingAcquisitions.push_back(std::move(m_stagedAcquisition));
+	}
+	m_stagedAcquisition = PendingAcquisition();
+	SetPipelineStage(PIPELINE_STAGE_COUNT);
+
+	g_waveformReadyEvent.Signal();
+}
+
+/**
+	@brief Marks the acquisition currently owned by the WaveformThread as being in a given pipeline stage
+
+	@param stage	The new stage, or PIPELINE_STAGE_COUNT if the WaveformThread is now idle
+ */
+void Session::SetPipelineStage(PipelineStage stage)
+{
+	lock_guard<mutex> lock(m_perfClockMutex);
+
+	double now = GetTime();
+	PipelineStage prev = m_activePipelineStage;
+	if(prev != PIPELINE_STAGE_COUNT)
+		m_pipelineBusyTime[prev] += now - m_pipelineStageStart;
+
+	m_activePipelineStage = stage;
+	m_pipelineStageStart = now;
+}
+
+/**
+	@brief Gets the total time the WaveformThread has spent working on a given pipeline stage, in seconds
+
+	Sample this periodically and divide the change by the elapsed time to get the stage's utilization.
+	Includes time spent so far on the stage currently in progress.
+ */
+double Session::GetPipelineBusyTime(PipelineStage stage)
+{
+	lock_guard<mutex> lock(m_perfClockMutex);
+
+	double t = m_pipelineBusyTime[stage];
+	if(m_activePipelineStage == stage)
+		t += GetTime() - m_pipelineStageStart;
+	return t;
+}
+
+/**
+	@brief Checks if the GUI thread has room to accept another acquisition
+
+	With a pipeline depth of 1 this reduces to lock-step processing: the next acquisition is not downloaded until the
+	GUI thread has displayed the previous one.
+ */
+bool Session::HasPipelineSlotAvailable()
+{
+	lock_guard<mutex> lock(m_pendingAcquisitionMutex);
+	return m_pendingAcquisitions.size() < m_pipelineDepth;
+}
+
+/**
+	@brief Gets the number of acquisitions currently in a given stage of the waveform processing pipeline
+ */
+size_t Session::GetPipelineOccupancy(PipelineStage stage)
+{
+	if(stage == PIPELINE_STAGE_DISPLAY)
+	{
+		lock_guard<mutex> lock(m_pendingAcquisitionMutex);
+		return m_pendingAcquisitions.size();
+	}
+
+	return (m_activePipelineStage == stage) ? 1 : 0;
+}
+
 /**
 	@brief Check if new waveform data has arrived
 
@@ -3227,38 +3973,47 @@ bool Session::CheckForWaveforms(vk::raii::CommandBuffer& cmdbuf)
 {
 	bool hadNewWaveforms = false;
 
+	CachePerformancePreferences();
+
 	if(g_waveformReadyEvent.Peek())
 	{
 		LogTrace("Waveform is ready\n");
 
-		//Add to history
-		vector<shared_ptr<Oscilloscope>> scopes;
+		//Grab everything the WaveformThread has finished since last time we checked, and add it to history oldest first.
+		//Hold the waveform data lock the whole time so the filter caches are always reachable from somewhere when the
+		//WaveformThread goes looking for them.
 		set<shared_ptr<TriggerGroup>> groups;
 		{
 			shared_lock<shared_mutex> lock2(m_waveformDataMutex);
-			lock_guard<mutex> lock(m_recentlyTriggeredScopeMutex);
-			for(auto scope : m_recentlyTriggeredScopes)
-				scopes.push_back(scope);
-			m_recentlyTriggeredScopes.clear();
 
-			groups = m_recentlyTriggeredGroups;
-			m_recentlyTriggeredGroups.clear();
+			list<PendingAcquisition> acquisitions;
+			{
+				lock_guard<mutex> lock(m_pendingAcquisitionMutex);
+				acquisitions.swap(m_pendingAcquisitions);
+			}
 
-			m_history.AddHistory(scopes);
+			for(auto& acq : acquisitions)
+			{
+				auto pt = m_history.AddHistory(acq.m_waveforms);
+				if(pt)
+					pt->m_filterCache = acq.m_filterCache;
+				groups.insert(acq.m_groups.begin(), acq.m_groups.end());
+			}
 		}
 
 		//Tone-map all of our waveforms
 		//Generally does not need waveform data locked since it only works on *rendered* data...
 		//but density functions like spectrogram are an exception as those don't have a render step.
+		//ToneMapAllWaveforms() waits for the GPU to finish before returning if any of those were present.
 		//TODO: should we "snapshot" the waveform into a render buffer or something to avoid this sync point?
 		hadNewWaveforms = true;
 		{
 			lock_guard<shared_mutex> lock(m_waveformDataMutex);
 			m_mainWindow->ToneMapAllWaveforms(cmdbuf);
-		}
 
-		//Release the waveform processing thread
-		g_waveformProcessedEvent.Signal();
+			//Make room for the new waveforms, now that nobody can be reading the ones we're moving around
+			m_history.EnforceBudgets(true);
+		}
 
 		//In multi-scope free-run mode, re-arm every instrument's trigger after we've processed all data
 		for(auto group : groups)
@@ -3269,6 +4024,20 @@ bool Session::CheckForWaveforms(vk::raii::CommandBuffer& cmdbuf)
 	if((g_rerenderDoneEvent.Peek() || g_refilterDoneEvent.Peek()) && !hadNewWaveforms)
 		m_mainWindow->ToneMapAllWaveforms(cmdbuf);
 
+	//Free any filters the user deleted which are only being kept around by cached outputs
+	if(m_history.HasOrphanedFilterCaches())
+	{
+		lock_guard<shared_mutex> lock(m_waveformDataMutex);
+		m_history.PurgeOrphanedFilterCaches();
+	}
+
+	//Free the memory of anything the history spill thread has finished writing to disk
+	if(m_history.HasFinishedSpills())
+	{
+		lock_guard<shared_mutex> lock(m_waveformDataMutex);
+		m_history.CommitSpills();
+	}
+
 	return hadNewWaveforms;
 }
 
@@ -3344,7 +4113,21 @@ void Session::RefreshAllFilters()
 		//Must lock mutexes in this order to avoid deadlock
 		lock_guard<shared_mutex> lock(m_waveformDataMutex);
 		//shared_lock<shared_mutex> lock3(g_vulkanActivityMutex);
-		m_graphExecutor.RunBlocking(nodes);
+
+		//Filters whose outputs were just restored from history don't need to run again
+		//(unless something was reconfigured since then)
+		set<FlowGraphNode*> nodesToRun;
+		bool restoredValid = (m_restoredFilterGeneration == m_history.GetFilterCacheGeneration());
+		for(auto node : nodes)
+		{
+			if(!restoredValid || (m_restoredFilters.find(node) == m_restoredFilters.end()) )
+				nodesToRun.emplace(node);
+		}
+		m_restoredFilters.clear();
+
+		m_history.DetachCachedFilterOutputs(nodesToRun);
+		m_graphExecutor.RunBlocking(nodesToRun);
+		UpdateFilterCache(nodesToRun);
 		UpdatePacketManagers(nodes);
 	}
 
@@ -3369,15 +4152,21 @@ bool Session::RefreshDirtyFilters()
 		if(m_dirtyChannels.empty())
 			return false;
 
-		//Start with all nodes
-		auto nodes = GetAllGraphNodes();
-
-		//Check each one to see if it needs updating
-		for(auto f : nodes)
+		//Make sure the index is current, includes everything that's dirty, and wasn't built before a dirty node
+		//rewired its own inputs (e.g. a filter adding inputs when its parameters change)
+		bool needRebuild = !m_graphIndex.IsValid();
+		for(auto node : m_dirtyChannels)
 		{
-			if(f->IsDownstreamOf(m_dirtyChannels))
-				nodesToUpdate.emplace(f);
+			if(needRebuild)
+				break;
+			if(!m_graphIndex.Contains(node) || m_graphIndex.InputsChanged(node))
+				needRebuild = true;
 		}
+		if(needRebuild)
+			m_graphIndex.Rebuild(GetAllGraphNodes());
+
+		//Find everything that needs updating
+		m_graphIndex.GetDownstreamCone(m_dirtyChannels, nodesToUpdate);
 
 		//The filter itself needs to be updated too
 		for(auto node : m_dirtyChannels)
@@ -3400,7 +4189,9 @@ bool Session::RefreshDirtyFilters()
 		//Must lock mutexes in this order to avoid deadlock
 		lock_guard<shared_mutex> lock(m_waveformDataMutex);
 		shared_lock<shared_mutex> lock3(g_vulkanActivityMutex);
+		m_history.DetachCachedFilterOutputs(nodesToUpdate);
 		m_graphExecutor.RunBlocking(nodesToUpdate);
+		UpdateFilterCache(nodesToUpdate);
 		UpdatePacketManagers(nodesToUpdate);
 	}
 
@@ -3439,6 +4230,56 @@ void Session::ClearSweeps()
 		f->ClearSweeps();
 }
 
+/**
+	@brief Saves the outputs of filters which just ran into the cache for the current point in history
+
+	Must be called with the waveform data mutex held.
+ */
+void Session::UpdateFilterCache(const set<FlowGraphNode*>& nodes)
+{
+	if(!m_currentFilterCache)
+		return;
+	m_currentFilterCache->Revalidate(m_history.GetFilterCacheGeneration());
+
+	//Only bother caching filters which are slower to re-run than to look up
+	auto runtimes = m_graphExecutor.GetRunTimes();
+	for(auto node : nodes)
+	{
+		auto f = dynamic_cast<Filter*>(node);
+		if(!f)
+			continue;
+
+		auto it = runtimes.find(node);
+		bool expensive = (it != runtimes.end()) && (it->second >= m_filterCacheMinRuntime);
+		if(m_filterCacheEnabled && expensive && FilterOutputCache::IsCacheable(f))
+			m_currentFilterCache->Update(f);
+		else
+			m_currentFilterCache->RemoveFilter(f);
+	}
+}
+
+/**
+	@brief Makes a filter cache current, restoring all of its outputs to their filters
+
+	Called when a point in history is loaded. The next full filter graph refresh skips any filter whose output was
+	restored from the cache, and saves anything else worth caching into it.
+
+	@param cache	The cache for the newly loaded data (may be null)
+ */
+void Session::LoadFilterCache(shared_ptr<FilterOutputCache> cache)
+{
+	lock_guard<shared_mutex> lock(m_waveformDataMutex);
+
+	m_currentFilterCache = cache;
+	m_restoredFilters.clear();
+	if(!cache)
+		return;
+
+	m_restoredFilterGeneration = m_history.GetFilterCacheGeneration();
+	cache->Revalidate(m_restoredFilterGeneration);
+	cache->Restore(m_restoredFilters);
+}
+
 /**
 	@brief Update all of the packet managers when new data arrives
  */
@@ -3496,11 +4337,37 @@ int64_t Session::GetToneMapTime()
 	return m_mainWindow->GetToneMapTime();
 }
 
+/**
+	@brief Gets the CPU time spent on the most recent frame, excluding time spent waiting on the GPU
+ */
+int64_t Session::GetFrameCpuTime()
+{
+	return m_mainWindow->GetFrameCpuTime();
+}
+
+/**
+	@brief Gets the GPU execution time of the most recently completed frame
+ */
+int64_t Session::GetFrameGpuTime()
+{
+	return m_mainWindow->GetFrameGpuTime();
+}
+
 void Session::RenderWaveformTextures(vk::raii::CommandBuffer& cmdbuf, vector<shared_ptr<DisplayedChannel> >& channels)
 {
 	m_mainWindow->RenderWaveformTextures(cmdbuf, channels);
 }
 
+/**
+	@brief Blocks until the most recently submitted tone mapping pass has completed
+
+	The caller must hold the rasterized waveform mutex.
+ */
+void Session::WaitForToneMap()
+{
+	m_mainWindow->WaitForToneMap();
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 // Reference filters
 
@@ -40,11 +40,14 @@ class WaveformArea;
 class DisplayedChannel;
 
 #include "../xptools/HzClock.h"
+#include "FlowGraphIndex.h"
 #include "HistoryManager.h"
 #include "PacketManager.h"
+#include "PollScheduler.h"
 #include "PreferenceManager.h"
 #include "Marker.h"
 #include "TriggerGroup.h"
+#include "WaveformSaveJob.h"
 
 extern std::atomic<int64_t> g_lastWaveformRenderTime;
 
@@ -56,7 +59,11 @@ public:
 	InstrumentConnectionState(InstrumentThreadArgs args)
 	{
 		m_shuttingDown = false;
+		m_pollInterval = 0;
+		m_acquisitionLatency = 0;
 		args.shuttingDown = &m_shuttingDown;
+		args.pollInterval = &m_pollInterval;
+		args.acquisitionLatency = &m_acquisitionLatency;
 		m_thread = std::make_unique<std::thread>(InstrumentThread, args);
 		m_lastTriggerState = Oscilloscope::TRIGGER_MODE_WAIT;
 	}
@@ -83,6 +90,34 @@ public:
 
 	///@brief Cached trigger state, to reflect in the UI
 	Oscilloscope::TriggerMode m_lastTriggerState;
+
+	///@brief Current interval between polls of the instrument, in fs
+	std::atomic<int64_t> m_pollInterval;
+
+	/**
+		@brief Most recent acquisition latency, in fs
+
+		For oscilloscopes, this is the worst case time from the trigger event to having the data downloaded
+		(i.e. measured from the last poll that did not see the trigger). For other instruments, it's the time taken to
+		read the instrument plus the poll interval.
+	 */
+	std::atomic<int64_t> m_acquisitionLatency;
+};
+
+/**
+	@brief A single acquisition which has been processed by the WaveformThread but not yet committed to history
+ */
+class PendingAcquisition
+{
+public:
+	///@brief Waveform data from each instrument that triggered
+	std::map<std::shared_ptr<Oscilloscope>, WaveformHistory> m_waveforms;
+
+	///@brief Trigger groups which contributed data to this acquisition
+	std::set<std::shared_ptr<TriggerGroup>> m_groups;
+
+	///@brief Outputs of expensive filters computed from this acquisition
+	std::shared_ptr<FilterOutputCache> m_filterCache;
 };
 
 /**
@@ -97,12 +132,26 @@ public:
 	Session(MainWindow* wnd);
 	virtual ~Session();
 
+	///@brief Stages of the waveform processing pipeline
+	enum PipelineStage
+	{
+		PIPELINE_STAGE_DOWNLOAD,
+		PIPELINE_STAGE_FILTER,
+		PIPELINE_STAGE_RENDER,
+		PIPELINE_STAGE_DISPLAY,
+
+		PIPELINE_STAGE_COUNT
+	};
+
 	bool OnMemoryPressure(MemoryPressureLevel level, MemoryPressureType type, size_t requestedSize);
 
 	void ArmTrigger(TriggerGroup::TriggerType type, bool all=false);
 	void StopTrigger(bool all=false);
 	bool HasOnlineScopes();
+	void CachePerformancePreferences();
 	void DownloadWaveforms();
+	void PublishAcquisition();
+	bool HasPipelineSlotAvailable();
 	bool CheckForWaveforms(vk::raii::CommandBuffer& cmdbuf);
 	void RefreshAllFilters();
 	void RefreshAllFiltersNonblocking();
@@ -112,9 +161,21 @@ public:
 
 	void MarkChannelDirty(InstrumentChannel* chan);
 
+	/**
+		@brief Notifies the session that filters have been created, deleted, or rewired
+	 */
+	void OnFilterGraphChanged()
+	{
+		m_graphIndex.Invalidate();
+		m_history.InvalidateFilterCaches();
+	}
+
+	void LoadFilterCache(std::shared_ptr<FilterOutputCache> cache);
+
 	void RenderWaveformTextures(
 		vk::raii::CommandBuffer& cmdbuf,
 		std::vector<std::shared_ptr<DisplayedChannel> >& channels);
+	void WaitForToneMap();
 
 	void Clear();
 	void ClearBackgroundThreads();
@@ -128,8 +189,20 @@ public:
 	YAML::Node SerializeFilterConfiguration();
 	YAML::Node SerializeMarkers();
 	bool SerializeWaveforms(const std::string& dataDir);
-	bool SerializeSparseWaveform(SparseWaveformBase* wfm, const std::string& path);
-	bool SerializeUniformWaveform(UniformWaveformBase* wfm, const std::string& path);
+	static bool SerializeSparseWaveform(
+		SparseWaveformBase* wfm, const std::string& path, bool columnar, WaveformSaveJob* job = nullptr);
+	static bool SerializeUniformWaveform(
+		UniformWaveformBase* wfm, const std::string& path, bool compress, WaveformSaveJob* job = nullptr);
+	static WaveformBase* DoLoadWaveformData(
+		WaveformBase* cap, const std::string& format, const std::string& fname, bool* ok = nullptr);
+
+	/**
+		@brief Gets the background job writing waveform data for the last save, if any
+	 */
+	WaveformSaveJob* GetSaveJob()
+	{ return m_saveJob.get(); }
+
+	void FinishSaveJob();
 
 	void AddMultimeterDialog(std::shared_ptr<SCPIMultimeter> meter);
 	std::shared_ptr<PacketManager> AddPacketFilter(PacketDecoder* filter);
@@ -180,6 +253,15 @@ public:
 		return m_packetmgrs[filter];
 	}
 
+	/**
+		@brief Returns a copy of the list of all packet managers
+	 */
+	std::map<PacketDecoder*, std::shared_ptr<PacketManager> > GetPacketManagers()
+	{
+		std::lock_guard<std::mutex> lock(m_packetMgrMutex);
+		return m_packetmgrs;
+	}
+
 	void ApplyPreferences(std::shared_ptr<Oscilloscope> scope);
 
 	size_t GetFilterCount();
@@ -187,6 +269,8 @@ public:
 	bool IsChannelBeingDragged();
 
 	int64_t GetToneMapTime();
+	int64_t GetFrameCpuTime();
+	int64_t GetFrameGpuTime();
 
 	/**
 		@brief Gets the last execution time of the filter graph
@@ -209,6 +293,35 @@ public:
 		return m_waveformDownloadRate.GetAverageHz();
 	}
 
+	/**
+		@brief Gets the maximum number of processed acquisitions which may be waiting for the GUI thread
+	 */
+	size_t GetPipelineDepth()
+	{ return m_pipelineDepth.load(); }
+
+	size_t GetPipelineOccupancy(PipelineStage stage);
+	double GetPipelineBusyTime(PipelineStage stage);
+
+	/**
+		@brief Gets the minimum poll interval for a given type of instrument, in fs
+	 */
+	int64_t GetPollBudget(PollScheduler::InstrumentClass c)
+	{ return m_pollBudget[c].load(); }
+
+	/**
+		@brief Gets the ceiling for exponential backoff when an instrument is idle, in fs
+	 */
+	int64_t GetMaxIdlePollInterval()
+	{ return m_maxIdlePollInterval.load(); }
+
+	/**
+		@brief Checks if waveforms without persistence should be rasterized at half precision
+	 */
+	bool IsRasterizeFp16()
+	{ return m_rasterizeFp16.load(); }
+
+	void SetPipelineStage(PipelineStage stage);
+
 	/**
 		@brief Get the set of scopes we're currently connected to
 	 */
@@ -331,7 +444,7 @@ public:
 
 	std::shared_ptr<TriggerGroup> GetTrendFilterGroup();
 
-	void OnMarkerChanged();
+	void OnMarkerChanged(TimePoint t);
 
 	///@brief Return the last filter graph runtime stats
 	std::map<FlowGraphNode*, int64_t> GetFilterGraphRuntime()
@@ -342,6 +455,7 @@ public:
 
 protected:
 	void UpdatePacketManagers(const std::set<FlowGraphNode*>& nodes);
+	void UpdateFilterCache(const std::set<FlowGraphNode*>& nodes);
 
 	std::string GetRegisteredTypeOfDriver(const std::string& drivername);
 
@@ -363,6 +477,53 @@ protected:
 	bool LoadFilters(int version, const YAML::Node& node);
 	bool LoadInstrumentInputs(int version, const YAML::Node& node);
 	bool LoadWaveformData(int version, const std::string& dataDir);
+	/**
+		@brief A single stream of a history point being loaded from a session
+	 */
+	class PendingStream
+	{
+	public:
+		///@brief Channel the waveform belongs to
+		OscilloscopeChannel* m_channel;
+
+		///@brief Stream index within m_channel
+		int m_stream;
+
+		///@brief The waveform being loaded (metadata only until the load job completes)
+		WaveformBase* m_waveform;
+
+		///@brief Format of the file
+		std::string m_format;
+
+		///@brief Path to the file
+		std::string m_path;
+
+		///@brief Size of the file, in bytes
+		size_t m_fileSize;
+
+		///@brief Index of our request in the WaveformLoadJob
+		size_t m_request;
+	};
+
+	/**
+		@brief A history point being loaded from a session
+	 */
+	class PendingHistoryPoint
+	{
+	public:
+		///@brief Timestamp of the point
+		TimePoint m_time;
+
+		///@brief True if the point is pinned
+		bool m_pinned;
+
+		///@brief Nickname of the point
+		std::string m_label;
+
+		///@brief Streams of the point
+		std::vector<PendingStream> m_streams;
+	};
+
 	bool LoadWaveformDataForScope(
 		int version,
 		const YAML::Node& node,
@@ -377,6 +538,7 @@ protected:
 		int stream,
 		std::string format,
 		std::string fname);
+	static WaveformBase* ConvertToUniformIfDense(WaveformBase* cap);
 
 	///@brief Version of the file being loaded
 	int m_fileLoadVersion;
@@ -438,14 +600,35 @@ protected:
 	///@brief Processing thread for waveform data
 	std::unique_ptr<std::thread> m_waveformThread;
 
-	///@brief Scopes whose data is currently being processed for history
-	std::set<std::shared_ptr<Oscilloscope> > m_recentlyTriggeredScopes;
+	///@brief Acquisition currently being downloaded, filtered, and rendered by the WaveformThread
+	PendingAcquisition m_stagedAcquisition;
+
+	///@brief Acquisitions which have been fully processed and are waiting for the GUI thread to display them
+	std::list<PendingAcquisition> m_pendingAcquisitions;
+
+	///@brief Mutex to synchronize access to m_pendingAcquisitions
+	std::mutex m_pendingAcquisitionMutex;
+
+	///@brief Maximum number of entries in m_pendingAcquisitions (cached from preferences for the WaveformThread)
+	std::atomic<size_t> m_pipelineDepth;
+
+	///@brief Pipeline stage that m_stagedAcquisition is in (PIPELINE_STAGE_COUNT if idle)
+	std::atomic<PipelineStage> m_activePipelineStage;
+
+	///@brief Time at which m_stagedAcquisition entered m_activePipelineStage (protected by m_perfClockMutex)
+	double m_pipelineStageStart;
 
-	///@brief Groups whose data is currently being processed
-	std::set<std::shared_ptr<TriggerGroup>> m_recentlyTriggeredGroups;
+	///@brief Total time the WaveformThread has spent in each pipeline stage, in seconds (protected by m_perfClockMutex)
+	double m_pipelineBusyTime[PIPELINE_STAGE_COUNT];
 
-	///@brief Mutex to synchronize access to m_recentlyTriggeredScopes
-	std::mutex m_recentlyTriggeredScopeMutex;
+	///@brief Minimum poll interval for each type of instrument (cached from preferences for the InstrumentThreads)
+	std::atomic<int64_t> m_pollBudget[PollScheduler::CLASS_COUNT];
+
+	///@brief Ceiling for idle poll backoff (cached from preferences for the InstrumentThreads)
+	std::atomic<int64_t> m_maxIdlePollInterval;
+
+	///@brief True if waveforms should be rasterized at half precision (cached from preferences for the WaveformThread)
+	std::atomic<bool> m_rasterizeFp16;
 
 	///@brief Time we last armed the global trigger
 	double m_tArm;
@@ -480,6 +663,24 @@ protected:
 	///@brief Historical waveform data
 	HistoryManager m_history;
 
+	///@brief Background job writing sample data for the last save (if any)
+	std::unique_ptr<WaveformSaveJob> m_saveJob;
+
+	///@brief Filter cache for the data currently loaded into the instruments (if any)
+	std::shared_ptr<FilterOutputCache> m_currentFilterCache;
+
+	///@brief Filters whose outputs were restored from m_currentFilterCache and don't need to run again
+	std::set<FlowGraphNode*> m_restoredFilters;
+
+	///@brief Filter cache generation at the time m_restoredFilters was filled
+	uint64_t m_restoredFilterGeneration;
+
+	///@brief True if filter outputs should be cached in history (cached from preferences for the WaveformThread)
+	std::atomic<bool> m_filterCacheEnabled;
+
+	///@brief Minimum run time for a filter's output to be cached (cached from preferences for the WaveformThread)
+	std::atomic<int64_t> m_filterCacheMinRuntime;
+
 	///@brief Mutex for controlling access to m_packetmgrs
 	std::mutex m_packetMgrMutex;
 
@@ -507,9 +708,12 @@ protected:
 	///@brief Set of dirty channels
 	std::set<FlowGraphNode*> m_dirtyChannels;
 
-	///@brief Mutex controlling access to m_dirtyChannels
+	///@brief Mutex controlling access to m_dirtyChannels and m_graphIndex
 	std::mutex m_dirtyChannelsMutex;
 
+	///@brief Cached adjacency index of the filter graph, for finding the downstream cone of dirty channels
+	FlowGraphIndex m_graphIndex;
+
 public:
 
 	/**
@@ -55,6 +55,8 @@ Texture::Texture(
 	bool upsampleLinear
 	)
 	: m_image(device, imageInfo)
+	, m_width(imageInfo.extent.width)
+	, m_height(imageInfo.extent.height)
 {
 	auto req = m_image.getMemoryRequirements();
 
@@ -142,6 +144,8 @@ Texture::Texture(
 	TextureManager* mgr,
 	const string& name)
 	: m_image(device, imageInfo)
+	, m_width(imageInfo.extent.width)
+	, m_height(imageInfo.extent.height)
 {
 	auto req = m_image.getMemoryRequirements();
 
@@ -175,7 +179,7 @@ Texture::Texture(
 		{},
 		*m_image,
 		vk::ImageViewType::e2D,
-		vk::Format::eR32G32B32A32Sfloat,
+		imageInfo.format,
 		{},
 		vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1)
 		);
@@ -334,6 +338,79 @@ TextureManager::~TextureManager()
 	m_queue = nullptr;
 }
 
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Texture pool
+
+/**
+	@brief Gets a blank texture at least as large as requested, reusing an idle one if possible
+
+	Sizes are rounded up to the next power of two in each axis so a texture can be reused across small resizes. The
+	caller is responsible for only using the requested region, and for transitioning the image out of the undefined
+	layout if it was newly created.
+
+	A texture goes back in the pool as soon as the last reference outside the pool is dropped, so keep it in the
+	frame's in-use set until rendering has finished with it.
+
+	@param imageInfo	Creation parameters (the extent is rounded up)
+	@param name			Debug name for the texture
+	@param created		Set true if a new texture was allocated, false if an existing one was reused
+ */
+shared_ptr<Texture> TextureManager::GetPooledTexture(
+	const vk::ImageCreateInfo& imageInfo,
+	const string& name,
+	bool& created)
+{
+	vk::ImageCreateInfo info = imageInfo;
+	info.extent.width = pow(2, ceil(log2(info.extent.width)));
+	info.extent.height = pow(2, ceil(log2(info.extent.height)));
+
+	for(auto& p : m_texturePool)
+	{
+		if( (p.m_texture.use_count() == 1) &&
+			(p.m_format == info.format) &&
+			(p.m_usage == info.usage) &&
+			(p.m_texture->GetWidth() == info.extent.width) &&
+			(p.m_texture->GetHeight() == info.extent.height) )
+		{
+			p.m_idleFrames = 0;
+			p.m_texture->SetName(name);
+			created = false;
+			return p.m_texture;
+		}
+	}
+
+	LogTrace("Allocating %u x %u pooled texture\n", info.extent.width, info.extent.height);
+	auto tex = make_shared<Texture>(*g_vkComputeDevice, info, this, name);
+	m_texturePool.push_back(PooledTexture(tex, info));
+	created = true;
+	return tex;
+}
+
+/**
+	@brief Frees pooled textures which haven't been used for a while
+
+	Call once per frame.
+ */
+void TextureManager::TrimTexturePool()
+{
+	//Roughly two seconds at 60 FPS, long enough to ride out dragging a splitter around
+	const size_t maxIdleFrames = 120;
+
+	for(size_t i=0; i<m_texturePool.size(); )
+	{
+		auto& p = m_texturePool[i];
+		if(p.m_texture.use_count() == 1)
+			p.m_idleFrames ++;
+		else
+			p.m_idleFrames = 0;
+
+		if(p.m_idleFrames > maxIdleFrames)
+			m_texturePool.erase(m_texturePool.begin() + i);
+		else
+			i++;
+	}
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 // File loading
 
@@ -76,6 +76,14 @@ public:
 	vk::Image GetImage()
 	{ return *m_image; }
 
+	///@brief Gets the width of the image, in pixels
+	uint32_t GetWidth()
+	{ return m_width; }
+
+	///@brief Gets the height of the image, in pixels
+	uint32_t GetHeight()
+	{ return m_height; }
+
 	void SetName(const std::string& name);
 
 protected:
@@ -89,6 +97,12 @@ protected:
 	///@brief Image object for our texture
 	vk::raii::Image m_image;
 
+	///@brief Width of the image
+	uint32_t m_width;
+
+	///@brief Height of the image
+	uint32_t m_height;
+
 	///@brief View of the image
 	std::unique_ptr<vk::raii::ImageView> m_view;
 
@@ -144,6 +158,12 @@ public:
 	vk::ImageView GetView(const std::string& name)
 	{ return m_textures[name]->GetView(); }
 
+	std::shared_ptr<Texture> GetPooledTexture(
+		const vk::ImageCreateInfo& imageInfo,
+		const std::string& name,
+		bool& created);
+	void TrimTexturePool();
+
 protected:
 
 	png_structp LoadPNG(
@@ -156,6 +176,35 @@ protected:
 
 	std::map<std::string, std::shared_ptr<Texture> > m_textures;
 
+	/**
+		@brief A texture owned by the pool, which may or may not be in use
+	 */
+	class PooledTexture
+	{
+	public:
+		PooledTexture(std::shared_ptr<Texture> tex, const vk::ImageCreateInfo& imageInfo)
+		: m_texture(tex)
+		, m_format(imageInfo.format)
+		, m_usage(imageInfo.usage)
+		, m_idleFrames(0)
+		{}
+
+		///@brief The texture (in use if anyone else holds a reference to it)
+		std::shared_ptr<Texture> m_texture;
+
+		///@brief Pixel format of the texture
+		vk::Format m_format;
+
+		///@brief Usage flags the texture was created with
+		vk::ImageUsageFlags m_usage;
+
+		///@brief Number of consecutive TrimTexturePool() calls the texture has been idle for
+		size_t m_idleFrames;
+	};
+
+	///@brief Textures available for reuse by GetPooledTexture()
+	std::vector<PooledTexture> m_texturePool;
+
 	///@brief Sampler for textures
 	std::unique_ptr<vk::raii::Sampler> m_sampler;
 
@@ -63,9 +63,14 @@ VulkanWindow::VulkanWindow(const string& title, shared_ptr<QueueHandle> queue)
 	, m_softwareResizeRequested(false)
 	, m_pendingWidth(0)
 	, m_pendingHeight(0)
-	, m_semaphoreIndex(0)
+	, m_requestedFramesInFlight(2)
+	, m_frameSlot(0)
 	, m_frameIndex(0)
-	, m_lastFrameIndex(0)
+	, m_hasTimestamps(false)
+	, m_timestampMask(0)
+	, m_timestampPeriod(0)
+	, m_frameCpuTime(0)
+	, m_frameGpuTime(0)
 	, m_width(0)
 	, m_height(0)
 	, m_fullscreen(false)
@@ -146,19 +151,20 @@ VulkanWindow::VulkanWindow(const string& title, shared_ptr<QueueHandle> queue)
 		vk::CommandPoolCreateFlagBits::eTransient | vk::CommandPoolCreateFlagBits::eResetCommandBuffer,
 		queue->m_family );
 	m_cmdPool = std::make_unique<vk::raii::CommandPool>(*g_vkComputeDevice, cmdPoolInfo);
-	vk::CommandBufferAllocateInfo bufinfo(**m_cmdPool, vk::CommandBufferLevel::ePrimary, m_backBuffers.size());
+
+	//See if we can time frames on the GPU
+	m_timestampPeriod = g_vkComputePhysicalDevice->getProperties().limits.timestampPeriod;
+	auto validBits = g_vkComputePhysicalDevice->getQueueFamilyProperties()[queue->m_family].timestampValidBits;
+	m_hasTimestamps = (validBits != 0);
+	if(validBits >= 64)
+		m_timestampMask = ~0ULL;
+	else
+		m_timestampMask = (1ULL << validBits) - 1;
+	if(!m_hasTimestamps)
+		LogDebug("Render queue does not support timestamps, GPU frame time will not be measured\n");
 
 	//Allocate frame state
-	vk::SemaphoreCreateInfo sinfo;
-	vk::FenceCreateInfo finfo(vk::FenceCreateFlagBits::eSignaled);
-	for(size_t i=0; i<m_backBuffers.size(); i++)
-	{
-		m_imageAcquiredSemaphores.push_back(make_unique<vk::raii::Semaphore>(*g_vkComputeDevice, sinfo));
-		m_renderCompleteSemaphores.push_back(make_unique<vk::raii::Semaphore>(*g_vkComputeDevice, sinfo));
-		m_fences.push_back(make_unique<vk::raii::Fence>(*g_vkComputeDevice, finfo));
-		m_cmdBuffers.push_back(make_unique<vk::raii::CommandBuffer>(
-			std::move(vk::raii::CommandBuffers(*g_vkComputeDevice, bufinfo).front())));
-	}
+	AllocateFrameResources();
 
 	//Initialize ImGui
 	ImGui_ImplGlfw_InitForVulkan(m_window, true);
@@ -227,38 +233,6 @@ VulkanWindow::VulkanWindow(const string& title, shared_ptr<QueueHandle> queue)
 				vk::ObjectType::eCommandPool,
 				reinterpret_cast<uint64_t>(static_cast<VkCommandPool>(**m_cmdPool)),
 				rpName.c_str()));
-
-		for(size_t i=0; i<m_backBuffers.size(); i++)
-		{
-			string iaName = prefix + "imageAcquired[" + to_string(i) + "]";
-			string rcName = prefix + "renderComplete[" + to_string(i) + "]";
-			string fName = prefix + "fence[" + to_string(i) + "]";
-			string cbName = prefix + "cmdBuf[" + to_string(i) + "]";
-
-			g_vkComputeDevice->setDebugUtilsObjectNameEXT(
-				vk::DebugUtilsObjectNameInfoEXT(
-					vk::ObjectType::eSemaphore,
-					reinterpret_cast<uint64_t>(static_cast<VkSemaphore>(**m_imageAcquiredSemaphores[i])),
-					iaName.c_str()));
-
-			g_vkComputeDevice->setDebugUtilsObjectNameEXT(
-				vk::DebugUtilsObjectNameInfoEXT(
-					vk::ObjectType::eSemaphore,
-					reinterpret_cast<uint64_t>(static_cast<VkSemaphore>(**m_renderCompleteSemaphores[i])),
-					rcName.c_str()));
-
-			g_vkComputeDevice->setDebugUtilsObjectNameEXT(
-				vk::DebugUtilsObjectNameInfoEXT(
-					vk::ObjectType::eFence,
-					reinterpret_cast<uint64_t>(static_cast<VkFence>(**m_fences[i])),
-					fName.c_str()));
-
-			g_vkComputeDevice->setDebugUtilsObjectNameEXT(
-				vk::DebugUtilsObjectNameInfoEXT(
-					vk::ObjectType::eCommandBuffer,
-					reinterpret_cast<uint64_t>(static_cast<VkCommandBuffer>(**m_cmdBuffers[i])),
-					cbName.c_str()));
-		}
 	}
 }
 
@@ -272,6 +246,10 @@ VulkanWindow::~VulkanWindow()
 	g_vkComputeDevice->waitIdle();
 
 	m_texturesUsedThisFrame.clear();
+	m_pendingLayoutTransitions.clear();
+	m_frameWaitSemaphores.clear();
+	m_timestampQueryPool = nullptr;
+	m_frameWaitStages.clear();
 
 	m_renderPass = nullptr;
 	m_swapchain = nullptr;
@@ -409,7 +387,6 @@ bool VulkanWindow::UpdateFramebuffer()
 	auto nbuffers = m_backBuffers.size();
 	m_backBufferViews.resize(nbuffers);
 	m_framebuffers.resize(nbuffers);
-	m_texturesUsedThisFrame.resize(nbuffers);
 	for (uint32_t i = 0; i < nbuffers; i++)
 	{
 		vk::ComponentMapping components(
@@ -428,10 +405,137 @@ bool VulkanWindow::UpdateFramebuffer()
 		m_framebuffers[i] = make_unique<vk::raii::Framebuffer>(*g_vkComputeDevice,fbinfo);
 	}
 
+	//Make render-complete semaphores for any new swapchain images.
+	//Never destroy old ones, the presentation engine may still be waiting on them.
+	while(m_renderCompleteSemaphores.size() < nbuffers)
+	{
+		m_renderCompleteSemaphores.push_back(
+			make_unique<vk::raii::Semaphore>(*g_vkComputeDevice, vk::SemaphoreCreateInfo()));
+
+		if(g_hasDebugUtils)
+		{
+			string rcName = "VulkanWindow.renderComplete[" + to_string(m_renderCompleteSemaphores.size() - 1) + "]";
+			g_vkComputeDevice->setDebugUtilsObjectNameEXT(
+				vk::DebugUtilsObjectNameInfoEXT(
+					vk::ObjectType::eSemaphore,
+					reinterpret_cast<uint64_t>(static_cast<VkSemaphore>(**m_renderCompleteSemaphores.back())),
+					rcName.c_str()));
+		}
+	}
+
 	m_resizeEventPending = false;
 	return true;
 }
 
+/**
+	@brief (Re)allocates the command buffers, fences, and semaphores for each frame in flight
+
+	The number of frames in flight is m_requestedFramesInFlight, clamped to the number of swapchain images since
+	ImGui only keeps that many copies of its vertex buffers. The GPU must be idle when this is called.
+ */
+void VulkanWindow::AllocateFrameResources()
+{
+	size_t nframes = GetTargetFramesInFlight();
+	LogTrace("Allocating resources for %zu frames in flight\n", nframes);
+
+	m_texturesUsedThisFrame.clear();
+	m_cmdBuffers.clear();
+	m_imageAcquiredSemaphores.clear();
+	m_fences.clear();
+	m_timestampQueryPool = nullptr;
+
+	vk::CommandBufferAllocateInfo bufinfo(**m_cmdPool, vk::CommandBufferLevel::ePrimary, 1);
+	vk::SemaphoreCreateInfo sinfo;
+	vk::FenceCreateInfo finfo(vk::FenceCreateFlagBits::eSignaled);
+	for(size_t i=0; i<nframes; i++)
+	{
+		m_imageAcquiredSemaphores.push_back(make_unique<vk::raii::Semaphore>(*g_vkComputeDevice, sinfo));
+		m_fences.push_back(make_unique<vk::raii::Fence>(*g_vkComputeDevice, finfo));
+		m_cmdBuffers.push_back(make_unique<vk::raii::CommandBuffer>(
+			std::move(vk::raii::CommandBuffers(*g_vkComputeDevice, bufinfo).front())));
+	}
+	m_texturesUsedThisFrame.resize(nframes);
+	m_timestampsPending.assign(nframes, false);
+	m_frameSlot = 0;
+
+	if(m_hasTimestamps)
+	{
+		vk::QueryPoolCreateInfo qinfo({}, vk::QueryType::eTimestamp, 2*nframes);
+		m_timestampQueryPool = make_unique<vk::raii::QueryPool>(*g_vkComputeDevice, qinfo);
+	}
+
+	if(g_hasDebugUtils)
+	{
+		string prefix = "VulkanWindow.";
+		for(size_t i=0; i<nframes; i++)
+		{
+			string iaName = prefix + "imageAcquired[" + to_string(i) + "]";
+			string fName = prefix + "fence[" + to_string(i) + "]";
+			string cbName = prefix + "cmdBuf[" + to_string(i) + "]";
+
+			g_vkComputeDevice->setDebugUtilsObjectNameEXT(
+				vk::DebugUtilsObjectNameInfoEXT(
+					vk::ObjectType::eSemaphore,
+					reinterpret_cast<uint64_t>(static_cast<VkSemaphore>(**m_imageAcquiredSemaphores[i])),
+					iaName.c_str()));
+
+			g_vkComputeDevice->setDebugUtilsObjectNameEXT(
+				vk::DebugUtilsObjectNameInfoEXT(
+					vk::ObjectType::eFence,
+					reinterpret_cast<uint64_t>(static_cast<VkFence>(**m_fences[i])),
+					fName.c_str()));
+
+			g_vkComputeDevice->setDebugUtilsObjectNameEXT(
+				vk::DebugUtilsObjectNameInfoEXT(
+					vk::ObjectType::eCommandBuffer,
+					reinterpret_cast<uint64_t>(static_cast<VkCommandBuffer>(**m_cmdBuffers[i])),
+					cbName.c_str()));
+		}
+
+		if(m_timestampQueryPool)
+		{
+			string qpName = prefix + "timestampQueryPool";
+			g_vkComputeDevice->setDebugUtilsObjectNameEXT(
+				vk::DebugUtilsObjectNameInfoEXT(
+					vk::ObjectType::eQueryPool,
+					reinterpret_cast<uint64_t>(static_cast<VkQueryPool>(**m_timestampQueryPool)),
+					qpName.c_str()));
+		}
+	}
+}
+
+/**
+	@brief Updates the GPU frame time from the timestamps of the current slot's last frame, if it had any
+
+	Must be called after that frame's fence has been signaled.
+ */
+void VulkanWindow::ReadFrameTimestamps()
+{
+	if(!m_timestampsPending[m_frameSlot])
+		return;
+	m_timestampsPending[m_frameSlot] = false;
+
+	//Same accidental API change as acquireNextImage(), see below
+	auto result = m_timestampQueryPool->getResults<uint64_t>(
+		2*m_frameSlot,
+		2,
+		2*sizeof(uint64_t),
+		sizeof(uint64_t),
+		vk::QueryResultFlagBits::e64);
+	#if (VK_HEADER_VERSION < 324)
+		if(result.first != vk::Result::eSuccess)
+			return;
+		auto& stamps = result.second;
+	#else
+		if(result.result != vk::Result::eSuccess)
+			return;
+		auto& stamps = result.value;
+	#endif
+
+	uint64_t ticks = (stamps[1] - stamps[0]) & m_timestampMask;
+	m_frameGpuTime = ticks * m_timestampPeriod * (FS_PER_SECOND / 1e9);
+}
+
 void VulkanWindow::Render()
 {
 	if(m_softwareResizeRequested)
@@ -474,6 +578,16 @@ void VulkanWindow::Render()
 			return;
 	}
 
+	//Switch to the requested number of frames in flight if it changed
+	if(GetTargetFramesInFlight() != m_fences.size())
+	{
+		lock_guard<shared_mutex> lock(g_vulkanActivityMutex);
+		g_vkComputeDevice->waitIdle();
+		AllocateFrameResources();
+	}
+
+	double start = GetTime();
+
 	//Start frame
 	{
 		QueueLock qlock(m_renderQueue);
@@ -482,16 +596,21 @@ void VulkanWindow::Render()
 	ImGui_ImplGlfw_NewFrame();
 	ImGui::NewFrame();
 
-	//Make sure the old frame has completed
-	//Otherwise we risk modifying textures that last frame is still using
-	(void)g_vkComputeDevice->waitForFences({**m_fences[m_frameIndex]}, VK_TRUE, UINT64_MAX);
+	//Make sure the last frame to use this slot has completed, so we can reuse its command buffer and semaphore.
+	//Other frames may still be in flight.
+	double waitStart = GetTime();
+	(void)g_vkComputeDevice->waitForFences({**m_fences[m_frameSlot]}, VK_TRUE, UINT64_MAX);
+	double waitTime = GetTime() - waitStart;
+	ReadFrameTimestamps();
+
+	//That frame is done with its textures, but don't free them until we're done with this frame
+	set<shared_ptr<Texture> > texturesToClear;
+	texturesToClear.swap(m_texturesUsedThisFrame[m_frameSlot]);
 
 	//Draw all of our application UI objects
 	RenderUI();
 
 	//Internal GUI rendering
-	set<shared_ptr<Texture> > texturesToClear = m_texturesUsedThisFrame[m_lastFrameIndex];
-	m_texturesUsedThisFrame[m_lastFrameIndex].clear();
 	ImGui::Render();
 
 	//Render the main window
@@ -502,8 +621,9 @@ void VulkanWindow::Render()
 		//Get the next frame to draw onto
 		try
 		{
-			auto result = m_swapchain->acquireNextImage(UINT64_MAX, **m_imageAcquiredSemaphores[m_semaphoreIndex], {});
-			m_lastFrameIndex = m_frameIndex;
+			waitStart = GetTime();
+			auto result = m_swapchain->acquireNextImage(UINT64_MAX, **m_imageAcquiredSemaphores[m_frameSlot], {});
+			waitTime += GetTime() - waitStart;
 
 			//Accidental breaking API change in 1.4.324 Vulkan SDK release.
 			//See https://github.com/KhronosGroup/Vulkan-Hpp/issues/2260
@@ -539,13 +659,18 @@ void VulkanWindow::Render()
 			return;
 		}
 
-		//Reset fences for next frame
-		g_vkComputeDevice->resetFences({**m_fences[m_frameIndex]});
-		(*QueueLock(m_renderQueue)).waitIdle();
+		//Only reset the fence once we know we're going to submit, otherwise the next wait on it would hang
+		g_vkComputeDevice->resetFences({**m_fences[m_frameSlot]});
 
 		//Start render pass
-		auto& cmdBuf = *m_cmdBuffers[m_frameIndex];
+		auto& cmdBuf = *m_cmdBuffers[m_frameSlot];
 		cmdBuf.begin(vk::CommandBufferBeginInfo(vk::CommandBufferUsageFlagBits::eOneTimeSubmit));
+		if(m_hasTimestamps)
+		{
+			cmdBuf.resetQueryPool(**m_timestampQueryPool, 2*m_frameSlot, 2);
+			cmdBuf.writeTimestamp(vk::PipelineStageFlagBits::eTopOfPipe, **m_timestampQueryPool, 2*m_frameSlot);
+		}
+		FlushPendingLayoutTransitions(cmdBuf);
 		vk::ClearValue clearValue;
 		vk::ClearColorValue clearColor;
 		clearColor.setFloat32({0.1f, 0.1f, 0.1f, 1.0f});
@@ -565,16 +690,28 @@ void VulkanWindow::Render()
 
 		//Finish up and submit
 		cmdBuf.endRenderPass();
+		if(m_hasTimestamps)
+		{
+			cmdBuf.writeTimestamp(vk::PipelineStageFlagBits::eBottomOfPipe, **m_timestampQueryPool, 2*m_frameSlot + 1);
+			m_timestampsPending[m_frameSlot] = true;
+		}
 		cmdBuf.end();
 
-		vk::PipelineStageFlags flags(vk::PipelineStageFlagBits::eColorAttachmentOutput);
+		//Wait for the swapchain image, plus anything else (e.g. tone mapping) that has to finish before we draw
+		vector<vk::Semaphore> waitSemaphores = m_frameWaitSemaphores;
+		vector<vk::PipelineStageFlags> waitStages = m_frameWaitStages;
+		waitSemaphores.push_back(**m_imageAcquiredSemaphores[m_frameSlot]);
+		waitStages.push_back(vk::PipelineStageFlagBits::eColorAttachmentOutput);
+		m_frameWaitSemaphores.clear();
+		m_frameWaitStages.clear();
+
 		vk::SubmitInfo info(
-			**m_imageAcquiredSemaphores[m_semaphoreIndex],
-			flags,
+			waitSemaphores,
+			waitStages,
 			*cmdBuf,
-			**m_renderCompleteSemaphores[m_semaphoreIndex]);
+			**m_renderCompleteSemaphores[m_frameIndex]);
 		QueueLock qlock(m_renderQueue);
-		(*qlock).submit(info, **m_fences[m_frameIndex]);
+		(*qlock).submit(info, **m_fences[m_frameSlot]);
 	}
 
 	// if (!m_resizeEventPending)
@@ -587,15 +724,19 @@ void VulkanWindow::Render()
 		}
 	}
 
-	//Present the main window
+	//Present the main window.
+	//No need to wait for the queue to go idle, presentation waits on the render-complete semaphore
 	if(!main_is_minimized)
 	{
-		vk::PresentInfoKHR presentInfo(**m_renderCompleteSemaphores[m_semaphoreIndex], **m_swapchain, m_frameIndex);
-		m_semaphoreIndex = (m_semaphoreIndex + 1) % m_backBuffers.size();
+		vk::PresentInfoKHR presentInfo(**m_renderCompleteSemaphores[m_frameIndex], **m_swapchain, m_frameIndex);
+
+		//Move on to the next frame in flight. Anything recorded from here on belongs to it.
+		m_frameSlot = (m_frameSlot + 1) % m_fences.size();
+		m_frameCpuTime = (GetTime() - start - waitTime) * FS_PER_SECOND;
+
 		try
 		{
 			QueueLock qlock(m_renderQueue);
-			(*qlock).waitIdle();
 			if(vk::Result::eSuboptimalKHR == (*qlock).presentKHR(presentInfo))
 			{
 				LogTrace("eSuboptimal at present\n");
@@ -611,7 +752,7 @@ void VulkanWindow::Render()
 		}
 	}
 
-	//We can now free references to last frame's textures
+	//We can now free references to textures used by the frame which last used this slot
 	//This will delete them if the containing object was destroyed that frame
 	texturesToClear.clear();
 }
@@ -620,6 +761,42 @@ void VulkanWindow::RenderUI()
 {
 }
 
+/**
+	@brief Records layout transitions for all textures created since the last call
+
+	Must be called outside of a render pass, before anything in the command buffer touches the textures.
+ */
+void VulkanWindow::FlushPendingLayoutTransitions(vk::raii::CommandBuffer& cmdBuf)
+{
+	if(m_pendingLayoutTransitions.empty())
+		return;
+
+	vk::ImageSubresourceRange range(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1);
+	vector<vk::ImageMemoryBarrier> barriers;
+	for(auto& tex : m_pendingLayoutTransitions)
+	{
+		barriers.push_back(vk::ImageMemoryBarrier(
+			vk::AccessFlagBits::eNone,
+			vk::AccessFlagBits::eShaderWrite | vk::AccessFlagBits::eShaderRead,
+			vk::ImageLayout::eUndefined,
+			vk::ImageLayout::eGeneral,
+			VK_QUEUE_FAMILY_IGNORED,
+			VK_QUEUE_FAMILY_IGNORED,
+			tex->GetImage(),
+			range));
+	}
+
+	cmdBuf.pipelineBarrier(
+		vk::PipelineStageFlagBits::eTopOfPipe,
+		vk::PipelineStageFlagBits::eComputeShader | vk::PipelineStageFlagBits::eFragmentShader,
+		{},
+		{},
+		{},
+		barriers);
+
+	m_pendingLayoutTransitions.clear();
+}
+
 void VulkanWindow::DoRender(vk::raii::CommandBuffer& /*cmdBuf*/)
 {
 }
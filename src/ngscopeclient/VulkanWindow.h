@@ -59,13 +59,61 @@ public:
 	{ return m_renderQueue; }
 
 	void AddTextureUsedThisFrame(std::shared_ptr<Texture> tex)
-	{ m_texturesUsedThisFrame[m_frameIndex].emplace(tex); }
+	{ m_texturesUsedThisFrame[m_frameSlot].emplace(tex); }
+
+	/**
+		@brief Sets the maximum number of frames the GPU may be working on while the CPU records the next one
+
+		Takes effect at the start of the next frame. Clamped to the number of swapchain images.
+	 */
+	void SetMaxFramesInFlight(size_t frames)
+	{ m_requestedFramesInFlight = frames; }
+
+	///@brief Gets the CPU time spent on the most recent frame, in fs (excluding time spent waiting on the GPU)
+	int64_t GetFrameCpuTime()
+	{ return m_frameCpuTime; }
+
+	///@brief Gets the GPU execution time of the most recently completed frame, in fs (zero if not supported)
+	int64_t GetFrameGpuTime()
+	{ return m_frameGpuTime; }
+
+	/**
+		@brief Requests that a newly created texture be transitioned to the "general" layout
+
+		The transition is recorded at the start of the next command buffer to use it, rather than blocking here.
+		Call from the GUI thread only.
+	 */
+	void AddPendingLayoutTransition(std::shared_ptr<Texture> tex)
+	{ m_pendingLayoutTransitions.push_back(tex); }
+
+	void FlushPendingLayoutTransitions(vk::raii::CommandBuffer& cmdBuf);
+
+	/**
+		@brief Makes the next frame wait on a semaphore before the given pipeline stages
+
+		Call from the GUI thread only.
+	 */
+	void AddFrameWaitSemaphore(vk::Semaphore sem, vk::PipelineStageFlags stages)
+	{
+		m_frameWaitSemaphores.push_back(sem);
+		m_frameWaitStages.push_back(stages);
+	}
+
+	///@brief Checks if the next frame is already going to wait on a semaphore
+	bool HasFrameWaitSemaphore(vk::Semaphore sem)
+	{ return std::find(m_frameWaitSemaphores.begin(), m_frameWaitSemaphores.end(), sem) != m_frameWaitSemaphores.end(); }
 
 	bool IsFullscreen()
 	{ return m_fullscreen; }
 
 protected:
 	bool UpdateFramebuffer();
+	void AllocateFrameResources();
+	void ReadFrameTimestamps();
+
+	///@brief Number of frames in flight we should be using, after clamping the request to what we can support
+	size_t GetTargetFramesInFlight()
+	{ return std::max(std::min(m_requestedFramesInFlight, m_backBuffers.size()), (size_t)1); }
 	void SetFullscreen(bool fullscreen);
 
 	virtual void DoRender(vk::raii::CommandBuffer& cmdBuf);
@@ -101,27 +149,48 @@ protected:
 	///@brief Frame command pool
 	std::unique_ptr<vk::raii::CommandPool> m_cmdPool;
 
-	///@brief Frame command buffers
+	///@brief Number of frames in flight requested by the user
+	size_t m_requestedFramesInFlight;
+
+	///@brief Frame command buffers (one per frame in flight)
 	std::vector<std::unique_ptr<vk::raii::CommandBuffer> > m_cmdBuffers;
 
-	///@brief Semaphore indicating framebuffer is ready
+	///@brief Semaphore indicating framebuffer is ready (one per frame in flight)
 	std::vector<std::unique_ptr<vk::raii::Semaphore> > m_imageAcquiredSemaphores;
 
-	///@brief Semaphore indicating frame is complete
+	///@brief Semaphore indicating frame is complete (one per swapchain image, since presentation waits on it)
 	std::vector<std::unique_ptr<vk::raii::Semaphore> > m_renderCompleteSemaphores;
 
-	///@brief Frame semaphore number for double buffering
-	uint32_t m_semaphoreIndex;
+	///@brief Index of the frame in flight we're currently recording
+	uint32_t m_frameSlot;
 
-	///@brief Frame number for double buffering
+	///@brief Index of the swapchain image we're currently drawing onto
 	uint32_t m_frameIndex;
 
-	///@brief Frame number for double buffering
-	uint32_t m_lastFrameIndex;
-
-	///@brief Frame fences
+	///@brief Frame fences (one per frame in flight)
 	std::vector<std::unique_ptr<vk::raii::Fence> > m_fences;
 
+	///@brief Start and end of frame timestamps (two per frame in flight)
+	std::unique_ptr<vk::raii::QueryPool> m_timestampQueryPool;
+
+	///@brief True if a frame with timestamps was submitted in each slot and we haven't read them yet
+	std::vector<bool> m_timestampsPending;
+
+	///@brief True if the render queue supports timestamp queries
+	bool m_hasTimestamps;
+
+	///@brief Mask of valid timestamp bits
+	uint64_t m_timestampMask;
+
+	///@brief Nanoseconds per timestamp tick
+	float m_timestampPeriod;
+
+	///@brief CPU time spent on the most recent frame, in fs
+	int64_t m_frameCpuTime;
+
+	///@brief GPU execution time of the most recently completed frame, in fs
+	int64_t m_frameGpuTime;
+
 	///@brief Back buffer view
 	std::vector<std::unique_ptr<vk::raii::ImageView> > m_backBufferViews;
 
@@ -170,9 +239,18 @@ protected:
 	///@brief Saved size before we went fullscreen
 	int m_windowedHeight;
 
-	///@brief Textures used this frame
+	///@brief Textures used by each frame in flight, kept alive until the frame completes
 	std::vector< std::set<std::shared_ptr<Texture> > > m_texturesUsedThisFrame;
 
+	///@brief New textures which haven't been transitioned to the "general" layout yet
+	std::vector<std::shared_ptr<Texture> > m_pendingLayoutTransitions;
+
+	///@brief Semaphores (other than the swapchain image) the next frame has to wait on
+	std::vector<vk::Semaphore> m_frameWaitSemaphores;
+
+	///@brief Pipeline stages which have to wait on each of m_frameWaitSemaphores
+	std::vector<vk::PipelineStageFlags> m_frameWaitStages;
+
 	///@brief Window title
 	std::string m_title;
 };
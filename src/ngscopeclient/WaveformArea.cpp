@@ -35,6 +35,7 @@
 #include "ngscopeclient.h"
 #include "WaveformArea.h"
 #include "MainWindow.h"
+#include "PreferenceTypes.h"
 #include "../../scopehal/TwoLevelTrigger.h"
 #include "../../scopeprotocols/ConstellationFilter.h"
 #include "../../scopeprotocols/EyePattern.h"
@@ -53,13 +54,24 @@ DisplayedChannel::DisplayedChannel(StreamDescriptor stream, Session& session)
 		: m_colorRamp("eye-gradient-viridis")
 		, m_stream(stream)
 		, m_session(session)
-		, m_rasterizedWaveform("DisplayedChannel.m_rasterizedWaveform")
+		, m_rasterizedWaveform(make_unique<AcceleratorBuffer<float> >("DisplayedChannel.m_rasterizedWaveform[0]"))
+		, m_nextRasterizedWaveform(make_unique<AcceleratorBuffer<float> >("DisplayedChannel.m_rasterizedWaveform[1]"))
 		, m_indexBuffer("DisplayedChannel.m_indexBuffer")
+		, m_indexTargetBuffer("DisplayedChannel.m_indexTargetBuffer")
+		, m_pyramid("DisplayedChannel.m_pyramid")
+		, m_pyramidLevels(0)
 		, m_rasterizedX(0)
 		, m_rasterizedY(0)
+		, m_nextRasterizedX(0)
+		, m_nextRasterizedY(0)
 		, m_cachedX(0)
 		, m_cachedY(0)
+		, m_textureUV(1, 1)
+		, m_textureFormat(vk::Format::eUndefined)
 		, m_persistenceEnabled(false)
+		, m_rasterizedFp16(false)
+		, m_nextRasterizedFp16(false)
+		, m_nextRasterizedPending(false)
 		, m_yButtonPos(0)
 {
 	auto schan = dynamic_cast<OscilloscopeChannel*>(stream.m_channel);
@@ -77,14 +89,26 @@ DisplayedChannel::DisplayedChannel(StreamDescriptor stream, Session& session)
 
 	//Use GPU-side memory for rasterized waveform
 	//TODO: instead of using CPU-side mirror, use a shader to memset it when clearing?
-	m_rasterizedWaveform.SetCpuAccessHint(AcceleratorBuffer<float>::HINT_LIKELY);
-	m_rasterizedWaveform.SetGpuAccessHint(AcceleratorBuffer<float>::HINT_LIKELY);
+	for(auto buf : {m_rasterizedWaveform.get(), m_nextRasterizedWaveform.get()})
+	{
+		buf->SetCpuAccessHint(AcceleratorBuffer<float>::HINT_LIKELY);
+		buf->SetGpuAccessHint(AcceleratorBuffer<float>::HINT_LIKELY);
+	}
 
-	//Use pinned memory for index buffer since it should only be read once
+	//Index buffer is kept across renders, and may be written by either the CPU or GPU
 	m_indexBuffer.SetCpuAccessHint(AcceleratorBuffer<uint32_t>::HINT_LIKELY);
-	m_indexBuffer.SetGpuAccessHint(AcceleratorBuffer<uint32_t>::HINT_UNLIKELY);
+	m_indexBuffer.SetGpuAccessHint(AcceleratorBuffer<uint32_t>::HINT_LIKELY);
+
+	//Use pinned memory for index targets since they're only read once
+	m_indexTargetBuffer.SetCpuAccessHint(AcceleratorBuffer<int64_t>::HINT_LIKELY);
+	m_indexTargetBuffer.SetGpuAccessHint(AcceleratorBuffer<int64_t>::HINT_UNLIKELY);
 
-	//Create tone map pipeline depending on waveform type
+	//Pyramid is built and used entirely on the GPU
+	m_pyramid.SetCpuAccessHint(AcceleratorBuffer<float>::HINT_UNLIKELY);
+	m_pyramid.SetGpuAccessHint(AcceleratorBuffer<float>::HINT_LIKELY);
+
+	//Create tone map pipeline depending on waveform type.
+	//Analog and digital waveforms have several variants, created on demand by GetToneMapPipeline()
 	switch(m_stream.GetType())
 	{
 		case Stream::STREAM_TYPE_EYE:
@@ -108,8 +132,7 @@ DisplayedChannel::DisplayedChannel(StreamDescriptor stream, Session& session)
 			break;
 
 		default:
-			m_toneMapPipe = make_shared<ComputePipeline>(
-				"shaders/WaveformToneMap.spv", 1, sizeof(WaveformToneMapArgs), 1);
+			break;
 	}
 }
 
@@ -165,10 +188,30 @@ bool DisplayedChannel::UpdateSize(ImVec2 newSize, MainWindow* top)
 			LogTrace("Hardware eye resolution changed, processing resize\n");
 	}
 
-	if( (m_cachedX != x) || (m_cachedY != y) )
+	//Analog and digital waveforms can use reduced precision textures, everything else is tone mapped to fp32
+	auto format = vk::Format::eR32G32B32A32Sfloat;
+	if(m_toneMapPipe == nullptr)
+	{
+		switch(m_session.GetPreferences().GetEnumRaw("Performance.Rendering.texture_format"))
+		{
+			case TEXTURE_FORMAT_RGBA8:
+				format = vk::Format::eR8G8B8A8Unorm;
+				break;
+
+			case TEXTURE_FORMAT_RGBA16F:
+				format = vk::Format::eR16G16B16A16Sfloat;
+				break;
+
+			default:
+				break;
+		}
+	}
+
+	if( (m_cachedX != x) || (m_cachedY != y) || (m_textureFormat != format) )
 	{
 		m_cachedX = x;
 		m_cachedY = y;
+		m_textureFormat = format;
 
 		//Don't actually create an image object if the image is degenerate (zero pixels)
 		if( (x == 0) || (y == 0) )
@@ -237,11 +280,10 @@ bool DisplayedChannel::UpdateSize(ImVec2 newSize, MainWindow* top)
 
 		LogTrace("Displayed channel resized (to %zu x %zu), reallocating texture\n", x, y);
 
-		//NOTE: Assumes the render queue is also capable of transfers (see QueueManager)
 		vk::ImageCreateInfo imageInfo(
 			{},
 			vk::ImageType::e2D,
-			vk::Format::eR32G32B32A32Sfloat,
+			format,
 			vk::Extent3D(x, y, 1),
 			1,
 			1,
@@ -257,33 +299,17 @@ bool DisplayedChannel::UpdateSize(ImVec2 newSize, MainWindow* top)
 		//in case the previous frame hasn't fully completed rendering yet
 		top->AddTextureUsedThisFrame(m_texture);
 
-		//Make the new texture and mark that as in use too
-		m_texture = make_shared<Texture>(
-			*g_vkComputeDevice, imageInfo, top->GetTextureManager(), "DisplayedChannel.m_texture");
+		//Grab a texture from the pool and mark that as in use too.
+		//It may be bigger than we asked for, only the first x by y pixels are used
+		bool created;
+		m_texture = top->GetTextureManager()->GetPooledTexture(imageInfo, "DisplayedChannel.m_texture", created);
 		top->AddTextureUsedThisFrame(m_texture);
+		m_textureUV = ImVec2(x * 1.0f / m_texture->GetWidth(), y * 1.0f / m_texture->GetHeight());
 
-		//Add a barrier to convert the image format to "general"
-		lock_guard<mutex> lock(g_vkTransferMutex);
-		vk::ImageSubresourceRange range(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1);
-		vk::ImageMemoryBarrier barrier(
-			vk::AccessFlagBits::eNone,
-			vk::AccessFlagBits::eShaderWrite,
-			vk::ImageLayout::eUndefined,
-			vk::ImageLayout::eGeneral,
-			VK_QUEUE_FAMILY_IGNORED,
-			VK_QUEUE_FAMILY_IGNORED,
-			m_texture->GetImage(),
-			range);
-		g_vkTransferCommandBuffer->begin({});
-		g_vkTransferCommandBuffer->pipelineBarrier(
-				vk::PipelineStageFlagBits::eTopOfPipe,
-				vk::PipelineStageFlagBits::eComputeShader,
-				{},
-				{},
-				{},
-				barrier);
-		g_vkTransferCommandBuffer->end();
-		g_vkTransferQueue->SubmitAndBlock(*g_vkTransferCommandBuffer);
+		//New images have to be converted to the "general" layout before first use.
+		//Do this at the start of the next frame's command buffer rather than with a blocking submit here.
+		if(created)
+			top->AddPendingLayoutTransition(m_texture);
 
 		return true;
 	}
@@ -293,23 +319,55 @@ bool DisplayedChannel::UpdateSize(ImVec2 newSize, MainWindow* top)
 
 /**
 	@brief Prepares to rasterize the waveform at the specified resolution
+
+	The waveform is drawn into a second buffer, so the GUI thread can keep tone mapping the previous one in the meantime.
+	Call SwapRasterizedWaveforms() once rendering has completed.
+
+	@param x		Width of the plot, in pixels
+	@param y		Height of the plot, in pixels
+	@param persist	True if the new waveform is going to be drawn on top of the previous one
  */
-void DisplayedChannel::PrepareToRasterize(size_t x, size_t y)
+void DisplayedChannel::PrepareToRasterize(size_t x, size_t y, bool persist)
 {
-	bool sizeChanged = (m_rasterizedX != x) || (m_rasterizedY != y);
+	//Persistence decays slowly over many frames, which needs more precision than fp16 has
+	bool fp16 = !m_persistenceEnabled && m_session.IsRasterizeFp16();
+
+	bool sizeChanged = (m_nextRasterizedX != x) || (m_nextRasterizedY != y);
+	bool formatChanged = (m_nextRasterizedFp16 != fp16);
 
-	m_rasterizedX = x;
-	m_rasterizedY = y;
+	m_nextRasterizedX = x;
+	m_nextRasterizedY = y;
+	m_nextRasterizedFp16 = fp16;
+	m_nextRasterizedPending = true;
 
-	if(sizeChanged)
+	//Rendering pipelines are specific to the buffer format.
+	//Rasterization blocks until complete, so the old ones are no longer in use.
+	if(formatChanged)
 	{
-		size_t npixels = x*y;
-		m_rasterizedWaveform.resize(npixels);
+		m_uniformAnalogComputePipeline = nullptr;
+		m_histogramComputePipeline = nullptr;
+		m_sparseAnalogComputePipeline = nullptr;
+		m_uniformDigitalComputePipeline = nullptr;
+		m_sparseDigitalComputePipeline = nullptr;
+	}
+
+	//Persistence draws on top of the previous waveform, which is in the other buffer
+	bool sameAsPrevious = (m_rasterizedX == x) && (m_rasterizedY == y) && (m_rasterizedFp16 == fp16);
+	if(persist && sameAsPrevious)
+		m_nextRasterizedWaveform->CopyFrom(*m_rasterizedWaveform);
+
+	else if(persist || sizeChanged || formatChanged)
+	{
+		//fp16 packs two vertically adjacent pixels into each word
+		size_t nwords = x*y;
+		if(fp16)
+			nwords = x * ((y+1) / 2);
+		m_nextRasterizedWaveform->resize(nwords);
 
 		//fill with black
-		m_rasterizedWaveform.PrepareForCpuAccess();
-		memset(m_rasterizedWaveform.GetCpuPointer(), 0, npixels * sizeof(float));
-		m_rasterizedWaveform.MarkModifiedFromCpu();
+		m_nextRasterizedWaveform->PrepareForCpuAccess();
+		memset(m_nextRasterizedWaveform->GetCpuPointer(), 0, nwords * sizeof(float));
+		m_nextRasterizedWaveform->MarkModifiedFromCpu();
 	}
 
 	//Allocate index buffer for sparse waveforms
@@ -317,6 +375,241 @@ void DisplayedChannel::PrepareToRasterize(size_t x, size_t y)
 		m_indexBuffer.resize(x);
 }
 
+/**
+	@brief Makes the waveform from the last PrepareToRasterize() call the one to tone map
+
+	Called from the WaveformThread, with the rasterized waveform mutex held, once the rendering shader has completed.
+ */
+void DisplayedChannel::SwapRasterizedWaveforms()
+{
+	if(!m_nextRasterizedPending)
+		return;
+	m_nextRasterizedPending = false;
+
+	swap(m_rasterizedWaveform, m_nextRasterizedWaveform);
+	swap(m_rasterizedX, m_nextRasterizedX);
+	swap(m_rasterizedY, m_nextRasterizedY);
+	swap(m_rasterizedFp16, m_nextRasterizedFp16);
+}
+
+/**
+	@brief Gets the pipeline for tone mapping this channel, creating it if necessary
+
+	Analog and digital waveforms have one variant for each combination of texture format and rasterized waveform format,
+	so the pipeline must be fetched after both UpdateSize() and PrepareToRasterize() have run.
+ */
+shared_ptr<ComputePipeline> DisplayedChannel::GetToneMapPipeline()
+{
+	if(m_toneMapPipe)
+		return m_toneMapPipe;
+
+	string path = "shaders/WaveformToneMap.";
+	if(m_rasterizedFp16)
+		path += "fp16.";
+	switch(m_textureFormat)
+	{
+		case vk::Format::eR8G8B8A8Unorm:
+			path += "rgba8.spv";
+			break;
+
+		case vk::Format::eR16G16B16A16Sfloat:
+			path += "rgba16f.spv";
+			break;
+
+		default:
+			path += "rgba32f.spv";
+			break;
+	}
+
+	auto& pipe = m_waveformToneMapPipes[path];
+	if(pipe == nullptr)
+		pipe = make_shared<ComputePipeline>(path, 1, sizeof(WaveformToneMapArgs), 1);
+	return pipe;
+}
+
+/**
+	@brief Updates the X axis index buffer for a sparse waveform
+
+	Column i of the index buffer holds the index of the first sample at or after floor(i / xscale) + offsetSamples.
+
+	The buffer is only recomputed when something actually changed. If the waveform is the same as last time, columns
+	whose target offset was already in the previous buffer (e.g. everything still on screen after a pan) are copied
+	over and only the newly exposed columns are searched. Since the targets are monotonic, each search only has to look
+	at samples after the previous column's result.
+
+	If the offsets are only valid on the GPU (e.g. the output of a GPU accelerated filter), the search is done by the
+	SparseIndexBuffer shader instead so the offsets never have to be copied back to the CPU.
+
+	@param data				The waveform being rasterized
+	@param w				Width of the plot, in pixels
+	@param xscale			Pixels per sample offset unit
+	@param offsetSamples	Sample offset of the left edge of the plot
+	@param cmdbuf			Command buffer the GPU search is recorded into, if needed
+
+	@return True if the buffer was modified (and has been marked as such), false if it was already up to date
+ */
+bool DisplayedChannel::UpdateIndexBuffer(
+	SparseWaveformBase* data,
+	size_t w,
+	double xscale,
+	int64_t offsetSamples,
+	vk::raii::CommandBuffer& cmdbuf)
+{
+	vector<int64_t> targets(w);
+	for(size_t i=0; i<w; i++)
+		targets[i] = floor(i / xscale) + offsetSamples;
+
+	//Old results can only be reused if the buffer hasn't been reallocated since they were computed
+	WaveformCacheKey key(data);
+	bool sameWaveform = (key == m_indexKey) && (m_indexBuffer.size() == m_indexTargets.size());
+	if(sameWaveform && (targets == m_indexTargets))
+		return false;
+
+	size_t len = data->size();
+
+	//Search on the GPU if the CPU copy of the offsets is stale
+	if(data->m_offsets.IsCpuBufferStale())
+	{
+		if(m_indexComputePipeline == nullptr)
+		{
+			m_indexComputePipeline = make_shared<ComputePipeline>(
+				"shaders/SparseIndexBuffer.spv", 3, sizeof(SparseIndexBufferArgs));
+		}
+
+		m_indexTargetBuffer.resize(w);
+		m_indexTargetBuffer.PrepareForCpuAccess();
+		memcpy(m_indexTargetBuffer.GetCpuPointer(), targets.data(), w * sizeof(int64_t));
+		m_indexTargetBuffer.MarkModifiedFromCpu();
+		m_indexBuffer.resize(w);
+
+		m_indexComputePipeline->BindBufferNonblocking(0, m_indexBuffer, cmdbuf, true);
+		m_indexComputePipeline->BindBufferNonblocking(1, data->m_offsets, cmdbuf);
+		m_indexComputePipeline->BindBufferNonblocking(2, m_indexTargetBuffer, cmdbuf);
+		SparseIndexBufferArgs args(len, w);
+		m_indexComputePipeline->Dispatch(cmdbuf, args, GetComputeBlockCount(w, 64));
+		m_indexComputePipeline->AddComputeMemoryBarrier(cmdbuf);
+		m_indexBuffer.MarkModifiedFromGpu();
+	}
+
+	else
+	{
+		m_indexBuffer.PrepareForCpuAccess();
+		data->m_offsets.PrepareForCpuAccess();
+		auto offsets = data->m_offsets.GetCpuPointer();
+
+		//Copy the previous index list so we can overwrite the buffer in place
+		vector<uint32_t> oldIndexes;
+		if(sameWaveform)
+		{
+			auto p = m_indexBuffer.GetCpuPointer();
+			oldIndexes.assign(p, p + m_indexBuffer.size());
+		}
+		if(m_indexBuffer.size() != w)
+			m_indexBuffer.resize(w);
+		size_t nold = oldIndexes.size();
+
+		size_t iold = 0;
+		size_t start = 0;
+		for(size_t i=0; i<w; i++)
+		{
+			int64_t target = targets[i];
+
+			//Reuse the old result if this target was in the previous buffer
+			while( (iold < nold) && (m_indexTargets[iold] < target) )
+				iold ++;
+			uint32_t index;
+			if( (iold < nold) && (m_indexTargets[iold] == target) )
+				index = oldIndexes[iold];
+
+			//Otherwise search, skipping everything before the previous column's result
+			else if(start < len)
+				index = start + BinarySearchForGequal(offsets + start, len - start, target);
+			else
+				index = len;
+
+			m_indexBuffer[i] = index;
+			start = index;
+		}
+		m_indexBuffer.MarkModifiedFromCpu();
+	}
+
+	m_indexTargets = std::move(targets);
+	m_indexKey = key;
+	return true;
+}
+
+/**
+	@brief Builds the min/max pyramid for a uniform analog waveform, if it's big enough to benefit from one
+
+	Each block stores the minimum and maximum voltage of the line segments it covers, and their total variation (the
+	sum of the absolute voltage change across each segment, i.e. how far the trace travels vertically). When zoomed far
+	out, the rasterizer draws whole blocks in the middle of each column instead of their individual segments: the
+	envelope is unchanged, and the total variation tells it how much intensity the segments would have added.
+
+	The pyramid is built on the GPU, and only rebuilt when the waveform changes.
+
+	@param data		The waveform being rasterized
+	@param cmdbuf	Command buffer to record the build into
+
+	@return Number of levels in the pyramid (zero if the waveform is too small to need one)
+ */
+uint32_t DisplayedChannel::UpdatePyramid(UniformAnalogWaveform* data, vk::raii::CommandBuffer& cmdbuf)
+{
+	WaveformCacheKey key(data);
+	if(key == m_pyramidKey)
+		return m_pyramidLevels;
+	m_pyramidKey = key;
+
+	//Only build levels which a column could span enough blocks of
+	size_t nseg = (data->size() > 1) ? data->size() - 1 : 0;
+	vector<uint32_t> blockCounts;
+	size_t blocksize = PYRAMID_BASE_BLOCK;
+	size_t total = 0;
+	while( (blockCounts.size() < PYRAMID_MAX_LEVELS) && (blocksize * PYRAMID_MIN_BLOCKS <= nseg) )
+	{
+		size_t nblocks = (nseg + blocksize - 1) / blocksize;
+		blockCounts.push_back(nblocks);
+		total += nblocks;
+		blocksize *= PYRAMID_FANOUT;
+	}
+	m_pyramidLevels = blockCounts.size();
+
+	//Always keep something allocated so the rendering shader has a buffer to bind
+	m_pyramid.resize(max(total, (size_t)1) * 3);
+	if(m_pyramidLevels == 0)
+		return 0;
+
+	if(m_pyramidComputePipeline == nullptr)
+	{
+		m_pyramidComputePipeline = make_shared<ComputePipeline>(
+			"shaders/WaveformPyramid.spv", 2, sizeof(WaveformPyramidArgs));
+	}
+
+	//Each level is built from the one below it
+	uint32_t srcOffset = 0;
+	uint32_t dstOffset = 0;
+	for(uint32_t level = 0; level < m_pyramidLevels; level++)
+	{
+		uint32_t nsrc = (level == 0) ? nseg : blockCounts[level-1];
+		uint32_t nblocks = blockCounts[level];
+
+		m_pyramidComputePipeline->BindBufferNonblocking(0, m_pyramid, cmdbuf);
+		m_pyramidComputePipeline->BindBufferNonblocking(1, data->m_samples, cmdbuf);
+		WaveformPyramidArgs args(nseg, level, srcOffset, dstOffset, nblocks, nsrc);
+		const uint32_t compute_block_count = GetComputeBlockCount(nblocks, 64);
+		m_pyramidComputePipeline->Dispatch(cmdbuf, args,
+			min(compute_block_count, 32768u),
+			compute_block_count / 32768 + 1);
+		m_pyramidComputePipeline->AddComputeMemoryBarrier(cmdbuf);
+
+		srcOffset = dstOffset;
+		dstOffset += nblocks;
+	}
+	m_pyramid.MarkModifiedFromGpu();
+
+	return m_pyramidLevels;
+}
+
 /**
 	@brief Serializes the configuration for this channel
  */
@@ -992,7 +1285,7 @@ void WaveformArea::PlotContextMenu()
 			if(ImGui::MenuItem("Delete"))
 			{
 				markers.erase(markers.begin() + selectedMarker);
-				m_parent->GetSession().OnMarkerChanged();
+				m_parent->GetSession().OnMarkerChanged(GetWaveformTimestamp());
 			}
 		}
 
@@ -1126,7 +1419,14 @@ void WaveformArea::RenderAnalogWaveform(shared_ptr<DisplayedChannel> channel, Im
 	//Render the tone mapped output (if we have it)
 	auto tex = channel->GetTexture();
 	if(tex != nullptr)
-		list->AddImage(tex->GetTexture(), start, ImVec2(start.x+size.x, start.y+size.y), ImVec2(0, 1), ImVec2(1, 0) );
+	{
+		list->AddImage(
+			tex->GetTexture(),
+			start,
+			ImVec2(start.x+size.x, start.y+size.y),
+			channel->GetTextureUV0(),
+			channel->GetTextureUV1() );
+	}
 
 	//If it's a peak detection filter, draw the peaks and annotations
 	auto pf = dynamic_cast<PeakDetectionFilter*>(stream.m_channel);
@@ -1157,7 +1457,14 @@ void WaveformArea::RenderWaterfallWaveform(shared_ptr<DisplayedChannel> channel,
 	//Render the tone mapped output (if we have it)
 	auto tex = channel->GetTexture();
 	if(tex != nullptr)
-		list->AddImage(tex->GetTexture(), start, ImVec2(start.x+size.x, start.y+size.y), ImVec2(0, 1), ImVec2(1, 0) );
+	{
+		list->AddImage(
+			tex->GetTexture(),
+			start,
+			ImVec2(start.x+size.x, start.y+size.y),
+			channel->GetTextureUV0(),
+			channel->GetTextureUV1() );
+	}
 }
 
 /**
@@ -1183,7 +1490,14 @@ void WaveformArea::RenderSpectrogramWaveform(shared_ptr<DisplayedChannel> channe
 	//Render the tone mapped output (if we have it)
 	auto tex = channel->GetTexture();
 	if(tex != nullptr)
-		list->AddImage(tex->GetTexture(), start, ImVec2(start.x+size.x, start.y+size.y), ImVec2(0, 1), ImVec2(1, 0) );
+	{
+		list->AddImage(
+			tex->GetTexture(),
+			start,
+			ImVec2(start.x+size.x, start.y+size.y),
+			channel->GetTextureUV0(),
+			channel->GetTextureUV1() );
+	}
 }
 
 /**
@@ -1209,7 +1523,14 @@ void WaveformArea::RenderEyeWaveform(shared_ptr<DisplayedChannel> channel, ImVec
 	//Render the tone mapped output (if we have it)
 	auto tex = channel->GetTexture();
 	if(tex != nullptr)
-		list->AddImage(tex->GetTexture(), start, ImVec2(start.x+size.x, start.y+size.y), ImVec2(0, 1), ImVec2(1, 0) );
+	{
+		list->AddImage(
+			tex->GetTexture(),
+			start,
+			ImVec2(start.x+size.x, start.y+size.y),
+			channel->GetTextureUV0(),
+			channel->GetTextureUV1() );
+	}
 
 	//Draw the mask (if there is one)
 	auto eye = dynamic_cast<EyePattern*>(stream.m_channel);
@@ -1283,7 +1604,14 @@ void WaveformArea::RenderConstellationWaveform(shared_ptr<DisplayedChannel> chan
 	//Render the tone mapped output (if we have it)
 	auto tex = channel->GetTexture();
 	if(tex != nullptr)
-		list->AddImage(tex->GetTexture(), start, ImVec2(start.x+size.x, start.y+size.y), ImVec2(0, 1), ImVec2(1, 0) );
+	{
+		list->AddImage(
+			tex->GetTexture(),
+			start,
+			ImVec2(start.x+size.x, start.y+size.y),
+			channel->GetTextureUV0(),
+			channel->GetTextureUV1() );
+	}
 
 	//Draw nominal point locations
 	auto cfilt = dynamic_cast<ConstellationFilter*>(stream.m_channel);
@@ -1648,8 +1976,8 @@ void WaveformArea::RenderDigitalWaveform(shared_ptr<DisplayedChannel> channel, I
 			tex->GetTexture(),
 			ImVec2(start.x, ypos - m_channelButtonHeight),
 			ImVec2(start.x+size.x, ypos),
-			ImVec2(0, 1),
-			ImVec2(1, 0) );
+			channel->GetTextureUV0(),
+			channel->GetTextureUV1() );
 	}
 }
 
@@ -1939,9 +2267,21 @@ void WaveformArea::MakePathSignalBody(ImDrawList* list, float xstart, float xend
 
 /**
 	@brief Tone map our waveforms
+
+	@param cmdbuf		Command buffer to record tone mapping commands into
+	@param channels		Channels we tone mapped are appended to this, to keep them alive until the GPU is done
+
+	@return True if any of the shaders read waveform data directly, rather than a rasterized copy of it.
+			Density functions (eyes, spectrograms, etc.) don't have a rendering step, so the caller must not let the
+			waveform data change until the tone mapping has completed.
  */
-void WaveformArea::ToneMapAllWaveforms(vk::raii::CommandBuffer& cmdbuf)
+bool WaveformArea::ToneMapAllWaveforms(
+	vk::raii::CommandBuffer& cmdbuf,
+	vector<shared_ptr<DisplayedChannel> >& channels)
 {
+	channels.insert(channels.end(), m_displayedChannels.begin(), m_displayedChannels.end());
+
+	bool readsWaveformData = false;
 	for(auto& chan : m_displayedChannels)
 	{
 		auto stream = chan->GetStream();
@@ -1957,18 +2297,22 @@ void WaveformArea::ToneMapAllWaveforms(vk::raii::CommandBuffer& cmdbuf)
 
 			case Stream::STREAM_TYPE_WATERFALL:
 				ToneMapWaterfallWaveform(chan, cmdbuf);
+				readsWaveformData = true;
 				break;
 
 			case Stream::STREAM_TYPE_SPECTROGRAM:
 				ToneMapSpectrogramWaveform(chan, cmdbuf);
+				readsWaveformData = true;
 				break;
 
 			case Stream::STREAM_TYPE_EYE:
 				ToneMapEyeWaveform(chan, cmdbuf);
+				readsWaveformData = true;
 				break;
 
 			case Stream::STREAM_TYPE_CONSTELLATION:
 				ToneMapConstellationWaveform(chan, cmdbuf);
+				readsWaveformData = true;
 				break;
 
 			//no tone mapping required
@@ -1984,6 +2328,8 @@ void WaveformArea::ToneMapAllWaveforms(vk::raii::CommandBuffer& cmdbuf)
 				break;
 		}
 	}
+
+	return readsWaveformData;
 }
 
 /**
@@ -1992,8 +2338,9 @@ void WaveformArea::ToneMapAllWaveforms(vk::raii::CommandBuffer& cmdbuf)
 	Called from WaveformThread
 
 	@param cmdbuf				Command buffer to record rendering commands into
-	@param chans				Set of channels we rendered into
-								Used to keep references active until rendering completes if we close them this frame
+	@param chans				Channels we rendered into are appended to this.
+								Used to keep references active until rendering completes if we close them this frame,
+								and to swap in the new rasterized waveforms afterwards
 	@param clearPersistence		True if persistence maps should be erased before rendering
  */
 void WaveformArea::RenderWaveformTextures(
@@ -2001,7 +2348,7 @@ void WaveformArea::RenderWaveformTextures(
 	vector<shared_ptr<DisplayedChannel> >& chans,
 	bool clearPersistence)
 {
-	chans = m_displayedChannels;
+	chans.insert(chans.end(), m_displayedChannels.begin(), m_displayedChannels.end());
 
 	bool clearThisAreaOnly = m_clearPersistence.exchange(false);
 	bool clearing = clearThisAreaOnly || clearPersistence;
@@ -2060,14 +2407,15 @@ void WaveformArea::RasterizeAnalogOrDigitalWaveform(
 	//If no data (or an empty buffer with no samples), set to 0x0 pixels and return
 	if( (data == nullptr) || data->empty() )
 	{
-		channel->PrepareToRasterize(0, 0);
+		channel->PrepareToRasterize(0, 0, false);
 		return;
 	}
 	size_t w = m_width;
 	size_t h = m_height;
 	if(channel->GetStream().GetType() == Stream::STREAM_TYPE_DIGITAL)
 		h = m_channelButtonHeight;
-	channel->PrepareToRasterize(w, h);
+	bool persist = channel->IsPersistenceEnabled() && !clearPersistence;
+	channel->PrepareToRasterize(w, h, persist);
 
 	shared_ptr<ComputePipeline> comp;
 
@@ -2122,24 +2470,22 @@ void WaveformArea::RasterizeAnalogOrDigitalWaveform(
 		if(channel->ShouldMapDurations())
 			comp->BindBufferNonblocking(4, sdata->m_durations, cmdbuf);
 
-		//Calculate indexes for X axis
-		auto& ibuf = channel->GetIndexBuffer();
-		ibuf.PrepareForCpuAccess();
-		sdata->m_offsets.PrepareForCpuAccess();
-		for(size_t i=0; i<w; i++)
-		{
-			int64_t target = floor(i / xscale) + offset_samples;
-			ibuf[i] = BinarySearchForGequal(
-				sdata->m_offsets.GetCpuPointer(),
-				data->size(),
-				target);
-		}
-		ibuf.MarkModifiedFromCpu();
-		comp->BindBufferNonblocking(3, ibuf, cmdbuf);
+		//Calculate indexes for X axis (reusing the previous render's if nothing moved)
+		channel->UpdateIndexBuffer(sdata, w, xscale, offset_samples, cmdbuf);
+		comp->BindBufferNonblocking(3, channel->GetIndexBuffer(), cmdbuf);
+	}
+
+	//Zoomed out analog waveforms are drawn from the min/max pyramid.
+	//Histograms and zero-hold waveforms don't draw line segments between samples, so they can't use it.
+	uint32_t pyramidLevels = 0;
+	if(uadata && !channel->ShouldFillUnder() && !channel->ZeroHoldFlagSet())
+	{
+		pyramidLevels = channel->UpdatePyramid(uadata, cmdbuf);
+		comp->BindBufferNonblocking(2, channel->GetPyramid(), cmdbuf);
 	}
 
 	//Bind output texture and bail if there's nothing there
-	auto& imgOut = channel->GetRasterizedWaveform();
+	auto& imgOut = channel->GetNextRasterizedWaveform();
 	if(imgOut.empty())
 		return;
 	comp->BindBufferNonblocking(0, imgOut, cmdbuf);
@@ -2148,15 +2494,20 @@ void WaveformArea::RasterizeAnalogOrDigitalWaveform(
 	//As we zoom out more, reduce alpha to get proper intensity grading
 	//TODO: make this constant, then apply a second alpha pass in tone mapping?
 	//This will eliminate the need for a (potentially heavy) re-render when adjusting the slider.
+	//Sparse waveforms do this in the shader since we may not have the offsets on the CPU.
 	float alpha = m_parent->GetTraceAlpha();
-	auto end = data->size() - 1;
-	int64_t firstOff = GetOffsetScaled(sdata, udata, 0);
-	int64_t lastOff = GetOffsetScaled(sdata, udata, end);
-	float capture_len = lastOff - firstOff;
-	float avg_sample_len = capture_len / data->size();
-	float samplesPerPixel = 1.0 / (pixelsPerX * avg_sample_len);
-	float alpha_scaled = alpha / sqrt(samplesPerPixel);
-	alpha_scaled = min(1.0f, alpha_scaled) * 2;
+	float alpha_scaled = alpha;
+	if(udata)
+	{
+		auto end = data->size() - 1;
+		int64_t firstOff = GetOffsetScaled(sdata, udata, 0);
+		int64_t lastOff = GetOffsetScaled(sdata, udata, end);
+		float capture_len = lastOff - firstOff;
+		float avg_sample_len = capture_len / data->size();
+		float samplesPerPixel = 1.0 / (pixelsPerX * avg_sample_len);
+		alpha_scaled = alpha / sqrt(samplesPerPixel);
+		alpha_scaled = min(1.0f, alpha_scaled) * 2;
+	}
 
 	//Trigger phase can't go entirely in ConfigPushConstants::xoff due to limited dynamic range
 	//so pass only the fractional part there and put the integer part in innerxoff
@@ -2186,10 +2537,11 @@ void WaveformArea::RasterizeAnalogOrDigitalWaveform(
 		config.yscale = m_channelButtonHeight - 1;
 		config.ybase = 0;
 	}
-	if(channel->IsPersistenceEnabled() && !clearPersistence)
+	if(persist)
 		config.persistScale = m_parent->GetPersistDecay();
 	else
 		config.persistScale = 0;
+	config.pyramidLevels = pyramidLevels;
 
 	//Dispatch the shader
 	comp->Dispatch(cmdbuf, config, w, 1, 1);
@@ -2198,7 +2550,7 @@ void WaveformArea::RasterizeAnalogOrDigitalWaveform(
 }
 
 /**
-	@brief Tone maps an analog or digital waveform by converting the internal fp32 buffer to RGBA
+	@brief Tone maps an analog or digital waveform by converting the internal fp32 or packed fp16 buffer to RGBA
  */
 void WaveformArea::ToneMapAnalogOrDigitalWaveform(shared_ptr<DisplayedChannel> channel, vk::raii::CommandBuffer& cmdbuf)
 {
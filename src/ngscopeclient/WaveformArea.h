@@ -129,6 +129,51 @@ public:
 	float m_yscale;
 };
 
+class SparseIndexBufferArgs
+{
+public:
+	SparseIndexBufferArgs(uint32_t depth, uint32_t w)
+	: m_memDepth(depth)
+	, m_width(w)
+	{}
+
+	uint32_t m_memDepth;
+	uint32_t m_width;
+};
+
+/**
+	@brief Min/max pyramid geometry (must match WaveformPyramid.glsl and waveform-compute.glsl)
+
+	Each level-0 block summarizes PYRAMID_BASE_BLOCK line segments, and each block of the next level up summarizes
+	PYRAMID_FANOUT blocks of the level below. A level is only built if a column could span PYRAMID_MIN_BLOCKS of its
+	blocks, since coarser levels would blur the intensity grading.
+ */
+#define PYRAMID_BASE_BLOCK 64
+#define PYRAMID_FANOUT 8
+#define PYRAMID_MIN_BLOCKS 16
+#define PYRAMID_MAX_LEVELS 8
+
+class WaveformPyramidArgs
+{
+public:
+	WaveformPyramidArgs(uint32_t nseg, uint32_t level, uint32_t srcOffset, uint32_t dstOffset, uint32_t nblocks,
+		uint32_t nsrc)
+	: m_numSegments(nseg)
+	, m_level(level)
+	, m_srcOffset(srcOffset)
+	, m_dstOffset(dstOffset)
+	, m_numBlocks(nblocks)
+	, m_numSrcBlocks(nsrc)
+	{}
+
+	uint32_t m_numSegments;
+	uint32_t m_level;
+	uint32_t m_srcOffset;
+	uint32_t m_dstOffset;
+	uint32_t m_numBlocks;
+	uint32_t m_numSrcBlocks;
+};
+
 struct ConfigPushConstants
 {
 	int64_t innerXoff;
@@ -143,6 +188,7 @@ struct ConfigPushConstants
 	float yscale;
 	float yoff;
 	float persistScale;
+	uint32_t pyramidLevels;
 };
 
 /**
@@ -183,6 +229,44 @@ struct PeakLabel
 	float m_fwhm;
 };
 
+/**
+	@brief Identifies one revision of a waveform, for invalidating data derived from it
+
+	The pointer is only compared against, never dereferenced. The start time is included to detect a new waveform
+	allocated at the same address as one we've since deleted.
+ */
+class WaveformCacheKey
+{
+public:
+	WaveformCacheKey(WaveformBase* wfm = nullptr)
+	: m_waveform(wfm)
+	, m_revision(wfm ? wfm->m_revision : 0)
+	, m_depth(wfm ? wfm->size() : 0)
+	, m_timestamp(wfm ? wfm->m_startTimestamp : 0)
+	, m_femtoseconds(wfm ? wfm->m_startFemtoseconds : 0)
+	{}
+
+	bool operator==(const WaveformCacheKey& rhs) const
+	{
+		return
+			(m_waveform == rhs.m_waveform) &&
+			(m_revision == rhs.m_revision) &&
+			(m_depth == rhs.m_depth) &&
+			(m_timestamp == rhs.m_timestamp) &&
+			(m_femtoseconds == rhs.m_femtoseconds);
+	}
+
+	bool operator!=(const WaveformCacheKey& rhs) const
+	{ return !(*this == rhs); }
+
+protected:
+	WaveformBase* m_waveform;
+	uint64_t m_revision;
+	size_t m_depth;
+	time_t m_timestamp;
+	int64_t m_femtoseconds;
+};
+
 /**
 	@brief Context data for a single channel being displayed within a WaveformArea
  */
@@ -204,15 +288,40 @@ public:
 	std::shared_ptr<Texture> GetTexture()
 	{ return m_texture; }
 
+	///@brief Gets the texture coordinates of the top left corner of the waveform (textures are stored bottom up)
+	ImVec2 GetTextureUV0()
+	{ return ImVec2(0, m_textureUV.y); }
+
+	///@brief Gets the texture coordinates of the bottom right corner of the waveform
+	ImVec2 GetTextureUV1()
+	{ return ImVec2(m_textureUV.x, 0); }
+
 	void SetTexture(std::shared_ptr<Texture> tex)
 	{ m_texture = tex; }
 
-	void PrepareToRasterize(size_t x, size_t y);
+	void PrepareToRasterize(size_t x, size_t y, bool persist);
+	void SwapRasterizedWaveforms();
+	bool UpdateIndexBuffer(
+		SparseWaveformBase* data,
+		size_t w,
+		double xscale,
+		int64_t offsetSamples,
+		vk::raii::CommandBuffer& cmdbuf);
+	uint32_t UpdatePyramid(UniformAnalogWaveform* data, vk::raii::CommandBuffer& cmdbuf);
+
+	///@brief Gets the min/max pyramid for the current waveform, see UpdatePyramid()
+	AcceleratorBuffer<float>& GetPyramid()
+	{ return m_pyramid; }
 
 	bool UpdateSize(ImVec2 newSize, MainWindow* top);
 
+	///@brief Gets the most recently completed rasterized waveform, for tone mapping
 	AcceleratorBuffer<float>& GetRasterizedWaveform()
-	{ return m_rasterizedWaveform; }
+	{ return *m_rasterizedWaveform; }
+
+	///@brief Gets the buffer the waveform is currently being rasterized into
+	AcceleratorBuffer<float>& GetNextRasterizedWaveform()
+	{ return *m_nextRasterizedWaveform; }
 
 	/**
 		@brief Return the X axis size of the rasterized waveform
@@ -236,12 +345,18 @@ public:
 		{
 			std::string base = "shaders/waveform-compute.";
 			std::string suffix;
+			int pyramidSSBOs = 1;
 			if(ZeroHoldFlagSet())
+			{
 				suffix += ".zerohold";
+				pyramidSSBOs = 0;
+			}
 			if(g_hasShaderInt64)
 				suffix += ".int64";
+			if(m_nextRasterizedFp16)
+				suffix += ".fp16";
 			m_uniformAnalogComputePipeline = std::make_shared<ComputePipeline>(
-				base + "analog" + suffix + ".dense.spv", 2, sizeof(ConfigPushConstants));
+				base + "analog" + suffix + ".dense.spv", pyramidSSBOs + 2, sizeof(ConfigPushConstants));
 		}
 
 		return m_uniformAnalogComputePipeline;
@@ -259,6 +374,8 @@ public:
 			std::string suffix;
 			if(g_hasShaderInt64)
 				suffix += ".int64";
+			if(m_nextRasterizedFp16)
+				suffix += ".fp16";
 			m_histogramComputePipeline = std::make_shared<ComputePipeline>(
 				base + "histogram" + suffix + ".dense.spv", 2, sizeof(ConfigPushConstants));
 		}
@@ -284,6 +401,8 @@ public:
 			}
 			if(g_hasShaderInt64)
 				suffix += ".int64";
+			if(m_nextRasterizedFp16)
+				suffix += ".fp16";
 			m_sparseAnalogComputePipeline = std::make_shared<ComputePipeline>(
 				base + "analog" + suffix + ".spv", durationSSBOs + 4, sizeof(ConfigPushConstants));
 		}
@@ -303,6 +422,8 @@ public:
 			std::string suffix;
 			if(g_hasShaderInt64)
 				suffix += ".int64";
+			if(m_nextRasterizedFp16)
+				suffix += ".fp16";
 			m_uniformDigitalComputePipeline = std::make_shared<ComputePipeline>(
 				base + "digital" + suffix + ".dense.spv", 2, sizeof(ConfigPushConstants));
 		}
@@ -323,6 +444,8 @@ public:
 			int durationSSBOs = 0;	//TODO: support gaps
 			if(g_hasShaderInt64)
 				suffix += ".int64";
+			if(m_nextRasterizedFp16)
+				suffix += ".fp16";
 			m_sparseDigitalComputePipeline = std::make_shared<ComputePipeline>(
 				base + "digital" + suffix + ".spv", durationSSBOs + 4, sizeof(ConfigPushConstants));
 		}
@@ -330,8 +453,7 @@ public:
 		return m_sparseDigitalComputePipeline;
 	}
 
-	std::shared_ptr<ComputePipeline> GetToneMapPipeline()
-	{ return m_toneMapPipe; }
+	std::shared_ptr<ComputePipeline> GetToneMapPipeline();
 
 	bool ZeroHoldFlagSet()
 	{
@@ -388,18 +510,45 @@ protected:
 	///@brief Parent session object
 	Session& m_session;
 
-	///@brief Buffer storing our rasterized waveform, prior to tone mapping
-	AcceleratorBuffer<float> m_rasterizedWaveform;
+	///@brief Buffer storing our most recently completed rasterized waveform, prior to tone mapping
+	std::unique_ptr<AcceleratorBuffer<float> > m_rasterizedWaveform;
+
+	///@brief Buffer the WaveformThread is rasterizing into, swapped with m_rasterizedWaveform when done
+	std::unique_ptr<AcceleratorBuffer<float> > m_nextRasterizedWaveform;
 
 	///@brief Buffer for X axis indexes (only used for sparse waveforms)
 	AcceleratorBuffer<uint32_t> m_indexBuffer;
 
+	///@brief Target sample offset for each column of m_indexBuffer, as of the last UpdateIndexBuffer() call
+	std::vector<int64_t> m_indexTargets;
+
+	///@brief Copy of m_indexTargets for the index shader
+	AcceleratorBuffer<int64_t> m_indexTargetBuffer;
+
+	///@brief Waveform m_indexBuffer was computed from
+	WaveformCacheKey m_indexKey;
+
+	///@brief Min/max/total variation pyramid for zoomed out rendering of uniform analog waveforms
+	AcceleratorBuffer<float> m_pyramid;
+
+	///@brief Waveform m_pyramid was computed from
+	WaveformCacheKey m_pyramidKey;
+
+	///@brief Number of levels in m_pyramid
+	uint32_t m_pyramidLevels;
+
 	///@brief X axis size of rasterized waveform
 	size_t m_rasterizedX;
 
 	///@brief Y axis size of rasterized waveform
 	size_t m_rasterizedY;
 
+	///@brief X axis size of m_nextRasterizedWaveform
+	size_t m_nextRasterizedX;
+
+	///@brief Y axis size of m_nextRasterizedWaveform
+	size_t m_nextRasterizedY;
+
 	///@brief The texture storing our final rendered waveform
 	std::shared_ptr<Texture> m_texture;
 
@@ -409,12 +558,30 @@ protected:
 	///@brief Y axis size of the texture as of last UpdateSize() call
 	size_t m_cachedY;
 
+	///@brief Fraction of m_texture (which may be larger than needed) actually used, in each axis
+	ImVec2 m_textureUV;
+
+	///@brief Pixel format of m_texture
+	vk::Format m_textureFormat;
+
 	///@brief Persistence enable flag
 	bool m_persistenceEnabled;
 
-	///@brief Compute pipeline for tone mapping fp32 images to RGBA
+	///@brief True if m_rasterizedWaveform holds packed fp16 pixel pairs rather than fp32 pixels
+	bool m_rasterizedFp16;
+
+	///@brief True if m_nextRasterizedWaveform holds packed fp16 pixel pairs rather than fp32 pixels
+	bool m_nextRasterizedFp16;
+
+	///@brief True if m_nextRasterizedWaveform is being drawn and should be swapped in once complete
+	bool m_nextRasterizedPending;
+
+	///@brief Compute pipeline for tone mapping eyes, waterfalls, etc. to RGBA (null for analog and digital waveforms)
 	std::shared_ptr<ComputePipeline> m_toneMapPipe;
 
+	///@brief Compute pipelines for tone mapping analog and digital waveforms, indexed by shader filename
+	std::map<std::string, std::shared_ptr<ComputePipeline> > m_waveformToneMapPipes;
+
 	///@brief Compute pipeline for rendering uniform analog waveforms
 	std::shared_ptr<ComputePipeline> m_uniformAnalogComputePipeline;
 
@@ -430,6 +597,12 @@ protected:
 	///@brief Compute pipeline for rendering sparse digital waveforms
 	std::shared_ptr<ComputePipeline> m_sparseDigitalComputePipeline;
 
+	///@brief Compute pipeline for building m_indexBuffer on the GPU
+	std::shared_ptr<ComputePipeline> m_indexComputePipeline;
+
+	///@brief Compute pipeline for building m_pyramid
+	std::shared_ptr<ComputePipeline> m_pyramidComputePipeline;
+
 	///@brief Y axis position of our button within the view
 	float m_yButtonPos;
 
@@ -454,7 +627,9 @@ public:
 		std::vector<std::shared_ptr<DisplayedChannel> >& channels,
 		bool clearPersistence);
 	void ReferenceWaveformTextures();
-	void ToneMapAllWaveforms(vk::raii::CommandBuffer& cmdbuf);
+	bool ToneMapAllWaveforms(
+		vk::raii::CommandBuffer& cmdbuf,
+		std::vector<std::shared_ptr<DisplayedChannel> >& channels);
 
 	size_t GetStreamCount()
 	{ return m_displayedChannels.size(); }
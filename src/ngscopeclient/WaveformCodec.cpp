@@ -0,0 +1,1019 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* ngscopeclient                                                                                                        *
+*                                                                                                                      *
+* Copyright (c) 2012-2025 Andrew D. Zonenberg and contributors                                                         *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+/**
+	@file
+	@author Andrew D. Zonenberg
+	@brief Implementation of WaveformCodec
+
+	Only depends on libscopehal (not the GUI) so it can be linked into unit tests.
+ */
+#include "../../lib/scopehal/scopehal.h"
+#include "WaveformCodec.h"
+
+#include <array>
+#include <cfloat>
+#include <cmath>
+
+#ifdef __x86_64__
+#include <immintrin.h>
+#endif
+
+using namespace std;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Format identification
+
+/**
+	@brief Checks if a format ID from the session metadata is one of the dense packed formats
+
+	@param format	Format ID ("sparsev1", "sparsev2", "densev1", or "densev2")
+ */
+bool WaveformCodec::IsDenseFormat(const string& format)
+{
+	return (format == "densev1") || (format == "densev2");
+}
+
+/**
+	@brief Gets the waveform object a stream should be reloaded into, after its samples were freed
+
+	Sparse analog streams which turned out to be dense packed are converted to uniform when loaded (see
+	Session::ConvertToUniformIfDense()), but the loader needs a sparse waveform to read a sparse file back into. For
+	those, a new empty sparse waveform with the same metadata is returned and the caller is responsible for deleting
+	the original. Anything else is returned as is.
+
+	@param wfm		The waveform being unloaded
+	@param dense	True if the stream was loaded from a dense format (see IsDenseFormat())
+ */
+WaveformBase* WaveformCodec::MakeReloadTarget(WaveformBase* wfm, bool dense)
+{
+	auto uacap = dynamic_cast<UniformAnalogWaveform*>(wfm);
+	if(dense || !uacap)
+		return wfm;
+
+	auto sacap = new SparseAnalogWaveform;
+	sacap->m_timescale = uacap->m_timescale;
+	sacap->m_startTimestamp = uacap->m_startTimestamp;
+	sacap->m_startFemtoseconds = uacap->m_startFemtoseconds;
+	sacap->m_triggerPhase = uacap->m_triggerPhase;
+	sacap->m_flags = uacap->m_flags;
+	return sacap;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// sparsev1
+
+/**
+	@brief Unpacks sparsev1 analog records into separate offset, duration, and sample arrays
+
+	@param buf			Interleaved records
+	@param nsamples		Number of records in buf
+	@param offsets		Output offsets (nsamples entries)
+	@param durations	Output durations (nsamples entries)
+	@param samples		Output samples (nsamples entries)
+ */
+void WaveformCodec::UnpackSparseV1Analog(
+	const uint8_t* buf,
+	size_t nsamples,
+	int64_t* offsets,
+	int64_t* durations,
+	float* samples)
+{
+	int64_t nchunks = (nsamples + m_chunkSize - 1) / m_chunkSize;
+
+	#pragma omp parallel for
+	for(int64_t i=0; i<nchunks; i++)
+	{
+		size_t start = i*m_chunkSize;
+		size_t end = min(start + m_chunkSize, nsamples);
+
+		#ifdef __x86_64__
+		if(g_hasAvx2)
+		{
+			UnpackAnalogAVX2(buf, start, end, offsets, durations, samples);
+			continue;
+		}
+		#endif
+
+		UnpackAnalog(buf, start, end, offsets, durations, samples);
+	}
+}
+
+/**
+	@brief Unpacks sparsev1 digital records into separate offset, duration, and sample arrays
+
+	@param buf			Interleaved records
+	@param nsamples		Number of records in buf
+	@param offsets		Output offsets (nsamples entries)
+	@param durations	Output durations (nsamples entries)
+	@param samples		Output samples (nsamples entries)
+ */
+void WaveformCodec::UnpackSparseV1Digital(
+	const uint8_t* buf,
+	size_t nsamples,
+	int64_t* offsets,
+	int64_t* durations,
+	bool* samples)
+{
+	int64_t nchunks = (nsamples + m_chunkSize - 1) / m_chunkSize;
+
+	#pragma omp parallel for
+	for(int64_t i=0; i<nchunks; i++)
+	{
+		size_t start = i*m_chunkSize;
+		size_t end = min(start + m_chunkSize, nsamples);
+
+		#ifdef __x86_64__
+		if(g_hasAvx2)
+		{
+			UnpackDigitalAVX2(buf, start, end, offsets, durations, samples);
+			continue;
+		}
+		#endif
+
+		UnpackDigital(buf, start, end, offsets, durations, samples);
+	}
+}
+
+/**
+	@brief Unpacks only the offsets and durations from sparsev1 records of any sample type
+
+	@param buf			Interleaved records
+	@param nsamples		Number of records in buf
+	@param recordSize	Size of each record, in bytes
+	@param offsets		Output offsets (nsamples entries)
+	@param durations	Output durations (nsamples entries)
+ */
+void WaveformCodec::UnpackSparseV1Timestamps(
+	const uint8_t* buf,
+	size_t nsamples,
+	size_t recordSize,
+	int64_t* offsets,
+	int64_t* durations)
+{
+	int64_t nchunks = (nsamples + m_chunkSize - 1) / m_chunkSize;
+
+	#pragma omp parallel for
+	for(int64_t i=0; i<nchunks; i++)
+	{
+		size_t start = i*m_chunkSize;
+		size_t end = min(start + m_chunkSize, nsamples);
+
+		#ifdef __x86_64__
+		if(g_hasAvx2)
+		{
+			UnpackTimestampsAVX2(buf, start, end, recordSize, offsets, durations);
+			continue;
+		}
+		#endif
+
+		UnpackTimestamps(buf, start, end, recordSize, offsets, durations);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// sparsev2
+
+/**
+	@brief Fills out a sparsev2 header, laying out the columns after it
+
+	@param nsamples		Number of samples
+	@param sampleSize	Size of each entry in the sample column
+	@param encoding		Encoding of the offset column
+	@param offsetBytes	Size of the encoded offset column
+ */
+WaveformCodec::SparseV2Header WaveformCodec::MakeSparseV2Header(
+	size_t nsamples,
+	size_t sampleSize,
+	OffsetEncoding encoding,
+	size_t offsetBytes)
+{
+	SparseV2Header hdr;
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.m_magic, "NGSPARS2", sizeof(hdr.m_magic));
+	hdr.m_headerSize = sizeof(hdr);
+	hdr.m_sampleSize = sampleSize;
+	hdr.m_offsetEncoding = encoding;
+	hdr.m_nsamples = nsamples;
+
+	hdr.m_columnSize[COLUMN_OFFSETS] = offsetBytes;
+	hdr.m_columnSize[COLUMN_DURATIONS] = nsamples * sizeof(int64_t);
+	hdr.m_columnSize[COLUMN_SAMPLES] = nsamples * sampleSize;
+
+	uint64_t pos = sizeof(hdr);
+	for(int i=0; i<COLUMN_COUNT; i++)
+	{
+		pos = (pos + SPARSEV2_ALIGN - 1) / SPARSEV2_ALIGN * SPARSEV2_ALIGN;
+		hdr.m_columnStart[i] = pos;
+		pos += hdr.m_columnSize[i];
+	}
+
+	return hdr;
+}
+
+/**
+	@brief Reads and sanity checks the header of a sparsev2 file
+
+	@param buf			File contents
+	@param len			Size of the file
+	@param sampleSize	Expected size of each entry in the sample column
+	@param hdr			Header (only valid if we returned true)
+
+	@return True if the header is valid and all columns are within the file
+ */
+bool WaveformCodec::ParseSparseV2Header(
+	const uint8_t* buf,
+	size_t len,
+	size_t sampleSize,
+	SparseV2Header& hdr)
+{
+	if(len < sizeof(hdr))
+		return false;
+	memcpy(&hdr, buf, sizeof(hdr));
+
+	if(memcmp(hdr.m_magic, "NGSPARS2", sizeof(hdr.m_magic)) != 0)
+		return false;
+	if( (hdr.m_headerSize < sizeof(hdr)) || (hdr.m_sampleSize != sampleSize) )
+		return false;
+
+	//Make sure fixed size columns are consistent with the sample count
+	if(hdr.m_nsamples > len)
+		return false;
+	if(hdr.m_columnSize[COLUMN_DURATIONS] != hdr.m_nsamples * sizeof(int64_t))
+		return false;
+	if(hdr.m_columnSize[COLUMN_SAMPLES] != hdr.m_nsamples * sampleSize)
+		return false;
+	if(hdr.m_offsetEncoding == OFFSETS_RAW)
+	{
+		if(hdr.m_columnSize[COLUMN_OFFSETS] != hdr.m_nsamples * sizeof(int64_t))
+			return false;
+	}
+	else if(hdr.m_offsetEncoding != OFFSETS_DELTA_VARINT)
+		return false;
+
+	//All columns must fit in the file
+	for(int i=0; i<COLUMN_COUNT; i++)
+	{
+		if( (hdr.m_columnStart[i] > len) || (hdr.m_columnSize[i] > len - hdr.m_columnStart[i]) )
+			return false;
+	}
+
+	return true;
+}
+
+/**
+	@brief Reads the offset and duration columns of a sparsev2 file
+
+	@param buf			File contents
+	@param hdr			Header, already checked by ParseSparseV2Header()
+	@param offsets		Output offsets (hdr.m_nsamples entries)
+	@param durations	Output durations (hdr.m_nsamples entries)
+
+	@return True on success, false if the offset column is corrupted
+ */
+bool WaveformCodec::UnpackSparseV2Timestamps(
+	const uint8_t* buf,
+	const SparseV2Header& hdr,
+	int64_t* offsets,
+	int64_t* durations)
+{
+	//Durations are always raw
+	memcpy(durations, buf + hdr.m_columnStart[COLUMN_DURATIONS], hdr.m_columnSize[COLUMN_DURATIONS]);
+
+	auto poff = buf + hdr.m_columnStart[COLUMN_OFFSETS];
+	if(hdr.m_offsetEncoding == OFFSETS_RAW)
+	{
+		memcpy(offsets, poff, hdr.m_columnSize[COLUMN_OFFSETS]);
+		return true;
+	}
+	return DecodeVarintDeltas(poff, hdr.m_columnSize[COLUMN_OFFSETS], hdr.m_nsamples, offsets);
+}
+
+/**
+	@brief Calculates the size of a delta-varint encoding of a monotonic array
+
+	@return Size in bytes, or SIZE_MAX if the values decrease anywhere and can't be delta encoded
+ */
+size_t WaveformCodec::GetVarintDeltaSize(const int64_t* values, size_t n)
+{
+	size_t bytes = 0;
+	int64_t prev = 0;
+	for(size_t i=0; i<n; i++)
+	{
+		if(values[i] < prev)
+			return SIZE_MAX;
+		uint64_t delta = values[i] - prev;
+		prev = values[i];
+
+		bytes ++;
+		while(delta >= 0x80)
+		{
+			delta >>= 7;
+			bytes ++;
+		}
+	}
+	return bytes;
+}
+
+/**
+	@brief Delta-varint encodes values [start, end) of a monotonic array
+
+	Each value is encoded relative to the one before it (or zero, for the first value in the array) so a long array
+	can be encoded in blocks.
+
+	@param values	Array to encode
+	@param start	First index to encode
+	@param end		One past the last index to encode
+	@param out		Output buffer, with room for at least (end - start) * MAX_VARINT_SIZE bytes
+
+	@return Number of bytes written
+ */
+size_t WaveformCodec::EncodeVarintDeltas(
+	const int64_t* values,
+	size_t start,
+	size_t end,
+	uint8_t* out)
+{
+	uint8_t* p = out;
+	int64_t prev = (start > 0) ? values[start-1] : 0;
+	for(size_t i=start; i<end; i++)
+	{
+		uint64_t delta = values[i] - prev;
+		prev = values[i];
+
+		while(delta >= 0x80)
+		{
+			*p++ = (delta & 0x7f) | 0x80;
+			delta >>= 7;
+		}
+		*p++ = delta;
+	}
+	return p - out;
+}
+
+/**
+	@brief Decodes a delta-varint encoded array
+
+	@param buf		Encoded data
+	@param len		Size of the encoded data
+	@param n		Number of values to decode
+	@param values	Output array
+
+	@return True on success, false if the data ran out or a value was malformed
+ */
+bool WaveformCodec::DecodeVarintDeltas(
+	const uint8_t* buf,
+	size_t len,
+	size_t n,
+	int64_t* values)
+{
+	const uint8_t* p = buf;
+	const uint8_t* end = buf + len;
+	int64_t prev = 0;
+	for(size_t i=0; i<n; i++)
+	{
+		uint64_t delta = 0;
+		for(int shift = 0; ; shift += 7)
+		{
+			if( (p >= end) || (shift >= 64) )
+				return false;
+
+			uint8_t b = *p++;
+			delta |= static_cast<uint64_t>(b & 0x7f) << shift;
+			if( (b & 0x80) == 0)
+				break;
+		}
+
+		prev += delta;
+		values[i] = prev;
+	}
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// densev2
+
+/**
+	@brief Creates the header for a densev2 file
+ */
+WaveformCodec::DenseV2Header WaveformCodec::MakeDenseV2Header(DenseV2SampleType type, size_t nsamples)
+{
+	DenseV2Header hdr;
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.m_magic, "NGDENSE2", sizeof(hdr.m_magic));
+	hdr.m_headerSize = sizeof(hdr);
+	hdr.m_sampleType = type;
+	hdr.m_nsamples = nsamples;
+	hdr.m_blockSize = DENSEV2_BLOCK_SIZE;
+	hdr.m_nblocks = (nsamples + DENSEV2_BLOCK_SIZE - 1) / DENSEV2_BLOCK_SIZE;
+	return hdr;
+}
+
+/**
+	@brief Checks if two floats are bitwise identical (unlike ==, distinguishes -0 from +0)
+ */
+static inline bool IsSameFloat(float a, float b)
+{
+	uint32_t ia;
+	uint32_t ib;
+	memcpy(&ia, &a, sizeof(ia));
+	memcpy(&ib, &b, sizeof(ib));
+	return ia == ib;
+}
+
+/**
+	@brief Encodes a block of analog samples for a densev2 file
+
+	Samples from an ADC only take on a small number of distinct, evenly spaced values. If the block fits on such a grid
+	with no more than 256 or 65536 steps, it's stored as 8 or 16 bit codes plus a palette giving the exact value of
+	each code. The grid spacing is estimated from the smallest nonzero difference between adjacent samples.
+
+	The palette is filled in from the data itself rather than calculated from the grid, since drivers differ in how
+	they round when converting codes to volts. Anything which doesn't map to a consistent code (NaN, data that isn't
+	really quantized, etc) is stored as an exception. If there are too many exceptions, or the data doesn't fit in 16
+	bits, the block is stored raw.
+
+	@param samples	Input samples
+	@param n		Number of samples (at most DENSEV2_BLOCK_SIZE)
+	@param out		Encoded block
+ */
+void WaveformCodec::EncodeDenseV2AnalogBlock(const float* samples, size_t n, vector<uint8_t>& out)
+{
+	DenseV2BlockHeader hdr;
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.m_encoding = BLOCK_RAW;
+
+	//Find the range of the data and the smallest step
+	float vmin = FLT_MAX;
+	float vmax = -FLT_MAX;
+	float dmin = FLT_MAX;
+	bool lastFinite = false;
+	for(size_t i=0; i<n; i++)
+	{
+		float v = samples[i];
+		bool finite = isfinite(v);
+		if(finite)
+		{
+			vmin = min(vmin, v);
+			vmax = max(vmax, v);
+			if(lastFinite)
+			{
+				float d = fabs(v - samples[i-1]);
+				if(d > 0)
+					dmin = min(dmin, d);
+			}
+		}
+		lastFinite = finite;
+	}
+
+	//Figure out how many codes we'd need
+	size_t codeSize = 0;
+	uint32_t span = 0;
+	double step = 0;
+	if(vmin == vmax)
+		codeSize = 1;
+	else if( (vmin < vmax) && (dmin < FLT_MAX) )
+	{
+		double fspan = round( (static_cast<double>(vmax) - vmin) / dmin);
+		if(fspan <= UINT16_MAX)
+		{
+			span = fspan;
+			codeSize = (span <= UINT8_MAX) ? 1 : 2;
+			step = (static_cast<double>(vmax) - vmin) / span;
+		}
+	}
+
+	//Quantize, building the palette as we go and keeping track of anything that doesn't fit
+	vector<DenseV2Exception> exceptions;
+	size_t maxExceptions = n / 16;
+	if(codeSize)
+	{
+		hdr.m_paletteSize = span + 1;
+		vector<float> palette(hdr.m_paletteSize, 0.0f);
+		vector<uint8_t> valid(hdr.m_paletteSize, 0);
+
+		size_t paletteBytes = hdr.m_paletteSize * sizeof(float);
+		out.resize(sizeof(hdr) + paletteBytes + n*codeSize);
+		auto pcodes = out.data() + sizeof(hdr) + paletteBytes;
+
+		double scale = (step > 0) ? (1.0 / step) : 0;
+		for(size_t i=0; i<n; i++)
+		{
+			float v = samples[i];
+			uint32_t code = 0;
+			bool ok = isfinite(v);
+			if(ok)
+			{
+				//Finite samples are never below vmin, so no need to clamp the low end
+				code = min(static_cast<uint32_t>( (v - vmin) * scale + 0.5), span);
+
+				if(!valid[code])
+				{
+					palette[code] = v;
+					valid[code] = 1;
+				}
+				else
+					ok = IsSameFloat(palette[code], v);
+			}
+
+			if(!ok)
+			{
+				exceptions.push_back({static_cast<uint32_t>(i), v});
+				if(exceptions.size() > maxExceptions)
+					break;
+			}
+
+			if(codeSize == 1)
+				pcodes[i] = code;
+			else
+			{
+				uint16_t code16 = code;
+				memcpy(pcodes + i*2, &code16, sizeof(code16));
+			}
+		}
+
+		if(exceptions.size() <= maxExceptions)
+		{
+			hdr.m_encoding = (codeSize == 1) ? BLOCK_INT8 : BLOCK_INT16;
+			memcpy(out.data() + sizeof(hdr), palette.data(), paletteBytes);
+		}
+	}
+
+	if(hdr.m_encoding == BLOCK_RAW)
+	{
+		hdr.m_paletteSize = 0;
+		out.resize(sizeof(hdr) + n*sizeof(float));
+		memcpy(out.data() + sizeof(hdr), samples, n*sizeof(float));
+	}
+	else
+	{
+		hdr.m_exceptionCount = exceptions.size();
+		size_t end = out.size();
+		out.resize(end + exceptions.size()*sizeof(DenseV2Exception));
+		if(!exceptions.empty())
+			memcpy(out.data() + end, exceptions.data(), exceptions.size()*sizeof(DenseV2Exception));
+	}
+
+	memcpy(out.data(), &hdr, sizeof(hdr));
+}
+
+/**
+	@brief Encodes a block of digital samples for a densev2 file
+
+	@param samples	Input samples
+	@param n		Number of samples (at most DENSEV2_BLOCK_SIZE)
+	@param out		Encoded block
+ */
+void WaveformCodec::EncodeDenseV2DigitalBlock(const bool* samples, size_t n, vector<uint8_t>& out)
+{
+	DenseV2BlockHeader hdr;
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.m_encoding = BLOCK_BITPACKED;
+
+	out.resize(sizeof(hdr) + (n+7)/8);
+	memcpy(out.data(), &hdr, sizeof(hdr));
+
+	auto pbits = out.data() + sizeof(hdr);
+	size_t nfull = n / 8;
+	for(size_t i=0; i<nfull; i++)
+	{
+		auto p = samples + i*8;
+		pbits[i] =
+			(p[0] << 0) | (p[1] << 1) | (p[2] << 2) | (p[3] << 3) |
+			(p[4] << 4) | (p[5] << 5) | (p[6] << 6) | (p[7] << 7);
+	}
+	if(nfull*8 < n)
+	{
+		uint8_t last = 0;
+		for(size_t i=nfull*8; i<n; i++)
+			last |= samples[i] << (i & 7);
+		pbits[nfull] = last;
+	}
+}
+
+/**
+	@brief Reads and validates the header and block table of a densev2 file
+
+	@param buf		File contents
+	@param len		Size of the file
+	@param type		Expected sample type
+	@param hdr		Parsed header
+
+	@return True if the header is valid and all blocks lie within the file
+ */
+bool WaveformCodec::ParseDenseV2Header(
+	const uint8_t* buf,
+	size_t len,
+	DenseV2SampleType type,
+	DenseV2Header& hdr)
+{
+	if(len < sizeof(hdr))
+		return false;
+	memcpy(&hdr, buf, sizeof(hdr));
+
+	if(memcmp(hdr.m_magic, "NGDENSE2", sizeof(hdr.m_magic)) != 0)
+		return false;
+	if( (hdr.m_headerSize < sizeof(hdr)) || (hdr.m_headerSize > len) || (hdr.m_sampleType != type) )
+		return false;
+
+	//Block table must be consistent with the sample count and fit in the file
+	if( (hdr.m_blockSize == 0) || (hdr.m_blockSize > UINT32_MAX) )
+		return false;
+	if(hdr.m_nblocks != (hdr.m_nsamples + hdr.m_blockSize - 1) / hdr.m_blockSize)
+		return false;
+	if(hdr.m_nblocks >= (len - hdr.m_headerSize) / sizeof(uint64_t))
+		return false;
+
+	//Blocks must be in order, after the table, and within the file
+	uint64_t prev = hdr.m_headerSize + DenseV2IndexSize(hdr.m_nblocks);
+	for(size_t i=0; i<=hdr.m_nblocks; i++)
+	{
+		uint64_t pos;
+		memcpy(&pos, buf + hdr.m_headerSize + i*sizeof(uint64_t), sizeof(pos));
+		if( (pos < prev) || (pos > len) )
+			return false;
+		prev = pos;
+	}
+
+	return true;
+}
+
+/**
+	@brief Decodes the analog samples in a densev2 file
+
+	@param buf		File contents
+	@param hdr		Header, already checked by ParseDenseV2Header()
+	@param samples	Output samples (hdr.m_nsamples entries)
+
+	@return True on success, false if a block is corrupted
+ */
+bool WaveformCodec::DecodeDenseV2Analog(const uint8_t* buf, const DenseV2Header& hdr, float* samples)
+{
+	auto index = buf + hdr.m_headerSize;
+	int64_t nblocks = hdr.m_nblocks;
+	int64_t failures = 0;
+
+	#pragma omp parallel for reduction(+:failures)
+	for(int64_t i=0; i<nblocks; i++)
+	{
+		uint64_t pos[2];
+		memcpy(pos, index + i*sizeof(uint64_t), sizeof(pos));
+
+		size_t start = i*hdr.m_blockSize;
+		size_t n = min(static_cast<size_t>(hdr.m_blockSize), static_cast<size_t>(hdr.m_nsamples - start));
+		if(!DecodeAnalogBlock(buf + pos[0], pos[1] - pos[0], n, samples + start))
+			failures ++;
+	}
+
+	return failures == 0;
+}
+
+/**
+	@brief Decodes the digital samples in a densev2 file
+
+	@param buf		File contents
+	@param hdr		Header, already checked by ParseDenseV2Header()
+	@param samples	Output samples (hdr.m_nsamples entries)
+
+	@return True on success, false if a block is corrupted
+ */
+bool WaveformCodec::DecodeDenseV2Digital(const uint8_t* buf, const DenseV2Header& hdr, bool* samples)
+{
+	auto index = buf + hdr.m_headerSize;
+	int64_t nblocks = hdr.m_nblocks;
+	int64_t failures = 0;
+
+	#pragma omp parallel for reduction(+:failures)
+	for(int64_t i=0; i<nblocks; i++)
+	{
+		uint64_t pos[2];
+		memcpy(pos, index + i*sizeof(uint64_t), sizeof(pos));
+
+		size_t start = i*hdr.m_blockSize;
+		size_t n = min(static_cast<size_t>(hdr.m_blockSize), static_cast<size_t>(hdr.m_nsamples - start));
+		if(!DecodeDigitalBlock(buf + pos[0], pos[1] - pos[0], n, samples + start))
+			failures ++;
+	}
+
+	return failures == 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Kernels
+
+/*
+	All of these are memory bound, so each one makes a single pass over its input records.
+ */
+
+/**
+	@brief Unpacks offsets and durations for records [start, end)
+ */
+void WaveformCodec::UnpackTimestamps(
+	const uint8_t* buf,
+	size_t start,
+	size_t end,
+	size_t recordSize,
+	int64_t* offsets,
+	int64_t* durations)
+{
+	for(size_t i=start; i<end; i++)
+	{
+		const uint8_t* p = buf + i*recordSize;
+		memcpy(offsets + i, p, sizeof(int64_t));
+		memcpy(durations + i, p + sizeof(int64_t), sizeof(int64_t));
+	}
+}
+
+/**
+	@brief Unpacks sparsev1 analog records [start, end)
+ */
+void WaveformCodec::UnpackAnalog(
+	const uint8_t* buf,
+	size_t start,
+	size_t end,
+	int64_t* offsets,
+	int64_t* durations,
+	float* samples)
+{
+	//The file format assumes "float" is IEEE754 32-bit float.
+	//If your platform doesn't do that, good luck.
+	const size_t recordSize = SparseV1RecordSize(sizeof(float));
+	for(size_t i=start; i<end; i++)
+	{
+		const uint8_t* p = buf + i*recordSize;
+		memcpy(offsets + i, p, sizeof(int64_t));
+		memcpy(durations + i, p + sizeof(int64_t), sizeof(int64_t));
+		memcpy(samples + i, p + 2*sizeof(int64_t), sizeof(float));
+	}
+}
+
+/**
+	@brief Unpacks sparsev1 digital records [start, end)
+ */
+void WaveformCodec::UnpackDigital(
+	const uint8_t* buf,
+	size_t start,
+	size_t end,
+	int64_t* offsets,
+	int64_t* durations,
+	bool* samples)
+{
+	const size_t recordSize = SparseV1RecordSize(sizeof(bool));
+	for(size_t i=start; i<end; i++)
+	{
+		const uint8_t* p = buf + i*recordSize;
+		memcpy(offsets + i, p, sizeof(int64_t));
+		memcpy(durations + i, p + sizeof(int64_t), sizeof(int64_t));
+		samples[i] = (p[2*sizeof(int64_t)] != 0);
+	}
+}
+
+/**
+	@brief Decodes a single analog block of a densev2 file
+
+	@param buf		Start of the block
+	@param len		Size of the block
+	@param n		Number of samples in the block
+	@param samples	Output samples
+ */
+bool WaveformCodec::DecodeAnalogBlock(const uint8_t* buf, size_t len, size_t n, float* samples)
+{
+	DenseV2BlockHeader hdr;
+	if(len < sizeof(hdr))
+		return false;
+	memcpy(&hdr, buf, sizeof(hdr));
+	auto payload = buf + sizeof(hdr);
+	len -= sizeof(hdr);
+
+	size_t codeSize;
+	switch(hdr.m_encoding)
+	{
+		case BLOCK_RAW:
+			if(len != n*sizeof(float))
+				return false;
+			memcpy(samples, payload, len);
+			return true;
+
+		case BLOCK_INT8:
+			codeSize = 1;
+			break;
+
+		case BLOCK_INT16:
+			codeSize = 2;
+			break;
+
+		default:
+			return false;
+	}
+
+	if(hdr.m_paletteSize > (1U << (codeSize*8)) )
+		return false;
+	size_t paletteBytes = hdr.m_paletteSize * sizeof(float);
+	if(len != paletteBytes + n*codeSize + hdr.m_exceptionCount*sizeof(DenseV2Exception))
+		return false;
+
+	//Pad the palette out to the full code range, so corrupted codes can't index past the end
+	vector<float> palette(1 << (codeSize*8), 0.0f);
+	memcpy(palette.data(), payload, paletteBytes);
+	payload += paletteBytes;
+
+	if(codeSize == 1)
+	{
+		for(size_t i=0; i<n; i++)
+			samples[i] = palette[payload[i]];
+	}
+	else
+	{
+		for(size_t i=0; i<n; i++)
+		{
+			uint16_t code;
+			memcpy(&code, payload + i*2, sizeof(code));
+			samples[i] = palette[code];
+		}
+	}
+
+	//Patch up anything that wasn't in the palette
+	auto pexc = payload + n*codeSize;
+	for(size_t i=0; i<hdr.m_exceptionCount; i++)
+	{
+		DenseV2Exception e;
+		memcpy(&e, pexc + i*sizeof(e), sizeof(e));
+		if(e.m_index >= n)
+			return false;
+		samples[e.m_index] = e.m_value;
+	}
+
+	return true;
+}
+
+/**
+	@brief Decodes a single digital block of a densev2 file
+
+	@param buf		Start of the block
+	@param len		Size of the block
+	@param n		Number of samples in the block
+	@param samples	Output samples
+ */
+bool WaveformCodec::DecodeDigitalBlock(const uint8_t* buf, size_t len, size_t n, bool* samples)
+{
+	DenseV2BlockHeader hdr;
+	if(len < sizeof(hdr))
+		return false;
+	memcpy(&hdr, buf, sizeof(hdr));
+	if( (hdr.m_encoding != BLOCK_BITPACKED) || (len - sizeof(hdr) != (n+7)/8) )
+		return false;
+
+	//Expand a byte at a time, using a table of the eight bools for each possible byte
+	static const auto expand = []
+	{
+		array<uint64_t, 256> table;
+		for(size_t i=0; i<256; i++)
+		{
+			uint8_t bools[8];
+			for(size_t j=0; j<8; j++)
+				bools[j] = (i >> j) & 1;
+			memcpy(&table[i], bools, sizeof(bools));
+		}
+		return table;
+	}();
+
+	auto pbits = buf + sizeof(hdr);
+	size_t nfull = n / 8;
+	for(size_t i=0; i<nfull; i++)
+		memcpy(samples + i*8, &expand[pbits[i]], 8);
+	for(size_t i=nfull*8; i<n; i++)
+		samples[i] = (pbits[i >> 3] >> (i & 7)) & 1;
+	return true;
+}
+
+#ifdef __x86_64__
+
+/**
+	@brief AVX2 version of UnpackTimestamps()
+
+	Gathers four records per instruction, since the records aren't a power of two in size.
+ */
+__attribute__((target("avx2")))
+void WaveformCodec::UnpackTimestampsAVX2(
+	const uint8_t* buf,
+	size_t start,
+	size_t end,
+	size_t recordSize,
+	int64_t* offsets,
+	int64_t* durations)
+{
+	int rs = recordSize;
+	__m128i idx = _mm_setr_epi32(0, rs, 2*rs, 3*rs);
+
+	size_t count = end - start;
+	size_t vend = start + count - (count % 4);
+	for(size_t i=start; i<vend; i += 4)
+	{
+		auto p = reinterpret_cast<const long long*>(buf + i*recordSize);
+		auto q = reinterpret_cast<const long long*>(buf + i*recordSize + sizeof(int64_t));
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(offsets + i), _mm256_i32gather_epi64(p, idx, 1));
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(durations + i), _mm256_i32gather_epi64(q, idx, 1));
+	}
+
+	UnpackTimestamps(buf, vend, end, recordSize, offsets, durations);
+}
+
+/**
+	@brief AVX2 version of UnpackAnalog()
+
+	Handles eight records per iteration: four at a time for the 64-bit fields, all eight at once for the samples.
+ */
+__attribute__((target("avx2")))
+void WaveformCodec::UnpackAnalogAVX2(
+	const uint8_t* buf,
+	size_t start,
+	size_t end,
+	int64_t* offsets,
+	int64_t* durations,
+	float* samples)
+{
+	const int rs = SparseV1RecordSize(sizeof(float));
+	__m128i idx4 = _mm_setr_epi32(0, rs, 2*rs, 3*rs);
+	__m256i idx8 = _mm256_setr_epi32(0, rs, 2*rs, 3*rs, 4*rs, 5*rs, 6*rs, 7*rs);
+
+	size_t count = end - start;
+	size_t vend = start + count - (count % 8);
+	for(size_t i=start; i<vend; i += 8)
+	{
+		const uint8_t* p = buf + i*rs;
+		auto off0 = reinterpret_cast<const long long*>(p);
+		auto off1 = reinterpret_cast<const long long*>(p + 4*rs);
+		auto dur0 = reinterpret_cast<const long long*>(p + sizeof(int64_t));
+		auto dur1 = reinterpret_cast<const long long*>(p + 4*rs + sizeof(int64_t));
+		auto smp = reinterpret_cast<const float*>(p + 2*sizeof(int64_t));
+
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(offsets + i), _mm256_i32gather_epi64(off0, idx4, 1));
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(offsets + i + 4), _mm256_i32gather_epi64(off1, idx4, 1));
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(durations + i), _mm256_i32gather_epi64(dur0, idx4, 1));
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(durations + i + 4), _mm256_i32gather_epi64(dur1, idx4, 1));
+		_mm256_storeu_ps(samples + i, _mm256_i32gather_ps(smp, idx8, 1));
+	}
+
+	UnpackAnalog(buf, vend, end, offsets, durations, samples);
+}
+
+/**
+	@brief AVX2 version of UnpackDigital()
+ */
+__attribute__((target("avx2")))
+void WaveformCodec::UnpackDigitalAVX2(
+	const uint8_t* buf,
+	size_t start,
+	size_t end,
+	int64_t* offsets,
+	int64_t* durations,
+	bool* samples)
+{
+	const int rs = SparseV1RecordSize(sizeof(bool));
+	__m128i idx = _mm_setr_epi32(0, rs, 2*rs, 3*rs);
+
+	size_t count = end - start;
+	size_t vend = start + count - (count % 4);
+	for(size_t i=start; i<vend; i += 4)
+	{
+		const uint8_t* p = buf + i*rs;
+		auto off = reinterpret_cast<const long long*>(p);
+		auto dur = reinterpret_cast<const long long*>(p + sizeof(int64_t));
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(offsets + i), _mm256_i32gather_epi64(off, idx, 1));
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(durations + i), _mm256_i32gather_epi64(dur, idx, 1));
+
+		//One byte per sample, not worth vectorizing
+		for(size_t j=0; j<4; j++)
+			samples[i+j] = (p[j*rs + 2*sizeof(int64_t)] != 0);
+	}
+
+	UnpackDigital(buf, vend, end, offsets, durations, samples);
+}
+
+#endif
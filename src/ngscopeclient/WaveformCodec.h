@@ -0,0 +1,355 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* ngscopeclient                                                                                                        *
+*                                                                                                                      *
+* Copyright (c) 2012-2025 Andrew D. Zonenberg and contributors                                                         *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+/**
+	@file
+	@author Andrew D. Zonenberg
+	@brief Declaration of WaveformCodec
+ */
+#ifndef WaveformCodec_h
+#define WaveformCodec_h
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class WaveformBase;
+
+/**
+	@brief Conversion between in-memory waveforms and the sample data formats used in .scopesession data directories
+
+	Everything here works on raw arrays (not waveform objects, apart from MakeReloadTarget()) and only depends on
+	libscopehal, so it can be linked into unit tests and benchmarks.
+ */
+class WaveformCodec
+{
+public:
+
+	static bool IsDenseFormat(const std::string& format);
+	static WaveformBase* MakeReloadTarget(WaveformBase* wfm, bool dense);
+
+	/**
+		@brief Size of a sparsev1 record: int64 offset, int64 duration, then the sample
+	 */
+	static constexpr size_t SparseV1RecordSize(size_t sampleSize)
+	{ return 2*sizeof(int64_t) + sampleSize; }
+
+	static void UnpackSparseV1Analog(
+		const uint8_t* buf,
+		size_t nsamples,
+		int64_t* offsets,
+		int64_t* durations,
+		float* samples);
+
+	static void UnpackSparseV1Digital(
+		const uint8_t* buf,
+		size_t nsamples,
+		int64_t* offsets,
+		int64_t* durations,
+		bool* samples);
+
+	static void UnpackSparseV1Timestamps(
+		const uint8_t* buf,
+		size_t nsamples,
+		size_t recordSize,
+		int64_t* offsets,
+		int64_t* durations);
+
+	/**
+		@brief Columns in a sparsev2 file, in the order they appear
+	 */
+	enum SparseV2Column
+	{
+		COLUMN_OFFSETS,
+		COLUMN_DURATIONS,
+		COLUMN_SAMPLES,
+
+		COLUMN_COUNT
+	};
+
+	/**
+		@brief Encodings for the offset column of a sparsev2 file
+	 */
+	enum OffsetEncoding
+	{
+		///@brief Raw int64 values
+		OFFSETS_RAW,
+
+		///@brief LEB128 varint of the difference from the previous offset (the first is relative to zero)
+		OFFSETS_DELTA_VARINT
+	};
+
+	/**
+		@brief Header at the start of a sparsev2 file
+
+		All fields are little endian. Each column starts at a multiple of SPARSEV2_ALIGN bytes from the start of the
+		file, so it can be used in place from a memory mapped file.
+	 */
+	class SparseV2Header
+	{
+	public:
+		///@brief Always "NGSPARS2"
+		char m_magic[8];
+
+		///@brief Size of this header, for forward compatibility
+		uint32_t m_headerSize;
+
+		///@brief Size of each entry in the sample column
+		uint32_t m_sampleSize;
+
+		///@brief Encoding of the offset column (OffsetEncoding)
+		uint32_t m_offsetEncoding;
+
+		///@brief Reserved, always zero
+		uint32_t m_reserved;
+
+		///@brief Number of samples
+		uint64_t m_nsamples;
+
+		///@brief Position of each column from the start of the file
+		uint64_t m_columnStart[COLUMN_COUNT];
+
+		///@brief Size of each column, in bytes
+		uint64_t m_columnSize[COLUMN_COUNT];
+	};
+
+	///@brief Alignment of columns in sparsev2 files
+	static const size_t SPARSEV2_ALIGN = 4096;
+
+	static SparseV2Header MakeSparseV2Header(
+		size_t nsamples,
+		size_t sampleSize,
+		OffsetEncoding encoding,
+		size_t offsetBytes);
+
+	static bool ParseSparseV2Header(
+		const uint8_t* buf,
+		size_t len,
+		size_t sampleSize,
+		SparseV2Header& hdr);
+
+	static bool UnpackSparseV2Timestamps(
+		const uint8_t* buf,
+		const SparseV2Header& hdr,
+		int64_t* offsets,
+		int64_t* durations);
+
+	static size_t GetVarintDeltaSize(const int64_t* values, size_t n);
+
+	static size_t EncodeVarintDeltas(
+		const int64_t* values,
+		size_t start,
+		size_t end,
+		uint8_t* out);
+
+	static bool DecodeVarintDeltas(
+		const uint8_t* buf,
+		size_t len,
+		size_t n,
+		int64_t* values);
+
+	///@brief Maximum size of a single varint encoded value
+	static const size_t MAX_VARINT_SIZE = 10;
+
+	/**
+		@brief Sample types in a densev2 file
+	 */
+	enum DenseV2SampleType
+	{
+		DENSEV2_ANALOG,
+		DENSEV2_DIGITAL
+	};
+
+	/**
+		@brief Encodings for a block of a densev2 file
+	 */
+	enum DenseV2Encoding
+	{
+		///@brief Raw fp32 samples
+		BLOCK_RAW,
+
+		///@brief uint8 ADC codes, sample = palette[code]
+		BLOCK_INT8,
+
+		///@brief uint16 ADC codes, sample = palette[code]
+		BLOCK_INT16,
+
+		///@brief One bit per sample, LSB first
+		BLOCK_BITPACKED
+	};
+
+	/**
+		@brief Header at the start of a densev2 file
+
+		All fields are little endian. The header is followed by a table of m_nblocks+1 uint64 block positions (from
+		the start of the file, the last entry being the end of the final block), then the blocks themselves.
+
+		Every block holds m_blockSize samples (except possibly the last) and is encoded independently, so blocks can
+		be encoded and decoded in parallel.
+	 */
+	class DenseV2Header
+	{
+	public:
+		///@brief Always "NGDENSE2"
+		char m_magic[8];
+
+		///@brief Size of this header, for forward compatibility
+		uint32_t m_headerSize;
+
+		///@brief Type of samples in the file (DenseV2SampleType)
+		uint32_t m_sampleType;
+
+		///@brief Number of samples
+		uint64_t m_nsamples;
+
+		///@brief Number of samples in each block
+		uint64_t m_blockSize;
+
+		///@brief Number of blocks
+		uint64_t m_nblocks;
+	};
+
+	/**
+		@brief Header at the start of each densev2 block
+
+		For integer encodings, the header is followed by a palette of m_paletteSize fp32 values (the voltage for each
+		ADC code, as computed by the driver), then the codes, then m_exceptionCount DenseV2Exception entries for
+		samples which aren't in the palette (NaNs, clipping markers, etc). Looking up each code then applying the
+		exceptions gives back the original samples bit for bit.
+	 */
+	class DenseV2BlockHeader
+	{
+	public:
+		///@brief Encoding of the block (DenseV2Encoding)
+		uint32_t m_encoding;
+
+		///@brief Number of exceptions after the codes
+		uint32_t m_exceptionCount;
+
+		///@brief Number of entries in the palette
+		uint32_t m_paletteSize;
+
+		///@brief Reserved, always zero
+		uint32_t m_reserved;
+	};
+
+	/**
+		@brief A sample stored verbatim in an integer encoded densev2 block
+	 */
+	class DenseV2Exception
+	{
+	public:
+		///@brief Index of the sample within the block
+		uint32_t m_index;
+
+		///@brief Value of the sample
+		float m_value;
+	};
+
+	///@brief Number of samples in each densev2 block
+	static const size_t DENSEV2_BLOCK_SIZE = 1024 * 1024;
+
+	///@brief Gets the size of the block table in a densev2 file
+	static constexpr size_t DenseV2IndexSize(size_t nblocks)
+	{ return (nblocks + 1) * sizeof(uint64_t); }
+
+	static DenseV2Header MakeDenseV2Header(DenseV2SampleType type, size_t nsamples);
+
+	static void EncodeDenseV2AnalogBlock(const float* samples, size_t n, std::vector<uint8_t>& out);
+	static void EncodeDenseV2DigitalBlock(const bool* samples, size_t n, std::vector<uint8_t>& out);
+
+	static bool ParseDenseV2Header(
+		const uint8_t* buf,
+		size_t len,
+		DenseV2SampleType type,
+		DenseV2Header& hdr);
+
+	static bool DecodeDenseV2Analog(const uint8_t* buf, const DenseV2Header& hdr, float* samples);
+	static bool DecodeDenseV2Digital(const uint8_t* buf, const DenseV2Header& hdr, bool* samples);
+
+protected:
+	static bool DecodeAnalogBlock(const uint8_t* buf, size_t len, size_t n, float* samples);
+	static bool DecodeDigitalBlock(const uint8_t* buf, size_t len, size_t n, bool* samples);
+
+	static void UnpackTimestamps(
+		const uint8_t* buf,
+		size_t start,
+		size_t end,
+		size_t recordSize,
+		int64_t* offsets,
+		int64_t* durations);
+
+	static void UnpackAnalog(
+		const uint8_t* buf,
+		size_t start,
+		size_t end,
+		int64_t* offsets,
+		int64_t* durations,
+		float* samples);
+
+	static void UnpackDigital(
+		const uint8_t* buf,
+		size_t start,
+		size_t end,
+		int64_t* offsets,
+		int64_t* durations,
+		bool* samples);
+
+#ifdef __x86_64__
+	static void UnpackTimestampsAVX2(
+		const uint8_t* buf,
+		size_t start,
+		size_t end,
+		size_t recordSize,
+		int64_t* offsets,
+		int64_t* durations);
+
+	static void UnpackAnalogAVX2(
+		const uint8_t* buf,
+		size_t start,
+		size_t end,
+		int64_t* offsets,
+		int64_t* durations,
+		float* samples);
+
+	static void UnpackDigitalAVX2(
+		const uint8_t* buf,
+		size_t start,
+		size_t end,
+		int64_t* offsets,
+		int64_t* durations,
+		bool* samples);
+#endif
+
+	///@brief Number of samples unpacked by each thread at a time
+	static const size_t m_chunkSize = 1024 * 1024;
+};
+
+#endif
@@ -109,13 +109,25 @@ void WaveformGroup::AddArea(shared_ptr<WaveformArea>& area)
 	@brief Run the tone-mapping shader on all of our waveforms
 
 	Called by MainWindow::ToneMapAllWaveforms() at the start of each frame if new data is ready to render
+
+	@param cmdbuf		Command buffer to record tone mapping commands into
+	@param channels		Channels we tone mapped are appended to this, to keep them alive until the GPU is done
+
+	@return True if any of the shaders read waveform data directly (see WaveformArea::ToneMapAllWaveforms())
  */
-void WaveformGroup::ToneMapAllWaveforms(vk::raii::CommandBuffer& cmdbuf)
+bool WaveformGroup::ToneMapAllWaveforms(
+	vk::raii::CommandBuffer& cmdbuf,
+	vector<shared_ptr<DisplayedChannel> >& channels)
 {
 	auto areas = GetWaveformAreas();
 
+	bool readsWaveformData = false;
 	for(auto a : areas)
-		a->ToneMapAllWaveforms(cmdbuf);
+	{
+		if(a->ToneMapAllWaveforms(cmdbuf, channels))
+			readsWaveformData = true;
+	}
+	return readsWaveformData;
 }
 
 void WaveformGroup::ReferenceWaveformTextures()
@@ -609,7 +621,7 @@ void WaveformGroup::RenderMarkers(ImVec2 pos, ImVec2 size)
 			auto name = m_dragMarker->m_name;
 
 			m_dragMarker->m_offset = newpos;
-			m_parent->GetSession().OnMarkerChanged();
+			m_parent->GetSession().OnMarkerChanged(wavetime);
 
 			//Find the marker again
 			//This is needed because OnMarkerChanged() sorts the list of markers
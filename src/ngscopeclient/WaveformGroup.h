@@ -49,7 +49,9 @@ public:
 	void Clear();
 
 	bool Render();
-	void ToneMapAllWaveforms(vk::raii::CommandBuffer& cmdbuf);
+	bool ToneMapAllWaveforms(
+		vk::raii::CommandBuffer& cmdbuf,
+		std::vector<std::shared_ptr<DisplayedChannel> >& channels);
 	void ReferenceWaveformTextures();
 
 	void RenderWaveformTextures(
@@ -0,0 +1,161 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* ngscopeclient                                                                                                        *
+*                                                                                                                      *
+* Copyright (c) 2012-2025 Andrew D. Zonenberg and contributors                                                         *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+/**
+	@file
+	@author Andrew D. Zonenberg
+	@brief Implementation of WaveformLoadJob
+ */
+#include "ngscopeclient.h"
+#include "pthread_compat.h"
+#include "Session.h"
+#include "WaveformLoadJob.h"
+
+#include <omp.h>
+
+using namespace std;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Construction / destruction
+
+WaveformLoadJob::WaveformLoadJob()
+	: m_nextRequest(0)
+	, m_inflightBytes(0)
+	, m_maxInflightBytes(0)
+	, m_ompThreadsPerWorker(1)
+	, m_failed(false)
+{
+}
+
+WaveformLoadJob::~WaveformLoadJob()
+{
+	Wait();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Job control
+
+/**
+	@brief Adds a stream to the job
+
+	Must not be called after Start().
+
+	@param wfm		The waveform to load into (metadata must already be filled out)
+	@param format	Format of the file
+	@param path		Path to the input file
+	@param fileSize	Size of the input file, in bytes
+
+	@return Index of the request, for use with GetWaveform()
+ */
+size_t WaveformLoadJob::Add(WaveformBase* wfm, const string& format, const string& path, size_t fileSize)
+{
+	m_requests.push_back(Request(wfm, format, path, fileSize));
+	return m_requests.size() - 1;
+}
+
+/**
+	@brief Launches the worker threads
+
+	@param maxInflightBytes	Maximum total size of files being decoded at once. A single file larger than this is
+							still loaded, but only when nothing else is in flight.
+ */
+void WaveformLoadJob::Start(size_t maxInflightBytes)
+{
+	m_maxInflightBytes = maxInflightBytes;
+
+	//Decoding is mostly CPU bound, so there's no point having more workers than cores.
+	//Each file is also decoded by an OpenMP team, so split the cores between the workers rather than letting every
+	//worker start a full size team of its own.
+	size_t ncores = max(static_cast<size_t>(thread::hardware_concurrency()), static_cast<size_t>(1));
+	size_t nthreads = min(m_requests.size(), ncores);
+	nthreads = max(nthreads, static_cast<size_t>(1));
+	m_ompThreadsPerWorker = max(ncores / nthreads, static_cast<size_t>(1));
+
+	LogTrace("Loading %zu streams using %zu threads (%zu OpenMP threads each)\n",
+		m_requests.size(), nthreads, m_ompThreadsPerWorker);
+
+	for(size_t i=0; i<nthreads; i++)
+		m_threads.push_back(make_unique<thread>(WorkerThread, this));
+}
+
+/**
+	@brief Blocks until all streams have been loaded
+ */
+void WaveformLoadJob::Wait()
+{
+	for(auto& t : m_threads)
+		t->join();
+	m_threads.clear();
+}
+
+void WaveformLoadJob::WorkerThread(WaveformLoadJob* job)
+{
+	pthread_setname_np_compat("WaveformLoad");
+
+	//Only affects parallel regions started from this thread
+	omp_set_num_threads(job->m_ompThreadsPerWorker);
+
+	while(true)
+	{
+		//Grab the next request once there's room for it
+		size_t i;
+		size_t size;
+		{
+			unique_lock<mutex> lock(job->m_mutex);
+			job->m_completion.wait(lock, [&]
+				{
+					if(job->m_nextRequest >= job->m_requests.size())
+						return true;
+					size_t next = job->m_requests[job->m_nextRequest].m_fileSize;
+					return (job->m_inflightBytes == 0) || (job->m_inflightBytes + next <= job->m_maxInflightBytes);
+				});
+
+			if(job->m_nextRequest >= job->m_requests.size())
+				break;
+			i = job->m_nextRequest ++;
+			size = job->m_requests[i].m_fileSize;
+			job->m_inflightBytes += size;
+		}
+
+		auto& req = job->m_requests[i];
+		bool ok;
+		req.m_waveform = Session::DoLoadWaveformData(req.m_waveform, req.m_format, req.m_path, &ok);
+		if(!ok)
+			job->m_failed = true;
+
+		{
+			lock_guard<mutex> lock(job->m_mutex);
+			job->m_inflightBytes -= size;
+		}
+		job->m_completion.notify_all();
+	}
+
+	//Wake anyone else waiting so they can see the queue is empty
+	job->m_completion.notify_all();
+}
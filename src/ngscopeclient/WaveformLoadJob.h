@@ -0,0 +1,133 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* ngscopeclient                                                                                                        *
+*                                                                                                                      *
+* Copyright (c) 2012-2025 Andrew D. Zonenberg and contributors                                                         *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+/**
+	@file
+	@author Andrew D. Zonenberg
+	@brief Declaration of WaveformLoadJob
+ */
+#ifndef WaveformLoadJob_h
+#define WaveformLoadJob_h
+
+#include <condition_variable>
+#include <thread>
+
+/**
+	@brief Reads sample data for a session from disk using a pool of worker threads
+
+	Every stream of every waveform is a separate file, so they can all be decoded in parallel. Requests are processed
+	in the order they were added, and the total size of files being decoded at once is limited to keep the page cache
+	from thrashing on large sessions.
+
+	Waveforms must not be touched by anything else until Wait() returns. Nothing is made available incrementally: the
+	session loader queues the newest history point first so it's decoded soonest, but commits history only once the
+	whole job is done. Showing the newest waveform before older history has loaded is what lazy loading (see
+	Session::LoadWaveformDataForScope()) is for.
+ */
+class WaveformLoadJob
+{
+public:
+	WaveformLoadJob();
+	~WaveformLoadJob();
+
+	size_t Add(WaveformBase* wfm, const std::string& format, const std::string& path, size_t fileSize);
+	void Start(size_t maxInflightBytes);
+	void Wait();
+
+	/**
+		@brief Gets the loaded waveform for a request
+
+		This is normally the waveform passed to Add(), but may be a replacement if the loader converted it to a
+		different type. Only valid after Wait() returns.
+	 */
+	WaveformBase* GetWaveform(size_t i)
+	{ return m_requests[i].m_waveform; }
+
+	///@brief Returns true if any stream failed to load (only valid after Wait() returns)
+	bool HasFailed()
+	{ return m_failed; }
+
+protected:
+	static void WorkerThread(WaveformLoadJob* job);
+
+	/**
+		@brief A single stream to be loaded
+	 */
+	class Request
+	{
+	public:
+		Request(WaveformBase* wfm, const std::string& format, const std::string& path, size_t fileSize)
+		: m_waveform(wfm)
+		, m_format(format)
+		, m_path(path)
+		, m_fileSize(fileSize)
+		{}
+
+		///@brief The waveform to load into
+		WaveformBase* m_waveform;
+
+		///@brief Format of the file
+		std::string m_format;
+
+		///@brief Path to the input file
+		std::string m_path;
+
+		///@brief Size of the input file, in bytes
+		size_t m_fileSize;
+	};
+
+	///@brief Everything we have to load
+	std::vector<Request> m_requests;
+
+	///@brief Mutex protecting m_nextRequest and m_inflightBytes
+	std::mutex m_mutex;
+
+	///@brief Signaled whenever a request completes
+	std::condition_variable m_completion;
+
+	///@brief Index of the next entry in m_requests to be picked up by a worker
+	size_t m_nextRequest;
+
+	///@brief Total size of files currently being decoded
+	size_t m_inflightBytes;
+
+	///@brief Maximum total size of files being decoded at once
+	size_t m_maxInflightBytes;
+
+	///@brief Size of the OpenMP team each worker decodes a file with
+	size_t m_ompThreadsPerWorker;
+
+	///@brief Set if any stream failed to load
+	std::atomic<bool> m_failed;
+
+	///@brief The worker threads
+	std::vector<std::unique_ptr<std::thread> > m_threads;
+};
+
+#endif
@@ -0,0 +1,173 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* ngscopeclient                                                                                                        *
+*                                                                                                                      *
+* Copyright (c) 2012-2025 Andrew D. Zonenberg and contributors                                                         *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+/**
+	@file
+	@author Andrew D. Zonenberg
+	@brief Implementation of WaveformSaveJob
+ */
+#include "ngscopeclient.h"
+#include "pthread_compat.h"
+#include "Session.h"
+#include "WaveformSaveJob.h"
+
+using namespace std;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Construction / destruction
+
+WaveformSaveJob::WaveformSaveJob(HistoryManager& mgr, bool compress, bool columnar)
+	: m_mgr(mgr)
+	, m_compress(compress)
+	, m_columnar(columnar)
+	, m_nextRequest(0)
+	, m_activeWorkers(0)
+	, m_failed(false)
+	, m_totalSamples(0)
+	, m_samplesWritten(0)
+	, m_bytesWritten(0)
+	, m_tstart(0)
+	, m_tend(0)
+	, m_started(false)
+{
+}
+
+WaveformSaveJob::~WaveformSaveJob()
+{
+	Wait();
+
+	//Release our references to history before anything else gets to move it around
+	m_requests.clear();
+	if(m_started)
+		m_mgr.UnlockTiers();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Job control
+
+/**
+	@brief Adds a waveform to the job
+
+	The waveform must already be prepared for CPU access. Must not be called after Start().
+
+	@param point	History point owning the waveform
+	@param wfm		The waveform to save
+	@param path		Path to the output file
+ */
+void WaveformSaveJob::Add(shared_ptr<HistoryPoint> point, WaveformBase* wfm, const string& path)
+{
+	m_requests.push_back(Request(point, wfm, path));
+	m_totalSamples += wfm->size();
+}
+
+/**
+	@brief Launches the worker threads
+ */
+void WaveformSaveJob::Start()
+{
+	//Nothing we're about to read can be moved or freed until we're done
+	m_mgr.LockTiers();
+	m_started = true;
+
+	//A handful of parallel writes is enough to keep an NVMe drive busy, more just thrash the disk cache
+	size_t nthreads = min(m_requests.size(), static_cast<size_t>(min(thread::hardware_concurrency(), 4u)));
+	nthreads = max(nthreads, static_cast<size_t>(1));
+
+	LogTrace("Saving %zu waveforms using %zu threads\n", m_requests.size(), nthreads);
+
+	m_tstart = GetTime();
+	m_activeWorkers = nthreads;
+	for(size_t i=0; i<nthreads; i++)
+		m_threads.push_back(make_unique<thread>(WorkerThread, this));
+}
+
+/**
+	@brief Blocks until all waveforms have been written
+ */
+void WaveformSaveJob::Wait()
+{
+	for(auto& t : m_threads)
+		t->join();
+	m_threads.clear();
+}
+
+/**
+	@brief Gets the fraction of samples written so far
+ */
+float WaveformSaveJob::GetProgress()
+{
+	if(m_totalSamples == 0)
+		return IsDone() ? 1 : 0;
+	return m_samplesWritten * 1.0f / m_totalSamples;
+}
+
+/**
+	@brief Gets the average write throughput so far, in bytes per second
+ */
+double WaveformSaveJob::GetThroughput()
+{
+	double tend = IsDone() ? m_tend.load() : GetTime();
+	double dt = tend - m_tstart;
+	if(dt <= 0)
+		return 0;
+	return m_bytesWritten / dt;
+}
+
+void WaveformSaveJob::WorkerThread(WaveformSaveJob* job)
+{
+	pthread_setname_np_compat("WaveformSave");
+
+	while(true)
+	{
+		size_t i = job->m_nextRequest ++;
+		if(i >= job->m_requests.size())
+			break;
+
+		auto& req = job->m_requests[i];
+		bool ok;
+		auto sparse = dynamic_cast<SparseWaveformBase*>(req.m_waveform);
+		if(sparse)
+			ok = Session::SerializeSparseWaveform(sparse, req.m_path, job->m_columnar, job);
+		else
+		{
+			ok = Session::SerializeUniformWaveform(
+				dynamic_cast<UniformWaveformBase*>(req.m_waveform), req.m_path, job->m_compress, job);
+		}
+
+		if(!ok)
+		{
+			LogError("Failed to save waveform data to %s\n", req.m_path.c_str());
+			job->m_failed = true;
+		}
+	}
+
+	//Last one out records the end time
+	job->m_tend = GetTime();
+	job->m_activeWorkers --;
+}
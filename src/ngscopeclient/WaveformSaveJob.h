@@ -0,0 +1,154 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* ngscopeclient                                                                                                        *
+*                                                                                                                      *
+* Copyright (c) 2012-2025 Andrew D. Zonenberg and contributors                                                         *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+/**
+	@file
+	@author Andrew D. Zonenberg
+	@brief Declaration of WaveformSaveJob
+ */
+#ifndef WaveformSaveJob_h
+#define WaveformSaveJob_h
+
+#include <thread>
+
+class HistoryManager;
+class HistoryPoint;
+
+/**
+	@brief Writes sample data for a session to disk in the background
+
+	Each waveform is a separate file, so files are written in parallel by a small pool of worker threads. The history
+	points being saved are kept alive (and, from Start() on, their storage tiers locked) until the job is destroyed,
+	so the GUI can keep running while the save is in progress.
+
+	Create and destroy from the GUI thread only.
+ */
+class WaveformSaveJob
+{
+public:
+	WaveformSaveJob(HistoryManager& mgr, bool compress, bool columnar);
+	~WaveformSaveJob();
+
+	void Add(std::shared_ptr<HistoryPoint> point, WaveformBase* wfm, const std::string& path);
+	void Start();
+	void Wait();
+
+	///@brief Returns true once all waveforms have been written (or failed)
+	bool IsDone()
+	{ return m_activeWorkers == 0; }
+
+	///@brief Returns true if any waveform failed to save
+	bool HasFailed()
+	{ return m_failed; }
+
+	float GetProgress();
+	double GetThroughput();
+
+	///@brief Gets the total number of bytes written so far
+	size_t GetBytesWritten()
+	{ return m_bytesWritten; }
+
+	/**
+		@brief Reports progress from the serialization functions
+	 */
+	void OnBlockWritten(size_t samples, size_t bytes)
+	{
+		m_samplesWritten += samples;
+		m_bytesWritten += bytes;
+	}
+
+protected:
+	static void WorkerThread(WaveformSaveJob* job);
+
+	/**
+		@brief A single waveform to be written
+	 */
+	class Request
+	{
+	public:
+		Request(std::shared_ptr<HistoryPoint> point, WaveformBase* wfm, const std::string& path)
+		: m_point(point)
+		, m_waveform(wfm)
+		, m_path(path)
+		{}
+
+		///@brief History point the waveform came from, kept alive until we're done
+		std::shared_ptr<HistoryPoint> m_point;
+
+		///@brief The waveform to write
+		WaveformBase* m_waveform;
+
+		///@brief Path to the output file
+		std::string m_path;
+	};
+
+	///@brief History manager whose tiers we've locked
+	HistoryManager& m_mgr;
+
+	///@brief True to write uniform waveforms in the compressed densev2 format
+	bool m_compress;
+
+	///@brief True to write sparse waveforms in the columnar sparsev2 format
+	bool m_columnar;
+
+	///@brief Everything we have to write
+	std::vector<Request> m_requests;
+
+	///@brief Index of the next entry in m_requests to be picked up by a worker
+	std::atomic<size_t> m_nextRequest;
+
+	///@brief Number of workers which haven't finished yet
+	std::atomic<size_t> m_activeWorkers;
+
+	///@brief Set if any waveform failed to save
+	std::atomic<bool> m_failed;
+
+	///@brief Total number of samples in all requests
+	size_t m_totalSamples;
+
+	///@brief Number of samples written so far
+	std::atomic<size_t> m_samplesWritten;
+
+	///@brief Number of bytes written so far
+	std::atomic<size_t> m_bytesWritten;
+
+	///@brief Time the job was started
+	double m_tstart;
+
+	///@brief Time the last worker finished (valid once IsDone() is true)
+	std::atomic<double> m_tend;
+
+	///@brief The worker threads
+	std::vector<std::unique_ptr<std::thread> > m_threads;
+
+	///@brief True once Start() has been called (and history tiers locked)
+	bool m_started;
+};
+
+#endif
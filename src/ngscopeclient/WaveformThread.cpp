@@ -47,7 +47,6 @@ Event g_partialRefilterRequestedEvent;
 Event g_refilterDoneEvent;
 
 Event g_waveformReadyEvent;
-Event g_waveformProcessedEvent;
 
 ///@brief Time spent on the last cycle of waveform rendering shaders
 atomic<int64_t> g_lastWaveformRenderTime;
@@ -122,6 +121,15 @@ void WaveformThread(Session* session, atomic<bool>* shuttingDown)
 			continue;
 		}
 
+		//Wait until the GUI thread has room for another acquisition.
+		//This bounds how far ahead of the display we can get, so we don't burn through history faster than
+		//anyone can look at it.
+		if(!session->HasPipelineSlotAvailable())
+		{
+			this_thread::sleep_for(chrono::milliseconds(1));
+			continue;
+		}
+
 		//Wait for data to be available from all scopes
 		if(!session->CheckForPendingWaveforms())
 		{
@@ -130,15 +138,18 @@ void WaveformThread(Session* session, atomic<bool>* shuttingDown)
 		}
 
 		//We've got data. Download it, then run the filter graph
+		session->SetPipelineStage(Session::PIPELINE_STAGE_DOWNLOAD);
 		session->DownloadWaveforms();
+		session->SetPipelineStage(Session::PIPELINE_STAGE_FILTER);
 		session->RefreshAllFilters();
 
 		//Rerun the heavyweight rendering shaders
+		session->SetPipelineStage(Session::PIPELINE_STAGE_RENDER);
 		RenderAllWaveforms(cmdbuf, session, queue);
 
-		//Unblock the UI threads, then wait for acknowledgement that it's processed
-		g_waveformReadyEvent.Signal();
-		g_waveformProcessedEvent.Block();
+		//Hand off to the GUI thread for tone mapping and history, then go right on to the next acquisition.
+		//The GUI thread may still be displaying this one while we download and filter the next.
+		session->PublishAcquisition();
 	}
 
 	LogTrace("Shutting down\n");
@@ -151,7 +162,13 @@ void RenderAllWaveforms(vk::raii::CommandBuffer& cmdbuf, Session* session, share
 	//Must lock mutexes in this order to avoid deadlock
 	shared_lock<shared_mutex> lock1(session->GetWaveformDataMutex());
 	shared_lock<shared_mutex> lock2(g_vulkanActivityMutex);
-	lock_guard<mutex> lock3(session->GetRasterizedWaveformMutex());
+
+	//We draw into each channel's second buffer, so the GUI thread can keep tone mapping the current ones meanwhile.
+	//The only conflict is a tone map still reading what was the current buffer before the last swap.
+	{
+		lock_guard<mutex> lock3(session->GetRasterizedWaveformMutex());
+		session->WaitForToneMap();
+	}
 
 	//Keep references to all displayed channels open until the rendering finishes
 	//This prevents problems if we close a WaveformArea or remove a channel from it before the shader completes
@@ -161,5 +178,12 @@ void RenderAllWaveforms(vk::raii::CommandBuffer& cmdbuf, Session* session, share
 	cmdbuf.end();
 	queue->SubmitAndBlock(cmdbuf);
 
+	//Hand the new waveforms over to the GUI thread for tone mapping
+	{
+		lock_guard<mutex> lock3(session->GetRasterizedWaveformMutex());
+		for(auto& chan : channels)
+			chan->SwapRasterizedWaveforms();
+	}
+
 	g_lastWaveformRenderTime = (GetTime() - tstart) * FS_PER_SECOND;
 }
@@ -66,6 +66,10 @@ public:
 	std::atomic<bool>* shuttingDown;
 	Session* session;
 
+	//Performance counters reported back to the UI
+	std::atomic<int64_t>* pollInterval;
+	std::atomic<int64_t>* acquisitionLatency;
+
 	//Additional per-instrument-type state we can add
 	std::shared_ptr<LoadState> loadstate;
 	std::shared_ptr<MultimeterState> meterstate;
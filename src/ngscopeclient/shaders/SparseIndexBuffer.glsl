@@ -0,0 +1,102 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* ngscopeclient                                                                                                        *
+*                                                                                                                      *
+* Copyright (c) 2012-2025 Andrew D. Zonenberg and contributors                                                         *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+/**
+	@file
+	@brief Computes the per-column sample index buffer for rendering a sparse waveform
+
+	For each column of the plot, finds the index of the first sample whose offset is at or after the column's target
+	offset (or memDepth if there is none), exactly like BinarySearchForGequal() on the CPU.
+
+	Offsets and targets are 64-bit signed integers, but are read as pairs of 32-bit words so this works on GPUs without
+	GL_ARB_gpu_shader_int64.
+ */
+
+#version 430
+#pragma shader_stage(compute)
+
+#extension GL_ARB_compute_shader : require
+#extension GL_ARB_shader_storage_buffer_object : require
+
+layout(local_size_x=64, local_size_y=1, local_size_z=1) in;
+
+//Global configuration for the run
+layout(std430, push_constant) uniform constants
+{
+	uint memDepth;
+	uint windowWidth;
+};
+
+//Output index for each column
+layout(std430, binding=0) restrict writeonly buffer index
+{
+	uint xind[];
+};
+
+//Sample offsets, in time ticks (actually 64-bit little endian signed ints)
+layout(std430, binding=1) restrict readonly buffer waveform_x
+{
+	uint xpos[];
+};
+
+//Target offset for each column, in time ticks (actually 64-bit little endian signed ints)
+layout(std430, binding=2) restrict readonly buffer column_targets
+{
+	uint targets[];
+};
+
+void main()
+{
+	uint col = gl_GlobalInvocationID.x;
+	if(col >= windowWidth)
+		return;
+
+	int target_hi = int(targets[col*2 + 1]);
+	uint target_lo = targets[col*2];
+
+	//Lower bound: find the first sample which is not less than the target
+	uint lo = 0;
+	uint hi = memDepth;
+	while(lo < hi)
+	{
+		uint mid = lo + (hi - lo) / 2;
+
+		//Signed 64-bit compare: high halves signed, low halves unsigned
+		int xpos_hi = int(xpos[mid*2 + 1]);
+		uint xpos_lo = xpos[mid*2];
+		bool less = (xpos_hi < target_hi) || ( (xpos_hi == target_hi) && (xpos_lo < target_lo) );
+
+		if(less)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	xind[col] = lo;
+}
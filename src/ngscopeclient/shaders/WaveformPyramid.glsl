@@ -0,0 +1,128 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* ngscopeclient                                                                                                        *
+*                                                                                                                      *
+* Copyright (c) 2012-2025 Andrew D. Zonenberg and contributors                                                         *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+/**
+	@file
+	@brief Builds one level of the min/max pyramid used to draw zoomed out uniform analog waveforms
+
+	Each block is three floats: minimum voltage, maximum voltage, and total variation (sum of absolute voltage change)
+	of the line segments it covers. Segment i runs from sample i to sample i+1.
+
+	Level 0 blocks cover PYRAMID_BASE_BLOCK segments and are computed from the samples, each higher level block covers
+	PYRAMID_FANOUT blocks of the level below. All levels are stored back to back in the same buffer.
+ */
+
+#version 430
+#pragma shader_stage(compute)
+
+#extension GL_ARB_compute_shader : require
+#extension GL_ARB_shader_storage_buffer_object : require
+
+//Must match WaveformArea.h
+#define PYRAMID_BASE_BLOCK 64
+#define PYRAMID_FANOUT 8
+
+layout(local_size_x=64, local_size_y=1, local_size_z=1) in;
+
+//Global configuration for the run
+layout(std430, push_constant) uniform constants
+{
+	uint numSegments;
+	uint level;
+	uint srcOffset;		//index of the first block of the level below
+	uint dstOffset;		//index of the first block of this level
+	uint numBlocks;		//number of blocks in this level
+	uint numSrcBlocks;	//number of blocks in the level below (unused for level 0)
+};
+
+//The pyramid
+layout(std430, binding=0) restrict buffer pyramid
+{
+	float pyr[];
+};
+
+//Input sample data
+layout(std430, binding=1) restrict readonly buffer waveform_y
+{
+	float voltage[];
+};
+
+void main()
+{
+	uint block = gl_GlobalInvocationID.y * gl_NumWorkGroups.x * gl_WorkGroupSize.x + gl_GlobalInvocationID.x;
+	if(block >= numBlocks)
+		return;
+
+	float vmin;
+	float vmax;
+	float tv = 0;
+
+	//Bottom level: walk the samples
+	if(level == 0)
+	{
+		uint start = block * PYRAMID_BASE_BLOCK;
+		uint end = min(start + PYRAMID_BASE_BLOCK, numSegments);
+
+		float prev = voltage[start];
+		vmin = prev;
+		vmax = prev;
+		for(uint i=start+1; i<=end; i++)
+		{
+			float v = voltage[i];
+			vmin = min(vmin, v);
+			vmax = max(vmax, v);
+			tv += abs(v - prev);
+			prev = v;
+		}
+	}
+
+	//Higher levels: merge the children
+	else
+	{
+		uint start = block * PYRAMID_FANOUT;
+		uint end = min(start + PYRAMID_FANOUT, numSrcBlocks);
+
+		uint base = (srcOffset + start) * 3;
+		vmin = pyr[base];
+		vmax = pyr[base + 1];
+		tv = pyr[base + 2];
+		for(uint i=start+1; i<end; i++)
+		{
+			base = (srcOffset + i) * 3;
+			vmin = min(vmin, pyr[base]);
+			vmax = max(vmax, pyr[base + 1]);
+			tv += pyr[base + 2];
+		}
+	}
+
+	uint out_base = (dstOffset + block) * 3;
+	pyr[out_base] = vmin;
+	pyr[out_base + 1] = vmax;
+	pyr[out_base + 2] = tv;
+}
@@ -30,12 +30,20 @@
 #version 430
 #pragma shader_stage(compute)
 
+//OUTPUT_FORMAT is the image format qualifier for the texture (rgba32f, rgba16f, or rgba8)
+//and PACKED_FP16_INPUT is set if the rasterized waveform is packed fp16 (see waveform-compute.glsl).
+//Both are set by CMake based on the output filename.
+
 layout(std430, binding=0) restrict readonly buffer buf_pixels
 {
+#ifdef PACKED_FP16_INPUT
+	uint pixels[];		//rows 2n and 2n+1 of each column in the low and high halves of one word
+#else
 	float pixels[];
+#endif
 };
 
-layout(binding=1, rgba32f) uniform image2D outputTex;
+layout(binding=1, OUTPUT_FORMAT) uniform writeonly image2D outputTex;
 
 layout(std430, push_constant) uniform constants
 {
@@ -56,8 +64,14 @@ void main()
 		return;
 
 	//Intensity graded grayscale input
+#ifdef PACKED_FP16_INPUT
+	uint npixel = (gl_GlobalInvocationID.y / 2)*width + gl_GlobalInvocationID.x;
+	vec2 pair = unpackHalf2x16(pixels[npixel]);
+	float pixval = ((gl_GlobalInvocationID.y & 1) == 0) ? pair.x : pair.y;
+#else
 	uint npixel = gl_GlobalInvocationID.y*width + gl_GlobalInvocationID.x;
 	float pixval = pixels[npixel];
+#endif
 
 	//Logarithmic shading
 	float y = pow(pixval, 1.0 / 4);
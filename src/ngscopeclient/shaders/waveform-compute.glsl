@@ -67,19 +67,24 @@ layout(std430, push_constant) uniform constants
 	uint windowWidth;
 	uint memDepth;
 	uint offset_samples;
-	float alpha;
+	float alpha;		//not yet scaled by sample density for sparse waveforms
 	float xoff;
 	float xscale;
 	float ybase;
 	float yscale;
 	float yoff;
 	float persistScale;
+	uint pyramidLevels;	//zero if there's no pyramid to draw from
 };
 
 //The output texture data
 layout(std430, binding=0) buffer outputTex
 {
+#ifdef PACKED_FP16_OUTPUT
+	uint outval[];		//two vertically adjacent pixels per word, see end of main()
+#else
 	float outval[];
+#endif
 };
 
 #ifdef ANALOG_PATH
@@ -156,6 +161,25 @@ layout(std430, binding=4) buffer durs
 	#define ADDTL_NEEDED_SAMPLES 0
 #endif
 
+//Zoomed out uniform analog waveforms (which draw lines between samples) can be drawn from a min/max pyramid
+#if defined(ANALOG_PATH) && defined(DENSE_PACK) && defined(USE_NEXT_COORDS) && !defined(HISTOGRAM_PATH)
+	#define USE_PYRAMID
+
+	//Must match WaveformArea.h
+	#define PYRAMID_BASE_BLOCK	64
+	#define PYRAMID_FANOUT		8
+	#define PYRAMID_MIN_BLOCKS	16
+
+	//Segments this close to either end of a column are always drawn from the samples,
+	//since istart and iend are only approximate and they may need to be clipped to the column
+	#define PYRAMID_EDGE_SEGMENTS	16
+
+	layout(std430, binding=2) restrict readonly buffer pyramid
+	{
+		float pyr[];	//min, max, total variation for each block (see WaveformPyramid.glsl)
+	};
+#endif
+
 float FetchX(uint i)
 {
 #ifdef HAS_INT64
@@ -207,6 +231,244 @@ float InterpolateY(vec2 left, vec2 right, float slope, float x)
 	return left.y + ( (x - left.x) * slope );
 }
 
+/*
+	Find the rows of the current column covered by the segment starting at sample i.
+
+	Returns false if nothing is visible. rightX is always set to the X coordinate of the end of the segment.
+ */
+bool GetSegmentRows(uint i, out int blockmin, out int blockmax, out float rightX)
+{
+	blockmin = 0;
+	blockmax = 0;
+
+	//Fetch coordinates
+	#ifdef ANALOG_PATH
+		float v = voltage[i];
+		vec2 left = vec2(FetchX(i) * xscale + xoff, (v + yoff)*yscale + ybase);
+
+		#ifdef USE_NEXT_COORDS
+			vec2 right = vec2(FetchX(i+1) * xscale + xoff, (voltage[i+1] + yoff)*yscale + ybase);
+		#else
+			vec2 right = left;
+			right.x += FETCH_DURATION(i) * xscale;
+		#endif
+	#endif
+
+	#ifdef DIGITAL_PATH
+		vec2 left = vec2(FetchX(i) * xscale + xoff, GetBoolean(i)*yscale + ybase);
+
+		#ifdef USE_NEXT_COORDS
+			vec2 right = vec2(FetchX(i+1)*xscale + xoff, GetBoolean(i+1)*yscale + ybase);
+		#else
+			vec2 right = left;
+			right.x += FETCH_DURATION(i) * xscale;
+		#endif
+	#endif
+
+	rightX = right.x;
+
+	//Skip offscreen samples
+	if(!( (right.x >= gl_GlobalInvocationID.x) && (left.x <= gl_GlobalInvocationID.x + 1) ))
+		return false;
+
+	//To start, assume we're drawing the entire segment
+	float starty = left.y;
+	float endy = right.y;
+
+	#ifdef ANALOG_PATH
+
+		#ifndef NO_INTERPOLATION
+
+			//Interpolate analog signals if either end is outside our column
+			float slope = (right.y - left.y) / (right.x - left.x);
+			if(left.x < gl_GlobalInvocationID.x)
+				starty = InterpolateY(left, right, slope, gl_GlobalInvocationID.x);
+			if(right.x > gl_GlobalInvocationID.x + 1)
+				endy = InterpolateY(left, right, slope, gl_GlobalInvocationID.x + 1);
+
+		#endif
+
+	#endif
+
+	#ifdef DIGITAL_PATH
+
+		//If we are very near the right edge, draw vertical line
+		starty = left.y;
+		if(abs(right.x - gl_GlobalInvocationID.x) <= 1)
+			endy = right.y;
+
+		//otherwise draw a single pixel
+		else
+			endy = left.y;
+
+	#endif
+
+	#ifdef HISTOGRAM_PATH
+		starty = yoff*yscale + ybase;
+		endy = left.y;
+	#endif
+
+	//If start and end are both off screen, nothing to draw
+	if( ( (starty < 0) && (endy < 0) ) ||
+		( (starty >= windowHeight) && (endy >= windowHeight) ) )
+	{
+		return false;
+	}
+
+	//Don't draw zero-height histogram bars
+	#ifdef HISTOGRAM_PATH
+		if(v <= 0)
+			return false;
+	#endif
+
+	//Something is visible. Clip to window size in case anything is partially offscreen
+	starty = min(starty, windowHeight - 1);
+	endy = min(endy, windowHeight - 1);
+	starty = max(starty, 0);
+	endy = max(endy, 0);
+
+	//Sort Y coordinates from min to max
+	blockmin = int(min(starty, endy));
+	blockmax = int(max(starty, endy));
+	return true;
+}
+
+#ifdef USE_PYRAMID
+
+//Draw segments [start, end) from the samples
+void DrawSegments(uint start, uint end)
+{
+	for(uint i = start + gl_LocalInvocationID.y; i < end; i += ROWS_PER_BLOCK)
+	{
+		int blockmin;
+		int blockmax;
+		float rightX;
+		if(GetSegmentRows(i, blockmin, blockmax, rightX))
+		{
+			for(int y=blockmin; y<=blockmax; y++)
+				atomicAdd(g_workingBuffer[y], 1);
+		}
+	}
+}
+
+/*
+	Draw blocks [start, end) of one pyramid level.
+
+	These are entirely inside the column, so the rows their segments cover are exactly [min, max]. We don't know how
+	many segments crossed each of those rows, so spread the total (one row per segment, plus one per row travelled)
+	evenly across the range.
+ */
+void DrawBlocks(uint level, uint start, uint end)
+{
+	//Find the level in the buffer
+	uint nseg = memDepth - 1;
+	uint blocksize = PYRAMID_BASE_BLOCK;
+	uint offset = 0;
+	for(uint l=0; l<level; l++)
+	{
+		offset += (nseg + blocksize - 1) / blocksize;
+		blocksize *= PYRAMID_FANOUT;
+	}
+
+	for(uint b = start + gl_LocalInvocationID.y; b < end; b += ROWS_PER_BLOCK)
+	{
+		uint base = (offset + b) * 3;
+		float ya = (pyr[base] + yoff)*yscale + ybase;
+		float yb = (pyr[base + 1] + yoff)*yscale + ybase;
+		float lo = min(ya, yb);
+		float hi = max(ya, yb);
+		if( (hi < 0) || (lo >= windowHeight) )
+			continue;
+
+		float rows = floor(hi) - floor(lo) + 1;
+		float total = pyr[base + 2] * abs(yscale) + blocksize;
+		uint weight = max(uint(round(total / rows)), 1u);
+
+		int blockmin = int(max(lo, 0));
+		int blockmax = int(min(hi, windowHeight - 1));
+		for(int y=blockmin; y<=blockmax; y++)
+			atomicAdd(g_workingBuffer[y], weight);
+	}
+}
+
+uint RoundUp(uint x, uint n)
+{
+	return ((x + n - 1) / n) * n;
+}
+
+uint RoundDown(uint x, uint n)
+{
+	return (x / n) * n;
+}
+
+/*
+	Draw the current column using the pyramid, if we're zoomed out far enough for it to help.
+
+	The segments near each end of the column are drawn from the samples since they may need to be clipped. The rest are
+	split into the fewest blocks: walk up the levels until aligned to the coarsest one, across it, then back down.
+
+	Returns false (having drawn nothing) if the column should be drawn the normal way.
+ */
+bool DrawFromPyramid(uint istart, uint iend)
+{
+	if(pyramidLevels == 0)
+		return false;
+
+	//Columns hanging off the start (istart wraps around) or end of the waveform are drawn the normal way
+	uint nseg = memDepth - 1;
+	if( (istart >= nseg) || (iend > nseg) || (iend < istart + 2*PYRAMID_EDGE_SEGMENTS) )
+		return false;
+	uint first = istart + PYRAMID_EDGE_SEGMENTS;
+	uint last = iend - PYRAMID_EDGE_SEGMENTS;
+	uint count = last - first;
+	if(count < PYRAMID_BASE_BLOCK * PYRAMID_MIN_BLOCKS)
+		return false;
+
+	//Pick the coarsest level the interior spans enough blocks of
+	uint top = 0;
+	uint topsize = PYRAMID_BASE_BLOCK;
+	while( (top + 1 < pyramidLevels) && (topsize * PYRAMID_FANOUT * PYRAMID_MIN_BLOCKS <= count) )
+	{
+		top ++;
+		topsize *= PYRAMID_FANOUT;
+	}
+
+	//Ends of the column
+	DrawSegments(istart, first);
+	DrawSegments(last, min(iend + PYRAMID_EDGE_SEGMENTS, nseg));
+
+	//Up from the start of the interior
+	uint pos = RoundUp(first, PYRAMID_BASE_BLOCK);
+	DrawSegments(first, pos);
+	uint blocksize = PYRAMID_BASE_BLOCK;
+	for(uint level=0; level<top; level++)
+	{
+		uint next = RoundUp(pos, blocksize * PYRAMID_FANOUT);
+		DrawBlocks(level, pos / blocksize, next / blocksize);
+		pos = next;
+		blocksize *= PYRAMID_FANOUT;
+	}
+
+	//Across the top
+	uint next = RoundDown(last, topsize);
+	DrawBlocks(top, pos / topsize, next / topsize);
+	pos = next;
+
+	//Down to the end of the interior
+	for(uint level=top; level>0; level--)
+	{
+		blocksize /= PYRAMID_FANOUT;
+		next = RoundDown(last, blocksize);
+		DrawBlocks(level - 1, pos / blocksize, next / blocksize);
+		pos = next;
+	}
+	DrawSegments(pos, last);
+
+	return true;
+}
+
+#endif
+
 void main()
 {
 	//Abort if window height is too big, or if we're off the end of the window
@@ -246,8 +508,15 @@ void main()
 	#endif
 	uint i = istart + gl_GlobalInvocationID.y;
 
+	//If zoomed far out, the whole column may come from the pyramid instead
+	#ifdef USE_PYRAMID
+		bool drawn = DrawFromPyramid(istart, iend);
+	#else
+		bool drawn = false;
+	#endif
+
 	//Main loop
-	while(true)
+	while(!drawn)
 	{
 		int blockmin = 0;
 		int blockmax = 0;
@@ -255,109 +524,11 @@ void main()
 
 		if(i < (memDepth - ADDTL_NEEDED_SAMPLES) )
 		{
-			//Fetch coordinates
-			#ifdef ANALOG_PATH
-				float v = voltage[i];
-				vec2 left = vec2(FetchX(i) * xscale + xoff, (v + yoff)*yscale + ybase);
-
-				#ifdef USE_NEXT_COORDS
-					vec2 right = vec2(FetchX(i+1) * xscale + xoff, (voltage[i+1] + yoff)*yscale + ybase);
-				#else
-					vec2 right = left;
-					right.x += FETCH_DURATION(i) * xscale;
-				#endif
-
-				//Don't draw zero-height histogram bars
-				#ifdef HISTOGRAM_PATH
-					bool zeroHeight = (v <= 0);
-				#endif
-
-			#endif
-
-			#ifdef DIGITAL_PATH
-				vec2 left = vec2(FetchX(i) * xscale + xoff, GetBoolean(i)*yscale + ybase);
-
-				#ifdef USE_NEXT_COORDS
-					vec2 right = vec2(FetchX(i+1)*xscale + xoff, GetBoolean(i+1)*yscale + ybase);
-				#else
-					vec2 right = left;
-					right.x += FETCH_DURATION(i) * xscale;
-				#endif
-			#endif
-
-			//Skip offscreen samples
-			if( (right.x >= gl_GlobalInvocationID.x) && (left.x <= gl_GlobalInvocationID.x + 1) )
-			{
-				//To start, assume we're drawing the entire segment
-				float starty = left.y;
-				float endy = right.y;
-
-				#ifdef ANALOG_PATH
-
-					#ifndef NO_INTERPOLATION
-
-						//Interpolate analog signals if either end is outside our column
-						float slope = (right.y - left.y) / (right.x - left.x);
-						if(left.x < gl_GlobalInvocationID.x)
-							starty = InterpolateY(left, right, slope, gl_GlobalInvocationID.x);
-						if(right.x > gl_GlobalInvocationID.x + 1)
-							endy = InterpolateY(left, right, slope, gl_GlobalInvocationID.x + 1);
-
-					#endif
-
-				#endif
-
-				#ifdef DIGITAL_PATH
-
-					//If we are very near the right edge, draw vertical line
-					starty = left.y;
-					if(abs(right.x - gl_GlobalInvocationID.x) <= 1)
-						endy = right.y;
-
-					//otherwise draw a single pixel
-					else
-						endy = left.y;
-
-				#endif
-
-				#ifdef HISTOGRAM_PATH
-					starty = yoff*yscale + ybase;
-					endy = left.y;
-				#endif
-
-				//If start and end are both off screen, nothing to draw
-				if( ( (starty < 0) && (endy < 0) ) ||
-					( (starty >= windowHeight) && (endy >= windowHeight) ) )
-				{
-					updating = false;
-				}
-
-				//Don't draw zero-height histogram bars
-				#ifdef HISTOGRAM_PATH
-				else if(zeroHeight)
-					updating = false;
-				#endif
-
-				//Something is visible. Clip to window size in case anything is partially offscreen
-				else
-				{
-					updating = true;
-
-					starty = min(starty, windowHeight - 1);
-					endy = min(endy, windowHeight - 1);
-					starty = max(starty, 0);
-					endy = max(endy, 0);
-
-					//Sort Y coordinates from min to max
-					blockmin = int(min(starty, endy));
-					blockmax = int(max(starty, endy));
-				}
-			}
-			else
-				updating = false;
+			float rightX;
+			updating = GetSegmentRows(i, blockmin, blockmax, rightX);
 
 			//Check if we're at the end of the pixel
-			if(right.x > gl_GlobalInvocationID.x + 1)
+			if(rightX > gl_GlobalInvocationID.x + 1)
 				l_done = true;
 		}
 
@@ -392,15 +563,44 @@ void main()
 	barrier();
 	memoryBarrierShared();
 
-	//Copy working buffer to float[] output and apply persistence if needed
-	for(uint y=gl_LocalInvocationID.y; y<windowHeight; y+= ROWS_PER_BLOCK)
-	{
-		float fout = g_workingBuffer[y] * alpha;
-		uint npix = (windowWidth * y) + gl_GlobalInvocationID.x;
+	//Sparse offsets may only be present on the GPU, so scale alpha by the average sample density here
+	//rather than on the CPU (same formula as WaveformArea::RasterizeAnalogOrDigitalWaveform() uses for dense data)
+	#ifdef DENSE_PACK
+		float scaledAlpha = alpha;
+	#else
+		float samplesPerPixel = float(memDepth) / (xscale * (FetchX(memDepth - 1) - FetchX(0)));
+		float scaledAlpha = min(1.0, alpha / sqrt(samplesPerPixel)) * 2;
+	#endif
 
-		if(persistScale != 0)
-			fout += outval[npix] * persistScale;
+	//Copy working buffer to output and apply persistence if needed
+	#ifdef PACKED_FP16_OUTPUT
 
-		outval[npix] = fout;
-	}
+		//Each word holds rows 2n (low half) and 2n+1 (high half) of one column as fp16
+		for(uint y=gl_LocalInvocationID.y*2; y<windowHeight; y+= ROWS_PER_BLOCK*2)
+		{
+			vec2 fout = vec2(float(g_workingBuffer[y]) * scaledAlpha, 0);
+			if(y+1 < windowHeight)
+				fout.y = float(g_workingBuffer[y+1]) * scaledAlpha;
+			uint npix = (windowWidth * (y/2)) + gl_GlobalInvocationID.x;
+
+			if(persistScale != 0)
+				fout += unpackHalf2x16(outval[npix]) * persistScale;
+
+			outval[npix] = packHalf2x16(fout);
+		}
+
+	#else
+
+		for(uint y=gl_LocalInvocationID.y; y<windowHeight; y+= ROWS_PER_BLOCK)
+		{
+			float fout = g_workingBuffer[y] * scaledAlpha;
+			uint npix = (windowWidth * y) + gl_GlobalInvocationID.x;
+
+			if(persistScale != 0)
+				fout += outval[npix] * persistScale;
+
+			outval[npix] = fout;
+		}
+
+	#endif
 }
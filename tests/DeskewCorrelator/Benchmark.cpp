@@ -0,0 +1,216 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* ngscopeclient                                                                                                        *
+*                                                                                                                      *
+* Copyright (c) 2012-2025 Andrew D. Zonenberg and contributors                                                         *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+/**
+	@file
+	@author Andrew D. Zonenberg
+	@brief Benchmark of CPU deskew correlation against the ScopeDeskewUniform* compute shaders
+
+	Hidden by default since the brute force shaders take a long time on software renderers. To run it on lavapipe:
+
+		VK_LOADER_DRIVERS_SELECT='*lvp*' ./DeskewCorrelator "[benchmark]"
+ */
+#ifdef _CATCH2_V3
+#include <catch2/catch_all.hpp>
+#else
+#include <catch2/catch.hpp>
+#endif
+
+#include "../../lib/scopehal/scopehal.h"
+#include "../../src/ngscopeclient/DeskewCorrelator.h"
+#include <random>
+
+using namespace std;
+
+/**
+	@brief Runs one of the deskew shaders and returns the best delay
+ */
+static int64_t RunShader(
+	const char* name,
+	const char* path,
+	UniformAnalogWaveform& pri,
+	UniformAnalogWaveform& sec,
+	int64_t maxDelta,
+	double tbase)
+{
+	//Create a queue and command buffer
+	shared_ptr<QueueHandle> queue(g_vkQueueManager->GetComputeQueue("DeskewCorrelator_Benchmark.queue"));
+	vk::CommandPoolCreateInfo poolInfo(
+		vk::CommandPoolCreateFlagBits::eTransient | vk::CommandPoolCreateFlagBits::eResetCommandBuffer,
+		queue->m_family );
+	vk::raii::CommandPool pool(*g_vkComputeDevice, poolInfo);
+
+	vk::CommandBufferAllocateInfo bufinfo(*pool, vk::CommandBufferLevel::ePrimary, 1);
+	vk::raii::CommandBuffer cmdbuf(std::move(vk::raii::CommandBuffers(*g_vkComputeDevice, bufinfo).front()));
+
+	ComputePipeline pipe(path, 3, sizeof(UniformCrossCorrelateArgs));
+
+	AcceleratorBuffer<float> corrOut;
+	corrOut.SetCpuAccessHint(AcceleratorBuffer<float>::HINT_LIKELY);
+	corrOut.SetGpuAccessHint(AcceleratorBuffer<float>::HINT_UNLIKELY);
+	corrOut.resize(2*maxDelta);
+
+	pri.PrepareForGpuAccess();
+	sec.PrepareForGpuAccess();
+
+	double start = GetTime();
+	cmdbuf.begin({});
+	UniformCrossCorrelateArgs args(&pri, &sec, maxDelta);
+	pipe.BindBufferNonblocking(0, corrOut, cmdbuf, true);
+	pipe.BindBufferNonblocking(1, pri.m_samples, cmdbuf);
+	pipe.BindBufferNonblocking(2, sec.m_samples, cmdbuf);
+	const uint32_t compute_block_count = GetComputeBlockCount(2*maxDelta, 64);
+	pipe.Dispatch(cmdbuf, args, min(compute_block_count, 32768u), compute_block_count / 32768 + 1);
+	cmdbuf.end();
+	queue->SubmitAndBlock(cmdbuf);
+	double dt = GetTime() - start;
+
+	corrOut.MarkModifiedFromGpu();
+	corrOut.PrepareForCpuAccess();
+	LogVerbose("GPU (%-12s): %8.2f ms, %.2fx speedup vs FFT\n", name, dt * 1000, tbase / dt);
+
+	int64_t bestOffset = 0;
+	float bestCorr = 0;
+	for(int64_t i=0; i<2*maxDelta; i++)
+	{
+		if(corrOut[i] > bestCorr)
+		{
+			bestCorr = corrOut[i];
+			bestOffset = i - maxDelta;
+		}
+	}
+	return bestOffset;
+}
+
+TEST_CASE("DeskewCorrelator_Benchmark", "[.][benchmark]")
+{
+	if(!g_vkComputeDevice && !VulkanInit(true))
+	{
+		WARN("No Vulkan device available");
+		return;
+	}
+
+	#ifdef __x86_64__
+	bool reallyHasAvx2 = g_hasAvx2;
+	bool reallyHasFMA = g_hasFMA;
+	bool reallyHasAvx512F = g_hasAvx512F;
+	#endif
+
+	//Same window as the deskew wizard, and a typical capture depth.
+	//Secondary trigger phase is a non-integer number of samples so no sample times line up exactly.
+	const size_t len = 1000000;
+	const int64_t maxDelta = 30000;
+	minstd_rand rng;
+	rng.seed(0);
+	uniform_real_distribution<float> step(-1, 1);
+
+	UniformAnalogWaveform pri;
+	UniformAnalogWaveform sec;
+	pri.m_timescale = 100;
+	sec.m_timescale = 100;
+	pri.m_triggerPhase = 0;
+	sec.m_triggerPhase = 123450;
+	pri.Resize(len);
+	sec.Resize(len);
+	pri.PrepareForCpuAccess();
+	sec.PrepareForCpuAccess();
+	float v = 0;
+	for(size_t i=0; i<len + 1234; i++)
+	{
+		v = v*0.95f + step(rng);
+		if(i < len)
+			sec.m_samples[i] = v;
+		if(i >= 1234)
+			pri.m_samples[i - 1234] = v;
+	}
+	pri.MarkModifiedFromCpu();
+	sec.MarkModifiedFromCpu();
+
+	//FFT engine, at each ISA level
+	DeskewCorrelator corr(maxDelta);
+	vector<float> rsec(corr.GetSecondaryLength(len));
+	int64_t validStart;
+	int64_t validEnd;
+	double start = GetTime();
+	DeskewCorrelator::ResampleUniform(
+		sec.m_samples.GetCpuPointer(), len, sec.m_timescale, pri.m_timescale,
+		pri.m_triggerPhase - sec.m_triggerPhase, -maxDelta, rsec.size(), rsec.data(), validStart, validEnd);
+	double tresample = GetTime() - start;
+	LogVerbose("CPU resample    : %8.2f ms\n", tresample * 1000);
+
+	#ifdef __x86_64__
+		g_hasAvx2 = false;
+		g_hasFMA = false;
+		g_hasAvx512F = false;
+	#endif
+	start = GetTime();
+	corr.Correlate(pri.m_samples.GetCpuPointer(), len, rsec.data(), validStart, validEnd);
+	double tbase = GetTime() - start + tresample;
+	LogVerbose("CPU (no AVX)    : %8.2f ms\n", tbase * 1000);
+	int64_t expected = corr.GetBestDelta();
+
+	#ifdef __x86_64__
+	if(reallyHasAvx2 && reallyHasFMA)
+	{
+		g_hasAvx2 = true;
+		g_hasFMA = true;
+		start = GetTime();
+		corr.Correlate(pri.m_samples.GetCpuPointer(), len, rsec.data(), validStart, validEnd);
+		double dt = GetTime() - start + tresample;
+		LogVerbose("CPU (FMA)       : %8.2f ms, %.2fx speedup\n", dt * 1000, tbase / dt);
+		REQUIRE(corr.GetBestDelta() == expected);
+		tbase = dt;
+	}
+	if(reallyHasAvx512F)
+	{
+		g_hasAvx512F = true;
+		start = GetTime();
+		corr.Correlate(pri.m_samples.GetCpuPointer(), len, rsec.data(), validStart, validEnd);
+		double dt = GetTime() - start + tresample;
+		LogVerbose("CPU (AVX512F)   : %8.2f ms, %.2fx speedup\n", dt * 1000, tbase / dt);
+		REQUIRE(corr.GetBestDelta() == expected);
+		tbase = dt;
+	}
+
+	g_hasAvx2 = reallyHasAvx2;
+	g_hasFMA = reallyHasFMA;
+	g_hasAvx512F = reallyHasAvx512F;
+	#endif
+
+	//Brute force shaders, as used by the wizard when the GPU has int64 support
+	if(!g_hasShaderInt64)
+	{
+		WARN("GPU does not support int64, skipping shaders");
+		return;
+	}
+	REQUIRE(RunShader("equal rate", "shaders/ScopeDeskewUniformEqualRate.spv", pri, sec, maxDelta, tbase) ==
+		expected);
+	REQUIRE(RunShader("unequal rate", "shaders/ScopeDeskewUniformUnequalRate.spv", pri, sec, maxDelta, tbase) ==
+		expected);
+}
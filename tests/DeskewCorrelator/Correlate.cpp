@@ -0,0 +1,541 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* ngscopeclient                                                                                                        *
+*                                                                                                                      *
+* Copyright (c) 2012-2025 Andrew D. Zonenberg and contributors                                                         *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+/**
+	@file
+	@author Andrew D. Zonenberg
+	@brief Unit test for FFT based deskew correlation
+ */
+#ifdef _CATCH2_V3
+#include <catch2/catch_all.hpp>
+#else
+#include <catch2/catch.hpp>
+#endif
+
+#include "../../lib/scopehal/scopehal.h"
+#include "../../src/ngscopeclient/DeskewCorrelator.h"
+#include <random>
+
+using namespace std;
+
+/**
+	@brief Brute force correlation of two uniform waveforms, as done by the deskew wizard before the FFT engine
+ */
+static vector<double> ReferenceCorrelate(
+	const vector<float>& pri,
+	int64_t ptimescale,
+	const vector<float>& sec,
+	int64_t stimescale,
+	int64_t phase,
+	int64_t maxDelta)
+{
+	vector<double> ret(2*maxDelta, 0);
+	for(int64_t d = -maxDelta; d < maxDelta; d++)
+	{
+		int64_t deltaFs = ptimescale * d + phase;
+		int64_t samplesProcessed = 0;
+		size_t isecondary = 0;
+		double correlation = 0;
+		for(size_t i=0; i<pri.size(); i++)
+		{
+			int64_t target = i * ptimescale + deltaFs;
+			if(target < 0)
+				continue;
+
+			bool done = false;
+			while( (static_cast<int64_t>(isecondary) + 1) * stimescale < target)
+			{
+				isecondary ++;
+				if(isecondary >= sec.size())
+				{
+					done = true;
+					break;
+				}
+			}
+			if(done)
+				break;
+
+			correlation += pri[i] * sec[isecondary];
+			samplesProcessed ++;
+		}
+
+		if(samplesProcessed)
+			ret[d + maxDelta] = correlation / samplesProcessed;
+	}
+	return ret;
+}
+
+/**
+	@brief Generates a zero mean random walk, which has a nice sharp autocorrelation peak
+ */
+static vector<float> RandomWalk(minstd_rand& rng, size_t len)
+{
+	uniform_real_distribution<float> step(-1, 1);
+	vector<float> ret(len);
+	float v = 0;
+	for(size_t i=0; i<len; i++)
+	{
+		v = v*0.95f + step(rng);
+		ret[i] = v;
+	}
+	return ret;
+}
+
+TEST_CASE("DeskewCorrelator_Uniform")
+{
+	//Deterministic PRNG for repeatable testing
+	minstd_rand rng;
+	rng.seed(0);
+
+	const int64_t maxDelta = 1000;
+
+	SECTION("EqualRate")
+	{
+		//Secondary is the primary delayed by 123 samples, with a bit of noise.
+		//Offset by half a sample so the primary doesn't land exactly on secondary sample boundaries.
+		auto sec = RandomWalk(rng, 20000);
+		vector<float> pri(sec.size() - 500);
+		normal_distribution<float> noise(0, 0.05);
+		for(size_t i=0; i<pri.size(); i++)
+			pri[i] = sec[i + 123] + noise(rng);
+
+		DeskewCorrelator corr(maxDelta);
+		vector<float> rsec(corr.GetSecondaryLength(pri.size()));
+		int64_t validStart;
+		int64_t validEnd;
+		DeskewCorrelator::ResampleUniform(
+			sec.data(), sec.size(), 100, 100, 50, -maxDelta, rsec.size(), rsec.data(), validStart, validEnd);
+		corr.Correlate(pri.data(), pri.size(), rsec.data(), validStart, validEnd);
+
+		REQUIRE(corr.GetBestDelta() == 123);
+		REQUIRE(fabs(corr.GetBestDeltaFraction()) < 0.5);
+
+		//Every delay should match the brute force implementation
+		auto expected = ReferenceCorrelate(pri, 100, sec, 100, 50, maxDelta);
+		auto& actual = corr.GetCorrelations();
+		REQUIRE(actual.size() == expected.size());
+		for(size_t i=0; i<expected.size(); i++)
+			REQUIRE(actual[i] == Approx(expected[i]).margin(1e-6));
+	}
+
+	SECTION("UnequalRate")
+	{
+		//Secondary sampled at 1/3 the rate of the primary, with nonzero relative trigger phase
+		auto pri = RandomWalk(rng, 30000);
+		vector<float> sec(pri.size() / 3);
+		for(size_t i=0; i<sec.size(); i++)
+			sec[i] = pri[i*3];
+
+		const int64_t phase = -250;
+
+		DeskewCorrelator corr(maxDelta);
+		vector<float> rsec(corr.GetSecondaryLength(pri.size()));
+		int64_t validStart;
+		int64_t validEnd;
+		DeskewCorrelator::ResampleUniform(
+			sec.data(), sec.size(), 300, 100, phase, -maxDelta, rsec.size(), rsec.data(), validStart, validEnd);
+		corr.Correlate(pri.data(), pri.size(), rsec.data(), validStart, validEnd);
+
+		auto expected = ReferenceCorrelate(pri, 100, sec, 300, phase, maxDelta);
+		auto& actual = corr.GetCorrelations();
+		size_t ibest = 0;
+		for(size_t i=0; i<expected.size(); i++)
+		{
+			REQUIRE(actual[i] == Approx(expected[i]).margin(1e-6));
+			if(expected[i] > expected[ibest])
+				ibest = i;
+		}
+		REQUIRE(corr.GetBestDelta() == static_cast<int64_t>(ibest) - maxDelta);
+	}
+
+	SECTION("SubSample")
+	{
+		//Sum of a few sines, delayed by a fractional number of samples
+		const size_t len = 200000;
+		const double delay = 37.3;
+		uniform_real_distribution<double> freq(0.02, 0.1);
+		uniform_real_distribution<double> phase(0, 2*M_PI);
+		vector<float> pri(len, 0);
+		vector<float> sec(len, 0);
+		for(int k=0; k<8; k++)
+		{
+			double w = freq(rng);
+			double p = phase(rng);
+			for(size_t i=0; i<len; i++)
+			{
+				pri[i] += sin(i*w + p);
+				sec[i] += sin( (i - delay)*w + p);
+			}
+		}
+
+		DeskewCorrelator corr(300);
+		vector<float> rsec(corr.GetSecondaryLength(len));
+		int64_t validStart;
+		int64_t validEnd;
+		DeskewCorrelator::ResampleUniform(
+			sec.data(), sec.size(), 100, 100, 50, -300, rsec.size(), rsec.data(), validStart, validEnd);
+		corr.Correlate(pri.data(), len, rsec.data(), validStart, validEnd);
+
+		REQUIRE(corr.GetBestDelta() + corr.GetBestDeltaFraction() == Approx(delay).margin(0.1));
+	}
+
+	SECTION("NoOverlap")
+	{
+		//Secondary entirely outside the search window, nothing should correlate
+		auto pri = RandomWalk(rng, 1000);
+		DeskewCorrelator corr(100);
+		vector<float> rsec(corr.GetSecondaryLength(pri.size()));
+		int64_t validStart;
+		int64_t validEnd;
+		DeskewCorrelator::ResampleUniform(
+			pri.data(), pri.size(), 100, 100, -1000000, -100, rsec.size(), rsec.data(), validStart, validEnd);
+		REQUIRE(validStart == validEnd);
+		corr.Correlate(pri.data(), pri.size(), rsec.data(), validStart, validEnd);
+		REQUIRE(corr.GetBestCorrelation() == 0);
+	}
+}
+
+TEST_CASE("DeskewCorrelator_Sparse")
+{
+	minstd_rand rng;
+	rng.seed(0);
+
+	//Sparse waveform with unit durations is equivalent to the uniform case
+	auto samples = RandomWalk(rng, 10000);
+	vector<int64_t> offsets(samples.size());
+	vector<int64_t> durations(samples.size(), 1);
+	for(size_t i=0; i<samples.size(); i++)
+		offsets[i] = i;
+
+	const int64_t maxDelta = 500;
+	DeskewCorrelator corr(maxDelta);
+	vector<float> rsec(corr.GetSecondaryLength(samples.size()));
+	int64_t validStart;
+	int64_t validEnd;
+	DeskewCorrelator::ResampleSparse(
+		samples.data(), offsets.data(), durations.data(), samples.size(), 100, 0,
+		100, 0, -maxDelta, rsec.size(), rsec.data(), validStart, validEnd);
+
+	vector<float> usec(corr.GetSecondaryLength(samples.size()));
+	int64_t uvalidStart;
+	int64_t uvalidEnd;
+	DeskewCorrelator::ResampleUniform(
+		samples.data(), samples.size(), 100, 100, 0, -maxDelta, usec.size(), usec.data(), uvalidStart, uvalidEnd);
+
+	REQUIRE(validStart == uvalidStart);
+	REQUIRE(validEnd == uvalidEnd);
+	REQUIRE(rsec == usec);
+
+	//Resample the primary the same way, then the autocorrelation should peak at zero
+	vector<float> pri(samples.size());
+	int64_t pvalidStart;
+	int64_t pvalidEnd;
+	DeskewCorrelator::ResampleSparse(
+		samples.data(), offsets.data(), durations.data(), samples.size(), 100, 0,
+		100, 0, 0, pri.size(), pri.data(), pvalidStart, pvalidEnd);
+	corr.Correlate(pri.data(), pri.size(), rsec.data(), validStart, validEnd);
+	REQUIRE(corr.GetBestDelta() == 0);
+	REQUIRE(corr.GetBestDeltaFraction() == Approx(0).margin(0.01));
+}
+
+/**
+	@brief Brute force correlation of two sparse waveforms, as done by the deskew wizard before the FFT engine
+ */
+static vector<double> ReferenceCorrelateSparse(const DeskewSparseInput& pri, const DeskewSparseInput& sec, int64_t maxDelta)
+{
+	vector<double> ret(2*maxDelta, 0);
+	for(int64_t d = -maxDelta; d < maxDelta; d++)
+	{
+		int64_t deltaFs = pri.m_timescale * d;
+		int64_t samplesProcessed = 0;
+		size_t isecondary = 0;
+		double correlation = 0;
+		for(size_t i=0; i<pri.m_samples.size(); i++)
+		{
+			int64_t start = pri.m_offsets[i] * pri.m_timescale + pri.m_triggerPhase;
+			int64_t target = start + deltaFs;
+			if(target < 0)
+				continue;
+
+			bool done = false;
+			while( (((sec.m_offsets[isecondary] + sec.m_durations[isecondary]) * sec.m_timescale) + sec.m_triggerPhase)
+				< target)
+			{
+				isecondary ++;
+				if(isecondary >= sec.m_samples.size())
+				{
+					done = true;
+					break;
+				}
+			}
+			if(done)
+				break;
+
+			correlation += pri.m_samples[i] * sec.m_samples[isecondary];
+			samplesProcessed ++;
+		}
+
+		if(samplesProcessed)
+			ret[d + maxDelta] = correlation / samplesProcessed;
+	}
+	return ret;
+}
+
+/**
+	@brief Samples a signal (one value per tick) at the given ticks, each sample lasting until the next one
+ */
+static DeskewSparseInput SampleSparse(
+	const vector<float>& signal, const vector<int64_t>& ticks, int64_t timescale, int64_t triggerPhase)
+{
+	DeskewSparseInput ret;
+	ret.m_timescale = timescale;
+	ret.m_triggerPhase = triggerPhase;
+	for(size_t i=0; i<ticks.size(); i++)
+	{
+		ret.m_samples.push_back(signal[ticks[i]]);
+		ret.m_offsets.push_back(ticks[i]);
+		ret.m_durations.push_back( (i+1 < ticks.size()) ? (ticks[i+1] - ticks[i]) : 1);
+	}
+	return ret;
+}
+
+/**
+	@brief Picks ascending ticks in [0, len) with random gaps between minGap and maxGap
+ */
+static vector<int64_t> RandomTicks(minstd_rand& rng, int64_t len, int64_t minGap, int64_t maxGap)
+{
+	uniform_int_distribution<int64_t> gap(minGap, maxGap);
+	vector<int64_t> ret;
+	for(int64_t t = gap(rng); t < len; t += gap(rng))
+		ret.push_back(t);
+	return ret;
+}
+
+/**
+	@brief Checks CorrelateSparse() against the brute force implementation at every delay
+ */
+static void CheckSparse(const DeskewSparseInput& pri, const DeskewSparseInput& sec, int64_t maxDelta)
+{
+	DeskewCorrelator corr(maxDelta);
+	corr.CorrelateSparse(pri, sec);
+
+	auto expected = ReferenceCorrelateSparse(pri, sec, maxDelta);
+	auto& actual = corr.GetCorrelations();
+	REQUIRE(actual.size() == expected.size());
+	size_t ibest = 0;
+	for(size_t i=0; i<expected.size(); i++)
+	{
+		REQUIRE(actual[i] == Approx(expected[i]).margin(1e-6));
+		if(expected[i] > expected[ibest])
+			ibest = i;
+	}
+	REQUIRE(corr.GetBestDelta() == static_cast<int64_t>(ibest) - maxDelta);
+}
+
+TEST_CASE("DeskewCorrelator_SparseGaps")
+{
+	minstd_rand rng;
+	rng.seed(0);
+
+	const int64_t maxDelta = 500;
+	const int64_t len = 40000;
+	auto signal = RandomWalk(rng, len);
+
+	SECTION("Grid")
+	{
+		//Primary has small gaps so it goes on the FFT grid, with more than one tick per sample
+		auto pri = SampleSparse(signal, RandomTicks(rng, len - 1000, 1, 3), 100, 0);
+		REQUIRE(pri.m_offsets.back() - pri.m_offsets[0] + 1 <=
+			DeskewCorrelator::MAX_SPARSE_GRID_RATIO * static_cast<int64_t>(pri.m_samples.size()));
+
+		//Secondary is the same signal 77 ticks later, sampled at different points
+		auto sticks = RandomTicks(rng, len - 100, 1, 2);
+		DeskewSparseInput sec;
+		sec.m_timescale = 100;
+		sec.m_triggerPhase = 0;
+		for(size_t i=0; i+1<sticks.size(); i++)
+		{
+			if(sticks[i] < 77)
+				continue;
+			sec.m_samples.push_back(signal[sticks[i]]);
+			sec.m_offsets.push_back(sticks[i] - 77);
+			sec.m_durations.push_back(sticks[i+1] - sticks[i]);
+		}
+
+		CheckSparse(pri, sec, maxDelta);
+
+		//A secondary sample ending exactly at the target time counts as covering it, so the peak can be a tick early
+		DeskewCorrelator corr(maxDelta);
+		corr.CorrelateSparse(pri, sec);
+		REQUIRE(llabs(corr.GetBestDelta() + 77) <= 1);
+	}
+
+	SECTION("Gappy")
+	{
+		//Short bursts spread over a long capture, too sparse for the grid
+		vector<int64_t> ticks;
+		for(int64_t burst = 0; burst < 8; burst ++)
+		{
+			for(int64_t i=0; i<1000; i++)
+				ticks.push_back(burst*4000 + i);
+		}
+		auto pri = SampleSparse(signal, ticks, 100, 0);
+		for(auto& o : pri.m_offsets)
+			o *= 1000;
+		REQUIRE(pri.m_offsets.back() - pri.m_offsets[0] + 1 >
+			DeskewCorrelator::MAX_SPARSE_GRID_RATIO * static_cast<int64_t>(pri.m_samples.size()));
+
+		auto sec = SampleSparse(signal, RandomTicks(rng, len, 1, 2), 100, 0);
+		for(auto& o : sec.m_offsets)
+			o *= 1000;
+		for(auto& d : sec.m_durations)
+			d *= 1000;
+
+		CheckSparse(pri, sec, maxDelta);
+	}
+
+	SECTION("UnequalRate")
+	{
+		//Secondary at a coarser timescale with a nonzero trigger phase
+		auto pri = SampleSparse(signal, RandomTicks(rng, len - 1000, 1, 2), 100, 30);
+		vector<int64_t> sticks;
+		for(int64_t t=0; t<len; t+=3)
+			sticks.push_back(t);
+		auto sec = SampleSparse(signal, sticks, 100, -250);
+		for(auto& o : sec.m_offsets)
+			o /= 3;
+		sec.m_timescale = 300;
+		for(auto& d : sec.m_durations)
+			d = 1;
+
+		CheckSparse(pri, sec, maxDelta);
+	}
+
+	SECTION("Empty")
+	{
+		DeskewSparseInput pri;
+		auto sec = SampleSparse(signal, RandomTicks(rng, len, 1, 2), 100, 0);
+		DeskewCorrelator corr(maxDelta);
+		corr.CorrelateSparse(pri, sec);
+		REQUIRE(corr.GetBestCorrelation() == 0);
+	}
+}
+
+TEST_CASE("DeskewCorrelator_Cancel")
+{
+	minstd_rand rng;
+	rng.seed(0);
+
+	//A cancelled correlator shouldn't do any of the work, in either the FFT or the direct sparse path
+	auto pri = RandomWalk(rng, 100000);
+	DeskewCorrelator corr(1000);
+	vector<float> sec(corr.GetSecondaryLength(pri.size()));
+	int64_t validStart;
+	int64_t validEnd;
+	DeskewCorrelator::ResampleUniform(
+		pri.data(), pri.size(), 100, 100, 0, -1000, sec.size(), sec.data(), validStart, validEnd);
+
+	corr.Cancel();
+	corr.Correlate(pri.data(), pri.size(), sec.data(), validStart, validEnd);
+	REQUIRE(corr.GetProgress() == 0);
+	REQUIRE(corr.GetBestCorrelation() == 0);
+
+	DeskewSparseInput spri = SampleSparse(pri, {0, 1, 50000, 99999}, 100, 0);
+	corr.CorrelateSparse(spri, spri);
+	REQUIRE(corr.GetProgress() == 0);
+	REQUIRE(corr.GetBestCorrelation() == 0);
+}
+
+TEST_CASE("DeskewCorrelator_SIMD")
+{
+	#ifdef __x86_64__
+	bool reallyHasAvx2 = g_hasAvx2;
+	bool reallyHasFMA = g_hasFMA;
+	bool reallyHasAvx512F = g_hasAvx512F;
+	#endif
+
+	minstd_rand rng;
+	rng.seed(0);
+
+	const int64_t maxDelta = 2000;
+	auto pri = RandomWalk(rng, 100000);
+	DeskewCorrelator corr(maxDelta);
+	vector<float> sec(corr.GetSecondaryLength(pri.size()));
+	int64_t validStart;
+	int64_t validEnd;
+	DeskewCorrelator::ResampleUniform(
+		pri.data(), pri.size(), 100, 100, 4250, -maxDelta, sec.size(), sec.data(), validStart, validEnd);
+
+	//Baseline with no vector extensions
+	#ifdef __x86_64__
+		g_hasAvx2 = false;
+		g_hasFMA = false;
+		g_hasAvx512F = false;
+	#endif
+	double start = GetTime();
+	corr.Correlate(pri.data(), pri.size(), sec.data(), validStart, validEnd);
+	double tbase = GetTime() - start;
+	LogVerbose("CPU (no AVX)  : %6.2f ms\n", tbase * 1000);
+	auto golden = corr.GetCorrelations();
+	REQUIRE(corr.GetBestDelta() == -42);
+
+	#ifdef __x86_64__
+	if(reallyHasAvx2 && reallyHasFMA)
+	{
+		g_hasAvx2 = true;
+		g_hasFMA = true;
+
+		start = GetTime();
+		corr.Correlate(pri.data(), pri.size(), sec.data(), validStart, validEnd);
+		double dt = GetTime() - start;
+		LogVerbose("CPU (FMA)     : %6.2f ms, %.2fx speedup\n", dt * 1000, tbase / dt);
+
+		auto& actual = corr.GetCorrelations();
+		for(size_t i=0; i<golden.size(); i++)
+			REQUIRE(actual[i] == Approx(golden[i]).margin(1e-9));
+	}
+	if(reallyHasAvx512F)
+	{
+		g_hasAvx512F = true;
+
+		start = GetTime();
+		corr.Correlate(pri.data(), pri.size(), sec.data(), validStart, validEnd);
+		double dt = GetTime() - start;
+		LogVerbose("CPU (AVX512F) : %6.2f ms, %.2fx speedup\n", dt * 1000, tbase / dt);
+
+		auto& actual = corr.GetCorrelations();
+		for(size_t i=0; i<golden.size(); i++)
+			REQUIRE(actual[i] == Approx(golden[i]).margin(1e-9));
+	}
+
+	g_hasAvx2 = reallyHasAvx2;
+	g_hasFMA = reallyHasFMA;
+	g_hasAvx512F = reallyHasAvx512F;
+	#endif
+}
@@ -0,0 +1,173 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* ngscopeclient                                                                                                        *
+*                                                                                                                      *
+* Copyright (c) 2012-2025 Andrew D. Zonenberg and contributors                                                         *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+/**
+	@file
+	@author Andrew D. Zonenberg
+	@brief Unit test and benchmark for compiled ProtocolDisplayFilter evaluation
+ */
+#ifdef _CATCH2_V3
+#include <catch2/catch_all.hpp>
+#else
+#include <catch2/catch.hpp>
+#endif
+
+#include "../../lib/scopehal/scopehal.h"
+#include "../../lib/scopehal/PacketDecoder.h"
+#include "../../src/ngscopeclient/ProtocolDisplayFilter.h"
+#include <random>
+
+using namespace std;
+
+/**
+	@brief Makes some packets that look vaguely like a bus decode
+ */
+static vector<unique_ptr<Packet> > MakePackets(size_t npackets)
+{
+	//Deterministic PRNG for repeatable testing
+	minstd_rand rng;
+	rng.seed(0);
+
+	const char* types[] = {"Read", "Write", "Ack", "Nak"};
+	const char* infos[] = {"", "CRC error", "timeout", "ok"};
+	vector<unique_ptr<Packet> > packets;
+	packets.reserve(npackets);
+	for(size_t i=0; i<npackets; i++)
+	{
+		auto pack = make_unique<Packet>();
+		pack->m_offset = i*1000;
+		pack->m_len = 500;
+		pack->m_headers["Type"] = types[rng() % 4];
+		pack->m_headers["Address"] = "0x" + to_string(rng() % 32);
+		pack->m_headers["Length"] = to_string(rng() % 8);
+		pack->m_headers["Info"] = infos[rng() % 4];
+
+		//Leave some headers out to exercise the NaN path
+		if(rng() % 2)
+			pack->m_headers["Sequence Number"] = to_string(rng() % 16);
+
+		size_t len = rng() % 8;
+		for(size_t j=0; j<len; j++)
+			pack->m_data.push_back(rng() % 64);
+
+		packets.push_back(move(pack));
+	}
+
+	return packets;
+}
+
+static const vector<string> g_headers = {"Type", "Address", "Length", "Sequence Number", "Info"};
+
+static const vector<string> g_expressions =
+{
+	"Type == \"Write\"",
+	"Type == \"Write\" && Length == 4",
+	"(Type == \"Write\") && (Length == 4)",
+	"(Type != \"Read\") || (Address startswith \"0x1\")",
+	"Info contains \"err\"",
+	"data[0] == 0x20",
+	"data[Length] == 5",
+	"!(Type == \"Write\") && (SequenceNumber == 3)",
+	"data[1] == data[2] && (Length != 0)",
+	"Length == 1.5 || (Address == \"0x7\")"
+};
+
+TEST_CASE("ProtocolDisplayFilter_Compiled")
+{
+	auto packets = MakePackets(200000);
+
+	for(auto& expr : g_expressions)
+	{
+		size_t i = 0;
+		ProtocolDisplayFilter filter(expr, i);
+		REQUIRE(filter.Validate(g_headers));
+
+		//Compare against the string based tree walking evaluator.
+		//Count mismatches rather than checking each packet, since REQUIRE is slow with hundreds of thousands of them
+		size_t mismatches = 0;
+		for(auto& p : packets)
+		{
+			bool expected = (filter.Evaluate(p.get()) != "0");
+			if(filter.Match(p.get()) != expected)
+				mismatches ++;
+		}
+		if(mismatches)
+			LogNotice("%zu mismatches for \"%s\"\n", mismatches, expr.c_str());
+		REQUIRE(mismatches == 0);
+	}
+}
+
+/**
+	@brief Evaluation time of the compiled filters compared to the tree walking evaluator
+
+	Hidden by default. Run with "[benchmark]" to include it.
+ */
+TEST_CASE("ProtocolDisplayFilter_Compiled_Benchmark", "[.][benchmark]")
+{
+	const size_t npackets = 200000;
+	auto packets = MakePackets(npackets);
+
+	double totalRef = 0;
+	double totalCompiled = 0;
+	for(auto& expr : g_expressions)
+	{
+		size_t i = 0;
+		ProtocolDisplayFilter filter(expr, i);
+		REQUIRE(filter.Validate(g_headers));
+
+		//Reference: string based tree walking evaluator
+		vector<bool> expected;
+		expected.reserve(npackets);
+		double start = GetTime();
+		for(auto& p : packets)
+			expected.push_back(filter.Evaluate(p.get()) != "0");
+		double dtRef = GetTime() - start;
+
+		//Compile once before timing so we only measure evaluation
+		filter.Match(packets[0].get());
+		vector<bool> actual;
+		actual.reserve(npackets);
+		start = GetTime();
+		for(auto& p : packets)
+			actual.push_back(filter.Match(p.get()));
+		double dtCompiled = GetTime() - start;
+
+		REQUIRE(expected == actual);
+		size_t nmatched = count(actual.begin(), actual.end(), true);
+
+		LogNotice("%-50s: %6zu matches, reference %7.2f ms, compiled %7.2f ms (%.2fx speedup)\n",
+			expr.c_str(), nmatched, dtRef*1000, dtCompiled*1000, dtRef / dtCompiled);
+
+		totalRef += dtRef;
+		totalCompiled += dtCompiled;
+	}
+
+	double rate = npackets * g_expressions.size() / totalCompiled;
+	LogNotice("Overall: %.2fx speedup, %.2f M packets/sec compiled\n", totalRef / totalCompiled, rate * 1e-6);
+}
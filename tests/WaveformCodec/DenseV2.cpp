@@ -0,0 +1,398 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* ngscopeclient                                                                                                        *
+*                                                                                                                      *
+* Copyright (c) 2012-2025 Andrew D. Zonenberg and contributors                                                         *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+/**
+	@file
+	@author Andrew D. Zonenberg
+	@brief Unit test and benchmark for densev2 waveform data
+ */
+#ifdef _CATCH2_V3
+#include <catch2/catch_all.hpp>
+#else
+#include <catch2/catch.hpp>
+#endif
+
+#include "../../lib/scopehal/scopehal.h"
+#include "../../src/ngscopeclient/WaveformCodec.h"
+#include <random>
+
+using namespace std;
+
+/**
+	@brief Builds a densev2 file image the same way Session::SerializeUniformWaveform() does
+ */
+template<class T>
+static vector<uint8_t> EncodeDenseV2(const T* samples, size_t nsamples)
+{
+	auto type = is_same_v<T, bool> ? WaveformCodec::DENSEV2_DIGITAL : WaveformCodec::DENSEV2_ANALOG;
+	auto hdr = WaveformCodec::MakeDenseV2Header(type, nsamples);
+
+	int64_t nblocks = hdr.m_nblocks;
+	vector<vector<uint8_t>> blocks(nblocks);
+	#pragma omp parallel for
+	for(int64_t i=0; i<nblocks; i++)
+	{
+		size_t start = i*hdr.m_blockSize;
+		size_t n = min(static_cast<size_t>(hdr.m_blockSize), nsamples - start);
+		if constexpr(is_same_v<T, bool>)
+			WaveformCodec::EncodeDenseV2DigitalBlock(samples + start, n, blocks[i]);
+		else
+			WaveformCodec::EncodeDenseV2AnalogBlock(samples + start, n, blocks[i]);
+	}
+
+	vector<uint64_t> index;
+	uint64_t pos = hdr.m_headerSize + WaveformCodec::DenseV2IndexSize(nblocks);
+	for(auto& b : blocks)
+	{
+		index.push_back(pos);
+		pos += b.size();
+	}
+	index.push_back(pos);
+
+	vector<uint8_t> buf(pos);
+	memcpy(buf.data(), &hdr, sizeof(hdr));
+	memcpy(buf.data() + hdr.m_headerSize, index.data(), index.size() * sizeof(uint64_t));
+	for(int64_t i=0; i<nblocks; i++)
+		memcpy(buf.data() + index[i], blocks[i].data(), blocks[i].size());
+	return buf;
+}
+
+/**
+	@brief Decodes a densev2 file image, checking that it's valid
+ */
+template<class T>
+static void DecodeDenseV2(const vector<uint8_t>& buf, size_t nsamples, T* samples)
+{
+	auto type = is_same_v<T, bool> ? WaveformCodec::DENSEV2_DIGITAL : WaveformCodec::DENSEV2_ANALOG;
+	WaveformCodec::DenseV2Header hdr;
+	REQUIRE(WaveformCodec::ParseDenseV2Header(buf.data(), buf.size(), type, hdr));
+	REQUIRE(hdr.m_nsamples == nsamples);
+
+	if constexpr(is_same_v<T, bool>)
+		REQUIRE(WaveformCodec::DecodeDenseV2Digital(buf.data(), hdr, samples));
+	else
+		REQUIRE(WaveformCodec::DecodeDenseV2Analog(buf.data(), hdr, samples));
+}
+
+/**
+	@brief Generates analog samples the way a scope driver converts ADC codes to volts
+ */
+static vector<float> MakeAdcSamples(size_t nsamples, int bits, minstd_rand& rng)
+{
+	int maxcode = (1 << bits) - 1;
+	float gain = 1.7f / maxcode;
+	float offset = -0.83f;
+
+	vector<float> samples(nsamples);
+	for(size_t i=0; i<nsamples; i++)
+	{
+		int code = maxcode/2 + (maxcode/3) * sin(i * 0.001) + static_cast<int>(rng() % 9) - 4;
+		samples[i] = code * gain + offset;
+	}
+	return samples;
+}
+
+/**
+	@brief Checks that two float arrays are identical, bit for bit
+ */
+static void RequireSameBits(const float* a, const float* b, size_t n)
+{
+	REQUIRE(memcmp(a, b, n * sizeof(float)) == 0);
+}
+
+TEST_CASE("WaveformCodec_DenseV2")
+{
+	//Deterministic PRNG for repeatable testing
+	minstd_rand rng;
+	rng.seed(0);
+
+	SECTION("Analog 8 bit")
+	{
+		const size_t len = 3*1024*1024 + 17;
+		auto samples = MakeAdcSamples(len, 8, rng);
+		auto buf = EncodeDenseV2(samples.data(), len);
+		LogNotice("8-bit ADC data: %zu bytes (%.1f%% of densev1)\n", buf.size(), buf.size() * 100.0 / (len * 4));
+		REQUIRE(buf.size() < len * sizeof(float) * 3 / 10);
+
+		vector<float> decoded(len);
+		DecodeDenseV2(buf, len, decoded.data());
+		RequireSameBits(samples.data(), decoded.data(), len);
+	}
+
+	SECTION("Analog 12 bit")
+	{
+		const size_t len = 2*1024*1024 + 3;
+		auto samples = MakeAdcSamples(len, 12, rng);
+		auto buf = EncodeDenseV2(samples.data(), len);
+		LogNotice("12-bit ADC data: %zu bytes (%.1f%% of densev1)\n", buf.size(), buf.size() * 100.0 / (len * 4));
+		REQUIRE(buf.size() < len * sizeof(float) * 6 / 10);
+
+		vector<float> decoded(len);
+		DecodeDenseV2(buf, len, decoded.data());
+		RequireSameBits(samples.data(), decoded.data(), len);
+	}
+
+	SECTION("Analog unquantized")
+	{
+		//Not on any grid (e.g. filter output) so has to be stored raw
+		const size_t len = 1024*1024 + 1;
+		vector<float> samples(len);
+		for(size_t i=0; i<len; i++)
+			samples[i] = sin(i * 0.0123) * (1 + (rng() % 100000) * 1e-7);
+		auto buf = EncodeDenseV2(samples.data(), len);
+
+		vector<float> decoded(len);
+		DecodeDenseV2(buf, len, decoded.data());
+		RequireSameBits(samples.data(), decoded.data(), len);
+	}
+
+	SECTION("Analog special values")
+	{
+		//A few NaNs, infinities, and negative zeros in otherwise quantized data are stored as exceptions
+		const size_t len = 100000;
+		auto samples = MakeAdcSamples(len, 8, rng);
+		samples[0] = NAN;
+		samples[17] = INFINITY;
+		samples[len-1] = -0.0f;
+		auto buf = EncodeDenseV2(samples.data(), len);
+		REQUIRE(buf.size() < len * sizeof(float) * 3 / 10);
+
+		vector<float> decoded(len);
+		DecodeDenseV2(buf, len, decoded.data());
+		RequireSameBits(samples.data(), decoded.data(), len);
+
+		//and a constant waveform is a single code
+		vector<float> flat(len, 0.25f);
+		buf = EncodeDenseV2(flat.data(), len);
+		REQUIRE(buf.size() < len * 2);
+		DecodeDenseV2(buf, len, decoded.data());
+		RequireSameBits(flat.data(), decoded.data(), len);
+	}
+
+	SECTION("Digital")
+	{
+		//Odd sizes to exercise partial bytes and partial blocks
+		for(size_t len : {0, 1, 7, 9, 1024*1024 + 3})
+		{
+			unique_ptr<bool[]> samples(new bool[len]);
+			for(size_t i=0; i<len; i++)
+				samples[i] = rng() & 1;
+			auto buf = EncodeDenseV2(samples.get(), len);
+			REQUIRE(buf.size() <= len/8 + 256);
+
+			unique_ptr<bool[]> decoded(new bool[len]);
+			DecodeDenseV2(buf, len, decoded.get());
+			REQUIRE(memcmp(samples.get(), decoded.get(), len) == 0);
+		}
+	}
+
+	SECTION("Corrupted files")
+	{
+		const size_t len = 1024*1024 + 5;
+		auto samples = MakeAdcSamples(len, 8, rng);
+		auto buf = EncodeDenseV2(samples.data(), len);
+
+		//Truncation, wrong sample type, or bad magic must be rejected by the header check
+		WaveformCodec::DenseV2Header hdr;
+		REQUIRE(!WaveformCodec::ParseDenseV2Header(buf.data(), buf.size() - 1, WaveformCodec::DENSEV2_ANALOG, hdr));
+		REQUIRE(!WaveformCodec::ParseDenseV2Header(buf.data(), buf.size(), WaveformCodec::DENSEV2_DIGITAL, hdr));
+		REQUIRE(WaveformCodec::ParseDenseV2Header(buf.data(), buf.size(), WaveformCodec::DENSEV2_ANALOG, hdr));
+
+		//Bad block contents must be caught by the decoder
+		uint64_t pos;
+		memcpy(&pos, buf.data() + hdr.m_headerSize, sizeof(pos));
+		buf[pos] = 0xff;
+		vector<float> decoded(len);
+		REQUIRE(!WaveformCodec::DecodeDenseV2Analog(buf.data(), hdr, decoded.data()));
+
+		buf[0] = 'X';
+		REQUIRE(!WaveformCodec::ParseDenseV2Header(buf.data(), buf.size(), WaveformCodec::DENSEV2_ANALOG, hdr));
+	}
+}
+
+/**
+	@brief Compares densev2 against densev1 (a raw copy of the samples) for size and speed
+ */
+template<class T>
+static void BenchmarkDenseV2(const T* samples, size_t nsamples, const char* name)
+{
+	//densev1 is just the raw samples, so saving and loading is a memcpy (plus the I/O)
+	vector<uint8_t> v1(nsamples * sizeof(T));
+	unique_ptr<T[]> decoded(new T[nsamples]);
+	double dtV1Save = 0;
+	double dtV1Load = 0;
+	for(int pass=0; pass<2; pass++)
+	{
+		double start = GetTime();
+		memcpy(v1.data(), samples, v1.size());
+		dtV1Save = GetTime() - start;
+
+		start = GetTime();
+		memcpy(decoded.get(), v1.data(), v1.size());
+		dtV1Load = GetTime() - start;
+	}
+
+	double dtV2Save = 0;
+	double dtV2Load = 0;
+	vector<uint8_t> v2;
+	for(int pass=0; pass<2; pass++)
+	{
+		double start = GetTime();
+		v2 = EncodeDenseV2(samples, nsamples);
+		dtV2Save = GetTime() - start;
+
+		start = GetTime();
+		DecodeDenseV2(v2, nsamples, decoded.get());
+		dtV2Load = GetTime() - start;
+	}
+	REQUIRE(memcmp(samples, decoded.get(), nsamples * sizeof(T)) == 0);
+
+	LogNotice("%-12s %10zu samples: densev1 %8.2f MB, save %7.2f ms, load %7.2f ms; "
+		"densev2 %8.2f MB (%5.1f%%), save %7.2f ms, load %7.2f ms\n",
+		name, nsamples,
+		v1.size() * 1e-6, dtV1Save * 1000, dtV1Load * 1000,
+		v2.size() * 1e-6, v2.size() * 100.0 / v1.size(), dtV2Save * 1000, dtV2Load * 1000);
+}
+
+/**
+	@brief Size and encode/decode time across a range of waveform sizes, compared to densev1
+
+	Hidden by default, since the largest case needs several GB of RAM. Run with "[benchmark]" to include it.
+	Times are in memory only; on disk, densev2 saves the difference in file size worth of I/O.
+ */
+TEST_CASE("WaveformCodec_DenseV2_Benchmark", "[.][benchmark]")
+{
+	minstd_rand rng;
+	rng.seed(0);
+
+	for(size_t nsamples : {1000000, 10000000, 100000000, 500000000})
+	{
+		auto samples = MakeAdcSamples(nsamples, 8, rng);
+		BenchmarkDenseV2(samples.data(), nsamples, "analog 8bit");
+
+		samples = MakeAdcSamples(nsamples, 12, rng);
+		BenchmarkDenseV2(samples.data(), nsamples, "analog 12bit");
+		samples.clear();
+		samples.shrink_to_fit();
+
+		unique_ptr<bool[]> digital(new bool[nsamples]);
+		for(size_t i=0; i<nsamples; i++)
+			digital[i] = (i / (1 + rng() % 64)) & 1;
+		BenchmarkDenseV2(digital.get(), nsamples, "digital");
+	}
+}
+
+/**
+	@brief Evicts a densev2 stream back to the session and reloads it, the way HistoryManager does for
+	TIER_SESSION points
+ */
+TEST_CASE("WaveformCodec_DenseV2_Reload")
+{
+	minstd_rand rng;
+	rng.seed(0);
+
+	REQUIRE(WaveformCodec::IsDenseFormat("densev1"));
+	REQUIRE(WaveformCodec::IsDenseFormat("densev2"));
+	REQUIRE(!WaveformCodec::IsDenseFormat("sparsev1"));
+	REQUIRE(!WaveformCodec::IsDenseFormat("sparsev2"));
+
+	SECTION("Analog")
+	{
+		const size_t len = 100000;
+		auto samples = MakeAdcSamples(len, 8, rng);
+
+		auto wfm = new UniformAnalogWaveform;
+		wfm->m_samples.SetGpuAccessHint(AcceleratorBuffer<float>::HINT_NEVER);
+		wfm->m_timescale = 625;
+		wfm->Resize(len);
+		memcpy(wfm->m_samples.GetCpuPointer(), samples.data(), len * sizeof(float));
+		auto buf = EncodeDenseV2(wfm->m_samples.GetCpuPointer(), len);
+
+		//Evict: a densev2 stream must stay uniform, with its samples freed
+		WaveformBase* target = WaveformCodec::MakeReloadTarget(wfm, WaveformCodec::IsDenseFormat("densev2"));
+		REQUIRE(target == wfm);
+		wfm->m_samples.clear();
+		wfm->m_samples.shrink_to_fit();
+
+		//Reload into the same object
+		wfm->Resize(len);
+		DecodeDenseV2(buf, len, wfm->m_samples.GetCpuPointer());
+		RequireSameBits(samples.data(), wfm->m_samples.GetCpuPointer(), len);
+		REQUIRE(wfm->m_timescale == 625);
+
+		delete wfm;
+	}
+
+	SECTION("Digital")
+	{
+		const size_t len = 4099;
+		unique_ptr<bool[]> samples(new bool[len]);
+		for(size_t i=0; i<len; i++)
+			samples[i] = rng() & 1;
+
+		auto wfm = new UniformDigitalWaveform;
+		wfm->m_samples.SetGpuAccessHint(AcceleratorBuffer<bool>::HINT_NEVER);
+		wfm->Resize(len);
+		memcpy(wfm->m_samples.GetCpuPointer(), samples.get(), len);
+		auto buf = EncodeDenseV2(samples.get(), len);
+
+		REQUIRE(WaveformCodec::MakeReloadTarget(wfm, WaveformCodec::IsDenseFormat("densev2")) == wfm);
+		wfm->m_samples.clear();
+		wfm->m_samples.shrink_to_fit();
+
+		wfm->Resize(len);
+		DecodeDenseV2(buf, len, wfm->m_samples.GetCpuPointer());
+		REQUIRE(memcmp(samples.get(), wfm->m_samples.GetCpuPointer(), len) == 0);
+
+		delete wfm;
+	}
+
+	SECTION("Sparse converted to uniform")
+	{
+		//A sparsev2 stream which was converted to uniform on load has to go back to sparse for the reload
+		auto wfm = new UniformAnalogWaveform;
+		wfm->m_timescale = 625;
+		wfm->m_startTimestamp = 1234;
+		wfm->m_startFemtoseconds = 5678;
+		wfm->m_triggerPhase = 42;
+
+		auto target = WaveformCodec::MakeReloadTarget(wfm, WaveformCodec::IsDenseFormat("sparsev2"));
+		REQUIRE(target != wfm);
+		auto sacap = dynamic_cast<SparseAnalogWaveform*>(target);
+		REQUIRE(sacap != nullptr);
+		REQUIRE(sacap->m_timescale == 625);
+		REQUIRE(sacap->m_startTimestamp == 1234);
+		REQUIRE(sacap->m_startFemtoseconds == 5678);
+		REQUIRE(sacap->m_triggerPhase == 42);
+		REQUIRE(sacap->size() == 0);
+
+		delete wfm;
+		delete target;
+	}
+}
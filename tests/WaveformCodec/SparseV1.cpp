@@ -0,0 +1,204 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* ngscopeclient                                                                                                        *
+*                                                                                                                      *
+* Copyright (c) 2012-2025 Andrew D. Zonenberg and contributors                                                         *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+/**
+	@file
+	@author Andrew D. Zonenberg
+	@brief Unit test and benchmark for unpacking sparsev1 waveform data
+ */
+#ifdef _CATCH2_V3
+#include <catch2/catch_all.hpp>
+#else
+#include <catch2/catch.hpp>
+#endif
+
+#include "../../lib/scopehal/scopehal.h"
+#include "../../src/ngscopeclient/WaveformCodec.h"
+#include <random>
+
+using namespace std;
+
+/**
+	@brief Generates a sparsev1 file image with random contents
+ */
+template<class T>
+static vector<uint8_t> MakeSparseV1(size_t nsamples, minstd_rand& rng)
+{
+	const size_t recordSize = WaveformCodec::SparseV1RecordSize(sizeof(T));
+	vector<uint8_t> buf(nsamples * recordSize);
+
+	int64_t off = 0;
+	for(size_t i=0; i<nsamples; i++)
+	{
+		int64_t dur = 1 + rng() % 100;
+		T sample;
+		if constexpr(is_same_v<T, bool>)
+			sample = rng() % 2;
+		else if constexpr(is_same_v<T, uint64_t>)
+			sample = (static_cast<uint64_t>(rng()) << 32) | rng();
+		else
+			sample = (rng() % 65536) / 100.0f - 300;
+
+		uint8_t* p = &buf[i*recordSize];
+		memcpy(p, &off, sizeof(off));
+		memcpy(p + sizeof(int64_t), &dur, sizeof(dur));
+		memcpy(p + 2*sizeof(int64_t), &sample, sizeof(sample));
+		off += dur;
+	}
+
+	return buf;
+}
+
+/**
+	@brief Unpacks a sparsev1 image one record at a time, the way the loader used to
+ */
+template<class T>
+static void UnpackReference(const vector<uint8_t>& buf, size_t nsamples, int64_t* offsets, int64_t* durations, T* samples)
+{
+	const size_t recordSize = WaveformCodec::SparseV1RecordSize(sizeof(T));
+	for(size_t i=0; i<nsamples; i++)
+	{
+		const uint8_t* p = &buf[i*recordSize];
+		memcpy(offsets + i, p, sizeof(int64_t));
+		memcpy(durations + i, p + sizeof(int64_t), sizeof(int64_t));
+		memcpy(samples + i, p + 2*sizeof(int64_t), sizeof(T));
+	}
+}
+
+/**
+	@brief Unpacks a random sparsev1 image with both implementations, verifies they match, and reports throughput
+ */
+template<class T>
+static void TestUnpack(size_t nsamples, const char* name)
+{
+	//Deterministic PRNG for repeatable testing
+	minstd_rand rng;
+	rng.seed(0);
+	auto buf = MakeSparseV1<T>(nsamples, rng);
+
+	//Use raw arrays for the samples since vector<bool> is bit packed
+	vector<int64_t> refOffsets(nsamples);
+	vector<int64_t> refDurations(nsamples);
+	unique_ptr<T[]> refSamples(new T[nsamples]);
+	double start = GetTime();
+	UnpackReference(buf, nsamples, refOffsets.data(), refDurations.data(), refSamples.get());
+	double dtRef = GetTime() - start;
+
+	vector<int64_t> offsets(nsamples);
+	vector<int64_t> durations(nsamples);
+	unique_ptr<T[]> samples(new T[nsamples]);
+
+	//Run twice, second time for score, so we don't count page faults on the output in the benchmark
+	double dt = 0;
+	for(int pass=0; pass<2; pass++)
+	{
+		start = GetTime();
+		if constexpr(is_same_v<T, bool>)
+			WaveformCodec::UnpackSparseV1Digital(buf.data(), nsamples, offsets.data(), durations.data(), samples.get());
+		else
+			WaveformCodec::UnpackSparseV1Analog(buf.data(), nsamples, offsets.data(), durations.data(), samples.get());
+		dt = GetTime() - start;
+	}
+
+	//Count mismatches rather than checking each sample, since REQUIRE is slow with millions of them
+	size_t mismatches = 0;
+	for(size_t i=0; i<nsamples; i++)
+	{
+		if( (offsets[i] != refOffsets[i]) || (durations[i] != refDurations[i]) || (samples[i] != refSamples[i]) )
+			mismatches ++;
+	}
+	REQUIRE(mismatches == 0);
+
+	double mbytes = buf.size() * 1e-6;
+	LogNotice("%-8s %10zu samples: reference %8.2f ms (%7.1f MB/s), unpacked %8.2f ms (%7.1f MB/s), %.2fx speedup\n",
+		name, nsamples, dtRef*1000, mbytes / dtRef, dt*1000, mbytes / dt, dtRef / dt);
+}
+
+/**
+	@brief Unpacks just the timestamps of a random sparsev1 image with 8-byte samples (as used for CAN captures) and
+	verifies they match the reference
+ */
+static void TestUnpackTimestamps(size_t nsamples)
+{
+	minstd_rand rng;
+	rng.seed(0);
+	auto buf = MakeSparseV1<uint64_t>(nsamples, rng);
+
+	vector<int64_t> refOffsets(nsamples);
+	vector<int64_t> refDurations(nsamples);
+	vector<uint64_t> refSamples(nsamples);
+	UnpackReference(buf, nsamples, refOffsets.data(), refDurations.data(), refSamples.data());
+
+	vector<int64_t> offsets(nsamples);
+	vector<int64_t> durations(nsamples);
+	WaveformCodec::UnpackSparseV1Timestamps(
+		buf.data(),
+		nsamples,
+		WaveformCodec::SparseV1RecordSize(sizeof(uint64_t)),
+		offsets.data(),
+		durations.data());
+
+	size_t mismatches = 0;
+	for(size_t i=0; i<nsamples; i++)
+	{
+		if( (offsets[i] != refOffsets[i]) || (durations[i] != refDurations[i]) )
+			mismatches ++;
+	}
+	REQUIRE(mismatches == 0);
+}
+
+TEST_CASE("WaveformCodec_SparseV1")
+{
+	//Odd sizes to exercise the scalar tails of the vector loops and partial chunks
+	for(size_t nsamples : {0, 1, 7, 1000003, 4*1024*1024 + 5})
+	{
+		TestUnpack<float>(nsamples, "analog");
+		TestUnpack<bool>(nsamples, "digital");
+	}
+}
+
+TEST_CASE("WaveformCodec_SparseV1_Timestamps")
+{
+	for(size_t nsamples : {0, 1, 7, 1000003, 4*1024*1024 + 5})
+		TestUnpackTimestamps(nsamples);
+}
+
+/**
+	@brief Throughput across a range of file sizes
+
+	Hidden by default, since the largest case needs tens of GB of RAM. Run with "[benchmark]" to include it.
+ */
+TEST_CASE("WaveformCodec_SparseV1_Benchmark", "[.][benchmark]")
+{
+	for(size_t nsamples : {1000000, 10000000, 100000000, 1000000000})
+	{
+		TestUnpack<float>(nsamples, "analog");
+		TestUnpack<bool>(nsamples, "digital");
+	}
+}
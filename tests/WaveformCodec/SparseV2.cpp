@@ -0,0 +1,120 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* ngscopeclient                                                                                                        *
+*                                                                                                                      *
+* Copyright (c) 2012-2025 Andrew D. Zonenberg and contributors                                                         *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+/**
+	@file
+	@author Andrew D. Zonenberg
+	@brief Unit test for sparsev2 headers and offset encoding
+ */
+#ifdef _CATCH2_V3
+#include <catch2/catch_all.hpp>
+#else
+#include <catch2/catch.hpp>
+#endif
+
+#include "../../lib/scopehal/scopehal.h"
+#include "../../src/ngscopeclient/WaveformCodec.h"
+#include <random>
+
+using namespace std;
+
+TEST_CASE("WaveformCodec_VarintDeltas")
+{
+	//Deterministic PRNG for repeatable testing
+	minstd_rand rng;
+	rng.seed(0);
+
+	//Mostly small steps (as seen in nearly uniform data) with the occasional huge gap
+	const size_t len = 1000000;
+	vector<int64_t> offsets(len);
+	int64_t off = 0;
+	for(size_t i=0; i<len; i++)
+	{
+		if( (rng() % 1000) == 0)
+			off += static_cast<int64_t>(rng()) << 8;
+		else
+			off += rng() % 3;
+		offsets[i] = off;
+	}
+
+	//Encode in uneven blocks to check that deltas carry across block boundaries
+	size_t expectedSize = WaveformCodec::GetVarintDeltaSize(offsets.data(), len);
+	REQUIRE(expectedSize < len * sizeof(int64_t));
+	vector<uint8_t> encoded(len * WaveformCodec::MAX_VARINT_SIZE);
+	size_t nbytes = 0;
+	for(size_t i=0; i<len; i += 65537)
+	{
+		size_t end = min(len, i + 65537);
+		nbytes += WaveformCodec::EncodeVarintDeltas(offsets.data(), i, end, encoded.data() + nbytes);
+	}
+	REQUIRE(nbytes == expectedSize);
+
+	vector<int64_t> decoded(len);
+	REQUIRE(WaveformCodec::DecodeVarintDeltas(encoded.data(), nbytes, len, decoded.data()));
+	REQUIRE(decoded == offsets);
+
+	//Truncated data must be rejected, not read past the end
+	REQUIRE(!WaveformCodec::DecodeVarintDeltas(encoded.data(), nbytes - 1, len, decoded.data()));
+
+	//Decreasing offsets can't be delta encoded
+	offsets[len/2] = -1;
+	REQUIRE(WaveformCodec::GetVarintDeltaSize(offsets.data(), len) == SIZE_MAX);
+}
+
+TEST_CASE("WaveformCodec_SparseV2Header")
+{
+	const size_t nsamples = 12345;
+	auto hdr = WaveformCodec::MakeSparseV2Header(
+		nsamples, sizeof(float), WaveformCodec::OFFSETS_DELTA_VARINT, 20000);
+
+	//Columns must be aligned and must not overlap
+	for(int i=0; i<WaveformCodec::COLUMN_COUNT; i++)
+	{
+		REQUIRE( (hdr.m_columnStart[i] % WaveformCodec::SPARSEV2_ALIGN) == 0);
+		if(i > 0)
+			REQUIRE(hdr.m_columnStart[i] >= hdr.m_columnStart[i-1] + hdr.m_columnSize[i-1]);
+	}
+	REQUIRE(hdr.m_columnStart[0] >= sizeof(hdr));
+
+	//Build a file image and parse it back
+	size_t len = hdr.m_columnStart[WaveformCodec::COLUMN_SAMPLES] + hdr.m_columnSize[WaveformCodec::COLUMN_SAMPLES];
+	vector<uint8_t> file(len);
+	memcpy(file.data(), &hdr, sizeof(hdr));
+
+	WaveformCodec::SparseV2Header parsed;
+	REQUIRE(WaveformCodec::ParseSparseV2Header(file.data(), len, sizeof(float), parsed));
+	REQUIRE(parsed.m_nsamples == nsamples);
+	REQUIRE(parsed.m_offsetEncoding == WaveformCodec::OFFSETS_DELTA_VARINT);
+
+	//Wrong sample type, truncated file, or bad magic must be rejected
+	REQUIRE(!WaveformCodec::ParseSparseV2Header(file.data(), len, sizeof(bool), parsed));
+	REQUIRE(!WaveformCodec::ParseSparseV2Header(file.data(), len - 1, sizeof(float), parsed));
+	file[0] = 'X';
+	REQUIRE(!WaveformCodec::ParseSparseV2Header(file.data(), len, sizeof(float), parsed));
+}
@@ -0,0 +1,132 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* ngscopeclient                                                                                                        *
+*                                                                                                                      *
+* Copyright (c) 2012-2025 Andrew D. Zonenberg and contributors                                                         *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+/**
+	@file
+	@author Andrew D. Zonenberg
+	@brief Tests of the SparseIndexBuffer shader against the CPU binary search it replaces
+
+	Run on a software Vulkan device (e.g. lavapipe) in CI:
+
+		VK_LOADER_DRIVERS_SELECT='*lvp*' ./WaveformRendering
+ */
+#ifdef _CATCH2_V3
+#include <catch2/catch_all.hpp>
+#else
+#include <catch2/catch.hpp>
+#endif
+
+#include "../../lib/scopehal/scopehal.h"
+#include <random>
+
+using namespace std;
+
+/**
+	@brief Push constants for SparseIndexBuffer (same layout as SparseIndexBufferArgs in ngscopeclient)
+ */
+struct IndexArgs
+{
+	uint32_t memDepth;
+	uint32_t width;
+};
+
+TEST_CASE("SparseIndexBuffer")
+{
+	shared_ptr<QueueHandle> queue(g_vkQueueManager->GetComputeQueue("SparseIndexBuffer.queue"));
+	vk::CommandPoolCreateInfo poolInfo(
+		vk::CommandPoolCreateFlagBits::eTransient | vk::CommandPoolCreateFlagBits::eResetCommandBuffer,
+		queue->m_family );
+	vk::raii::CommandPool pool(*g_vkComputeDevice, poolInfo);
+
+	vk::CommandBufferAllocateInfo bufinfo(*pool, vk::CommandBufferLevel::ePrimary, 1);
+	vk::raii::CommandBuffer cmdbuf(std::move(vk::raii::CommandBuffers(*g_vkComputeDevice, bufinfo).front()));
+
+	ComputePipeline pipe("shaders/SparseIndexBuffer.spv", 3, sizeof(IndexArgs));
+
+	//Random sparse offsets, starting negative (pre-trigger) and with gaps of varying size
+	const size_t len = 100000;
+	minstd_rand rng;
+	rng.seed(0);
+	uniform_int_distribution<int64_t> step(1, 1000);
+
+	AcceleratorBuffer<int64_t> offsets;
+	offsets.resize(len);
+	offsets.PrepareForCpuAccess();
+	int64_t off = -5000000;
+	for(size_t i=0; i<len; i++)
+	{
+		offsets[i] = off;
+		off += step(rng);
+	}
+	offsets.MarkModifiedFromCpu();
+
+	//Columns are computed the same way as the renderer does.
+	//Cover the view starting before the first sample, in the middle, and running off the end of the waveform
+	const size_t w = 1920;
+	AcceleratorBuffer<int64_t> targets;
+	targets.resize(w);
+	AcceleratorBuffer<uint32_t> xind;
+	xind.resize(w);
+
+	const double xscales[] = {0.0001, 0.01, 1, 7.3};
+	const int64_t offsetSamples[] = {-10000000, -12345, 0, 21000000, 49000000, 60000000};
+	for(auto xscale : xscales)
+	{
+		for(auto offsetSample : offsetSamples)
+		{
+			targets.PrepareForCpuAccess();
+			for(size_t i=0; i<w; i++)
+				targets[i] = floor(i / xscale) + offsetSample;
+			targets.MarkModifiedFromCpu();
+
+			cmdbuf.begin({});
+			pipe.BindBufferNonblocking(0, xind, cmdbuf, true);
+			pipe.BindBufferNonblocking(1, offsets, cmdbuf);
+			pipe.BindBufferNonblocking(2, targets, cmdbuf);
+			IndexArgs args = {static_cast<uint32_t>(len), static_cast<uint32_t>(w)};
+			pipe.Dispatch(cmdbuf, args, GetComputeBlockCount(w, 64));
+			cmdbuf.end();
+			queue->SubmitAndBlock(cmdbuf);
+			xind.MarkModifiedFromGpu();
+
+			xind.PrepareForCpuAccess();
+			offsets.PrepareForCpuAccess();
+			for(size_t i=0; i<w; i++)
+			{
+				auto expected = BinarySearchForGequal(offsets.GetCpuPointer(), len, targets[i]);
+				if(xind[i] != expected)
+				{
+					LogError("xscale %f, offset %" PRIi64 ", column %zu: got %u, expected %zu\n",
+						xscale, offsetSample, i, xind[i], expected);
+				}
+				REQUIRE(xind[i] == expected);
+			}
+		}
+	}
+}
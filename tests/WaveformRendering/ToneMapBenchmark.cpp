@@ -0,0 +1,244 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* ngscopeclient                                                                                                        *
+*                                                                                                                      *
+* Copyright (c) 2012-2025 Andrew D. Zonenberg and contributors                                                         *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+/**
+	@file
+	@author Andrew D. Zonenberg
+	@brief Benchmark of the WaveformToneMap shader for each texture and rasterized waveform format
+
+	Hidden by default since timings on software renderers aren't meaningful. To run it anyway:
+
+		./WaveformRendering "[benchmark]"
+ */
+#ifdef _CATCH2_V3
+#include <catch2/catch_all.hpp>
+#else
+#include <catch2/catch.hpp>
+#endif
+
+#include "../../lib/scopehal/scopehal.h"
+
+using namespace std;
+
+/**
+	@brief Push constants for WaveformToneMap (same layout as WaveformToneMapArgs in ngscopeclient)
+ */
+struct ToneMapArgs
+{
+	float red;
+	float green;
+	float blue;
+	uint32_t width;
+	uint32_t height;
+};
+
+/**
+	@brief Finds a device local memory type compatible with the given requirements
+ */
+static uint32_t FindDeviceLocalMemoryType(const vk::MemoryRequirements& req)
+{
+	auto memProperties = g_vkComputePhysicalDevice->getMemoryProperties();
+	for(uint32_t i=0; i<32; i++)
+	{
+		if(!(memProperties.memoryTypes[i].propertyFlags & vk::MemoryPropertyFlagBits::eDeviceLocal))
+			continue;
+		if(req.memoryTypeBits & (1 << i) )
+			return i;
+	}
+	return 0;
+}
+
+TEST_CASE("WaveformToneMap_Benchmark", "[.][benchmark]")
+{
+	shared_ptr<QueueHandle> queue(g_vkQueueManager->GetComputeQueue("WaveformToneMap_Benchmark.queue"));
+	vk::CommandPoolCreateInfo poolInfo(
+		vk::CommandPoolCreateFlagBits::eTransient | vk::CommandPoolCreateFlagBits::eResetCommandBuffer,
+		queue->m_family );
+	vk::raii::CommandPool pool(*g_vkComputeDevice, poolInfo);
+
+	vk::CommandBufferAllocateInfo bufinfo(*pool, vk::CommandBufferLevel::ePrimary, 1);
+	vk::raii::CommandBuffer cmdbuf(std::move(vk::raii::CommandBuffers(*g_vkComputeDevice, bufinfo).front()));
+
+	//One full screen waveform area on a 4K display
+	const uint32_t w = 3840;
+	const uint32_t h = 2160;
+	const int iterations = 100;
+
+	//Rasterized waveform at full and half precision, with the same (arbitrary) intensity in every pixel.
+	//0x3800 is 0.5 in fp16, and each word holds two vertically adjacent pixels.
+	AcceleratorBuffer<float> fp32Pixels;
+	fp32Pixels.SetGpuAccessHint(AcceleratorBuffer<float>::HINT_LIKELY);
+	fp32Pixels.resize(w*h);
+	fp32Pixels.PrepareForCpuAccess();
+	for(size_t i=0; i<fp32Pixels.size(); i++)
+		fp32Pixels[i] = 0.5;
+	fp32Pixels.MarkModifiedFromCpu();
+	fp32Pixels.PrepareForGpuAccess();
+
+	AcceleratorBuffer<uint32_t> fp16Pixels;
+	fp16Pixels.SetGpuAccessHint(AcceleratorBuffer<uint32_t>::HINT_LIKELY);
+	fp16Pixels.resize(w * ((h+1) / 2));
+	fp16Pixels.PrepareForCpuAccess();
+	for(size_t i=0; i<fp16Pixels.size(); i++)
+		fp16Pixels[i] = 0x38003800;
+	fp16Pixels.MarkModifiedFromCpu();
+	fp16Pixels.PrepareForGpuAccess();
+
+	//Same configuration as the TextureManager sampler
+	vk::SamplerCreateInfo sinfo(
+		{},
+		vk::Filter::eLinear,
+		vk::Filter::eLinear,
+		vk::SamplerMipmapMode::eLinear,
+		vk::SamplerAddressMode::eRepeat,
+		vk::SamplerAddressMode::eRepeat,
+		vk::SamplerAddressMode::eRepeat,
+		{},
+		{},
+		1.0,
+		{},
+		vk::CompareOp::eNever,
+		-1000,
+		1000
+	);
+	vk::raii::Sampler sampler(*g_vkComputeDevice, sinfo);
+
+	struct Variant
+	{
+		const char* name;
+		vk::Format format;
+		bool fp16;
+	};
+	const Variant variants[] =
+	{
+		{ "rgba32f",	vk::Format::eR32G32B32A32Sfloat,	false },
+		{ "rgba16f",	vk::Format::eR16G16B16A16Sfloat,	false },
+		{ "rgba8",		vk::Format::eR8G8B8A8Unorm,			false },
+		{ "rgba32f",	vk::Format::eR32G32B32A32Sfloat,	true },
+		{ "rgba16f",	vk::Format::eR16G16B16A16Sfloat,	true },
+		{ "rgba8",		vk::Format::eR8G8B8A8Unorm,			true }
+	};
+
+	double tbase = 0;
+	size_t bytesBase = 0;
+	for(auto& v : variants)
+	{
+		//Make the output texture
+		vk::ImageCreateInfo imageInfo(
+			{},
+			vk::ImageType::e2D,
+			v.format,
+			vk::Extent3D(w, h, 1),
+			1,
+			1,
+			vk::SampleCountFlagBits::e1,
+			vk::ImageTiling::eOptimal,
+			vk::ImageUsageFlagBits::eStorage | vk::ImageUsageFlagBits::eSampled,
+			vk::SharingMode::eExclusive,
+			{},
+			vk::ImageLayout::eUndefined
+			);
+		vk::raii::Image image(*g_vkComputeDevice, imageInfo);
+		auto req = image.getMemoryRequirements();
+		vk::raii::DeviceMemory mem(*g_vkComputeDevice, vk::MemoryAllocateInfo(req.size, FindDeviceLocalMemoryType(req)));
+		image.bindMemory(*mem, 0);
+
+		vk::ImageViewCreateInfo vinfo(
+			{},
+			*image,
+			vk::ImageViewType::e2D,
+			v.format,
+			{},
+			vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1)
+			);
+		vk::raii::ImageView view(*g_vkComputeDevice, vinfo);
+
+		string path = string("shaders/WaveformToneMap.") + (v.fp16 ? "fp16." : "") + v.name + ".spv";
+		ComputePipeline pipe(path, 1, sizeof(ToneMapArgs), 1);
+
+		//Convert the texture to general layout and warm up the pipeline
+		vk::ImageMemoryBarrier barrier(
+			vk::AccessFlagBits::eNone,
+			vk::AccessFlagBits::eShaderWrite,
+			vk::ImageLayout::eUndefined,
+			vk::ImageLayout::eGeneral,
+			VK_QUEUE_FAMILY_IGNORED,
+			VK_QUEUE_FAMILY_IGNORED,
+			*image,
+			vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1));
+		ToneMapArgs args = {1, 1, 0, w, h};
+
+		cmdbuf.begin({});
+		cmdbuf.pipelineBarrier(
+			vk::PipelineStageFlagBits::eTopOfPipe,
+			vk::PipelineStageFlagBits::eComputeShader,
+			{},
+			{},
+			{},
+			barrier);
+		if(v.fp16)
+			pipe.BindBufferNonblocking(0, fp16Pixels, cmdbuf);
+		else
+			pipe.BindBufferNonblocking(0, fp32Pixels, cmdbuf);
+		pipe.BindStorageImage(1, *sampler, *view, vk::ImageLayout::eGeneral);
+		pipe.Dispatch(cmdbuf, args, GetComputeBlockCount(w, 64), h);
+		cmdbuf.end();
+		queue->SubmitAndBlock(cmdbuf);
+
+		//Back to back tone maps in one command buffer so submission overhead doesn't dominate
+		double start = GetTime();
+		cmdbuf.begin({});
+		for(int i=0; i<iterations; i++)
+		{
+			pipe.Dispatch(cmdbuf, args, GetComputeBlockCount(w, 64), h);
+			pipe.AddComputeMemoryBarrier(cmdbuf);
+		}
+		cmdbuf.end();
+		queue->SubmitAndBlock(cmdbuf);
+		double dt = (GetTime() - start) / iterations;
+
+		//Everything the tone map touches: the rasterized waveform it reads and the texture it writes
+		size_t bufferBytes = v.fp16 ? (fp16Pixels.size() * sizeof(uint32_t)) : (fp32Pixels.size() * sizeof(float));
+		size_t bytes = bufferBytes + req.size;
+		if(tbase == 0)
+		{
+			tbase = dt;
+			bytesBase = bytes;
+		}
+
+		LogVerbose("%-4s -> %-7s: %7.3f ms (%.2fx speedup), %6.1f MB buffer + %6.1f MB texture (%.2fx smaller)\n",
+			v.fp16 ? "fp16" : "fp32",
+			v.name,
+			dt * 1000,
+			tbase / dt,
+			bufferBytes * 1e-6,
+			req.size * 1e-6,
+			bytesBase * 1.0 / bytes);
+	}
+}
@@ -0,0 +1,361 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* ngscopeclient                                                                                                        *
+*                                                                                                                      *
+* Copyright (c) 2012-2025 Andrew D. Zonenberg and contributors                                                         *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+/**
+	@file
+	@author Andrew D. Zonenberg
+	@brief Tests of the WaveformPyramid shader, and of drawing zoomed out waveforms from the pyramid it builds
+
+	Run on a software Vulkan device (e.g. lavapipe) in CI:
+
+		VK_LOADER_DRIVERS_SELECT='*lvp*' ./WaveformRendering
+ */
+#ifdef _CATCH2_V3
+#include <catch2/catch_all.hpp>
+#else
+#include <catch2/catch.hpp>
+#endif
+
+#include "../../lib/scopehal/scopehal.h"
+#include <random>
+
+using namespace std;
+
+//Must match WaveformArea.h
+#define PYRAMID_BASE_BLOCK 64
+#define PYRAMID_FANOUT 8
+#define PYRAMID_MIN_BLOCKS 16
+#define PYRAMID_MAX_LEVELS 8
+
+/**
+	@brief Push constants for WaveformPyramid (same layout as WaveformPyramidArgs in ngscopeclient)
+ */
+struct PyramidArgs
+{
+	uint32_t numSegments;
+	uint32_t level;
+	uint32_t srcOffset;
+	uint32_t dstOffset;
+	uint32_t numBlocks;
+	uint32_t numSrcBlocks;
+};
+
+/**
+	@brief Push constants for waveform-compute (same layout as ConfigPushConstants in ngscopeclient)
+ */
+struct RasterArgs
+{
+	int64_t innerXoff;
+	uint32_t windowHeight;
+	uint32_t windowWidth;
+	uint32_t memDepth;
+	uint32_t offset_samples;
+	float alpha;
+	float xoff;
+	float xscale;
+	float ybase;
+	float yscale;
+	float yoff;
+	float persistScale;
+	uint32_t pyramidLevels;
+};
+
+/**
+	@brief Command pool and buffer for running one shader at a time
+ */
+class PyramidTestContext
+{
+public:
+	PyramidTestContext()
+	: m_queue(g_vkQueueManager->GetComputeQueue("WaveformPyramid.queue"))
+	, m_pool(*g_vkComputeDevice, vk::CommandPoolCreateInfo(
+		vk::CommandPoolCreateFlagBits::eTransient | vk::CommandPoolCreateFlagBits::eResetCommandBuffer,
+		m_queue->m_family))
+	, m_cmdbuf(std::move(vk::raii::CommandBuffers(*g_vkComputeDevice,
+		vk::CommandBufferAllocateInfo(*m_pool, vk::CommandBufferLevel::ePrimary, 1)).front()))
+	{}
+
+	shared_ptr<QueueHandle> m_queue;
+	vk::raii::CommandPool m_pool;
+	vk::raii::CommandBuffer m_cmdbuf;
+};
+
+/**
+	@brief Builds the pyramid for a waveform the same way DisplayedChannel::UpdatePyramid() does
+
+	@return Number of blocks in each level
+ */
+static vector<uint32_t> BuildPyramid(
+	PyramidTestContext& ctx,
+	AcceleratorBuffer<float>& samples,
+	AcceleratorBuffer<float>& pyramid)
+{
+	uint32_t nseg = samples.size() - 1;
+	vector<uint32_t> blockCounts;
+	size_t blocksize = PYRAMID_BASE_BLOCK;
+	size_t total = 0;
+	while( (blockCounts.size() < PYRAMID_MAX_LEVELS) && (blocksize * PYRAMID_MIN_BLOCKS <= nseg) )
+	{
+		size_t nblocks = (nseg + blocksize - 1) / blocksize;
+		blockCounts.push_back(nblocks);
+		total += nblocks;
+		blocksize *= PYRAMID_FANOUT;
+	}
+	pyramid.resize(max(total, (size_t)1) * 3);
+
+	ComputePipeline pipe("shaders/WaveformPyramid.spv", 2, sizeof(PyramidArgs));
+	ctx.m_cmdbuf.begin({});
+	uint32_t srcOffset = 0;
+	uint32_t dstOffset = 0;
+	for(uint32_t level = 0; level < blockCounts.size(); level++)
+	{
+		pipe.BindBufferNonblocking(0, pyramid, ctx.m_cmdbuf);
+		pipe.BindBufferNonblocking(1, samples, ctx.m_cmdbuf);
+		PyramidArgs args =
+		{
+			nseg,
+			level,
+			srcOffset,
+			dstOffset,
+			blockCounts[level],
+			(level == 0) ? nseg : blockCounts[level-1]
+		};
+		const uint32_t compute_block_count = GetComputeBlockCount(blockCounts[level], 64);
+		pipe.Dispatch(ctx.m_cmdbuf, args, min(compute_block_count, 32768u), compute_block_count / 32768 + 1);
+		pipe.AddComputeMemoryBarrier(ctx.m_cmdbuf);
+
+		srcOffset = dstOffset;
+		dstOffset += blockCounts[level];
+	}
+	ctx.m_cmdbuf.end();
+	ctx.m_queue->SubmitAndBlock(ctx.m_cmdbuf);
+	pyramid.MarkModifiedFromGpu();
+
+	return blockCounts;
+}
+
+/**
+	@brief Generates a zero mean random walk with some large excursions, so blocks have a range of heights
+ */
+static void RandomWalk(AcceleratorBuffer<float>& samples, size_t len)
+{
+	minstd_rand rng;
+	rng.seed(0);
+	uniform_real_distribution<float> step(-0.01, 0.01);
+
+	samples.resize(len);
+	samples.PrepareForCpuAccess();
+	float v = 0;
+	for(size_t i=0; i<len; i++)
+	{
+		v = v*0.999f + step(rng);
+		if( (i % 100000) == 50000)
+			v += 0.5f;
+		samples[i] = v;
+	}
+	samples.MarkModifiedFromCpu();
+}
+
+TEST_CASE("WaveformPyramid_Build")
+{
+	PyramidTestContext ctx;
+
+	//Not a multiple of the block size at any level
+	const size_t len = 3*1024*1024 + 17;
+	AcceleratorBuffer<float> samples;
+	RandomWalk(samples, len);
+
+	AcceleratorBuffer<float> pyramid;
+	auto blockCounts = BuildPyramid(ctx, samples, pyramid);
+	REQUIRE(blockCounts.size() == 4);
+
+	//Level 0 from the samples, then each level from the one below it, in the same order as the shader
+	samples.PrepareForCpuAccess();
+	pyramid.PrepareForCpuAccess();
+	size_t nseg = len - 1;
+	vector<float> expected;
+	for(size_t start = 0; start < nseg; start += PYRAMID_BASE_BLOCK)
+	{
+		size_t end = min(start + PYRAMID_BASE_BLOCK, nseg);
+		float vmin = samples[start];
+		float vmax = samples[start];
+		float tv = 0;
+		for(size_t i=start+1; i<=end; i++)
+		{
+			vmin = min(vmin, samples[i]);
+			vmax = max(vmax, samples[i]);
+			tv += fabs(samples[i] - samples[i-1]);
+		}
+		expected.push_back(vmin);
+		expected.push_back(vmax);
+		expected.push_back(tv);
+	}
+	size_t srcOffset = 0;
+	for(size_t level = 1; level < blockCounts.size(); level++)
+	{
+		size_t nsrc = blockCounts[level-1];
+		for(size_t start = 0; start < nsrc; start += PYRAMID_FANOUT)
+		{
+			size_t end = min(start + PYRAMID_FANOUT, nsrc);
+			size_t base = (srcOffset + start) * 3;
+			float vmin = expected[base];
+			float vmax = expected[base + 1];
+			float tv = expected[base + 2];
+			for(size_t i=start+1; i<end; i++)
+			{
+				base = (srcOffset + i) * 3;
+				vmin = min(vmin, expected[base]);
+				vmax = max(vmax, expected[base + 1]);
+				tv += expected[base + 2];
+			}
+			expected.push_back(vmin);
+			expected.push_back(vmax);
+			expected.push_back(tv);
+		}
+		srcOffset += nsrc;
+	}
+
+	//Min and max are exact, total variation may be rounded differently on the GPU
+	REQUIRE(pyramid.size() == expected.size());
+	for(size_t i=0; i<expected.size(); i += 3)
+	{
+		REQUIRE(pyramid[i] == expected[i]);
+		REQUIRE(pyramid[i+1] == expected[i+1]);
+		REQUIRE(pyramid[i+2] == Approx(expected[i+2]).epsilon(1e-4));
+	}
+}
+
+TEST_CASE("WaveformPyramid_Rasterize")
+{
+	PyramidTestContext ctx;
+
+	const size_t len = 8*1024*1024;
+	AcceleratorBuffer<float> samples;
+	RandomWalk(samples, len);
+
+	AcceleratorBuffer<float> pyramid;
+	auto blockCounts = BuildPyramid(ctx, samples, pyramid);
+
+	//Draw a zoomed out view, 16K segments per column, from the pyramid.
+	//Same constants as WaveformArea::RasterizeAnalogOrDigitalWaveform() with no offset or trigger phase.
+	const uint32_t w = 512;
+	const uint32_t h = 400;
+	RasterArgs args;
+	args.innerXoff = 0;
+	args.windowHeight = h;
+	args.windowWidth = w;
+	args.memDepth = len;
+	args.offset_samples = -2;
+	args.alpha = 1;
+	args.xoff = 0;
+	args.xscale = static_cast<float>(w) / len;
+	args.ybase = h * 0.5f;
+	args.yscale = 40;
+	args.yoff = 0;
+	args.persistScale = 0;
+	args.pyramidLevels = blockCounts.size();
+
+	ComputePipeline pipe("shaders/waveform-compute.analog.dense.spv", 3, sizeof(RasterArgs));
+	AcceleratorBuffer<float> out;
+	out.resize(w*h);
+	ctx.m_cmdbuf.begin({});
+	pipe.BindBufferNonblocking(0, out, ctx.m_cmdbuf, true);
+	pipe.BindBufferNonblocking(1, samples, ctx.m_cmdbuf);
+	pipe.BindBufferNonblocking(2, pyramid, ctx.m_cmdbuf);
+	pipe.Dispatch(ctx.m_cmdbuf, args, w, 1, 1);
+	ctx.m_cmdbuf.end();
+	ctx.m_queue->SubmitAndBlock(ctx.m_cmdbuf);
+	out.MarkModifiedFromGpu();
+	out.PrepareForCpuAccess();
+	samples.PrepareForCpuAccess();
+
+	//Compare each column against drawing its segments one at a time on the CPU, the same way the shader's normal
+	//path does. (The normal path itself isn't a good reference on a software device, since how far it gets before
+	//its early exit depends on how the invocations of a workgroup are scheduled.)
+	//Column 0 starts before the first sample so isn't drawn from the pyramid.
+	size_t nseg = len - 1;
+	for(uint32_t x=1; x<w; x++)
+	{
+		int envMin = h;
+		int envMax = -1;
+		double expectedSum = 0;
+		size_t first = max(floor(x / args.xscale), 1.0) - 1;
+		size_t last = min(static_cast<size_t>(floor((x + 1) / args.xscale)) + 2, nseg);
+		for(size_t i=first; i<last; i++)
+		{
+			float lx = i * args.xscale;
+			float rx = (i+1) * args.xscale;
+			float ly = (samples[i] + args.yoff)*args.yscale + args.ybase;
+			float ry = (samples[i+1] + args.yoff)*args.yscale + args.ybase;
+			if( (rx < x) || (lx > x + 1) )
+				continue;
+
+			float starty = ly;
+			float endy = ry;
+			float slope = (ry - ly) / (rx - lx);
+			if(lx < x)
+				starty = ly + (x - lx)*slope;
+			if(rx > x + 1)
+				endy = ly + (x + 1 - lx)*slope;
+
+			int lo = static_cast<int>(min(max(min(starty, endy), 0.0f), h - 1.0f));
+			int hi = static_cast<int>(min(max(max(starty, endy), 0.0f), h - 1.0f));
+			envMin = min(envMin, lo);
+			envMax = max(envMax, hi);
+			expectedSum += hi - lo + 1;
+		}
+		REQUIRE(envMax >= envMin);
+
+		//Pyramid blocks are the min/max envelope of the segments they replace, so the same rows should be covered
+		//(give or take rounding at the column edges), and the total intensity should be close.
+		int rowMin = h;
+		int rowMax = -1;
+		double sum = 0;
+		for(uint32_t y=0; y<h; y++)
+		{
+			float v = out[y*w + x];
+			if(v > 0)
+			{
+				rowMin = min(rowMin, static_cast<int>(y));
+				rowMax = max(rowMax, static_cast<int>(y));
+			}
+			sum += v;
+		}
+		if( (abs(rowMin - envMin) > 1) || (abs(rowMax - envMax) > 1) )
+		{
+			LogError("column %u: pyramid covers rows %d-%d, segments cover %d-%d\n",
+				x, rowMin, rowMax, envMin, envMax);
+		}
+		REQUIRE(abs(rowMin - envMin) <= 1);
+		REQUIRE(abs(rowMax - envMax) <= 1);
+		for(int y=rowMin; y<=rowMax; y++)
+			REQUIRE(out[y*w + x] > 0);
+		REQUIRE(sum == Approx(expectedSum).epsilon(0.25));
+	}
+}